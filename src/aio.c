@@ -0,0 +1,603 @@
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t, uintptr_t
+#include <stdbool.h>    // bool
+#include <string.h>     // memset
+#include <errno.h>      // errno
+#include <pthread.h>    // pthread_*
+#include <unistd.h>     // close, pread, write
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <time.h>           // nanosleep
+#include <linux/io_uring.h>
+#include <sys/syscall.h>    // __NR_io_uring_*
+#include <sys/mman.h>       // mmap, munmap
+#include <sys/eventfd.h>    // eventfd
+#endif
+
+#include "aio.h"
+#include "common.h"
+#include "alloc.h"
+
+typedef struct {
+    zseek_aio_req_t *head;
+    zseek_aio_req_t *tail;
+} queue_t;
+
+#ifdef HAVE_LINUX_IO_URING_H
+// Default number of reads in flight
+#define QUEUE_DEPTH 128
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/**
+ * io_uring instance, set up without liburing
+ */
+typedef struct {
+    int fd;
+    void *rings;            // submission and completion rings, mapped
+    size_t rings_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned tail;          // next submission, up to date unlike *sq_tail
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    struct io_uring_cqe *cqes;
+    unsigned cq_mask;
+} ring_t;
+#endif
+
+struct zseek_aio {
+    zseek_async_backend_t backend;
+    zseek_aio_process_t process;
+    void *user_data;
+    const zseek_allocator_t *allocator;
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;   // requests to process, or stopping
+    queue_t todo;           // read, to process
+    bool stop;
+    pthread_t *workers;
+    size_t nb_workers;
+
+#ifdef HAVE_LINUX_IO_URING_H
+    int file_fd;
+    ring_t ring;
+    int event_fd;           // wakes up the ring thread
+    uint64_t event;         // read from event_fd
+    queue_t to_read;
+    bool ring_stop;
+    bool ring_failed;       // reads go to the workers, see ring_main()
+    pthread_t ring_thread;
+#endif
+};
+
+static void queue_push(queue_t *q, zseek_aio_req_t *req)
+{
+    req->next = NULL;
+    if (q->tail)
+        q->tail->next = req;
+    else
+        q->head = req;
+    q->tail = req;
+}
+
+static zseek_aio_req_t *queue_pop(queue_t *q)
+{
+    zseek_aio_req_t *req = q->head;
+    if (req) {
+        q->head = req->next;
+        if (!q->head)
+            q->tail = NULL;
+    }
+
+    return req;
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+/**
+ * Reads what is left of @p req synchronously, as io_uring would have
+ */
+static void read_fallback(const zseek_aio_t *aio, zseek_aio_req_t *req)
+{
+    while (req->done < req->size) {
+        ssize_t n = pread(aio->file_fd, (uint8_t*)req->data + req->done,
+            req->size - req->done, req->offset + req->done);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            req->error = errno;
+            return;
+        }
+        if (n == 0)
+            break;
+        req->done += n;
+    }
+}
+#endif
+
+static void *worker_main(void *arg)
+{
+    zseek_aio_t *aio = arg;
+
+    pthread_mutex_lock(&aio->lock);
+    for (;;) {
+        zseek_aio_req_t *req = queue_pop(&aio->todo);
+        if (!req) {
+            // Drain the queue before stopping
+            if (aio->stop)
+                break;
+            pthread_cond_wait(&aio->ready, &aio->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&aio->lock);
+#ifdef HAVE_LINUX_IO_URING_H
+        if (req->fallback)
+            read_fallback(aio, req);
+#endif
+        aio->process(req, aio->user_data);
+        pthread_mutex_lock(&aio->lock);
+    }
+    pthread_mutex_unlock(&aio->lock);
+
+    return NULL;
+}
+
+/**
+ * Stops and joins the first @p nb_workers workers of @p aio, once all
+ * requests are processed
+ */
+static void stop_workers(zseek_aio_t *aio, size_t nb_workers)
+{
+    pthread_mutex_lock(&aio->lock);
+    aio->stop = true;
+    pthread_mutex_unlock(&aio->lock);
+    pthread_cond_broadcast(&aio->ready);
+
+    for (size_t i = 0; i < nb_workers; i++)
+        pthread_join(aio->workers[i], NULL);
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+/**
+ * Moves the requests of @p src to the end of @p dst
+ */
+static void queue_splice(queue_t *dst, queue_t *src)
+{
+    if (!src->head)
+        return;
+
+    if (dst->tail)
+        dst->tail->next = src->head;
+    else
+        dst->head = src->head;
+    dst->tail = src->tail;
+    src->head = src->tail = NULL;
+}
+
+/**
+ * Sets up @p ring with room for @p entries submissions, returning 0 or an
+ * errno value
+ */
+static int ring_init(ring_t *ring, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (fd == -1)
+        return errno;
+
+    // NOTE: Reads at the current position (of the eventfd) came along with
+    // IORING_OP_READ, in Linux 5.6
+    int err = ENOSYS;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(p.features & IORING_FEAT_RW_CUR_POS))
+        goto fail_w_fd;
+
+    ring->rings_size = MAX(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+        p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe));
+    ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->rings == MAP_FAILED) {
+        err = errno;
+        goto fail_w_fd;
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        err = errno;
+        goto fail_w_rings;
+    }
+
+    uint8_t *rings = ring->rings;
+    ring->fd = fd;
+    ring->sq_head = (void*)(rings + p.sq_off.head);
+    ring->sq_tail = (void*)(rings + p.sq_off.tail);
+    ring->sq_array = (void*)(rings + p.sq_off.array);
+    ring->sq_mask = *(unsigned*)(void*)(rings + p.sq_off.ring_mask);
+    ring->sq_entries = p.sq_entries;
+    ring->tail = *ring->sq_tail;
+    ring->cq_head = (void*)(rings + p.cq_off.head);
+    ring->cq_tail = (void*)(rings + p.cq_off.tail);
+    ring->cqes = (void*)(rings + p.cq_off.cqes);
+    ring->cq_mask = *(unsigned*)(void*)(rings + p.cq_off.ring_mask);
+
+    return 0;
+
+fail_w_rings:
+    munmap(ring->rings, ring->rings_size);
+fail_w_fd:
+    close(fd);
+    return err;
+}
+
+static void ring_fini(ring_t *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->rings, ring->rings_size);
+    close(ring->fd);
+}
+
+/**
+ * Queues a read of @p size bytes at @p offset of @p fd into @p data, tagged
+ * with @p tag, for the next ring_enter()
+ */
+static void ring_prep_read(ring_t *ring, int fd, void *data, size_t size,
+    uint64_t offset, const void *tag)
+{
+    unsigned idx = ring->tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)data;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = (uintptr_t)tag;
+    ring->sq_array[idx] = idx;
+    ring->tail++;
+    __atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * Submits the queued reads, and waits for a completion
+ */
+static int ring_enter(ring_t *ring)
+{
+    unsigned to_submit = ring->tail -
+        __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    return (int)syscall(__NR_io_uring_enter, ring->fd, to_submit, 1,
+        IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+static void wake_ring(zseek_aio_t *aio)
+{
+    uint64_t one = 1;
+    // NOTE: Fails only if the counter would overflow, i.e. it is awake
+    while (write(aio->event_fd, &one, sizeof(one)) == -1 && errno == EINTR)
+        ;
+}
+
+/**
+ * Takes the completions of @p ring, handing the requests read over to the
+ * workers, and queueing to @p pending those to resume
+ */
+static void reap_ring(zseek_aio_t *aio, queue_t *pending, size_t *in_flight,
+    bool *armed)
+{
+    ring_t *ring = &aio->ring;
+
+    queue_t done = {NULL, NULL};
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+        zseek_aio_req_t *req = (void*)(uintptr_t)cqe->user_data;
+        if (!req) {
+            *armed = false;
+            continue;
+        }
+
+        (*in_flight)--;
+        if (cqe->res == -EINTR || cqe->res == -EAGAIN) {
+            queue_push(pending, req);
+        } else if (cqe->res < 0) {
+            req->error = -cqe->res;
+            queue_push(&done, req);
+        } else {
+            // Resume short reads, unless at the end of the file
+            req->done += cqe->res;
+            if (cqe->res > 0 && req->done < req->size)
+                queue_push(pending, req);
+            else
+                queue_push(&done, req);
+        }
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    if (done.head) {
+        pthread_mutex_lock(&aio->lock);
+        queue_splice(&aio->todo, &done);
+        pthread_mutex_unlock(&aio->lock);
+        pthread_cond_broadcast(&aio->ready);
+    }
+}
+
+/**
+ * Hands @p pending over to the workers, along with the requests yet to come,
+ * for them to read synchronously
+ */
+static void fail_over(zseek_aio_t *aio, queue_t *pending)
+{
+    pthread_mutex_lock(&aio->lock);
+    aio->ring_failed = true;
+    queue_splice(pending, &aio->to_read);
+    for (zseek_aio_req_t *req = pending->head; req; req = req->next)
+        req->fallback = true;
+    queue_splice(&aio->todo, pending);
+    pthread_mutex_unlock(&aio->lock);
+    pthread_cond_broadcast(&aio->ready);
+}
+
+/**
+ * Submits the reads of the requests in batches, as they come, and hands
+ * them over to the workers as they complete. Should io_uring fail, the
+ * workers read the requests instead.
+ */
+static void *ring_main(void *arg)
+{
+    zseek_aio_t *aio = arg;
+    ring_t *ring = &aio->ring;
+
+    queue_t pending = {NULL, NULL};
+    size_t in_flight = 0;   // reads of requests
+    bool armed = false;     // read of event_fd in flight
+    bool failed = false;
+    for (;;) {
+        if (failed) {
+            fail_over(aio, &pending);
+            if (in_flight == 0)
+                break;
+            // NOTE: Reads submitted before complete anyway, so wait for them
+            // without io_uring_enter()
+            nanosleep(&(struct timespec){0, 1000 * 1000}, NULL);
+            reap_ring(aio, &pending, &in_flight, &armed);
+            continue;
+        }
+
+        pthread_mutex_lock(&aio->lock);
+        queue_splice(&pending, &aio->to_read);
+        bool stop = aio->ring_stop;
+        pthread_mutex_unlock(&aio->lock);
+
+        if (stop && !armed && in_flight == 0 && !pending.head)
+            break;
+
+        // NOTE: The read of event_fd wakes this up on new requests, and
+        // keeps a submission slot of its own
+        if (!armed && !stop) {
+            ring_prep_read(ring, aio->event_fd, &aio->event,
+                sizeof(aio->event), (uint64_t)-1, NULL);
+            armed = true;
+        }
+        while (pending.head && in_flight + 1 < ring->sq_entries) {
+            zseek_aio_req_t *req = queue_pop(&pending);
+            ring_prep_read(ring, aio->file_fd, (uint8_t*)req->data + req->done,
+                req->size - req->done, req->offset + req->done, req);
+            in_flight++;
+        }
+
+        if (ring_enter(ring) == -1 && errno != EINTR && errno != EAGAIN &&
+            errno != EBUSY) {
+            // NOTE: Nothing was submitted, so take the reads back. The read of
+            // event_fd, if submitted before, is cancelled as the ring closes.
+            unsigned sq_head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+            for (unsigned i = sq_head; i != ring->tail; i++) {
+                zseek_aio_req_t *req =
+                    (void*)(uintptr_t)ring->sqes[i & ring->sq_mask].user_data;
+                if (req) {
+                    queue_push(&pending, req);
+                    in_flight--;
+                }
+            }
+            ring->tail = sq_head;
+            __atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+            failed = true;
+            continue;
+        }
+
+        reap_ring(aio, &pending, &in_flight, &armed);
+    }
+
+    return NULL;
+}
+
+/**
+ * Sets up io_uring reads of @p fd for @p aio, returning 0 or an errno value
+ */
+static int init_uring(zseek_aio_t *aio, int fd, size_t queue_depth)
+{
+    int err = ring_init(&aio->ring, queue_depth ? queue_depth : QUEUE_DEPTH);
+    if (err)
+        return err;
+
+    aio->event_fd = eventfd(0, EFD_CLOEXEC);
+    if (aio->event_fd == -1) {
+        err = errno;
+        ring_fini(&aio->ring);
+        return err;
+    }
+    aio->file_fd = fd;
+
+    return 0;
+}
+
+static void fini_uring(zseek_aio_t *aio)
+{
+    close(aio->event_fd);
+    ring_fini(&aio->ring);
+}
+#endif
+
+zseek_aio_t *zseek_aio_new(zseek_async_backend_t backend, int fd,
+    size_t queue_depth, size_t nb_workers, zseek_aio_process_t process,
+    void *user_data, const zseek_allocator_t *allocator,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (nb_workers == 0) {
+        set_error(errbuf, "invalid number of workers (0)");
+        goto fail;
+    }
+    if (backend != ZSEEK_ASYNC_AUTO && backend != ZSEEK_ASYNC_IO_URING &&
+        backend != ZSEEK_ASYNC_THREADS) {
+        set_error(errbuf, "invalid asynchronous backend");
+        goto fail;
+    }
+
+    zseek_aio_t *aio = zseek_alloc(allocator, sizeof(*aio));
+    if (!aio) {
+        set_error_with_errno(errbuf, "allocate asynchronous engine", errno);
+        goto fail;
+    }
+    memset(aio, 0, sizeof(*aio));
+    aio->process = process;
+    aio->user_data = user_data;
+    aio->allocator = allocator;
+
+    int pr = pthread_mutex_init(&aio->lock, NULL);
+    if (pr) {
+        set_error_with_errno(errbuf, "initialize lock", pr);
+        goto fail_w_aio;
+    }
+    pr = pthread_cond_init(&aio->ready, NULL);
+    if (pr) {
+        set_error_with_errno(errbuf, "initialize condition", pr);
+        goto fail_w_lock;
+    }
+
+    aio->backend = ZSEEK_ASYNC_THREADS;
+    if (backend != ZSEEK_ASYNC_THREADS && fd != -1) {
+#ifdef HAVE_LINUX_IO_URING_H
+        int err = init_uring(aio, fd, queue_depth);
+        if (!err)
+            aio->backend = ZSEEK_ASYNC_IO_URING;
+        else if (backend == ZSEEK_ASYNC_IO_URING) {
+            set_error_with_errno(errbuf, "set up io_uring", err);
+            goto fail_w_cond;
+        }
+#else
+        (void)queue_depth;
+#endif
+    }
+    if (backend == ZSEEK_ASYNC_IO_URING &&
+        aio->backend != ZSEEK_ASYNC_IO_URING) {
+        set_error(errbuf, "io_uring is not available for this file");
+        goto fail_w_cond;
+    }
+
+    aio->workers = zseek_alloc(allocator, nb_workers * sizeof(pthread_t));
+    if (!aio->workers) {
+        set_error_with_errno(errbuf, "allocate workers", errno);
+        goto fail_w_uring;
+    }
+    for (; aio->nb_workers < nb_workers; aio->nb_workers++) {
+        pr = pthread_create(&aio->workers[aio->nb_workers], NULL,
+            worker_main, aio);
+        if (pr) {
+            set_error_with_errno(errbuf, "create worker", pr);
+            goto fail_w_workers;
+        }
+    }
+
+#ifdef HAVE_LINUX_IO_URING_H
+    if (aio->backend == ZSEEK_ASYNC_IO_URING) {
+        pr = pthread_create(&aio->ring_thread, NULL, ring_main, aio);
+        if (pr) {
+            set_error_with_errno(errbuf, "create ring thread", pr);
+            goto fail_w_workers;
+        }
+    }
+#endif
+
+    return aio;
+
+fail_w_workers:
+    stop_workers(aio, aio->nb_workers);
+    zseek_free(allocator, aio->workers);
+fail_w_uring:
+#ifdef HAVE_LINUX_IO_URING_H
+    if (aio->backend == ZSEEK_ASYNC_IO_URING)
+        fini_uring(aio);
+#endif
+fail_w_cond:
+    pthread_cond_destroy(&aio->ready);
+fail_w_lock:
+    pthread_mutex_destroy(&aio->lock);
+fail_w_aio:
+    zseek_free(allocator, aio);
+fail:
+    return NULL;
+}
+
+void zseek_aio_free(zseek_aio_t *aio)
+{
+    if (!aio)
+        return;
+
+#ifdef HAVE_LINUX_IO_URING_H
+    if (aio->backend == ZSEEK_ASYNC_IO_URING) {
+        // Reads complete first, then the workers process them
+        pthread_mutex_lock(&aio->lock);
+        aio->ring_stop = true;
+        bool failed = aio->ring_failed;
+        pthread_mutex_unlock(&aio->lock);
+        // NOTE: A failed ring stops on its own, see ring_main()
+        if (!failed)
+            wake_ring(aio);
+        pthread_join(aio->ring_thread, NULL);
+        fini_uring(aio);
+    }
+#endif
+    stop_workers(aio, aio->nb_workers);
+
+    zseek_free(aio->allocator, aio->workers);
+    pthread_cond_destroy(&aio->ready);
+    pthread_mutex_destroy(&aio->lock);
+    zseek_free(aio->allocator, aio);
+}
+
+void zseek_aio_submit(zseek_aio_t *aio, zseek_aio_req_t *req)
+{
+    req->done = 0;
+    req->error = 0;
+    req->fallback = false;
+
+#ifdef HAVE_LINUX_IO_URING_H
+    if (aio->backend == ZSEEK_ASYNC_IO_URING && req->size > 0) {
+        pthread_mutex_lock(&aio->lock);
+        req->fallback = aio->ring_failed;
+        queue_push(req->fallback ? &aio->todo : &aio->to_read, req);
+        pthread_mutex_unlock(&aio->lock);
+        if (req->fallback)
+            pthread_cond_signal(&aio->ready);
+        else
+            wake_ring(aio);
+        return;
+    }
+#endif
+
+    pthread_mutex_lock(&aio->lock);
+    queue_push(&aio->todo, req);
+    pthread_mutex_unlock(&aio->lock);
+    pthread_cond_signal(&aio->ready);
+}
+
+zseek_async_backend_t zseek_aio_backend(const zseek_aio_t *aio)
+{
+    return aio->backend;
+}
@@ -0,0 +1,67 @@
+#ifndef AIO_H
+#define AIO_H
+
+#include <stddef.h>     // size_t
+#include <stdbool.h>    // bool
+
+#include "zseek.h"
+
+/**
+ * Engine of asynchronous reads: requests read a range of a file, if any,
+ * with io_uring, then a worker thread processes them (e.g. decompresses).
+ * Without io_uring, requests go straight to the workers, which read
+ * synchronously instead.
+ */
+typedef struct zseek_aio zseek_aio_t;
+
+/**
+ * Request, embedded in a larger one of the caller
+ */
+typedef struct zseek_aio_req {
+    struct zseek_aio_req *next;     // queue
+    void *data;         // of the read, none if size is 0
+    size_t size;
+    size_t offset;
+    size_t done;        // bytes read, short at the end of the file
+    int error;          // errno of the read, or 0
+    bool fallback;      // read by a worker instead, io_uring having failed
+} zseek_aio_req_t;
+
+/**
+ * Processes @p req, on a worker thread, once its read completed.
+ * Owns @p req from then on.
+ */
+typedef void (*zseek_aio_process_t)(zseek_aio_req_t *req, void *user_data);
+
+/**
+ * Creates an engine of @p nb_workers threads calling @p process, reading
+ * from @p fd (-1 if none) as per @p backend, with up to @p queue_depth reads
+ * in flight. Memory comes from @p allocator (the C library if @a NULL), which
+ * must outlive the engine.
+ * Returns @a NULL on error.
+ */
+zseek_aio_t *zseek_aio_new(zseek_async_backend_t backend, int fd,
+    size_t queue_depth, size_t nb_workers, zseek_aio_process_t process,
+    void *user_data, const zseek_allocator_t *allocator,
+    char errbuf[ZSEEK_ERRBUF_SIZE]);
+
+/**
+ * Waits for all requests to be processed, stops the threads and frees
+ * @p aio.
+ *
+ * @attention Not safe to call concurrently with zseek_aio_submit().
+ */
+void zseek_aio_free(zseek_aio_t *aio);
+
+/**
+ * Queues @p req, reading @p req->size bytes at @p req->offset into
+ * @p req->data first, if not 0, unless the backend has no reads of its own.
+ */
+void zseek_aio_submit(zseek_aio_t *aio, zseek_aio_req_t *req);
+
+/**
+ * Returns the backend of @p aio, never ZSEEK_ASYNC_AUTO.
+ */
+zseek_async_backend_t zseek_aio_backend(const zseek_aio_t *aio);
+
+#endif  // AIO_H
@@ -0,0 +1,93 @@
+#include <stddef.h>     // size_t
+#include <stdlib.h>     // malloc, realloc, free
+#include <string.h>     // memcpy
+
+#include "alloc.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static void *default_alloc(size_t size, void *user_data)
+{
+    (void)user_data;
+
+    return malloc(size);
+}
+
+static void *default_realloc(void *ptr, size_t size, void *user_data)
+{
+    (void)user_data;
+
+    return realloc(ptr, size);
+}
+
+static void default_free(void *ptr, void *user_data)
+{
+    (void)user_data;
+
+    free(ptr);
+}
+
+void zseek_allocator_init(zseek_allocator_t *dst,
+    const zseek_allocator_t *src)
+{
+    if (src) {
+        *dst = *src;
+        return;
+    }
+
+    *dst = (zseek_allocator_t) {
+        .alloc = default_alloc,
+        .realloc = default_realloc,
+        .free = default_free,
+    };
+}
+
+void *zseek_alloc(const zseek_allocator_t *allocator, size_t size)
+{
+    if (!allocator)
+        return malloc(size);
+
+    return allocator->alloc(size, allocator->user_data);
+}
+
+void *zseek_realloc(const zseek_allocator_t *allocator, void *ptr,
+    size_t old_size, size_t size)
+{
+    if (!allocator)
+        return realloc(ptr, size);
+
+    if (allocator->realloc)
+        return allocator->realloc(ptr, size, allocator->user_data);
+
+    void *new_ptr = allocator->alloc(size, allocator->user_data);
+    if (!new_ptr)
+        return NULL;
+    if (ptr) {
+        memcpy(new_ptr, ptr, MIN(old_size, size));
+        allocator->free(ptr, allocator->user_data);
+    }
+
+    return new_ptr;
+}
+
+void zseek_free(const zseek_allocator_t *allocator, void *ptr)
+{
+    if (!allocator) {
+        free(ptr);
+        return;
+    }
+
+    // NOTE: Like free(), accept NULL, so that the user's free need not.
+    if (ptr)
+        allocator->free(ptr, allocator->user_data);
+}
+
+void *zseek_mem_alloc(void *opaque, size_t size)
+{
+    return zseek_alloc(opaque, size);
+}
+
+void zseek_mem_free(void *opaque, void *ptr)
+{
+    zseek_free(opaque, ptr);
+}
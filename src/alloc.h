@@ -0,0 +1,45 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>     // size_t
+
+#include "zseek.h"
+
+/**
+ * Copy @p src into @p dst, filling in the C library's functions if @p src is
+ * @a NULL.
+ */
+void zseek_allocator_init(zseek_allocator_t *dst,
+    const zseek_allocator_t *src);
+
+/**
+ * Allocates @p size bytes with @p allocator, or the C library if @a NULL.
+ */
+void *zseek_alloc(const zseek_allocator_t *allocator, size_t size);
+
+/**
+ * Resizes @p ptr, of @p old_size bytes, to @p size bytes with @p allocator,
+ * or the C library if @a NULL. Allocates and copies if @p allocator has no
+ * realloc.
+ */
+void *zseek_realloc(const zseek_allocator_t *allocator, void *ptr,
+    size_t old_size, size_t size);
+
+/**
+ * Frees @p ptr with @p allocator, or the C library if @a NULL.
+ */
+void zseek_free(const zseek_allocator_t *allocator, void *ptr);
+
+/**
+ * Allocation callback for the customMem of zstd and lz4, where @p opaque is
+ * the allocator.
+ */
+void *zseek_mem_alloc(void *opaque, size_t size);
+
+/**
+ * Free callback for the customMem of zstd and lz4, where @p opaque is the
+ * allocator.
+ */
+void zseek_mem_free(void *opaque, void *ptr);
+
+#endif  // ALLOC_H
@@ -0,0 +1,380 @@
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t, UINT32_MAX
+#include <stdbool.h>    // bool
+#include <string.h>     // memcpy
+#include <errno.h>      // errno
+#include <assert.h>
+
+#include <endian.h>     // htole32, le32toh
+
+#include "bindex.h"
+#include "alloc.h"
+#include "common.h"
+
+#define LZ4_MAGIC 0x184D2204
+// Magic number, FLG, BD, content size, dictionary ID and header checksum
+#define LZ4_MAX_HEADER_SIZE 19
+// Largest block size of the lz4 frame format (LZ4F_max4MB)
+#define LZ4_MAX_BLOCK_SIZE (4 << 20)
+
+// Bits of the FLG byte of the frame header
+#define LZ4_FLG_BLOCK_INDEP 0x20
+#define LZ4_FLG_BLOCK_CHECKSUM 0x10
+#define LZ4_FLG_CONTENT_SIZE 0x08
+#define LZ4_FLG_DICT_ID 0x01
+// High bit of the block size, for blocks stored uncompressed
+#define LZ4_BLOCK_UNCOMPRESSED 0x80000000U
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+typedef enum {
+    SCAN_FRAME_HEADER,
+    SCAN_BLOCK_HEADER,
+    SCAN_BLOCK_DATA,
+    SCAN_TRAILER,   // end mark seen, content checksum (if any) left
+} scan_state_t;
+
+struct zseek_blog {
+    const zseek_allocator_t *allocator;
+    size_t block_size;
+    uint32_t *offsets;  // of all blocks, each in its frame
+    size_t nb_offsets;
+    size_t capacity;
+    size_t frame_first; // index in offsets of the first block of the frame
+    bool valid;
+    // Scanner of the frame being written
+    scan_state_t state;
+    uint8_t hbuf[LZ4_MAX_HEADER_SIZE];  // frame or block header gathered
+    size_t hlen;
+    size_t hneed;
+    size_t pos;         // in the frame
+    size_t skip;        // bytes left of the block
+    bool block_checksum;
+};
+
+struct zseek_bindex {
+    const zseek_allocator_t *allocator;
+    size_t block_size;
+    uint32_t *offsets;  // of all blocks, each in its frame
+    size_t *first;      // index in offsets of the first block of each frame
+    size_t nb_frames;
+};
+
+static void write_le32(uint8_t *dst, uint32_t value)
+{
+    uint32_t value_le = htole32(value);
+    memcpy(dst, &value_le, sizeof(value_le));
+}
+
+static uint32_t read_le32(const uint8_t *src)
+{
+    uint32_t value_le;
+    memcpy(&value_le, src, sizeof(value_le));
+    return le32toh(value_le);
+}
+
+static size_t nb_frame_blocks(size_t dsize, size_t block_size)
+{
+    return (dsize + block_size - 1) / block_size;
+}
+
+zseek_blog_t *zseek_blog_new(size_t block_size,
+    const zseek_allocator_t *allocator)
+{
+    if (block_size == 0 || block_size > LZ4_MAX_BLOCK_SIZE)
+        return NULL;
+
+    zseek_blog_t *blog = zseek_alloc(allocator, sizeof(*blog));
+    if (!blog)
+        return NULL;
+    memset(blog, 0, sizeof(*blog));
+    blog->allocator = allocator;
+    blog->block_size = block_size;
+    blog->valid = true;
+    blog->state = SCAN_FRAME_HEADER;
+    blog->hneed = 5;    // up to FLG
+
+    return blog;
+}
+
+void zseek_blog_free(zseek_blog_t *blog)
+{
+    if (!blog)
+        return;
+
+    zseek_free(blog->allocator, blog->offsets);
+    zseek_free(blog->allocator, blog);
+}
+
+static bool push_offset(zseek_blog_t *blog, size_t offset)
+{
+    if (offset > UINT32_MAX) {
+        blog->valid = false;
+        return true;
+    }
+
+    if (blog->nb_offsets == blog->capacity) {
+        size_t capacity = blog->capacity ? blog->capacity * 2 : 1024;
+        uint32_t *offsets = zseek_realloc(blog->allocator, blog->offsets,
+            blog->capacity * sizeof(*offsets), capacity * sizeof(*offsets));
+        if (!offsets)
+            return false;
+        blog->offsets = offsets;
+        blog->capacity = capacity;
+    }
+    blog->offsets[blog->nb_offsets++] = offset;
+    return true;
+}
+
+/**
+ * Parses the frame header gathered so far, returning whether it is complete
+ */
+static bool parse_frame_header(zseek_blog_t *blog)
+{
+    if (blog->hlen == 5) {
+        uint8_t flg = blog->hbuf[4];
+        if (read_le32(blog->hbuf) != LZ4_MAGIC ||
+                !(flg & LZ4_FLG_BLOCK_INDEP)) {
+            blog->valid = false;
+            return false;
+        }
+        blog->block_checksum = flg & LZ4_FLG_BLOCK_CHECKSUM;
+        blog->hneed = 7;
+        if (flg & LZ4_FLG_CONTENT_SIZE)
+            blog->hneed += 8;
+        if (flg & LZ4_FLG_DICT_ID)
+            blog->hneed += 4;
+    }
+    return blog->hlen == blog->hneed;
+}
+
+bool zseek_blog_feed(zseek_blog_t *blog, const void *data, size_t size)
+{
+    const uint8_t *src = data;
+
+    while (size > 0 && blog->valid) {
+        size_t n = 0;
+        switch (blog->state) {
+        case SCAN_FRAME_HEADER:
+            n = MIN(size, blog->hneed - blog->hlen);
+            memcpy(blog->hbuf + blog->hlen, src, n);
+            blog->hlen += n;
+            if (parse_frame_header(blog)) {
+                blog->state = SCAN_BLOCK_HEADER;
+                blog->hlen = 0;
+            }
+            break;
+        case SCAN_BLOCK_HEADER:
+            n = MIN(size, 4 - blog->hlen);
+            memcpy(blog->hbuf + blog->hlen, src, n);
+            blog->hlen += n;
+            if (blog->hlen < 4)
+                break;
+
+            uint32_t header = read_le32(blog->hbuf);
+            blog->hlen = 0;
+            if (header == 0) {
+                blog->state = SCAN_TRAILER;
+                break;
+            }
+            if (!push_offset(blog, blog->pos + n - 4))
+                return false;
+            blog->skip = (header & ~LZ4_BLOCK_UNCOMPRESSED)
+                + (blog->block_checksum ? 4 : 0);
+            blog->state = SCAN_BLOCK_DATA;
+            break;
+        case SCAN_BLOCK_DATA:
+            n = MIN(size, blog->skip);
+            blog->skip -= n;
+            if (blog->skip == 0)
+                blog->state = SCAN_BLOCK_HEADER;
+            break;
+        case SCAN_TRAILER:
+            n = size;
+            break;
+        default:
+            // BUG
+            assert(false);
+        }
+        blog->pos += n;
+        src += n;
+        size -= n;
+    }
+    return true;
+}
+
+void zseek_blog_end_frame(zseek_blog_t *blog, size_t dsize)
+{
+    size_t nb_blocks = blog->nb_offsets - blog->frame_first;
+    bool scanned = blog->state == SCAN_TRAILER ||
+        (blog->state == SCAN_FRAME_HEADER && blog->pos == 0);
+    if (!scanned || nb_blocks != nb_frame_blocks(dsize, blog->block_size))
+        blog->valid = false;
+
+    blog->frame_first = blog->nb_offsets;
+    blog->state = SCAN_FRAME_HEADER;
+    blog->hlen = 0;
+    blog->hneed = 5;
+    blog->pos = 0;
+    blog->skip = 0;
+}
+
+bool zseek_blog_valid(const zseek_blog_t *blog)
+{
+    return blog->valid;
+}
+
+size_t zseek_blog_entries(const zseek_blog_t *blog)
+{
+    return blog->nb_offsets;
+}
+
+void zseek_blog_header(const zseek_blog_t *blog,
+    uint8_t header[ZSEEK_BINDEX_HEADER_SIZE])
+{
+    // NOTE: The frame size of skippable frames excludes the magic number and
+    // the frame size itself.
+    write_le32(header, ZSEEK_BINDEX_MAGIC);
+    write_le32(header + 4, 4 + blog->nb_offsets * ZSEEK_BINDEX_ENTRY_SIZE);
+    write_le32(header + 8, blog->block_size);
+}
+
+size_t zseek_blog_encode(const zseek_blog_t *blog, size_t first, void *dst,
+    size_t capacity)
+{
+    uint8_t *out = dst;
+    size_t n = MIN(blog->nb_offsets - first,
+        capacity / ZSEEK_BINDEX_ENTRY_SIZE);
+    for (size_t i = 0; i < n; i++)
+        write_le32(out + i * ZSEEK_BINDEX_ENTRY_SIZE, blog->offsets[first + i]);
+    return n;
+}
+
+size_t zseek_blog_memory_usage(const zseek_blog_t *blog)
+{
+    return sizeof(*blog) + blog->capacity * sizeof(blog->offsets[0]);
+}
+
+bool zseek_bindex_parse(const uint8_t header[ZSEEK_BINDEX_HEADER_SIZE],
+    size_t *nb_blocks, size_t *block_size)
+{
+    if (read_le32(header) != ZSEEK_BINDEX_MAGIC)
+        return false;
+
+    uint32_t frame_size = read_le32(header + 4);
+    if (frame_size < 4 || (frame_size - 4) % ZSEEK_BINDEX_ENTRY_SIZE != 0)
+        return false;
+
+    uint32_t _block_size = read_le32(header + 8);
+    if (_block_size == 0 || _block_size > LZ4_MAX_BLOCK_SIZE)
+        return false;
+
+    *nb_blocks = (frame_size - 4) / ZSEEK_BINDEX_ENTRY_SIZE;
+    *block_size = _block_size;
+    return true;
+}
+
+size_t zseek_bindex_entries(ZSTD_seekTable *st, size_t block_size)
+{
+    size_t nb_blocks = 0;
+    for (size_t i = 0; i < seek_table_entries(st); i++)
+        nb_blocks += nb_frame_blocks(frame_size_d(st, i), block_size);
+    return nb_blocks;
+}
+
+zseek_bindex_t *zseek_bindex_new(const void *entries, size_t nb_blocks,
+    size_t block_size, ZSTD_seekTable *st, const zseek_allocator_t *allocator,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    const uint8_t *src = entries;
+    size_t nb_frames = seek_table_entries(st);
+
+    zseek_bindex_t *bindex = zseek_alloc(allocator, sizeof(*bindex));
+    if (!bindex) {
+        set_error_with_errno(errbuf, "allocate block index", errno);
+        goto fail;
+    }
+    bindex->allocator = allocator;
+    bindex->block_size = block_size;
+    bindex->nb_frames = nb_frames;
+
+    bindex->first = zseek_alloc(allocator,
+        (nb_frames + 1) * sizeof(bindex->first[0]));
+    if (!bindex->first) {
+        set_error_with_errno(errbuf, "allocate block index frames", errno);
+        goto fail_w_bindex;
+    }
+
+    bindex->offsets = zseek_alloc(allocator,
+        (nb_blocks ? nb_blocks : 1) * sizeof(bindex->offsets[0]));
+    if (!bindex->offsets) {
+        set_error_with_errno(errbuf, "allocate block index offsets", errno);
+        goto fail_w_first;
+    }
+
+    // Blocks must be in order, each with room for its header in its frame,
+    // or reads would run past the next block or the frame
+    size_t idx = 0;
+    for (size_t i = 0; i < nb_frames; i++) {
+        size_t n = nb_frame_blocks(frame_size_d(st, i), block_size);
+        size_t csize = frame_size_c(st, i);
+        if (n > nb_blocks - idx)
+            goto fail_w_invalid;
+
+        bindex->first[i] = idx;
+        size_t min_offset = 0;
+        for (size_t j = 0; j < n; j++, idx++) {
+            uint32_t offset = read_le32(src + idx * ZSEEK_BINDEX_ENTRY_SIZE);
+            if (offset < min_offset || (size_t)offset + 4 > csize)
+                goto fail_w_invalid;
+            bindex->offsets[idx] = offset;
+            min_offset = (size_t)offset + 4;
+        }
+    }
+    if (idx != nb_blocks)
+        goto fail_w_invalid;
+    bindex->first[nb_frames] = idx;
+
+    return bindex;
+
+fail_w_invalid:
+    set_error(errbuf, "invalid block index");
+    zseek_free(allocator, bindex->offsets);
+fail_w_first:
+    zseek_free(allocator, bindex->first);
+fail_w_bindex:
+    zseek_free(allocator, bindex);
+fail:
+    return NULL;
+}
+
+void zseek_bindex_free(zseek_bindex_t *bindex)
+{
+    if (!bindex)
+        return;
+
+    zseek_free(bindex->allocator, bindex->offsets);
+    zseek_free(bindex->allocator, bindex->first);
+    zseek_free(bindex->allocator, bindex);
+}
+
+size_t zseek_bindex_block_size(const zseek_bindex_t *bindex)
+{
+    return bindex->block_size;
+}
+
+const uint32_t *zseek_bindex_blocks(const zseek_bindex_t *bindex,
+    size_t frame_idx, size_t *nb_blocks)
+{
+    assert(frame_idx < bindex->nb_frames);
+    size_t first = bindex->first[frame_idx];
+    *nb_blocks = bindex->first[frame_idx + 1] - first;
+    return bindex->offsets + first;
+}
+
+size_t zseek_bindex_memory_usage(const zseek_bindex_t *bindex)
+{
+    return sizeof(*bindex)
+        + (bindex->nb_frames + 1) * sizeof(bindex->first[0])
+        + bindex->first[bindex->nb_frames] * sizeof(bindex->offsets[0]);
+}
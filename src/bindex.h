@@ -0,0 +1,136 @@
+#ifndef BINDEX_H
+#define BINDEX_H
+
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t
+#include <stdbool.h>    // bool
+
+#include <zstd.h>
+
+#include "zseek.h"
+#include "seek_table.h"
+
+/**
+ * Magic number of the skippable frame holding the block index of lz4 files,
+ * between the last frame and the seek table. It differs from those of the
+ * seek table and the dictionary.
+ */
+#define ZSEEK_BINDEX_MAGIC 0x184D2A5C
+/**
+ * Size of the block index frame header: the magic number, the frame size and
+ * the decompressed size of blocks
+ */
+#define ZSEEK_BINDEX_HEADER_SIZE 12
+/**
+ * Size of a block index entry: the offset of the block in its frame
+ */
+#define ZSEEK_BINDEX_ENTRY_SIZE 4
+
+/**
+ * Log of the blocks of the lz4 frames written so far, found by scanning the
+ * frames as they are written out. Frames must have independent blocks, all
+ * of the same decompressed size but for the last one of each frame.
+ */
+typedef struct zseek_blog zseek_blog_t;
+
+/**
+ * Creates a log of blocks of @p block_size decompressed bytes. Memory comes
+ * from @p allocator (the C library if @a NULL), which must outlive the log.
+ * Returns @a NULL on error.
+ */
+zseek_blog_t *zseek_blog_new(size_t block_size,
+    const zseek_allocator_t *allocator);
+
+void zseek_blog_free(zseek_blog_t *blog);
+
+/**
+ * Scans the next @p size bytes of the compressed frame being written.
+ * Returns @a false on error (out of memory).
+ */
+bool zseek_blog_feed(zseek_blog_t *blog, const void *data, size_t size);
+
+/**
+ * Ends the frame being written, of @p dsize decompressed bytes. Frames not
+ * scanned at all (e.g. skippable ones) must have none. If the blocks found do
+ * not match @p dsize, the log is no longer valid.
+ */
+void zseek_blog_end_frame(zseek_blog_t *blog, size_t dsize);
+
+/**
+ * Returns whether every frame logged had the expected blocks.
+ */
+bool zseek_blog_valid(const zseek_blog_t *blog);
+
+/**
+ * Returns the number of blocks logged.
+ */
+size_t zseek_blog_entries(const zseek_blog_t *blog);
+
+/**
+ * Encodes in @p header the header of the block index frame of @p blog.
+ */
+void zseek_blog_header(const zseek_blog_t *blog,
+    uint8_t header[ZSEEK_BINDEX_HEADER_SIZE]);
+
+/**
+ * Encodes up to @p capacity bytes of the entries of @p blog into @p dst,
+ * starting from entry @p first. Returns the number of entries encoded.
+ */
+size_t zseek_blog_encode(const zseek_blog_t *blog, size_t first, void *dst,
+    size_t capacity);
+
+/**
+ * Returns the memory usage (total heap allocation) of @p blog in bytes.
+ */
+size_t zseek_blog_memory_usage(const zseek_blog_t *blog);
+
+/**
+ * Block index of the frames of a seek table
+ */
+typedef struct zseek_bindex zseek_bindex_t;
+
+/**
+ * Decodes the block index frame @p header into the number of blocks
+ * @p nb_blocks and their decompressed size @p block_size.
+ * Returns @a false if @p header is not that of a block index frame.
+ */
+bool zseek_bindex_parse(const uint8_t header[ZSEEK_BINDEX_HEADER_SIZE],
+    size_t *nb_blocks, size_t *block_size);
+
+/**
+ * Returns the number of blocks of @p block_size decompressed bytes of the
+ * frames of @p st, as indexed.
+ */
+size_t zseek_bindex_entries(ZSTD_seekTable *st, size_t block_size);
+
+/**
+ * Creates the block index of the frames of @p st from the @p nb_blocks
+ * encoded entries at @p entries, of blocks of @p block_size decompressed
+ * bytes. Memory comes from @p allocator (the C library if @a NULL), which
+ * must outlive the index.
+ * Returns @a NULL on error, e.g. if the index does not match @p st.
+ */
+zseek_bindex_t *zseek_bindex_new(const void *entries, size_t nb_blocks,
+    size_t block_size, ZSTD_seekTable *st, const zseek_allocator_t *allocator,
+    char errbuf[ZSEEK_ERRBUF_SIZE]);
+
+void zseek_bindex_free(zseek_bindex_t *bindex);
+
+/**
+ * Returns the decompressed size of blocks, but for the last one of each frame.
+ */
+size_t zseek_bindex_block_size(const zseek_bindex_t *bindex);
+
+/**
+ * Returns the offsets of the blocks of the frame at index @p frame_idx, in
+ * the frame, and their number in @p nb_blocks.
+ */
+const uint32_t *zseek_bindex_blocks(const zseek_bindex_t *bindex,
+    size_t frame_idx, size_t *nb_blocks);
+
+/**
+ * Returns the memory usage (total heap allocation) of @p bindex in bytes.
+ */
+size_t zseek_bindex_memory_usage(const zseek_bindex_t *bindex);
+
+#endif  // BINDEX_H
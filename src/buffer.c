@@ -1,20 +1,23 @@
-#include <stdlib.h>     // malloc, realloc, free
 #include <string.h>     // memset, memmove
 
 #include "buffer.h"
+#include "alloc.h"
 
 struct zseek_buffer {
     void *data;
     size_t size;
     size_t capacity;
+    const zseek_allocator_t *allocator;
 };
 
-zseek_buffer_t *zseek_buffer_new(size_t capacity)
+zseek_buffer_t *zseek_buffer_new(size_t capacity,
+    const zseek_allocator_t *allocator)
 {
-    zseek_buffer_t *buffer = malloc(sizeof(*buffer));
+    zseek_buffer_t *buffer = zseek_alloc(allocator, sizeof(*buffer));
     if (!buffer)
         goto fail;
     memset(buffer, 0, sizeof(*buffer));
+    buffer->allocator = allocator;
 
     if (!zseek_buffer_reserve(buffer, capacity))
         goto fail_w_buffer;
@@ -22,7 +25,7 @@ zseek_buffer_t *zseek_buffer_new(size_t capacity)
     return buffer;
 
 fail_w_buffer:
-    free(buffer);
+    zseek_free(allocator, buffer);
 fail:
     return NULL;
 }
@@ -32,8 +35,8 @@ void zseek_buffer_free(zseek_buffer_t *buffer)
     if (!buffer)
         return;
 
-    free(buffer->data);
-    free(buffer);
+    zseek_free(buffer->allocator, buffer->data);
+    zseek_free(buffer->allocator, buffer);
 }
 
 size_t zseek_buffer_size(zseek_buffer_t *buffer)
@@ -91,7 +94,8 @@ bool zseek_buffer_reserve(zseek_buffer_t *buffer, size_t capacity)
     if (capacity > new_capacity)
         new_capacity = capacity;
 
-    void *new_data = realloc(buffer->data, new_capacity);
+    void *new_data = zseek_realloc(buffer->allocator, buffer->data,
+        buffer->capacity, new_capacity);
     if (!new_data)
         return false;
     buffer->data = new_data;
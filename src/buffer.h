@@ -5,12 +5,17 @@
 #include <stdint.h>     // uint*_t
 #include <stdbool.h>    // bool
 
+#include "zseek.h"
+
 typedef struct zseek_buffer zseek_buffer_t;
 
 /**
  * Creates a new buffer with a capacity of at least @p capacity bytes.
+ * Memory comes from @p allocator, which must outlive the buffer, or the C
+ * library if @a NULL.
  */
-zseek_buffer_t *zseek_buffer_new(size_t capacity);
+zseek_buffer_t *zseek_buffer_new(size_t capacity,
+    const zseek_allocator_t *allocator);
 
 /**
  * Frees the buffer pointed to by @p buffer.
@@ -1,102 +1,871 @@
-#include <stdlib.h>     // malloc, free
+#include <assert.h>     // assert
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t, SIZE_MAX
 #include <string.h>     // memset
+#include <errno.h>      // errno
+#include <pthread.h>    // pthread_mutex*
 
-#include <search.h>     // insque, remque, tsearch
+#include <sys/types.h>  // ssize_t
+#include <sys/stat.h>   // struct stat
 
 #include "cache.h"
+#include "common.h"
+#include "alloc.h"
+#include "fpool.h"
 
-struct zseek_cached_frame {
-    struct zseek_cached_frame *next;
-    struct zseek_cached_frame *prev;
+// Shards hold at least that many frames, so that small caches are not split
+// into shards too small to hold their share of the working set
+#define MIN_SHARD_CAPACITY 8
+#define MAX_SHARDS 64
 
-    zseek_frame_t frame;
+#define CACHE_LINE 64
+
+// Slot state: live bit, pin count, and generation, bumped on eviction so that
+// a lookup racing with it cannot pin the next frame in the slot by mistake
+#define STATE_LIVE ((uint64_t)1)
+#define STATE_PIN ((uint64_t)1 << 1)
+#define STATE_PINS_MASK (((uint64_t)1 << 32) - STATE_PIN)
+#define STATE_GEN ((uint64_t)1 << 32)
+
+// Queue of a cached frame: the main one, swept by the clock hand, or the
+// probation FIFO of new frames (2Q's A1in, the window of W-TinyLFU)
+#define QUEUE_MAIN 0
+#define QUEUE_PROBATION 1
+
+// TinyLFU count-min sketch: rows, saturating counters, and accesses per frame
+// of capacity between halvings of the counts, to age them
+#define SKETCH_DEPTH 4
+#define SKETCH_MAX 15
+#define SKETCH_SAMPLE 10
+
+#define NO_GHOST UINT64_MAX
+
+// Default frames of a shared cache per byte of its budget
+#define DEFAULT_SHARED_FRAME_SIZE (16 << 10)
+
+/**
+ * Cached frame and its state. Slots are allocated with their shard and
+ * never freed before the cache, so lock-free lookups can always read them.
+ */
+typedef union {
+    struct {
+        zseek_frame_t frame;    // first, see zseek_cache_release()
+        uint64_t state;
+        zseek_cache_user_t *user;   // along with frame.idx, the key
+        uint8_t referenced;     // CLOCK bit, set by hits
+        // NOTE: The rest belongs to the policy, under the shard lock
+        uint8_t queue;
+        uint32_t prev, next;    // in the probation FIFO, slot index + 1
+    };
+    char pad[CACHE_LINE];       // no false sharing between hot frames
+} zseek_cache_slot_t;
+
+typedef union {
+    struct {
+        // NOTE: Taken by inserts only, which evict and move table entries.
+        // Lookups go lock-free, validating what they find.
+        pthread_mutex_t lock;
+        zseek_cache_slot_t *slots;
+        size_t capacity;
+        size_t used;            // slots used at least once
+        size_t hand;
+        // Slots freed by evictions
+        uint32_t *free_slots;
+        size_t nb_free;
+        // Share of the budget of the cache, for the policies to size their
+        // queues by, in bytes, 0 if unbounded, and the size of its frames
+        size_t max_size;
+        size_t size;
+        // Open addressing with linear probing, slot index + 1, 0 if empty
+        uint32_t *table;
+        size_t mask;
+        // Probation FIFO, from head (oldest) to tail, and its share of the
+        // shard, in frames and in bytes (0 if unbounded)
+        uint32_t head, tail;
+        size_t nb_probation;
+        size_t probation_size;
+        size_t max_probation;
+        size_t max_probation_size;
+        // 2Q's A1out: ring of the keys of frames evicted from probation
+        uint64_t *ghosts;
+        size_t nb_ghosts;
+        size_t ghost_pos;
+        // TinyLFU: SKETCH_DEPTH rows of mask + 1 counters
+        uint8_t *sketch;
+        size_t sketch_mask;
+        size_t sample;          // accesses between halvings
+    };
+    char pad[4 * CACHE_LINE];
+} zseek_cache_shard_t;
+
+/**
+ * Counters of a shard, written by lookups, apart from what they only read:
+ * hits and misses of a user, or accesses of the cache
+ */
+typedef union {
+    struct {
+        size_t hits;            // atomic
+        size_t misses;          // atomic
+        size_t accesses;        // atomic, since the sketch was last halved
+    };
+    char pad[CACHE_LINE];
+} zseek_cache_counters_t;
+
+/**
+ * Reader of the cache, whose frames it tells apart from those of others, or
+ * readers of the same file
+ */
+struct zseek_cache_user {
+    uint64_t id;
+    // Identity of the file, if known, see zseek_cache_attach()
+    bool has_file;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    size_t refs;                // under the users lock of the cache
+    zseek_cache_user_t *next;   // of the users with a file
+    size_t entries;             // atomic
+    size_t memory;              // atomic
+    size_t peak_memory;         // atomic
+    zseek_cache_counters_t counters[];  // hits and misses, per shard
 };
-typedef struct zseek_cached_frame zseek_cached_frame_t;
+
+/**
+ * Replacement policy. Lookups only set the CLOCK bit of the frames they hit,
+ * so that hits never lock: policies work from it, with the shard locked.
+ */
+typedef struct {
+    /** Places the frame newly inserted in @p slot */
+    void (*admit)(zseek_cache_t *cache, zseek_cache_shard_t *shard,
+        zseek_cache_slot_t *slot);
+    /**
+     * Returns the frame to evict next, unpinned when checked, or @a NULL if
+     * every frame is pinned
+     */
+    zseek_cache_slot_t *(*victim)(zseek_cache_t *cache,
+        zseek_cache_shard_t *shard);
+    /** Forgets the frame in @p slot, just evicted */
+    void (*evicted)(zseek_cache_t *cache, zseek_cache_shard_t *shard,
+        zseek_cache_slot_t *slot);
+} zseek_cache_policy_ops_t;
 
 struct zseek_cache {
-    // TODO OPT: Lock independently from zseek_reader
+    zseek_cache_shard_t *shards;
+    zseek_cache_counters_t *counters;   // accesses, per shard
+    size_t nb_shards;
+    unsigned shard_shift;
+    const zseek_cache_policy_ops_t *policy;
+    size_t overhead;            // atomic, memory usage, but for the frames
+    size_t entries;             // atomic
+    size_t entries_memory;      // atomic, within max_size
+    size_t peak_memory;         // atomic
+    size_t max_size;            // for frames, in bytes, 0 if unbounded
+    size_t evict_hand;          // atomic, next shard to evict from for others
+    size_t users;               // atomic
+    uint64_t next_user_id;      // atomic
+    // NOTE: Taken by attaches and detaches only
+    pthread_mutex_t users_lock;
+    zseek_cache_user_t *file_users;
+    const zseek_allocator_t *allocator;
+    zseek_frame_pool_t *pool;   // to return frame data to, if any
+    // Shared caches only
+    zseek_allocator_t own_allocator;
+    bool own_pool;
+};
 
-    // BST with nodes linking to the list below
-    void *root;
+static size_t shard_idx_of(const zseek_cache_t *cache,
+    const zseek_cache_user_t *user, size_t frame_idx)
+{
+    // NOTE: Consecutive frames land in different shards
+    return (frame_idx + user->id) & (cache->nb_shards - 1);
+}
 
-    // Linked list containing the actual cache entries (head is LRU, tail is
-    // MRU)
-    zseek_cached_frame_t *head;
-    zseek_cached_frame_t *tail;
+static zseek_cache_shard_t *shard_of(const zseek_cache_t *cache,
+    const zseek_cache_user_t *user, size_t frame_idx)
+{
+    return &cache->shards[shard_idx_of(cache, user, frame_idx)];
+}
 
-    size_t size;
-    size_t capacity;
-    size_t entries_memory;
-};
+static size_t home_of(const zseek_cache_t *cache,
+    const zseek_cache_shard_t *shard, const zseek_cache_user_t *user,
+    size_t frame_idx)
+{
+    // Fibonacci hashing of the index within the shard, and of the user
+    uint64_t h = ((uint64_t)(frame_idx >> cache->shard_shift) +
+        (user->id << 32)) * 0x9E3779B97F4A7C15ull;
+    return (size_t)(h >> 32) & shard->mask;
+}
+
+/**
+ * Returns the key of the frame at index @p frame_idx of @p user, for the
+ * policies, which may tell keys apart approximately.
+ */
+static uint64_t key_of(const zseek_cache_user_t *user, size_t frame_idx)
+{
+    return (uint64_t)frame_idx ^ (user->id << 40);
+}
+
+static void free_data(zseek_cache_t *cache, zseek_frame_t *frame)
+{
+    if (cache->pool)
+        zseek_frame_pool_put(cache->pool, frame->data, frame->len);
+    else
+        zseek_free(cache->allocator, frame->data);
+}
+
+/**
+ * Returns the table position of the frame at index @p frame_idx of @p user in
+ * @p shard, or -1 if absent.
+ *
+ * @attention The shard must be locked.
+ */
+static ssize_t table_find(const zseek_cache_t *cache,
+    const zseek_cache_shard_t *shard, const zseek_cache_user_t *user,
+    size_t frame_idx)
+{
+    size_t pos = home_of(cache, shard, user, frame_idx);
+    for (uint32_t s; (s = shard->table[pos]); pos = (pos + 1) & shard->mask) {
+        const zseek_cache_slot_t *slot = &shard->slots[s - 1];
+        if (slot->frame.idx == frame_idx && slot->user == user)
+            return pos;
+    }
+
+    return -1;
+}
+
+/**
+ * Removes the table entry at @p pos from @p shard, shifting back the entries
+ * that probed past it.
+ *
+ * @attention The shard must be locked.
+ */
+static void table_remove(const zseek_cache_t *cache,
+    zseek_cache_shard_t *shard, size_t pos)
+{
+    size_t hole = pos;
+    for (size_t i = (pos + 1) & shard->mask; shard->table[i];
+            i = (i + 1) & shard->mask) {
+        uint32_t s = shard->table[i];
+        const zseek_cache_slot_t *slot = &shard->slots[s - 1];
+        size_t home = home_of(cache, shard, slot->user, slot->frame.idx);
+        // Move it unless its home lies cyclically in (hole, i]
+        bool stays = hole <= i ? (hole < home && home <= i) :
+            (hole < home || home <= i);
+        if (stays)
+            continue;
+        __atomic_store_n(&shard->table[hole], s, __ATOMIC_RELEASE);
+        hole = i;
+    }
+    __atomic_store_n(&shard->table[hole], 0, __ATOMIC_RELEASE);
+}
+
+static bool evictable(zseek_cache_slot_t *slot)
+{
+    uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+    return (state & STATE_LIVE) && !(state & STATE_PINS_MASK);
+}
+
+/**
+ * Returns a frame of the main queue of @p shard that was not used since the
+ * clock hand last passed it, or @a NULL if there is none unpinned.
+ */
+static zseek_cache_slot_t *clock_victim(zseek_cache_shard_t *shard)
+{
+    // Two sweeps at most: the first may only clear CLOCK bits
+    for (size_t n = 0; n < 2 * shard->used; n++) {
+        zseek_cache_slot_t *slot = &shard->slots[shard->hand];
+        shard->hand = (shard->hand + 1) % shard->used;
+
+        if (slot->queue != QUEUE_MAIN || !evictable(slot))
+            continue;
+        if (__atomic_load_n(&slot->referenced, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&slot->referenced, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        return slot;
+    }
+
+    return NULL;
+}
+
+static void fifo_push(zseek_cache_shard_t *shard, zseek_cache_slot_t *slot)
+{
+    uint32_t s = (uint32_t)(slot - shard->slots + 1);
+    slot->queue = QUEUE_PROBATION;
+    slot->prev = shard->tail;
+    slot->next = 0;
+    if (shard->tail)
+        shard->slots[shard->tail - 1].next = s;
+    else
+        shard->head = s;
+    shard->tail = s;
+    shard->nb_probation++;
+    shard->probation_size += slot->frame.len;
+}
+
+/**
+ * Takes @p slot out of the probation FIFO, into the main queue.
+ */
+static void fifo_remove(zseek_cache_shard_t *shard, zseek_cache_slot_t *slot)
+{
+    if (slot->prev)
+        shard->slots[slot->prev - 1].next = slot->next;
+    else
+        shard->head = slot->next;
+    if (slot->next)
+        shard->slots[slot->next - 1].prev = slot->prev;
+    else
+        shard->tail = slot->prev;
+    slot->queue = QUEUE_MAIN;
+    shard->nb_probation--;
+    shard->probation_size -= slot->frame.len;
+}
+
+/**
+ * Returns the oldest frame on probation in @p shard not pinned, if any.
+ */
+static zseek_cache_slot_t *fifo_oldest(zseek_cache_shard_t *shard)
+{
+    for (uint32_t s = shard->head; s; s = shard->slots[s - 1].next) {
+        if (evictable(&shard->slots[s - 1]))
+            return &shard->slots[s - 1];
+    }
+
+    return NULL;
+}
+
+/**
+ * Whether the frames on probation in @p shard take up their share of it, or
+ * more than that if @p over.
+ */
+static bool probation_full(const zseek_cache_shard_t *shard, bool over)
+{
+    if (over) {
+        return shard->nb_probation > shard->max_probation ||
+            (shard->max_probation_size &&
+            shard->probation_size > shard->max_probation_size);
+    }
+
+    return shard->nb_probation >= shard->max_probation ||
+        (shard->max_probation_size &&
+        shard->probation_size >= shard->max_probation_size);
+}
+
+static void clock_admit(zseek_cache_t *cache, zseek_cache_shard_t *shard,
+    zseek_cache_slot_t *slot)
+{
+    (void)cache;
+    (void)shard;
+
+    slot->queue = QUEUE_MAIN;
+}
+
+static zseek_cache_slot_t *clock_victim_of(zseek_cache_t *cache,
+    zseek_cache_shard_t *shard)
+{
+    (void)cache;
+
+    return clock_victim(shard);
+}
+
+static void clock_evicted(zseek_cache_t *cache, zseek_cache_shard_t *shard,
+    zseek_cache_slot_t *slot)
+{
+    (void)cache;
+    (void)shard;
+    (void)slot;
+}
 
-static int compare(const void *pa, const void *pb)
+/**
+ * Removes @p key from the ghosts of @p shard, returning whether it was there.
+ */
+static bool ghost_take(zseek_cache_shard_t *shard, uint64_t key)
 {
-    const zseek_cached_frame_t *a = pa;
-    const zseek_cached_frame_t *b = pb;
+    // TODO OPT: Hash the ghosts, if shards grow large
+    for (size_t i = 0; i < shard->nb_ghosts; i++) {
+        if (shard->ghosts[i] == key) {
+            shard->ghosts[i] = NO_GHOST;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void ghost_add(zseek_cache_shard_t *shard, uint64_t key)
+{
+    shard->ghosts[shard->ghost_pos] = key;
+    shard->ghost_pos = (shard->ghost_pos + 1) % shard->nb_ghosts;
+}
+
+/**
+ * 2Q: new frames go on probation, in FIFO order, which a scan only goes
+ * through. Those used again after leaving it, while their index is still
+ * remembered, go to the main queue.
+ */
+static void twoq_admit(zseek_cache_t *cache, zseek_cache_shard_t *shard,
+    zseek_cache_slot_t *slot)
+{
+    (void)cache;
 
-    if (a->frame.idx < b->frame.idx)
-        return -1;
-    if (a->frame.idx > b->frame.idx)
-        return 1;
-    return 0;
+    if (ghost_take(shard, key_of(slot->user, slot->frame.idx)))
+        slot->queue = QUEUE_MAIN;
+    else
+        fifo_push(shard, slot);
 }
 
-static void free_node(void *nodep)
+static zseek_cache_slot_t *twoq_victim(zseek_cache_t *cache,
+    zseek_cache_shard_t *shard)
 {
-    // Free corresponding list element
-    zseek_cached_frame_t *f = nodep;
-    free(f->frame.data);
-    free(f);
+    (void)cache;
+
+    zseek_cache_slot_t *slot = NULL;
+    if (probation_full(shard, false))
+        slot = fifo_oldest(shard);
+    if (!slot)
+        slot = clock_victim(shard);
+    if (!slot)
+        slot = fifo_oldest(shard);
+
+    return slot;
 }
 
-static void evict_lru(zseek_cache_t *cache)
+static void twoq_evicted(zseek_cache_t *cache, zseek_cache_shard_t *shard,
+    zseek_cache_slot_t *slot)
 {
-    // Remove from list
-    zseek_cached_frame_t *lru = cache->head;
-    if (!lru)
+    (void)cache;
+
+    if (slot->queue == QUEUE_PROBATION) {
+        fifo_remove(shard, slot);
+        ghost_add(shard, key_of(slot->user, slot->frame.idx));
+    }
+}
+
+static uint64_t sketch_hash(uint64_t key, unsigned row)
+{
+    // splitmix64 finalizer, seeded per row
+    uint64_t h = key + (row + 1) * 0x9E3779B97F4A7C15ull;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+    return h ^ (h >> 31);
+}
+
+/**
+ * Counts an access to the frame of key @p key in the shard at index @p i,
+ * without locking.
+ */
+static void sketch_add(zseek_cache_t *cache, size_t i, uint64_t key)
+{
+    zseek_cache_shard_t *shard = &cache->shards[i];
+    for (unsigned row = 0; row < SKETCH_DEPTH; row++) {
+        uint8_t *c = &shard->sketch[row * (shard->sketch_mask + 1) +
+            (sketch_hash(key, row) & shard->sketch_mask)];
+        // NOTE: Racing increments may overshoot a little, which is harmless
+        if (__atomic_load_n(c, __ATOMIC_RELAXED) < SKETCH_MAX)
+            __atomic_add_fetch(c, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&cache->counters[i].accesses, 1, __ATOMIC_RELAXED);
+}
+
+static uint8_t sketch_estimate(const zseek_cache_shard_t *shard,
+    const zseek_cache_slot_t *slot)
+{
+    uint64_t key = key_of(slot->user, slot->frame.idx);
+    uint8_t min = UINT8_MAX;
+    for (unsigned row = 0; row < SKETCH_DEPTH; row++) {
+        uint8_t c = __atomic_load_n(&shard->sketch[row *
+            (shard->sketch_mask + 1) + (sketch_hash(key, row) &
+            shard->sketch_mask)], __ATOMIC_RELAXED);
+        if (c < min)
+            min = c;
+    }
+
+    return min;
+}
+
+/**
+ * Halves the counts of the sketch of @p shard once a sample of accesses went
+ * by, so that frames popular long ago do not stay so forever.
+ *
+ * @attention The shard must be locked.
+ */
+static void sketch_age(zseek_cache_t *cache, zseek_cache_shard_t *shard)
+{
+    size_t *accesses = &cache->counters[shard - cache->shards].accesses;
+    if (__atomic_load_n(accesses, __ATOMIC_RELAXED) < shard->sample)
         return;
-    if (cache->head == cache->tail) {
-        // Single item
-        cache->head = NULL;
-        cache->tail = NULL;
-    } else {
-        cache->head = cache->head->next;
-        remque(lru);
+
+    __atomic_store_n(accesses, 0, __ATOMIC_RELAXED);
+    size_t n = SKETCH_DEPTH * (shard->sketch_mask + 1);
+    for (size_t i = 0; i < n; i++) {
+        uint8_t c = __atomic_load_n(&shard->sketch[i], __ATOMIC_RELAXED);
+        __atomic_store_n(&shard->sketch[i], c / 2, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * W-TinyLFU: new frames go to a small probation window, in FIFO order. Once
+ * the shard is full, the oldest of them only replaces the next victim of the
+ * main queue if used more often lately, per the sketch, or is evicted.
+ */
+static void tinylfu_admit(zseek_cache_t *cache, zseek_cache_shard_t *shard,
+    zseek_cache_slot_t *slot)
+{
+    (void)cache;
+
+    fifo_push(shard, slot);
+
+    // Until the main queue fills up, frames leaving the window go there
+    size_t live = shard->used - shard->nb_free;
+    while (shard->slots[shard->head - 1].next && probation_full(shard, true)) {
+        bool room = live - shard->nb_probation <
+            shard->capacity - shard->max_probation && (!shard->max_size ||
+            shard->size - shard->probation_size <
+            shard->max_size - shard->max_probation_size);
+        if (!room)
+            break;
+        fifo_remove(shard, &shard->slots[shard->head - 1]);
     }
+}
+
+static zseek_cache_slot_t *tinylfu_victim(zseek_cache_t *cache,
+    zseek_cache_shard_t *shard)
+{
+    (void)cache;
+
+    zseek_cache_slot_t *main = clock_victim(shard);
+    if (!probation_full(shard, false))
+        return main ? main : fifo_oldest(shard);
+
+    zseek_cache_slot_t *candidate = fifo_oldest(shard);
+    if (!candidate || !main)
+        return candidate ? candidate : main;
+    if (sketch_estimate(shard, candidate) <= sketch_estimate(shard, main))
+        return candidate;
+
+    // Admitted, at the expense of the victim
+    fifo_remove(shard, candidate);
+    return main;
+}
+
+static void tinylfu_evicted(zseek_cache_t *cache, zseek_cache_shard_t *shard,
+    zseek_cache_slot_t *slot)
+{
+    (void)cache;
 
-    // Remove from BST
-    (void*)tdelete(lru, &cache->root, compare);
+    if (slot->queue == QUEUE_PROBATION)
+        fifo_remove(shard, slot);
+}
 
-    cache->size--;
-    cache->entries_memory -= lru->frame.len;
+static const zseek_cache_policy_ops_t clock_policy = {
+    clock_admit, clock_victim_of, clock_evicted,
+};
+
+static const zseek_cache_policy_ops_t twoq_policy = {
+    twoq_admit, twoq_victim, twoq_evicted,
+};
 
-    free(lru->frame.data);
-    free(lru);
+static const zseek_cache_policy_ops_t tinylfu_policy = {
+    tinylfu_admit, tinylfu_victim, tinylfu_evicted,
+};
+
+/**
+ * Removes the frame in @p slot of @p shard, already marked dead, from the
+ * cache and frees its data.
+ *
+ * @attention The shard must be locked.
+ */
+static void drop(zseek_cache_t *cache, zseek_cache_shard_t *shard,
+    zseek_cache_slot_t *slot)
+{
+    cache->policy->evicted(cache, shard, slot);
+    ssize_t pos = table_find(cache, shard, slot->user, slot->frame.idx);
+    if (pos >= 0)
+        table_remove(cache, shard, pos);
+    shard->size -= slot->frame.len;
+    __atomic_sub_fetch(&cache->entries, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&cache->entries_memory, slot->frame.len,
+        __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&slot->user->entries, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&slot->user->memory, slot->frame.len,
+        __ATOMIC_RELAXED);
+    free_data(cache, &slot->frame);
+    shard->free_slots[shard->nb_free++] = (uint32_t)(slot - shard->slots);
 }
 
-static void make_mru(zseek_cache_t *cache, zseek_cached_frame_t *f)
+/**
+ * Evicts a frame of @p shard, as chosen by the policy. Returns @a false if
+ * every frame is pinned.
+ *
+ * @attention The shard must be locked.
+ */
+static bool evict(zseek_cache_t *cache, zseek_cache_shard_t *shard)
 {
-    remque(f);
+    // NOTE: Lookups may pin the victim before it goes, then try the next
+    for (size_t n = 0; n <= shard->capacity; n++) {
+        zseek_cache_slot_t *slot = cache->policy->victim(cache, shard);
+        if (!slot)
+            return false;
+
+        // Fails if pinned meanwhile
+        uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+        uint64_t evicted = (state & ~STATE_LIVE) + STATE_GEN;
+        if (!(state & STATE_LIVE) || state & STATE_PINS_MASK ||
+                !__atomic_compare_exchange_n(&slot->state, &state, evicted,
+                false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            continue;
 
-    if (!cache->tail)
-        cache->head = f;
-    insque(f, cache->tail);
-    cache->tail = f;
+        drop(cache, shard, slot);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Raises @p peak to @p value, if lower.
+ */
+static void raise_peak(size_t *peak, size_t value)
+{
+    size_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (value > old && !__atomic_compare_exchange_n(peak, &old, value,
+            true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/**
+ * Evicts a frame of a shard other than @p shard, as chosen by its policy, in
+ * turns. Returns @a false if every frame of the others is pinned, or they are
+ * all locked.
+ *
+ * @attention @p shard must be locked.
+ */
+static bool evict_other(zseek_cache_t *cache, zseek_cache_shard_t *shard)
+{
+    for (size_t n = 0; n < cache->nb_shards; n++) {
+        size_t i = __atomic_fetch_add(&cache->evict_hand, 1,
+            __ATOMIC_RELAXED) & (cache->nb_shards - 1);
+        zseek_cache_shard_t *other = &cache->shards[i];
+        // NOTE: Never wait for another shard while holding one, which could
+        // deadlock with an insert there evicting from this one
+        if (other == shard || pthread_mutex_trylock(&other->lock))
+            continue;
+        bool evicted = evict(cache, other);
+        pthread_mutex_unlock(&other->lock);
+        if (evicted)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Accounts for @p len more bytes of frames in @p cache, if within its budget.
+ */
+static bool reserve(zseek_cache_t *cache, size_t len)
+{
+    size_t size = __atomic_load_n(&cache->entries_memory, __ATOMIC_RELAXED);
+    do {
+        if (cache->max_size && size + len > cache->max_size)
+            return false;
+    } while (!__atomic_compare_exchange_n(&cache->entries_memory, &size,
+        size + len, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    raise_peak(&cache->peak_memory, size + len);
+
+    return true;
 }
 
-zseek_cache_t *zseek_cache_new(size_t capacity)
+/**
+ * Returns a free slot of @p shard, with room for @p len bytes in the budget
+ * of @p cache, accounted for, evicting frames as needed, or @a NULL if every
+ * frame is pinned or @p len exceeds the budget.
+ *
+ * @attention The shard must be locked.
+ */
+static zseek_cache_slot_t *take_slot(zseek_cache_t *cache,
+    zseek_cache_shard_t *shard, size_t len)
 {
-    if (capacity == 0)
+    if (cache->max_size && len > cache->max_size)
         return NULL;
 
-    zseek_cache_t *cache = malloc(sizeof(*cache));
-    if (!cache)
+    while (!shard->nb_free && shard->used == shard->capacity) {
+        if (!evict(cache, shard))
+            return NULL;
+    }
+    // NOTE: The budget is that of the whole cache, so a frame may need the
+    // room of frames of other shards
+    while (!reserve(cache, len)) {
+        if (!evict(cache, shard) && !evict_other(cache, shard))
+            return NULL;
+    }
+
+    if (shard->nb_free)
+        return &shard->slots[shard->free_slots[--shard->nb_free]];
+    return &shard->slots[shard->used++];
+}
+
+/**
+ * Pins @p slot if it holds the frame at index @p frame_idx of @p user.
+ */
+static bool pin(zseek_cache_slot_t *slot, const zseek_cache_user_t *user,
+    size_t frame_idx)
+{
+    uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+    while (state & STATE_LIVE) {
+        // NOTE: The key only changes along with the generation, failing the
+        // exchange below if it did since the state was read.
+        if (__atomic_load_n(&slot->frame.idx, __ATOMIC_RELAXED) != frame_idx ||
+                __atomic_load_n(&slot->user, __ATOMIC_RELAXED) != user)
+            return false;
+        uint64_t gen = state & ~(STATE_GEN - 1);
+        if (__atomic_compare_exchange_n(&slot->state, &state,
+                state + STATE_PIN, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+            return true;
+        if ((state & ~(STATE_GEN - 1)) != gen)
+            return false;
+    }
+
+    return false;
+}
+
+/**
+ * Sizes the policy state of @p shard, returning how many bytes it takes.
+ */
+static size_t policy_layout(zseek_cache_policy_t policy,
+    zseek_cache_shard_t *shard)
+{
+    switch (policy) {
+    case ZSEEK_CACHE_CLOCK:
+        return 0;
+    case ZSEEK_CACHE_2Q:
+        // As recommended by the paper: a quarter on probation, and the
+        // indexes of half as many frames as fit remembered
+        shard->max_probation = shard->capacity / 4 + 1;
+        shard->max_probation_size = shard->max_size / 4;
+        shard->nb_ghosts = shard->capacity / 2 + 1;
+        return shard->nb_ghosts * sizeof(*shard->ghosts);
+    case ZSEEK_CACHE_TINYLFU:
+        // A 1% window, as in the paper, of a frame at least
+        shard->max_probation = shard->capacity / 100 + 1;
+        shard->max_probation_size = shard->max_size / 100;
+        shard->sketch_mask = 15;
+        while (shard->sketch_mask + 1 < 4 * shard->capacity)
+            shard->sketch_mask = 2 * shard->sketch_mask + 1;
+        shard->sample = SKETCH_SAMPLE * shard->capacity;
+        return SKETCH_DEPTH * (shard->sketch_mask + 1);
+    default:
+        // BUG
+        assert(false);
+        return 0;
+    }
+}
+
+zseek_cache_t *zseek_cache_new(size_t capacity, size_t max_size,
+    zseek_cache_policy_t policy, zseek_frame_pool_t *pool,
+    const zseek_allocator_t *allocator)
+{
+    if (capacity == 0 || capacity > UINT32_MAX)
         return NULL;
+
+    zseek_cache_t *cache = zseek_alloc(allocator, sizeof(*cache));
+    if (!cache)
+        goto fail;
     memset(cache, 0, sizeof(*cache));
+    cache->allocator = allocator;
+    cache->pool = pool;
+    cache->max_size = max_size;
+
+    switch (policy) {
+    case ZSEEK_CACHE_CLOCK:
+        cache->policy = &clock_policy;
+        break;
+    case ZSEEK_CACHE_2Q:
+        cache->policy = &twoq_policy;
+        break;
+    case ZSEEK_CACHE_TINYLFU:
+        cache->policy = &tinylfu_policy;
+        break;
+    default:
+        goto fail_w_cache;
+    }
+
+    cache->nb_shards = 1;
+    while (cache->nb_shards < MAX_SHARDS &&
+            cache->nb_shards * 2 * MIN_SHARD_CAPACITY <= capacity) {
+        cache->nb_shards *= 2;
+        cache->shard_shift++;
+    }
+    size_t shards_size = cache->nb_shards * sizeof(*cache->shards);
+    cache->shards = zseek_alloc(allocator, shards_size);
+    if (!cache->shards)
+        goto fail_w_cache;
+    memset(cache->shards, 0, shards_size);
+    size_t counters_size = cache->nb_shards * sizeof(*cache->counters);
+    cache->counters = zseek_alloc(allocator, counters_size);
+    if (!cache->counters)
+        goto fail_w_shards_array;
+    memset(cache->counters, 0, counters_size);
+    cache->overhead = sizeof(*cache) + shards_size + counters_size;
+
+    size_t i;
+    for (i = 0; i < cache->nb_shards; i++) {
+        zseek_cache_shard_t *shard = &cache->shards[i];
+        shard->capacity = capacity / cache->nb_shards +
+            (i < capacity % cache->nb_shards);
+        shard->max_size = max_size / cache->nb_shards +
+            (i < max_size % cache->nb_shards);
+        // At most half full
+        size_t table_size = 1;
+        while (table_size < 2 * shard->capacity)
+            table_size *= 2;
+        shard->mask = table_size - 1;
 
-    cache->capacity = capacity;
+        size_t slots_size = shard->capacity * sizeof(*shard->slots);
+        size_t table_bytes = table_size * sizeof(*shard->table);
+        size_t free_bytes = shard->capacity * sizeof(*shard->free_slots);
+        // NOTE: Before the table, which needs less alignment
+        size_t policy_bytes = policy_layout(policy, shard);
+        size_t size = slots_size + policy_bytes + table_bytes + free_bytes;
+        shard->slots = zseek_alloc(allocator, size);
+        if (!shard->slots)
+            goto fail_w_shards;
+        memset(shard->slots, 0, size);
+        char *policy_data = (char*)shard->slots + slots_size;
+        shard->table = (uint32_t*)(policy_data + policy_bytes);
+        shard->free_slots = shard->table + table_size;
+        if (shard->nb_ghosts) {
+            shard->ghosts = (uint64_t*)policy_data;
+            for (size_t j = 0; j < shard->nb_ghosts; j++)
+                shard->ghosts[j] = NO_GHOST;
+        }
+        if (shard->sample)
+            shard->sketch = (uint8_t*)policy_data;
+        cache->overhead += size;
+
+        if (pthread_mutex_init(&shard->lock, NULL)) {
+            zseek_free(allocator, shard->slots);
+            goto fail_w_shards;
+        }
+    }
+    if (pthread_mutex_init(&cache->users_lock, NULL))
+        goto fail_w_shards;
 
     return cache;
+
+fail_w_shards:
+    while (i-- > 0) {
+        pthread_mutex_destroy(&cache->shards[i].lock);
+        zseek_free(allocator, cache->shards[i].slots);
+    }
+    zseek_free(allocator, cache->counters);
+fail_w_shards_array:
+    zseek_free(allocator, cache->shards);
+fail_w_cache:
+    zseek_free(allocator, cache);
+fail:
+    return NULL;
 }
 
 void zseek_cache_free(zseek_cache_t *cache)
@@ -104,58 +873,245 @@ void zseek_cache_free(zseek_cache_t *cache)
     if (!cache)
         return;
 
-    tdestroy(cache->root, free_node);
+    for (size_t i = 0; i < cache->nb_shards; i++) {
+        zseek_cache_shard_t *shard = &cache->shards[i];
+        for (size_t j = 0; j < shard->used; j++) {
+            if (shard->slots[j].state & STATE_LIVE)
+                free_data(cache, &shard->slots[j].frame);
+        }
+        pthread_mutex_destroy(&shard->lock);
+        zseek_free(cache->allocator, shard->slots);
+    }
+    pthread_mutex_destroy(&cache->users_lock);
+    zseek_free(cache->allocator, cache->counters);
+    zseek_free(cache->allocator, cache->shards);
+
+    // NOTE: That of a shared cache lives in it
+    zseek_allocator_t allocator;
+    zseek_allocator_init(&allocator, cache->allocator);
+    zseek_free(&allocator, cache);
+}
 
-    free(cache);
+/**
+ * Whether @p user reads the file of status @p st, as it was then: same
+ * device and inode, and not modified since.
+ */
+static bool same_file(const zseek_cache_user_t *user, const struct stat *st)
+{
+    return user->dev == st->st_dev && user->ino == st->st_ino &&
+        user->size == st->st_size &&
+        user->mtime.tv_sec == st->st_mtim.tv_sec &&
+        user->mtime.tv_nsec == st->st_mtim.tv_nsec;
 }
 
-zseek_frame_t zseek_cache_find(zseek_cache_t *cache, size_t frame_idx)
+zseek_cache_user_t *zseek_cache_attach(zseek_cache_t *cache,
+    const struct stat *st)
 {
     if (!cache)
-        return (zseek_frame_t){NULL, 0, 0};
+        return NULL;
+
+    zseek_cache_user_t *user = NULL;
+    if (st) {
+        pthread_mutex_lock(&cache->users_lock);
+        for (user = cache->file_users; user; user = user->next) {
+            if (same_file(user, st))
+                break;
+        }
+    }
+
+    if (user) {
+        user->refs++;
+    } else {
+        size_t size = sizeof(zseek_cache_user_t) +
+            cache->nb_shards * sizeof(zseek_cache_counters_t);
+        user = zseek_alloc(cache->allocator, size);
+        if (!user)
+            goto out;
+        memset(user, 0, size);
+        user->id = __atomic_fetch_add(&cache->next_user_id, 1,
+            __ATOMIC_RELAXED);
+        user->refs = 1;
+        if (st) {
+            user->has_file = true;
+            user->dev = st->st_dev;
+            user->ino = st->st_ino;
+            user->size = st->st_size;
+            user->mtime = st->st_mtim;
+            user->next = cache->file_users;
+            cache->file_users = user;
+        }
+        __atomic_add_fetch(&cache->overhead, size, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&cache->users, 1, __ATOMIC_RELAXED);
+
+out:
+    if (st)
+        pthread_mutex_unlock(&cache->users_lock);
+
+    return user;
+}
 
-    zseek_cached_frame_t key;
-    key.frame.idx = frame_idx;
-    zseek_cached_frame_t **found = tfind(&key, &cache->root, compare);
-    if (!found)
-        return (zseek_frame_t){NULL, 0, 0};
+void zseek_cache_detach(zseek_cache_t *cache, zseek_cache_user_t *user)
+{
+    if (!cache || !user)
+        return;
 
-    make_mru(cache, *found);
+    __atomic_sub_fetch(&cache->users, 1, __ATOMIC_RELAXED);
+    if (user->has_file) {
+        pthread_mutex_lock(&cache->users_lock);
+        bool last = --user->refs == 0;
+        if (last) {
+            zseek_cache_user_t **p = &cache->file_users;
+            while (*p != user)
+                p = &(*p)->next;
+            *p = user->next;
+        }
+        pthread_mutex_unlock(&cache->users_lock);
+        // NOTE: The frames stay cached for the other readers of the file
+        if (!last)
+            return;
+    }
 
-    return (*found)->frame;
+    for (size_t i = 0; i < cache->nb_shards; i++) {
+        zseek_cache_shard_t *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        for (size_t j = 0; j < shard->used; j++) {
+            zseek_cache_slot_t *slot = &shard->slots[j];
+            uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+            if (!(state & STATE_LIVE) || slot->user != user)
+                continue;
+            // NOTE: Only lookups of the user could pin it
+            __atomic_store_n(&slot->state, (state & ~STATE_LIVE) + STATE_GEN,
+                __ATOMIC_RELEASE);
+            drop(cache, shard, slot);
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    size_t size = sizeof(zseek_cache_user_t) +
+        cache->nb_shards * sizeof(zseek_cache_counters_t);
+    __atomic_sub_fetch(&cache->overhead, size, __ATOMIC_RELAXED);
+    zseek_free(cache->allocator, user);
 }
 
-bool zseek_cache_insert(zseek_cache_t *cache, zseek_frame_t frame)
+zseek_frame_t *zseek_cache_peek(zseek_cache_t *cache,
+    const zseek_cache_user_t *user, size_t frame_idx)
 {
     if (!cache)
-        return false;
+        return NULL;
 
-    if (cache->size == cache->capacity)
-        evict_lru(cache);
+    zseek_cache_shard_t *shard = shard_of(cache, user, frame_idx);
+    size_t pos = home_of(cache, shard, user, frame_idx);
+    // NOTE: Concurrent inserts may move entries around, bound the probing
+    for (size_t n = 0; n <= shard->mask; n++) {
+        uint32_t s = __atomic_load_n(&shard->table[pos], __ATOMIC_ACQUIRE);
+        if (!s)
+            break;
 
-    // Insert to BST
-    zseek_cached_frame_t *f = malloc(sizeof(*f));
-    if (!f)
-        goto fail;
-    f->frame = frame;
-    if (!tsearch(f, &cache->root, compare))
-        goto fail_w_f;
+        zseek_cache_slot_t *slot = &shard->slots[s - 1];
+        if (pin(slot, user, frame_idx))
+            return &slot->frame;
+        pos = (pos + 1) & shard->mask;
+    }
 
-    // Insert to list
-    if (!cache->tail)
-        cache->head = f;
-    insque(f, cache->tail);
-    cache->tail = f;
+    return NULL;
+}
 
-    cache->size++;
-    cache->entries_memory += frame.len;
+zseek_frame_t *zseek_cache_find(zseek_cache_t *cache,
+    zseek_cache_user_t *user, size_t frame_idx)
+{
+    if (!cache)
+        return NULL;
 
-    return true;
+    size_t i = shard_idx_of(cache, user, frame_idx);
+    if (cache->shards[i].sketch)
+        sketch_add(cache, i, key_of(user, frame_idx));
 
-fail_w_f:
-    free(f);
-fail:
-    return false;
+    zseek_frame_t *frame = zseek_cache_peek(cache, user, frame_idx);
+    if (!frame) {
+        __atomic_add_fetch(&user->counters[i].misses, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    __atomic_add_fetch(&user->counters[i].hits, 1, __ATOMIC_RELAXED);
+    // Avoid dirtying the cache line of hot frames
+    zseek_cache_slot_t *slot = (zseek_cache_slot_t*)frame;
+    if (!__atomic_load_n(&slot->referenced, __ATOMIC_RELAXED))
+        __atomic_store_n(&slot->referenced, 1, __ATOMIC_RELAXED);
+
+    return frame;
+}
+
+zseek_frame_t *zseek_cache_insert(zseek_cache_t *cache,
+    zseek_cache_user_t *user, zseek_frame_t frame)
+{
+    if (!cache)
+        return NULL;
+
+    zseek_cache_shard_t *shard = shard_of(cache, user, frame.idx);
+    pthread_mutex_lock(&shard->lock);
+
+    zseek_cache_slot_t *slot;
+    ssize_t pos = table_find(cache, shard, user, frame.idx);
+    if (pos >= 0) {
+        // Lost the race against another insert: keep the cached frame
+        slot = &shard->slots[shard->table[pos] - 1];
+        __atomic_add_fetch(&slot->state, STATE_PIN, __ATOMIC_ACQUIRE);
+        pthread_mutex_unlock(&shard->lock);
+        free_data(cache, &frame);
+        return &slot->frame;
+    }
+
+    if (shard->sketch)
+        sketch_age(cache, shard);
+
+    slot = take_slot(cache, shard, frame.len);
+    if (!slot) {
+        pthread_mutex_unlock(&shard->lock);
+        return NULL;
+    }
+
+    // NOTE: Dead, so lookups only read the key, to fail pinning it
+    __atomic_store_n(&slot->frame.idx, frame.idx, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->user, user, __ATOMIC_RELAXED);
+    slot->frame.data = frame.data;
+    slot->frame.len = frame.len;
+    __atomic_store_n(&slot->referenced, 0, __ATOMIC_RELAXED);
+    shard->size += frame.len;
+    cache->policy->admit(cache, shard, slot);
+    uint64_t state = __atomic_load_n(&slot->state, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->state, state | STATE_LIVE | STATE_PIN,
+        __ATOMIC_RELEASE);
+
+    pos = home_of(cache, shard, user, frame.idx);
+    while (shard->table[pos])
+        pos = (pos + 1) & shard->mask;
+    __atomic_store_n(&shard->table[pos], (uint32_t)(slot - shard->slots + 1),
+        __ATOMIC_RELEASE);
+    __atomic_add_fetch(&cache->entries, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&user->entries, 1, __ATOMIC_RELAXED);
+    raise_peak(&user->peak_memory, __atomic_add_fetch(&user->memory,
+        frame.len, __ATOMIC_RELAXED));
+
+    pthread_mutex_unlock(&shard->lock);
+
+    return &slot->frame;
+}
+
+void zseek_cache_release(zseek_cache_t *cache, zseek_frame_t *frame)
+{
+    (void)cache;
+
+    if (!frame)
+        return;
+
+    zseek_cache_slot_t *slot = (zseek_cache_slot_t*)frame;
+    __atomic_sub_fetch(&slot->state, STATE_PIN, __ATOMIC_RELEASE);
+}
+
+zseek_frame_pool_t *zseek_cache_pool(const zseek_cache_t *cache)
+{
+    return cache ? cache->pool : NULL;
 }
 
 size_t zseek_cache_memory_usage(const zseek_cache_t *cache)
@@ -163,8 +1119,17 @@ size_t zseek_cache_memory_usage(const zseek_cache_t *cache)
     if (!cache)
         return 0;
 
-    return sizeof(*cache) + cache->size * sizeof(*(cache->head)) +
-        cache->entries_memory;
+    return __atomic_load_n(&cache->overhead, __ATOMIC_RELAXED) +
+        __atomic_load_n(&cache->entries_memory, __ATOMIC_RELAXED);
+}
+
+size_t zseek_cache_peak_memory_usage(const zseek_cache_t *cache)
+{
+    if (!cache)
+        return 0;
+
+    return __atomic_load_n(&cache->overhead, __ATOMIC_RELAXED) +
+        __atomic_load_n(&cache->peak_memory, __ATOMIC_RELAXED);
 }
 
 size_t zseek_cache_entries(const zseek_cache_t *cache)
@@ -172,5 +1137,114 @@ size_t zseek_cache_entries(const zseek_cache_t *cache)
     if (!cache)
         return 0;
 
-    return cache->size;
+    return __atomic_load_n(&cache->entries, __ATOMIC_RELAXED);
+}
+
+void zseek_cache_usage(const zseek_cache_t *cache,
+    const zseek_cache_user_t *user, zseek_cache_usage_t *usage)
+{
+    *usage = (zseek_cache_usage_t){0};
+    if (!cache || !user)
+        return;
+
+    usage->entries = __atomic_load_n(&user->entries, __ATOMIC_RELAXED);
+    usage->memory = __atomic_load_n(&user->memory, __ATOMIC_RELAXED);
+    usage->peak_memory = __atomic_load_n(&user->peak_memory,
+        __ATOMIC_RELAXED);
+    for (size_t i = 0; i < cache->nb_shards; i++) {
+        usage->hits += __atomic_load_n(&user->counters[i].hits,
+            __ATOMIC_RELAXED);
+        usage->misses += __atomic_load_n(&user->counters[i].misses,
+            __ATOMIC_RELAXED);
+    }
+}
+
+zseek_cache_t *zseek_shared_cache_new(zseek_shared_cache_param_t *zscp,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!zscp || zscp->max_size == 0) {
+        set_error(errbuf, "invalid cache size");
+        goto fail;
+    }
+
+    size_t capacity = zscp->max_frames;
+    if (capacity == 0) {
+        capacity = zscp->max_size / DEFAULT_SHARED_FRAME_SIZE;
+        if (capacity == 0)
+            capacity = 1;
+    }
+    if (capacity > UINT32_MAX) {
+        set_error(errbuf, "invalid cache size");
+        goto fail;
+    }
+    if (zscp->policy != ZSEEK_CACHE_CLOCK && zscp->policy != ZSEEK_CACHE_2Q &&
+            zscp->policy != ZSEEK_CACHE_TINYLFU) {
+        set_error(errbuf, "invalid cache policy");
+        goto fail;
+    }
+
+    zseek_allocator_t allocator;
+    zseek_allocator_init(&allocator, zscp->allocator);
+    zseek_cache_t *cache = zseek_cache_new(capacity, zscp->max_size,
+        zscp->policy, NULL, &allocator);
+    if (!cache) {
+        set_error_with_errno(errbuf, "allocate cache", errno);
+        goto fail;
+    }
+    // NOTE: Each reader uses its own, so the cache keeps a copy
+    cache->own_allocator = allocator;
+    cache->allocator = &cache->own_allocator;
+
+    cache->pool = zscp->frame_pool;
+    if (!cache->pool) {
+        zseek_frame_pool_param_t zfp = {
+            .max_size = zscp->frame_pool_size,
+            .allocator = cache->allocator,
+        };
+        cache->pool = zseek_frame_pool_new(&zfp, errbuf);
+        if (!cache->pool)
+            goto fail_w_cache;
+        cache->own_pool = true;
+    }
+
+    return cache;
+
+fail_w_cache:
+    zseek_cache_free(cache);
+fail:
+    return NULL;
+}
+
+bool zseek_shared_cache_stats(zseek_cache_t *cache,
+    zseek_shared_cache_stats_t *stats, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!cache) {
+        set_error(errbuf, "invalid cache");
+        return false;
+    }
+
+    if (!stats) {
+        set_error(errbuf, "invalid stats pointer");
+        return false;
+    }
+
+    *stats = (zseek_shared_cache_stats_t) {
+        .memory = zseek_cache_memory_usage(cache),
+        .memory_peak = zseek_cache_peak_memory_usage(cache),
+        .cached_frames = zseek_cache_entries(cache),
+        .readers = __atomic_load_n(&cache->users, __ATOMIC_RELAXED),
+    };
+
+    return true;
+}
+
+void zseek_shared_cache_free(zseek_cache_t *cache)
+{
+    if (!cache)
+        return;
+
+    // NOTE: Frames go back to the pool, freed after them
+    zseek_frame_pool_t *pool = cache->own_pool ? cache->pool : NULL;
+    zseek_cache_free(cache);
+    zseek_frame_pool_free(pool);
 }
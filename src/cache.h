@@ -4,7 +4,14 @@
 #include <stdbool.h>    // bool
 #include <stddef.h>     // size_t
 
-typedef struct zseek_cache zseek_cache_t;
+#include <sys/stat.h>   // struct stat
+
+#include "zseek.h"
+
+/**
+ * Reader of a cache, see zseek_cache_attach()
+ */
+typedef struct zseek_cache_user zseek_cache_user_t;
 
 typedef struct {
     void *data;
@@ -13,36 +20,104 @@ typedef struct {
 } zseek_frame_t;
 
 /**
- * Creates a new cache with a capacity of @p capacity frames.
+ * Share of a cache used by one of its readers
+ */
+typedef struct {
+    size_t entries;
+    size_t memory;          // of the frames, in bytes
+    size_t peak_memory;
+    size_t hits;            // lookups with zseek_cache_find()
+    size_t misses;
+} zseek_cache_usage_t;
+
+/**
+ * Creates a new cache with a capacity of @p capacity frames, and of
+ * @p max_size bytes of frame data unless 0, evicting as per @p policy.
+ * Memory comes from @p allocator, which must outlive the cache, or the C
+ * library if @a NULL. Evicted frames go back to @p pool, if not @a NULL.
+ *
+ * The cache is split in shards by frame index, each evicting on its own,
+ * within its share of the capacity in frames. The size in bytes is bounded
+ * across shards: inserts evict from their own first, then from the others.
+ * Frames larger than @p max_size are not cached.
  */
-zseek_cache_t *zseek_cache_new(size_t capacity);
+zseek_cache_t *zseek_cache_new(size_t capacity, size_t max_size,
+    zseek_cache_policy_t policy, zseek_frame_pool_t *pool,
+    const zseek_allocator_t *allocator);
 /**
  * Frees the cache pointed to by @p cache.
+ *
+ * @attention No frame may remain pinned.
  */
 void zseek_cache_free(zseek_cache_t *cache);
 /**
- * Searches for the frame at index @p frame_idx in @p cache. If not found,
- * zseek_frame_t.data of the return value will be @a NULL.
+ * Registers a reader of @p cache, whose frames are told apart from those of
+ * other readers, and evicted along with them. Readers of the same file, as
+ * per its status @p st, if not @a NULL, share their frames and counts, under
+ * the same user. Returns @a NULL on error.
+ */
+zseek_cache_user_t *zseek_cache_attach(zseek_cache_t *cache,
+    const struct stat *st);
+/**
+ * Unregisters a reader of @p cache. Once no other reader of its file uses
+ * @p user, drops its frames from @p cache, and frees it.
  *
- * @attention Not safe to call concurrently (unlocked).
+ * @attention No frame of @p user may then remain pinned.
  */
-zseek_frame_t zseek_cache_find(zseek_cache_t *cache, size_t frame_idx);
+void zseek_cache_detach(zseek_cache_t *cache, zseek_cache_user_t *user);
 /**
- * Inserts @p frame in @p cache as MRU (most recently used). Might evict LRU.
- * Returns @a false on error.
+ * Searches for the frame at index @p frame_idx of @p user in @p cache,
+ * without locking, and counts the access, as a hit or a miss.
+ * Returns @a NULL if not found, or the frame pinned in the cache, which must
+ * be released with zseek_cache_release().
  *
- * @note Assumes ownership of @p frame.data
+ * @note Might miss a frame being inserted or moved concurrently.
+ */
+zseek_frame_t *zseek_cache_find(zseek_cache_t *cache,
+    zseek_cache_user_t *user, size_t frame_idx);
+/**
+ * Same as zseek_cache_find(), but not counted as an access, e.g. to look for
+ * a frame again after a miss.
+ */
+zseek_frame_t *zseek_cache_peek(zseek_cache_t *cache,
+    const zseek_cache_user_t *user, size_t frame_idx);
+/**
+ * Inserts @p frame of @p user in @p cache. Might evict frames, of any user,
+ * as chosen by the policy among those not pinned, until it fits.
+ * Returns the cached frame, pinned as with zseek_cache_find(), which is
+ * that already cached if @p frame was inserted concurrently. Returns @a NULL
+ * if every frame it could evict is pinned, or @p frame is too large.
  *
- * @attention Not safe to call concurrently (unlocked).
+ * @note Assumes ownership of @p frame.data, taken from the pool of @p cache,
+ * or allocated with its allocator if it has none, unless it returns @a NULL.
+ */
+zseek_frame_t *zseek_cache_insert(zseek_cache_t *cache,
+    zseek_cache_user_t *user, zseek_frame_t frame);
+/**
+ * Unpins @p frame, returned by zseek_cache_find() or zseek_cache_insert().
  */
-bool zseek_cache_insert(zseek_cache_t *cache, zseek_frame_t frame);
+void zseek_cache_release(zseek_cache_t *cache, zseek_frame_t *frame);
+/**
+ * Returns the pool evicted frames of @p cache go back to, if any.
+ */
+zseek_frame_pool_t *zseek_cache_pool(const zseek_cache_t *cache);
 /**
  * Returns the memory usage (total heap allocation) of @p cache in bytes.
  */
 size_t zseek_cache_memory_usage(const zseek_cache_t *cache);
+/**
+ * Returns the highest memory usage of @p cache so far, in bytes.
+ */
+size_t zseek_cache_peak_memory_usage(const zseek_cache_t *cache);
 /**
  * Returns the number of frames currently cached in @p cache.
  */
 size_t zseek_cache_entries(const zseek_cache_t *cache);
+/**
+ * Fills @p usage with the share of @p cache used by @p user, zeroed if
+ * either is @a NULL.
+ */
+void zseek_cache_usage(const zseek_cache_t *cache,
+    const zseek_cache_user_t *user, zseek_cache_usage_t *usage);
 
 #endif  // CACHE_H
@@ -0,0 +1,229 @@
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t
+#include <stdbool.h>    // bool
+
+#include "cdc.h"
+
+// Bytes affecting the hash, as each is shifted out after 64 steps
+#define WINDOW_SIZE 64
+
+// Extra mask bits, below and above avg_size (normalization level)
+#define NORMALIZATION 2
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/*
+ * Random values for each byte, fixed so that cut points are stable across
+ * versions. Generated with splitmix64.
+ */
+static const uint64_t gear[256] = {
+    0xd4ecbdc97210dd3bULL, 0x3723bc737e94ae1dULL, 0x0fb2b264495861b0ULL,
+    0x2314bbb9ecbe07aeULL, 0x839692e529ba5cb3ULL, 0x8ed07ce6fc84737dULL,
+    0x3d7b2c8877581607ULL, 0xc8da3dcf2e31cacfULL, 0x6f908574327a4495ULL,
+    0x46d782ba68372cabULL, 0xf9050cf85b492547ULL, 0xac83259070980e1cULL,
+    0xfd3c7820da191df2ULL, 0x8a3ea7d77bbdf728ULL, 0x566f0e96d0861a75ULL,
+    0x72f338d528f7d6a3ULL, 0xe86c43c397ac00efULL, 0x0b751aa325a5c903ULL,
+    0x8dca7eaaa7c83363ULL, 0xbf4af236718e7101ULL, 0xb8901f3b7dd960eeULL,
+    0x09c0fb3ea81fc141ULL, 0x43bde303b6ad93f5ULL, 0x3c8368405e33f9c2ULL,
+    0x0cd65982f26b50c7ULL, 0x5adb580438364472ULL, 0xf0f3a859e88c1052ULL,
+    0xd46eeee477afe95fULL, 0xd5aac833a1638fe4ULL, 0x6a31bfc2dc800fa4ULL,
+    0x50885a6013e1c8c3ULL, 0x11a8a7c8cb43ee09ULL, 0xd284c05af772212dULL,
+    0xd5f3a26b2c992fcdULL, 0xc5c9f0c9895db6f1ULL, 0x1cf5e477f1faf59cULL,
+    0x345c91a2538148a7ULL, 0x855ee000a5fcc028ULL, 0xdb6622b11f58a851ULL,
+    0xa859040ea00fc8a9ULL, 0x56218cf6c3ca0e1bULL, 0x4a3292c5a5507b4bULL,
+    0x3d4c860379bad1faULL, 0x022dc4c86e80f286ULL, 0x3a14565a030ae756ULL,
+    0xca4acfc6151b8b9bULL, 0x32b0544a78a28daeULL, 0xc4e57b25fbe38c0aULL,
+    0x9319d5e21da68518ULL, 0x18eff3a9b2ae9bbaULL, 0xb36193f6ea711543ULL,
+    0xf289c23f2d3e2b1fULL, 0x2250217e7cbed1f5ULL, 0x36d8f8a421689631ULL,
+    0xd0086c61383bbcd5ULL, 0xf4e670639b3dcdc5ULL, 0x11e37106fe9e06a7ULL,
+    0x3d011dc17706812cULL, 0x488b15486006adbbULL, 0xd0dfcbb89959e483ULL,
+    0xd3f3391bc9b69935ULL, 0xc83aa2bd14cdc6c4ULL, 0xbef3ce57a604d17bULL,
+    0x5ec821dc36005eb1ULL, 0xc30aea969c7a0769ULL, 0x621a49429234911aULL,
+    0x6031f1e83f14109eULL, 0x6d7883df0f5cc985ULL, 0x32d46424553bcdb3ULL,
+    0xfeb15c3e4373245aULL, 0x2df8e00063666e5bULL, 0x5e74d8ed8d22587aULL,
+    0x99c2670d77377af2ULL, 0xc7090d7f08cecedbULL, 0xe3aea50e67716b4fULL,
+    0xf82e7db3a141efd7ULL, 0x9ee273b52b0593d1ULL, 0xe559afe7c4e6dd36ULL,
+    0xdbeecc15704444beULL, 0x007abe0e2e7553a7ULL, 0xbe9e37bd3710a889ULL,
+    0x62df335d0a24a14dULL, 0x29a2a82a7bf84ed7ULL, 0xdda23f4df9f7315fULL,
+    0x6a35f4d2fcafd153ULL, 0x5967bcf9a17cfc72ULL, 0xf1824bc7bcb3495bULL,
+    0x0c42eed5f3fb64beULL, 0x3519e1726349558aULL, 0x8661bffe5896d96fULL,
+    0xf4edbefbd1888a7dULL, 0xb16e6455a10736e3ULL, 0x8f4186e7da2d1770ULL,
+    0x88218a28affa8071ULL, 0x2e1bbf1f773623adULL, 0xe0f33467c57bf096ULL,
+    0xdf012528bc36c6e9ULL, 0xb70d6980dac8864dULL, 0xd8403bcbd677ac1aULL,
+    0x54a7108e391f2f09ULL, 0x8d360a04454a0ba6ULL, 0x86cfd709d0c3bf91ULL,
+    0x21ab60ad54b45d4fULL, 0x229200dd7db9a1ceULL, 0x09bc4a66b101ff4fULL,
+    0x85476931d91cb5b5ULL, 0x68b1f0a6ae5e6131ULL, 0xb0b29370ec15a128ULL,
+    0xd3b954330fec7f23ULL, 0xad511898b35ffb09ULL, 0x87d210a778503d32ULL,
+    0x1e3603caacc90890ULL, 0x1b27b94f504726bbULL, 0x3b3254ee1e74773eULL,
+    0x5ba70e3d770e2588ULL, 0xf463d5aa7bcdd4aaULL, 0x5473f73bade889e2ULL,
+    0xe4768fc4ef44e4b4ULL, 0x4eab6091ac197386ULL, 0x23ab571bf290e44eULL,
+    0x48f8a8b15d6bdc35ULL, 0xff1bae1159ca6cfaULL, 0x67da2231b4565ba3ULL,
+    0xc8f60bff3a9c159cULL, 0x342b7a1459282ce7ULL, 0x7f82741afdb7f0ccULL,
+    0xfcc0a38174f16125ULL, 0xe9fdec7ddcb88e2fULL, 0x82c2dbfa897049b1ULL,
+    0x8e4c226cad291d09ULL, 0xbbe2a1bca7754223ULL, 0x416c0c5980846353ULL,
+    0x05cafd16d778cf95ULL, 0x78d46ff82d982a38ULL, 0xfdb8158ec5a57874ULL,
+    0x73a94f7cb916528aULL, 0x7d833a008c142477ULL, 0xd37e5e8c1e6eec41ULL,
+    0x157163ae1e3b2269ULL, 0x42becf91eefc660fULL, 0xcac4b21663568dc3ULL,
+    0xca66b0494b15616dULL, 0x336c92ef77c62981ULL, 0x9e9a26d8d2cf73e4ULL,
+    0xa3d9c7bb0e09737cULL, 0xe475afb8c486e996ULL, 0xb847d70345052a72ULL,
+    0xb3c83086fd9c9aaeULL, 0xceff04767f2f5149ULL, 0xac13f1291db0d33cULL,
+    0xc0603498057034cbULL, 0x5f08d97d667729afULL, 0xad56ad6eeadce861ULL,
+    0xa1d308f17ef0eb35ULL, 0x43fa9dcf4c3ca8edULL, 0x5e7a53d28661d36dULL,
+    0xd244bac391b6843fULL, 0xedea2763a78d60aaULL, 0xecc9daf7ff28d4b4ULL,
+    0xcbd2adaa601e130cULL, 0x5fbfb63f1a15c0fcULL, 0xd145b9df4497a378ULL,
+    0xf1ed77246a9858bfULL, 0x081578f14e9838beULL, 0x81d8088712e19769ULL,
+    0x64233e53c94f498aULL, 0x63f734edf5b2d4fcULL, 0xc38bf9f83b8f5f99ULL,
+    0x8c7f6fe785c32323ULL, 0xae4cca7a73d8c886ULL, 0xc0eb73867b51be18ULL,
+    0xb152f4328744825aULL, 0x743f22bc0fd352eeULL, 0x27116ad579af0c79ULL,
+    0x60f35bc6c2f60aacULL, 0x656fc7c5bda6cc14ULL, 0x2bab9093aa1f7b58ULL,
+    0xabce01de85dde04cULL, 0xacfeb9ba477525d9ULL, 0x862c405e60877ce1ULL,
+    0xbf28accd344e671eULL, 0x250e2c34baa3a8dbULL, 0x49c408ac6964ab17ULL,
+    0x599fdc3744669d4eULL, 0xdb89467d2693a44eULL, 0xd035121d8a0128afULL,
+    0xd5abf7d05af0ecd9ULL, 0x77af8df0fbdb9a2cULL, 0xf72a7949c72e4da7ULL,
+    0x6e8a74e3428b4a9cULL, 0xaa3558bbc8a2ce6cULL, 0x8085c8c312a8fa41ULL,
+    0xeef156fa4d711d08ULL, 0xbdc94bb0fd0ad251ULL, 0x7e48117a460ff506ULL,
+    0xe473cae1b7d1a2c4ULL, 0x605df7791514ab6dULL, 0xc89a21303cb099abULL,
+    0x4653be9413e48acfULL, 0xf38fb3b10007df9aULL, 0x45044eecabadafd1ULL,
+    0x931ca7113b9ef68dULL, 0xed9889ae77024684ULL, 0x6d243fa429f2787fULL,
+    0xc7770ae5236dc378ULL, 0x27a2a7d21771b972ULL, 0x3f3b2985ea38bb8aULL,
+    0x8b6af343fffee39eULL, 0xf6f3f174b20ac8daULL, 0x92b5de843ff5696cULL,
+    0xebaa8eb1fc0ed5f1ULL, 0x77f7c255516ccc49ULL, 0xddd5f616b9b2090bULL,
+    0xc35d019fae5bf2c3ULL, 0x2f3a8227aa78699aULL, 0x3552578b69208ae5ULL,
+    0x5f100d5aa3e63506ULL, 0x41de9d7e28028f70ULL, 0x20355fbf4e39e743ULL,
+    0x9ce6e6ee1e022e0aULL, 0x683ec692bb294230ULL, 0xd6eb8e038eb4de5aULL,
+    0x6f5691b611d48057ULL, 0x8bc4f8acf872a04bULL, 0xf553468ed5b37c38ULL,
+    0x71688e2811dff350ULL, 0xcf867f9c6f133dbcULL, 0x46726b71052e0514ULL,
+    0x679f20daafc59839ULL, 0xfc77a82cc3ea2ff2ULL, 0xec66441e7d22c92bULL,
+    0xc9d1607b45cafa7eULL, 0x1719839652b68632ULL, 0x14a39f19f5897056ULL,
+    0x005ecfeb92a661a9ULL, 0x0e2054467b7662e9ULL, 0xe33d236c5370e4bbULL,
+    0xb6ff698133b4b07dULL, 0x682c9dd9d3701362ULL, 0x71bcdc3ecd66a749ULL,
+    0x856931aa7223bb51ULL, 0x2e64ebcf6e2ecff2ULL, 0x44a86a034e18c934ULL,
+    0xc2fa3b4af57bd6c5ULL, 0xafd37e453cca5428ULL, 0x724d459a83f27b15ULL,
+    0x913da821623556a0ULL, 0xc83072551fe7f6ddULL, 0x9d07ecd0dd521565ULL,
+    0x05226d720aee5defULL, 0xc9834e763f3b8d0eULL, 0x9575dab22aa64741ULL,
+    0x9131e7165336ca10ULL, 0x2cdbdabc17f769d9ULL, 0x165c612ce336f8bfULL,
+    0xa52b4318008c38a6ULL,
+};
+
+/**
+ * Returns a mask of the @p bits most significant bits. These depend on the
+ * whole window, unlike the least significant ones.
+ */
+static uint64_t high_mask(unsigned bits)
+{
+    if (bits == 0)
+        return 0;
+    if (bits >= 64)
+        return UINT64_MAX;
+    return ((UINT64_C(1) << bits) - 1) << (64 - bits);
+}
+
+static unsigned log2_floor(size_t x)
+{
+    unsigned r = 0;
+    while (x >>= 1)
+        r++;
+    return r;
+}
+
+bool zseek_cdc_init(zseek_cdc_t *cdc, size_t min_size, size_t avg_size,
+    size_t max_size)
+{
+    if (!cdc || min_size >= avg_size || avg_size > max_size)
+        return false;
+
+    unsigned bits = log2_floor(avg_size);
+    *cdc = (zseek_cdc_t) {
+        .min_size = min_size,
+        .avg_size = avg_size,
+        .max_size = max_size,
+        .mask_s = high_mask(bits + NORMALIZATION),
+        .mask_l = high_mask(bits > NORMALIZATION ? bits - NORMALIZATION : 1),
+    };
+
+    return true;
+}
+
+void zseek_cdc_reset(zseek_cdc_t *cdc)
+{
+    cdc->hash = 0;
+    cdc->size = 0;
+}
+
+/**
+ * Rolls the hash over @p buf until a byte leaves it matching @p mask, or up
+ * to @p len bytes. Returns the number of bytes rolled over.
+ */
+static size_t roll(uint64_t *hash, const uint8_t *buf, size_t len,
+    uint64_t mask, bool *cut)
+{
+    // NOTE: The hash only depends on the last WINDOW_SIZE bytes, so distant
+    // positions could be hashed in independent lanes, each warmed up over
+    // the WINDOW_SIZE bytes before it. That is not done: rolling 4 lanes of
+    // 512 bytes at once found the same cuts, at about the same speed, as
+    // the shift and add fuse into a single instruction, and the lanes are
+    // bound by table loads instead.
+    uint64_t h = *hash;
+    for (size_t i = 0; i < len; i++) {
+        h = (h << 1) + gear[buf[i]];
+        if (!(h & mask)) {
+            *hash = h;
+            *cut = true;
+            return i + 1;
+        }
+    }
+    *hash = h;
+
+    return len;
+}
+
+size_t zseek_cdc_next(zseek_cdc_t *cdc, const void *buf, size_t len,
+    bool *cut)
+{
+    const uint8_t *data = buf;
+    size_t pos = 0;
+    *cut = false;
+
+    // Skip bytes that cannot affect the hash at min_size, the first possible
+    // cut point
+    size_t skip = cdc->min_size > WINDOW_SIZE ?
+        cdc->min_size - WINDOW_SIZE : 0;
+    if (cdc->size < skip) {
+        size_t n = MIN(skip - cdc->size, len);
+        cdc->size += n;
+        pos += n;
+    }
+
+    // Warm up the hash, no cuts before min_size
+    if (pos < len && cdc->size < cdc->min_size) {
+        size_t n = MIN(cdc->min_size - cdc->size, len - pos);
+        for (size_t i = 0; i < n; i++)
+            cdc->hash = (cdc->hash << 1) + gear[data[pos + i]];
+        cdc->size += n;
+        pos += n;
+    }
+
+    // Cut less eagerly below avg_size...
+    if (pos < len && cdc->size < cdc->avg_size) {
+        size_t n = roll(&cdc->hash, data + pos,
+            MIN(cdc->avg_size - cdc->size, len - pos), cdc->mask_s, cut);
+        cdc->size += n;
+        pos += n;
+    }
+
+    // ...and more eagerly above it, up to max_size
+    if (!*cut && pos < len && cdc->size < cdc->max_size) {
+        size_t n = roll(&cdc->hash, data + pos,
+            MIN(cdc->max_size - cdc->size, len - pos), cdc->mask_l, cut);
+        cdc->size += n;
+        pos += n;
+    }
+
+    if (cdc->size >= cdc->max_size)
+        *cut = true;
+
+    if (*cut)
+        zseek_cdc_reset(cdc);
+
+    return pos;
+}
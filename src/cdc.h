@@ -0,0 +1,46 @@
+#ifndef CDC_H
+#define CDC_H
+
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t
+#include <stdbool.h>    // bool
+
+/**
+ * Content-defined chunking state, using a gear rolling hash (FastCDC).
+ */
+typedef struct {
+    uint64_t hash;
+    size_t size;        // bytes of the current chunk seen so far
+    size_t min_size;
+    size_t avg_size;
+    size_t max_size;
+    uint64_t mask_s;    // stricter mask, below avg_size
+    uint64_t mask_l;    // looser mask, above avg_size
+} zseek_cdc_t;
+
+/**
+ * Initializes @p cdc to cut chunks of at least @p min_size, on average about
+ * @p avg_size and at most @p max_size bytes.
+ * Returns @a false if the sizes are not in strictly increasing order, apart
+ * from @p max_size which may equal @p avg_size.
+ */
+bool zseek_cdc_init(zseek_cdc_t *cdc, size_t min_size, size_t avg_size,
+    size_t max_size);
+
+/**
+ * Scans @p len bytes from @p buf, continuing the current chunk.
+ * Returns the number of bytes belonging to the current chunk. If a cut point
+ * was found, @p cut is set to @a true and the next byte starts a new chunk.
+ *
+ * Cut points depend only on the data since the previous one, not on how it
+ * is split across calls.
+ */
+size_t zseek_cdc_next(zseek_cdc_t *cdc, const void *buf, size_t len,
+    bool *cut);
+
+/**
+ * Starts a new chunk, discarding the current one.
+ */
+void zseek_cdc_reset(zseek_cdc_t *cdc);
+
+#endif  // CDC_H
@@ -1,6 +1,7 @@
 #include <string.h>     // strerror_r
 #include <stdio.h>      // snprintf
 #include <stdarg.h>
+#include <time.h>       // clock_gettime
 
 #include "zseek.h"      // ZSEEK_ERRBUF_SIZE
 
@@ -52,3 +53,11 @@ void set_error(char errbuf[ZSEEK_ERRBUF_SIZE], const char *message, ...)
     vsnprintf(errbuf, ZSEEK_ERRBUF_SIZE, message, arg_ptr);
     va_end(arg_ptr);
 }
+
+uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    // NOTE: Cannot fail, given a valid clock and pointer
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
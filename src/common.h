@@ -2,6 +2,7 @@
 #define COMMON_H
 
 #include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t
 
 /**
  * Return in @p errbuf the equivalent of using perror with @p msg and errno set
@@ -16,5 +17,9 @@ void set_error_with_errno(char errbuf[ZSEEK_ERRBUF_SIZE], const char *msg, int e
  */
 void set_error(char errbuf[ZSEEK_ERRBUF_SIZE], const char *message, ...) __attribute__ ((format(printf, 2, 3)));
 
+/**
+ * Returns the current time of the monotonic clock, in nanoseconds.
+ */
+uint64_t monotonic_ns(void);
 
 #endif  // COMMON_H
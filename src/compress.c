@@ -1,28 +1,75 @@
 #include <stdbool.h>    // bool
 #include <stddef.h>     // size_t
+#include <stdint.h>     // SIZE_MAX
+#include <limits.h>     // INT_MIN
 #include <stdio.h>      // I/O
-#include <stdlib.h>     // malloc, free
 #include <errno.h>      // errno
 #include <string.h>     // memset
-#include <pthread.h>    // pthread_setaffinity_np
+#include <pthread.h>    // pthread_setaffinity_np, pthread_mutex*
 #include <assert.h>     // assert
+#include <unistd.h>     // fsync
 
+// For custom memory
+#define ZSTD_STATIC_LINKING_ONLY
 #include <zstd.h>
 #include <lz4.h>
+#if defined(HAVE_LZ4F_DICT) || defined(HAVE_LZ4F_CUSTOMMEM)
+// Part of the static-only API (dictionaries before lz4 1.10, custom memory)
+#define LZ4F_STATIC_LINKING_ONLY
+#endif
 #include <lz4frame.h>
 
 #include "zseek.h"
 #include "seek_table.h"
 #include "common.h"
 #include "buffer.h"
+#include "cpool.h"
+#include "cdc.h"
+#include "fsctl.h"
+#include "dict.h"
+#include "alloc.h"
+#include "stage.h"
+#include "fdio.h"
+#include "bindex.h"
+
+// Number of frames in flight per worker, in frame-parallel mode
+#define FRAMES_PER_WORKER 2
+// Default queue budget per worker, in frames, in asynchronous mode
+#define QUEUED_FRAMES_PER_WORKER 4
+// Upper bound for the number of frames in flight, in asynchronous mode
+#define MAX_QUEUED_FRAMES 1024
+
+// Default maximum frame size, relative to the minimum, for adaptive sizes
+#define ADAPTIVE_MAX_FACTOR 16
+// Default number of levels to drop below the configured one, for adaptive
+// levels
+#define ADAPTIVE_LEVEL_RANGE 8
+
+// Default maximum size of trained dictionaries, lz4 only uses the last 64 KiB
+#define DICT_MAX_SIZE_ZSTD (110 << 10)
+#define DICT_MAX_SIZE_LZ4 (64 << 10)
+
+// Default alignment of staged output
+#define OUTPUT_ALIGNMENT 4096
+// Default size of staged output, for direct I/O
+#define DIRECT_OUTPUT_BUFFER_SIZE (1 << 20)
+// Largest piece of seek table to write out at once
+#define SEEK_TABLE_CHUNK_MAX (1 << 20)
+// Decompressed size of lz4 blocks, as per LZ4F_max64KB
+#define BLOCK_SIZE_LZ4 (64 << 10)
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 struct zseek_writer {
+    zseek_allocator_t allocator;    // see zseek_writer_param_t.allocator
     zseek_write_file_t user_file;
+    zseek_fd_file_t fd_file;        // see zseek_writer_open_fd()
     zseek_compression_type_t type;
     union {
         ZSTD_CCtx *cctx_zstd;
         struct {
-            zseek_buffer_t *ubuf;
+            LZ4F_cctx *cctx_lz4;
             LZ4F_preferences_t preferences;
         };
     };
@@ -33,6 +80,56 @@ struct zseek_writer {
     size_t total_cm;    // Total file compressed bytes _excluding_ frame_cm
     ZSTD_frameLog *fl;
     zseek_buffer_t *cbuf;
+    zseek_stage_t *stage;   // see zseek_writer_param_t.output_buffer_size
+    zseek_blog_t *blog;     // see zseek_lz4_param_t.block_index
+
+    // Frame-parallel compression, see zseek_zstd_param_t.frame_parallel
+    zseek_cpool_t *pool;
+    void **wctxs;       // per-worker compression contexts
+    int nb_wctxs;
+    zseek_cjob_t *job;  // frame currently being filled
+    pthread_mutex_t lock;   // protects fl, total_cm, fsctl from output thread
+
+    // Asynchronous mode, see zseek_writer_param_t.async
+    bool async;
+    size_t max_queued_size;
+    zseek_backpressure_t backpressure;
+    void *call_data;    // per-call data for background writes
+
+    // Content-defined frames, see zseek_writer_param_t.content_defined
+    bool content_defined;
+    zseek_cdc_t cdc;
+
+    // Adaptive frame sizes, see zseek_writer_param_t.adaptive
+    bool adaptive;
+    zseek_fsctl_t fsctl;    // protected by lock, if there is a pool
+    uint64_t frame_ns;      // time spent on the current frame, if streaming
+
+    // Compression level of the next frame, see zseek_writer_param_t
+    int level;
+    bool adaptive_level;
+    int min_level;
+    int max_level;
+    uint64_t target_latency_ns;
+    uint64_t frame_write_ns;    // time spent in writes to the current frame
+    size_t frame_writes;        // number of writes to the current frame
+    int *levels;        // per-frame levels, protected by lock if pool
+    size_t nb_levels;
+    size_t levels_capacity;
+
+    // Dictionary, see zseek_writer_param_t.dict
+    void *dict;
+    size_t dict_size;
+    bool dict_pending;      // not set up and written out yet
+#ifdef HAVE_LZ4F_DICT
+    LZ4F_CDict *cdict_lz4;
+#endif
+    zseek_buffer_t *train;  // data buffered for training, until trained
+    size_t train_size;
+    size_t dict_max_size;
+    size_t *train_lens;     // sizes of the buffered writes
+    size_t nb_train_lens;
+    size_t train_lens_capacity;
 };
 
 static bool default_write(const void *data, size_t size, void *user_data,
@@ -48,31 +145,60 @@ static bool default_write(const void *data, size_t size, void *user_data,
     return true;
 }
 
-static zseek_writer_t *zseek_writer_open_full_zstd(zseek_write_file_t user_file,
-	zseek_compression_param_t* zsp, size_t min_frame_size, void *call_data,
-	char errbuf[ZSEEK_ERRBUF_SIZE])
+static bool default_flush(void *user_data, void *call_data)
 {
     (void)call_data;
 
-    int compression_level = ZSTD_CLEVEL_DEFAULT;
-    ZSTD_strategy strategy = ZSTD_fast;
-    if (zsp) {
-        compression_level = zsp->params.zstd_params.compression_level;
-        strategy = zsp->params.zstd_params.strategy;
+    FILE *fout = user_data;
+    if (fflush(fout) == EOF) {
+        // perror("flush file");
+        return false;
     }
-
-    zseek_writer_t *writer = malloc(sizeof(*writer));
-    if (!writer) {
-        set_error_with_errno(errbuf, "allocate writer", errno);
-        goto fail;
+    // Not all files can be synced (e.g. pipes), they are as durable as it gets
+    if (fsync(fileno(fout)) == -1 && errno != EINVAL && errno != EROFS) {
+        // perror("sync file");
+        return false;
     }
-    memset(writer, 0, sizeof(*writer));
-    writer->type = ZSEEK_ZSTD;
+    return true;
+}
+
+/**
+ * Write out @p len bytes of compressed data, through the staging buffer if
+ * there is one
+ */
+static bool output(zseek_writer_t *writer, const void *data, size_t len,
+    void *call_data)
+{
+    if (writer->stage)
+        return zseek_stage_write(writer->stage, data, len, &writer->user_file,
+            call_data);
+
+    return writer->user_file.write(data, len, writer->user_file.user_data,
+        call_data);
+}
+
+/**
+ * Write out the staged output, if any
+ */
+static bool flush_output(zseek_writer_t *writer, void *call_data)
+{
+    if (!writer->stage)
+        return true;
+
+    return zseek_stage_flush(writer->stage, &writer->user_file, call_data);
+}
 
-    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+/**
+ * Create a single-threaded zstd compression context with the given parameters
+ */
+static ZSTD_CCtx *new_cctx_zstd(int compression_level, ZSTD_strategy strategy,
+    zseek_allocator_t *allocator, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    ZSTD_customMem cmem = {zseek_mem_alloc, zseek_mem_free, allocator};
+    ZSTD_CCtx *cctx = ZSTD_createCCtx_advanced(cmem);
     if (!cctx) {
         set_error(errbuf, "context creation failed");
-        goto fail_w_writer;
+        goto fail;
     }
     size_t r = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
         compression_level);
@@ -88,6 +214,63 @@ static zseek_writer_t *zseek_writer_open_full_zstd(zseek_write_file_t user_file,
         goto fail_w_cctx;
     }
 
+    return cctx;
+
+fail_w_cctx:
+    ZSTD_freeCCtx(cctx);
+fail:
+    return NULL;
+}
+
+/**
+ * Create an lz4 compression context, from @p allocator if lz4 supports it
+ */
+static LZ4F_cctx *new_cctx_lz4(zseek_allocator_t *allocator,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+#ifdef HAVE_LZ4F_CUSTOMMEM
+    LZ4F_CustomMem cmem = {zseek_mem_alloc, NULL, zseek_mem_free, allocator};
+    LZ4F_cctx *cctx = LZ4F_createCompressionContext_advanced(cmem,
+        LZ4F_VERSION);
+    if (!cctx)
+        set_error(errbuf, "context creation failed");
+    return cctx;
+#else
+    // NOTE: Without custom memory support in lz4, the context comes from the
+    // C library.
+    (void)allocator;
+
+    LZ4F_cctx *cctx;
+    LZ4F_errorCode_t lr = LZ4F_createCompressionContext(&cctx, LZ4F_VERSION);
+    if (LZ4F_isError(lr)) {
+        set_error(errbuf, "%s: %s", "create context", LZ4F_getErrorName(lr));
+        return NULL;
+    }
+    return cctx;
+#endif
+}
+
+static zseek_writer_t *zseek_writer_open_full_zstd(zseek_writer_t *writer,
+    zseek_write_file_t user_file, zseek_compression_param_t* zsp,
+    zseek_writer_param_t *zwp, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    (void)call_data;
+
+    int compression_level = ZSTD_CLEVEL_DEFAULT;
+    ZSTD_strategy strategy = ZSTD_fast;
+    if (zsp) {
+        compression_level = zsp->params.zstd_params.compression_level;
+        strategy = zsp->params.zstd_params.strategy;
+    }
+
+    writer->type = ZSEEK_ZSTD;
+
+    ZSTD_CCtx *cctx = new_cctx_zstd(compression_level, strategy,
+        &writer->allocator, errbuf);
+    if (!cctx)
+        goto fail;
+    size_t r;
+
     // Declared here to be in scope at fail_w_cpuset
     pthread_t self_tid = pthread_self();
     cpu_set_t prev_cpuset;
@@ -138,16 +321,16 @@ static zseek_writer_t *zseek_writer_open_full_zstd(zseek_write_file_t user_file,
         }
     }
     writer->cctx_zstd = cctx;
-    writer->min_frame_size = min_frame_size;
+    writer->min_frame_size = zwp->min_frame_size;
 
-    ZSTD_frameLog *fl = ZSTD_seekable_createFrameLog(0);
+    ZSTD_frameLog *fl = ZSTD_seekable_createFrameLog(0, &writer->allocator);
     if (!fl) {
         set_error(errbuf, "framelog creation failed");
         goto fail_w_cpuset;
     }
     writer->fl = fl;
 
-    zseek_buffer_t *cbuf = zseek_buffer_new(0);
+    zseek_buffer_t *cbuf = zseek_buffer_new(0, &writer->allocator);
     if (!cbuf) {
         set_error(errbuf, "buffer creation failed");
         goto fail_w_fl;
@@ -165,15 +348,13 @@ fail_w_cpuset:
         pthread_setaffinity_np(self_tid, sizeof(prev_cpuset), &prev_cpuset);
 fail_w_cctx:
     ZSTD_freeCCtx(cctx);
-fail_w_writer:
-    free(writer);
 fail:
     return NULL;
 }
 
-static zseek_writer_t *zseek_writer_open_full_lz4(zseek_write_file_t user_file,
-	zseek_compression_param_t* zsp, size_t min_frame_size, void *call_data,
-	char errbuf[ZSEEK_ERRBUF_SIZE])
+static zseek_writer_t *zseek_writer_open_full_lz4(zseek_writer_t *writer,
+    zseek_write_file_t user_file, zseek_compression_param_t* zsp,
+    zseek_writer_param_t *zwp, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
 {
     (void)call_data;
 
@@ -181,37 +362,30 @@ static zseek_writer_t *zseek_writer_open_full_lz4(zseek_write_file_t user_file,
     if (zsp)
         compression_level = zsp->params.lz4_params.compression_level;
 
-    zseek_writer_t *writer = malloc(sizeof(*writer));
-    if (!writer) {
-        set_error_with_errno(errbuf, "allocate writer", errno);
-        goto fail;
-    }
-    memset(writer, 0, sizeof(*writer));
     writer->type = ZSEEK_LZ4;
     writer->preferences.compressionLevel = compression_level;
-    // Avoid unnecessary copies since we compress all at once anyway
-    writer->preferences.autoFlush = 1;
+    // NOTE: No autoFlush, so that small writes are gathered into whole blocks
+    // by LZ4F itself, instead of being flushed as tiny blocks.
     // Use smaller block sizes to reduce buffering
     writer->preferences.frameInfo.blockSizeID = LZ4F_max64KB;
+    // Independent blocks, so that the block index can point at any of them
+    if (writer->blog)
+        writer->preferences.frameInfo.blockMode = LZ4F_blockIndependent;
+    writer->min_frame_size = zwp->min_frame_size;
 
-    zseek_buffer_t *ubuf = zseek_buffer_new(min_frame_size);
-    if (!ubuf) {
-        set_error(errbuf, "input buffer creation failed");
-        goto fail_w_writer;
-    }
-    writer->ubuf = ubuf;
-    writer->min_frame_size = min_frame_size;
+    LZ4F_cctx *cctx = new_cctx_lz4(&writer->allocator, errbuf);
+    if (!cctx)
+        goto fail;
+    writer->cctx_lz4 = cctx;
 
-    ZSTD_frameLog *fl = ZSTD_seekable_createFrameLog(0);
+    ZSTD_frameLog *fl = ZSTD_seekable_createFrameLog(0, &writer->allocator);
     if (!fl) {
         set_error(errbuf, "framelog creation failed");
-        goto fail_w_ubuf;
+        goto fail_w_cctx;
     }
     writer->fl = fl;
 
-    size_t cbuf_len = LZ4F_compressFrameBound(min_frame_size,
-        &writer->preferences);
-    zseek_buffer_t *cbuf = zseek_buffer_new(cbuf_len);
+    zseek_buffer_t *cbuf = zseek_buffer_new(0, &writer->allocator);
     if (!cbuf) {
         set_error(errbuf, "output buffer creation failed");
         goto fail_w_fl;
@@ -224,291 +398,1660 @@ static zseek_writer_t *zseek_writer_open_full_lz4(zseek_write_file_t user_file,
 
 fail_w_fl:
     ZSTD_seekable_freeFrameLog(fl);
-fail_w_ubuf:
-    zseek_buffer_free(ubuf);
-fail_w_writer:
-    free(writer);
+fail_w_cctx:
+    LZ4F_freeCompressionContext(cctx);
 fail:
     return NULL;
 }
 
-zseek_writer_t *zseek_writer_open_full(zseek_write_file_t user_file,
-	zseek_compression_param_t* zsp, size_t min_frame_size, void *call_data,
-	char errbuf[ZSEEK_ERRBUF_SIZE])
+/**
+ * Adapt the size of the next frame to the current one, which just ended
+ */
+static void adapt_frame_size(zseek_writer_t *writer)
 {
-    // TODO OPT: Don't hard-code the default (zstd)?
-    if (!zsp) {
-        return zseek_writer_open_full_zstd(user_file, zsp, min_frame_size,
-            call_data, errbuf);
+    if (!writer->adaptive)
+        return;
+
+    // NOTE: Compressing and writing out are interleaved when streaming, so
+    // all the time is accounted as compression.
+    zseek_fsctl_update(&writer->fsctl, writer->frame_uc, writer->frame_cm,
+        writer->frame_ns, 0, 1);
+    writer->min_frame_size = zseek_fsctl_size(&writer->fsctl);
+    writer->frame_ns = 0;
+}
+
+/**
+ * Returns the compression level @p step levels above @p level
+ */
+static int step_level(zseek_compression_type_t type, int level, int step)
+{
+    int next = level + step;
+    // 0 is not a level for zstd, but an alias of the default one
+    if (type == ZSEEK_ZSTD && next == 0)
+        next += step;
+    return next;
+}
+
+/**
+ * Record the compression level of the frame just logged
+ */
+static bool log_level(zseek_writer_t *writer, int level)
+{
+    if (!writer->adaptive_level)
+        return true;
+
+    if (writer->nb_levels == writer->levels_capacity) {
+        size_t capacity = MAX(2 * writer->levels_capacity, (size_t)64);
+        int *levels = zseek_realloc(&writer->allocator, writer->levels,
+            writer->levels_capacity * sizeof(*levels),
+            capacity * sizeof(*levels));
+        if (!levels)
+            return false;
+        writer->levels = levels;
+        writer->levels_capacity = capacity;
     }
+    writer->levels[writer->nb_levels++] = level;
 
-    switch (zsp->type) {
+    return true;
+}
+
+/**
+ * Adapt the compression level of the next frame to the latency of writes to
+ * the current one, which just ended
+ */
+static void adapt_level(zseek_writer_t *writer)
+{
+    if (!writer->adaptive_level || writer->frame_writes == 0)
+        return;
+
+    // NOTE: The mean, since the write ending a frame is inherently slower
+    uint64_t latency = writer->frame_write_ns / writer->frame_writes;
+    if (latency > writer->target_latency_ns &&
+        writer->level > writer->min_level)
+        writer->level = step_level(writer->type, writer->level, -1);
+    else if (latency < writer->target_latency_ns / 2 &&
+        writer->level < writer->max_level)
+        writer->level = step_level(writer->type, writer->level, 1);
+    writer->frame_write_ns = 0;
+    writer->frame_writes = 0;
+
+    // Apply to the next frame, if streaming
+    if (writer->pool)
+        return;
+    switch (writer->type) {
     case ZSEEK_ZSTD:
-        return zseek_writer_open_full_zstd(user_file, zsp, min_frame_size,
-            call_data, errbuf);
+        // NOTE: Cannot fail between frames, for a valid level
+        ZSTD_CCtx_setParameter(writer->cctx_zstd, ZSTD_c_compressionLevel,
+            writer->level);
+        break;
     case ZSEEK_LZ4:
-        return zseek_writer_open_full_lz4(user_file, zsp, min_frame_size,
-            call_data, errbuf);
+        writer->preferences.compressionLevel = writer->level;
+        break;
     default:
-        set_error(errbuf, "wrong compression type (%d)", zsp->type);
-        return NULL;
+        // BUG
+        assert(false);
+        break;
     }
 }
 
-zseek_writer_t *zseek_writer_open(FILE *cfile, zseek_compression_param_t *zsp,
-    size_t min_frame_size, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+/**
+ * Begin an lz4 frame, with the dictionary if there is one
+ */
+static size_t begin_frame_lz4(const zseek_writer_t *writer, LZ4F_cctx *cctx,
+    void *dst, size_t capacity, const LZ4F_preferences_t *preferences)
 {
-    zseek_write_file_t user_file = {cfile, default_write};
-    return zseek_writer_open_full(user_file, zsp, min_frame_size, call_data,
-        errbuf);
+#ifdef HAVE_LZ4F_DICT
+    if (writer->cdict_lz4) {
+        return LZ4F_compressBegin_usingCDict(cctx, dst, capacity,
+            writer->cdict_lz4, preferences);
+    }
+#else
+    (void)writer;
+#endif
+    return LZ4F_compressBegin(cctx, dst, capacity, preferences);
 }
 
 /**
- * Flush, close and write current frame. This will block.
+ * Compress a whole frame on a pool worker, with a single-threaded context
  */
-static bool end_frame_zstd(zseek_writer_t *writer, void *call_data)
+static bool compress_job_zstd(zseek_cjob_t *job, void *worker_data,
+    void *user_data)
 {
-    // TODO: Communicate error info?
-
-    // Resize output buffer
-    size_t cbuf_len = ZSTD_CStreamOutSize();
-    if (!zseek_buffer_resize(writer->cbuf, cbuf_len)) {
-        // fprintf(stderr, "resize output buffer failed");
-        return false;
-    }
-    void *cbuf_data = zseek_buffer_data(writer->cbuf);
-    assert(cbuf_data);
+    const zseek_writer_t *writer = user_data;
+    ZSTD_CCtx *cctx = worker_data;
 
-    ZSTD_inBuffer buffin = {NULL, 0, 0};
-    size_t rem = 0;
-    do {
-        // Flush and end frame
-        ZSTD_outBuffer buffout = {cbuf_data, cbuf_len, 0};
-        rem = ZSTD_compressStream2(writer->cctx_zstd, &buffout, &buffin,
-            ZSTD_e_end);
-        if (ZSTD_isError(rem)) {
-            // fprintf(stderr, "compress: %s\n", ZSTD_getErrorName(rem));
+    if (writer->adaptive_level) {
+        size_t r = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+            job->level);
+        if (ZSTD_isError(r)) {
+            set_error(job->errbuf, "%s: %s", "set compression level",
+                ZSTD_getErrorName(r));
             return false;
         }
+    }
 
-        // Update current frame compressed bytes
-        writer->frame_cm += buffout.pos;
-
-        // Write output
-        if (!writer->user_file.write(buffout.dst, buffout.pos,
-            writer->user_file.user_data, call_data)) {
-
-            // TODO OPT: Use errno if user_file.write sets it
-            // fprintf(stderr, "write to file failed");
-            return false;
-        }
-    } while (rem > 0);
+    // Resize output buffer
+    size_t ubuf_len = zseek_buffer_size(job->ubuf);
+    size_t cbuf_len = ZSTD_compressBound(ubuf_len);
+    if (!zseek_buffer_resize(job->cbuf, cbuf_len)) {
+        set_error(job->errbuf, "resize output buffer failed");
+        return false;
+    }
 
-    // Log frame
-    size_t r = ZSTD_seekable_logFrame(writer->fl, writer->frame_cm,
-        writer->frame_uc, 0);
+    size_t r = ZSTD_compress2(cctx, zseek_buffer_data(job->cbuf), cbuf_len,
+        zseek_buffer_data(job->ubuf), ubuf_len);
     if (ZSTD_isError(r)) {
-        // fprintf(stderr, "log frame: %s\n", ZSTD_getErrorName(r));
+        set_error(job->errbuf, "%s: %s", "compress frame",
+            ZSTD_getErrorName(r));
         return false;
     }
-
-    // Reset current frame bytes
-    writer->total_cm += writer->frame_cm;
-    writer->frame_uc = 0;
-    writer->frame_cm = 0;
+    // Correct buffer size (shrinks it, does not fail)
+    zseek_buffer_resize(job->cbuf, r);
 
     return true;
 }
 
-static bool zseek_writer_close_zstd(zseek_writer_t *writer,
-    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+/**
+ * Compress a whole frame on a pool worker
+ */
+static bool compress_job_lz4(zseek_cjob_t *job, void *worker_data,
+    void *user_data)
 {
-    bool is_error = false;
+    const zseek_writer_t *writer = user_data;
+    LZ4F_cctx *cctx = worker_data;
 
-    if (writer->frame_uc > 0) {
-        // End final frame
-        if (!end_frame_zstd(writer, call_data)) {
-            set_error(errbuf, "end_frame_zstd failed");
-            is_error = true;
-        }
+    // Resize output buffer
+    size_t ubuf_len = zseek_buffer_size(job->ubuf);
+    LZ4F_preferences_t preferences = writer->preferences;
+    preferences.frameInfo.contentSize = ubuf_len;
+    preferences.compressionLevel = job->level;
+    size_t cbuf_len = LZ4F_compressFrameBound(ubuf_len, &preferences);
+    if (!zseek_buffer_resize(job->cbuf, cbuf_len)) {
+        set_error(job->errbuf, "resize output buffer failed");
+        return false;
     }
-
-    size_t cbuf_len = 4096;
-    if (!zseek_buffer_resize(writer->cbuf, cbuf_len) && !is_error) {
-        set_error(errbuf, "resize output buffer failed");
-        is_error = true;
+    uint8_t *cbuf_data = zseek_buffer_data(job->cbuf);
+
+    // NOTE: The same as LZ4F_compressFrame, but reusing the worker's context,
+    // which the dictionary needs.
+    size_t pos = begin_frame_lz4(writer, cctx, cbuf_data, cbuf_len,
+        &preferences);
+    if (LZ4F_isError(pos)) {
+        set_error(job->errbuf, "%s: %s", "begin frame",
+            LZ4F_getErrorName(pos));
+        return false;
     }
-    void *cbuf_data = zseek_buffer_data(writer->cbuf);
-    assert(cbuf_data);
-
-    // Write seek table
-    size_t rem = 0;
-    do {
-        ZSTD_outBuffer buffout = {cbuf_data, cbuf_len, 0};
-        rem = ZSTD_seekable_writeSeekTable(writer->fl, &buffout);
-        if (ZSTD_isError(rem) && !is_error) {
-            set_error(errbuf, "%s: %s", "write seek table",
-                ZSTD_getErrorName(rem));
-            is_error = true;
-        }
-
-        bool written = writer->user_file.write(buffout.dst, buffout.pos,
-            writer->user_file.user_data, call_data);
-        if (!written && !is_error) {
-            // TODO OPT: Use errno if user_file.write sets it
-            set_error(errbuf, "write to file failed");
-            is_error = true;
-        }
-    } while (rem > 0);
-
-    zseek_buffer_free(writer->cbuf);
-
-    size_t r = ZSTD_seekable_freeFrameLog(writer->fl);
-    if (ZSTD_isError(r) && !is_error) {
-        set_error(errbuf, "%s: %s", "free frame log", ZSTD_getErrorName(r));
-        is_error = true;
+    size_t r = LZ4F_compressUpdate(cctx, cbuf_data + pos, cbuf_len - pos,
+        zseek_buffer_data(job->ubuf), ubuf_len, NULL);
+    if (LZ4F_isError(r)) {
+        set_error(job->errbuf, "%s: %s", "compress frame",
+            LZ4F_getErrorName(r));
+        return false;
     }
-
-    r = ZSTD_freeCCtx(writer->cctx_zstd);
-    if (ZSTD_isError(r) && !is_error) {
-        set_error(errbuf, "%s: %s", "free context", ZSTD_getErrorName(r));
-        is_error = true;
+    pos += r;
+    r = LZ4F_compressEnd(cctx, cbuf_data + pos, cbuf_len - pos, NULL);
+    if (LZ4F_isError(r)) {
+        set_error(job->errbuf, "%s: %s", "end frame", LZ4F_getErrorName(r));
+        return false;
     }
+    pos += r;
+    // Correct buffer size (shrinks it, does not fail)
+    zseek_buffer_resize(job->cbuf, pos);
 
-    free(writer);
-
-    return !is_error;
+    return true;
 }
 
 /**
- * Flush, close and write current frame. This will block.
+ * Log the blocks of the whole lz4 frame of @p csize bytes at @p cdata, of
+ * @p dsize decompressed bytes, if indexed
  */
-static bool end_frame_lz4(zseek_writer_t *writer, void *call_data)
+static bool log_blocks(zseek_writer_t *writer, const void *cdata, size_t csize,
+    size_t dsize)
 {
-    // TODO: Communicate error info?
-
-    size_t ubuf_len = zseek_buffer_size(writer->ubuf);
-    void *ubuf_data = zseek_buffer_data(writer->ubuf);
-    assert(ubuf_data);
+    if (!writer->blog)
+        return true;
 
-    // Resize output buffer
-    writer->preferences.frameInfo.contentSize = writer->frame_uc;
-    size_t cbuf_len = LZ4F_compressFrameBound(writer->frame_uc,
-        &writer->preferences);
-    if (!zseek_buffer_resize(writer->cbuf, cbuf_len)) {
-        // fprintf(stderr, "resize output buffer failed");
+    if (!zseek_blog_feed(writer->blog, cdata, csize))
         return false;
-    }
-    void *cbuf_data = zseek_buffer_data(writer->cbuf);
-    assert(cbuf_data);
+    zseek_blog_end_frame(writer->blog, dsize);
+    return true;
+}
 
-    // Compress frame
-    size_t cdata_len = LZ4F_compressFrame(cbuf_data, cbuf_len, ubuf_data,
-        ubuf_len, &writer->preferences);
-    if (LZ4F_isError(cdata_len)) {
-        // fprintf(stderr, "%s: %s", "compress", LZ4F_getErrorName(cdata_len));
+/**
+ * Write out and log a compressed frame
+ */
+static bool output_frame_pool(zseek_writer_t *writer, zseek_cjob_t *job,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (job->failed) {
+        set_error(errbuf, "%s", job->errbuf);
         return false;
     }
-    // Correct buffer size (shrinks it, should not fail)
-    assert(zseek_buffer_resize(writer->cbuf, cdata_len));
-    writer->frame_cm += cdata_len;
 
-    // Write output
-    if (!writer->user_file.write(cbuf_data, cdata_len,
-        writer->user_file.user_data, call_data)) {
+    size_t cdata_len = zseek_buffer_size(job->cbuf);
+    size_t udata_len = zseek_buffer_size(job->ubuf);
 
+    // Write output
+    uint64_t start = writer->adaptive ? monotonic_ns() : 0;
+    if (!output(writer, zseek_buffer_data(job->cbuf), cdata_len, call_data)) {
         // TODO OPT: Use errno if user_file.write sets it
-        // fprintf(stderr, "write to file failed");
+        set_error(errbuf, "write to file failed");
         return false;
     }
+    uint64_t write_ns = writer->adaptive ? monotonic_ns() - start : 0;
 
     // Log frame
-    size_t r = ZSTD_seekable_logFrame(writer->fl, writer->frame_cm,
-        writer->frame_uc, 0);
+    pthread_mutex_lock(&writer->lock);
+    size_t r = ZSTD_seekable_logFrame(writer->fl, cdata_len, udata_len, 0);
+    if (!ZSTD_isError(r))
+        writer->total_cm += cdata_len;
+    bool level_logged = !ZSTD_isError(r) && log_level(writer, job->level);
+    bool blocks_logged = log_blocks(writer, zseek_buffer_data(job->cbuf),
+        cdata_len, udata_len);
+    if (writer->adaptive) {
+        zseek_fsctl_update(&writer->fsctl, udata_len, cdata_len,
+            job->compress_ns, write_ns, writer->nb_wctxs);
+    }
+    pthread_mutex_unlock(&writer->lock);
     if (ZSTD_isError(r)) {
-        // fprintf(stderr, "log frame: %s\n", ZSTD_getErrorName(r));
+        set_error(errbuf, "%s: %s", "log frame", ZSTD_getErrorName(r));
+        return false;
+    }
+    if (!level_logged) {
+        set_error(errbuf, "log level failed");
+        return false;
+    }
+    if (!blocks_logged) {
+        set_error(errbuf, "log blocks failed");
         return false;
     }
-
-    // Reset buffers and counters
-    writer->total_cm += writer->frame_cm;
-    writer->frame_uc = 0;
-    writer->frame_cm = 0;
-    zseek_buffer_reset(writer->ubuf);
-    zseek_buffer_reset(writer->cbuf);
 
     return true;
 }
 
-static bool zseek_writer_close_lz4(zseek_writer_t *writer,
-    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
-{
+/**
+ * Output callback of the pool, in asynchronous mode
+ */
+static bool output_job(zseek_cjob_t *job, void *user_data)
+{
+    zseek_writer_t *writer = user_data;
+    return output_frame_pool(writer, job, writer->call_data, job->errbuf);
+}
+
+static bool free_wctxs(zseek_writer_t *writer, void **wctxs, int nb_wctxs,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!wctxs)
+        return true;
+
+    bool is_error = false;
+    for (int i = 0; i < nb_wctxs; i++) {
+        if (writer->type == ZSEEK_LZ4) {
+            LZ4F_errorCode_t r = LZ4F_freeCompressionContext(wctxs[i]);
+            if (LZ4F_isError(r) && !is_error) {
+                set_error(errbuf, "%s: %s", "free context",
+                    LZ4F_getErrorName(r));
+                is_error = true;
+            }
+            continue;
+        }
+        size_t r = ZSTD_freeCCtx(wctxs[i]);
+        if (ZSTD_isError(r) && !is_error) {
+            set_error(errbuf, "%s: %s", "free context", ZSTD_getErrorName(r));
+            is_error = true;
+        }
+    }
+    zseek_free(&writer->allocator, wctxs);
+
+    return !is_error;
+}
+
+static zseek_writer_t *zseek_writer_open_full_pool(zseek_writer_t *writer,
+    zseek_write_file_t user_file, zseek_compression_param_t* zsp,
+    zseek_writer_param_t *zwp, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    zseek_compression_type_t type = zsp ? zsp->type : ZSEEK_ZSTD;
+    int nb_workers = 1;
+    int compression_level = type == ZSEEK_ZSTD ? ZSTD_CLEVEL_DEFAULT : 0;
+    ZSTD_strategy strategy = ZSTD_fast;
+    size_t cpusetsize = 0;
+    const cpu_set_t *cpuset = NULL;
+    zseek_cpool_compress_t compress = compress_job_zstd;
+    if (zsp && type == ZSEEK_ZSTD) {
+        nb_workers = MAX(zsp->params.zstd_params.nb_workers, 1);
+        compression_level = zsp->params.zstd_params.compression_level;
+        strategy = zsp->params.zstd_params.strategy;
+        cpusetsize = zsp->params.zstd_params.cpusetsize;
+        cpuset = zsp->params.zstd_params.cpuset;
+    } else if (zsp && type == ZSEEK_LZ4) {
+        nb_workers = MAX(zsp->params.lz4_params.nb_workers, 1);
+        compression_level = zsp->params.lz4_params.compression_level;
+        compress = compress_job_lz4;
+    }
+
+    writer->type = type;
+    writer->min_frame_size = zwp->min_frame_size;
+    writer->async = zwp->async;
+    writer->backpressure = zwp->backpressure;
+    writer->call_data = call_data;
+    if (type == ZSEEK_LZ4) {
+        writer->preferences.compressionLevel = compression_level;
+        writer->preferences.frameInfo.blockSizeID = LZ4F_max64KB;
+        if (writer->blog)
+            writer->preferences.frameInfo.blockMode = LZ4F_blockIndependent;
+    }
+
+    size_t queue_size = FRAMES_PER_WORKER * nb_workers;
+    if (writer->async) {
+        writer->max_queued_size = zwp->max_queued_size;
+        if (writer->max_queued_size == 0) {
+            writer->max_queued_size = QUEUED_FRAMES_PER_WORKER * nb_workers *
+                MAX(writer->min_frame_size, (size_t)1);
+        }
+        // Room for the budget worth of frames, plus the one being filled
+        size_t queued_frames = writer->max_queued_size /
+            MAX(writer->min_frame_size, (size_t)1) + 1;
+        queue_size = MAX(queue_size, MIN(queued_frames, MAX_QUEUED_FRAMES));
+    }
+
+    void **wctxs = zseek_alloc(&writer->allocator,
+        nb_workers * sizeof(*wctxs));
+    if (!wctxs) {
+        set_error_with_errno(errbuf, "allocate contexts", errno);
+        goto fail;
+    }
+    memset(wctxs, 0, nb_workers * sizeof(*wctxs));
+    for (int i = 0; i < nb_workers; i++) {
+        if (type == ZSEEK_LZ4) {
+            wctxs[i] = new_cctx_lz4(&writer->allocator, errbuf);
+            if (!wctxs[i])
+                goto fail_w_wctxs;
+            continue;
+        }
+        wctxs[i] = new_cctx_zstd(compression_level, strategy,
+            &writer->allocator, errbuf);
+        if (!wctxs[i])
+            goto fail_w_wctxs;
+    }
+    writer->wctxs = wctxs;
+    writer->nb_wctxs = nb_workers;
+
+    int pr = pthread_mutex_init(&writer->lock, NULL);
+    if (pr) {
+        set_error_with_errno(errbuf, "initialize lock", pr);
+        goto fail_w_wctxs;
+    }
+
+    ZSTD_frameLog *fl = ZSTD_seekable_createFrameLog(0, &writer->allocator);
+    if (!fl) {
+        set_error(errbuf, "framelog creation failed");
+        goto fail_w_lock;
+    }
+    writer->fl = fl;
+
+    zseek_buffer_t *cbuf = zseek_buffer_new(0, &writer->allocator);
+    if (!cbuf) {
+        set_error(errbuf, "buffer creation failed");
+        goto fail_w_fl;
+    }
+    writer->cbuf = cbuf;
+
+    writer->user_file = user_file;
+
+    zseek_cpool_t *pool = zseek_cpool_new(nb_workers, queue_size, compress,
+        writer->async ? output_job : NULL, wctxs, writer, cpusetsize, cpuset,
+        &writer->allocator);
+    if (!pool) {
+        set_error(errbuf, "worker pool creation failed");
+        goto fail_w_cbuf;
+    }
+    writer->pool = pool;
+
+    return writer;
+
+fail_w_cbuf:
+    zseek_buffer_free(cbuf);
+fail_w_fl:
+    ZSTD_seekable_freeFrameLog(fl);
+fail_w_lock:
+    pthread_mutex_destroy(&writer->lock);
+fail_w_wctxs:
+    free_wctxs(writer, wctxs, nb_workers, NULL);
+fail:
+    return NULL;
+}
+
+/**
+ * Set up the compression level of frames, adaptive or not
+ */
+static void init_level(zseek_writer_t *writer, zseek_compression_param_t *zsp,
+    zseek_writer_param_t *zwp)
+{
+    int level = 0;
+    if (writer->type == ZSEEK_ZSTD) {
+        level = zsp ? zsp->params.zstd_params.compression_level : 0;
+        if (level == 0)
+            level = ZSTD_CLEVEL_DEFAULT;
+    } else if (zsp) {
+        level = zsp->params.lz4_params.compression_level;
+    }
+    writer->level = level;
+    writer->max_level = level;
+    writer->min_level = level;
+
+    if (!zwp->adaptive_level)
+        return;
+
+    writer->adaptive_level = true;
+    writer->target_latency_ns = (uint64_t)zwp->target_latency_us * 1000;
+    unsigned range = zwp->level_range ? zwp->level_range :
+        ADAPTIVE_LEVEL_RANGE;
+    int min_level = writer->type == ZSEEK_ZSTD ? ZSTD_minCLevel() : INT_MIN;
+    for (unsigned i = 0; i < range; i++) {
+        int next = step_level(writer->type, writer->min_level, -1);
+        if (next < min_level || next > writer->min_level)
+            break;
+        writer->min_level = next;
+    }
+}
+
+static zseek_writer_t *open_writer(zseek_writer_t *writer,
+    zseek_write_file_t user_file, zseek_compression_param_t *zsp,
+    zseek_writer_param_t *zwp, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    // TODO OPT: Don't hard-code the default (zstd)?
+    if (!zsp) {
+        if (zwp->async)
+            return zseek_writer_open_full_pool(writer, user_file, zsp, zwp,
+                call_data, errbuf);
+        return zseek_writer_open_full_zstd(writer, user_file, zsp, zwp,
+            call_data, errbuf);
+    }
+
+    switch (zsp->type) {
+    case ZSEEK_ZSTD:
+        if (zwp->async || zsp->params.zstd_params.frame_parallel)
+            return zseek_writer_open_full_pool(writer, user_file, zsp, zwp,
+                call_data, errbuf);
+        return zseek_writer_open_full_zstd(writer, user_file, zsp, zwp,
+            call_data, errbuf);
+    case ZSEEK_LZ4:
+        if (zwp->async)
+            return zseek_writer_open_full_pool(writer, user_file, zsp, zwp,
+                call_data, errbuf);
+        return zseek_writer_open_full_lz4(writer, user_file, zsp, zwp,
+            call_data, errbuf);
+    default:
+        set_error(errbuf, "wrong compression type (%d)", zsp->type);
+        return NULL;
+    }
+}
+
+/**
+ * Free the writer itself, with its own allocator
+ */
+static void free_writer(zseek_writer_t *writer)
+{
+    zseek_allocator_t allocator = writer->allocator;
+    zseek_free(&allocator, writer);
+}
+
+/**
+ * Create a writer, as per zseek_writer_open_ext(), padding staged output if
+ * @p pad_output, for direct I/O (see zseek_stage_new())
+ */
+static zseek_writer_t *new_writer(zseek_write_file_t user_file,
+    zseek_compression_param_t *zsp, zseek_writer_param_t *zwp,
+    bool pad_output, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!zwp) {
+        set_error(errbuf, "invalid writer parameters");
+        return NULL;
+    }
+
+    zseek_cdc_t cdc;
+    if (zwp->content_defined) {
+        size_t avg_frame_size = zwp->avg_frame_size ? zwp->avg_frame_size :
+            2 * zwp->min_frame_size;
+        size_t max_frame_size = zwp->max_frame_size ? zwp->max_frame_size :
+            4 * avg_frame_size;
+        if (!zseek_cdc_init(&cdc, zwp->min_frame_size, avg_frame_size,
+            max_frame_size)) {
+            set_error(errbuf, "invalid frame sizes (%zu, %zu, %zu)",
+                zwp->min_frame_size, avg_frame_size, max_frame_size);
+            return NULL;
+        }
+    }
+
+    zseek_fsctl_t fsctl;
+    if (zwp->adaptive) {
+        if (zwp->content_defined) {
+            set_error(errbuf, "adaptive frame sizes are incompatible with "
+                "content-defined frames");
+            return NULL;
+        }
+        size_t max_frame_size = zwp->max_frame_size ? zwp->max_frame_size :
+            ADAPTIVE_MAX_FACTOR * zwp->min_frame_size;
+        if (!zseek_fsctl_init(&fsctl, zwp->min_frame_size, max_frame_size,
+            zwp->target_throughput)) {
+            set_error(errbuf, "invalid adaptive frame sizes (%zu, %zu) or "
+                "target (%zu)", zwp->min_frame_size, max_frame_size,
+                zwp->target_throughput);
+            return NULL;
+        }
+    }
+
+    zseek_compression_type_t type = zsp ? zsp->type : ZSEEK_ZSTD;
+    if (zwp->dict && zwp->dict_train_size > 0) {
+        set_error(errbuf, "a dictionary cannot be both given and trained");
+        return NULL;
+    }
+    if ((zwp->dict != NULL) != (zwp->dict_size > 0) ||
+        zwp->dict_size > ZSEEK_DICT_MAX_SIZE) {
+        set_error(errbuf, "invalid dictionary size (%zu)", zwp->dict_size);
+        return NULL;
+    }
+    if (zwp->dict_max_size > ZSEEK_DICT_MAX_SIZE) {
+        set_error(errbuf, "invalid dictionary size (%zu)",
+            zwp->dict_max_size);
+        return NULL;
+    }
+    size_t output_alignment = zwp->output_alignment ? zwp->output_alignment :
+        OUTPUT_ALIGNMENT;
+    if (output_alignment & (output_alignment - 1)) {
+        set_error(errbuf, "invalid output alignment (%zu)", output_alignment);
+        return NULL;
+    }
+#ifndef HAVE_LZ4F_DICT
+    if (type == ZSEEK_LZ4 && (zwp->dict || zwp->dict_train_size > 0)) {
+        set_error(errbuf, "lz4 dictionaries are not supported by this lz4");
+        return NULL;
+    }
+#endif
+
+    zseek_writer_t *writer = zseek_alloc(zwp->allocator, sizeof(*writer));
+    if (!writer) {
+        set_error_with_errno(errbuf, "allocate writer", errno);
+        goto fail;
+    }
+    memset(writer, 0, sizeof(*writer));
+    zseek_allocator_init(&writer->allocator, zwp->allocator);
+
+    // NOTE: The dictionary is only set up and written out on the first write,
+    // flush or close, so that nothing is written out here.
+    void *dict = NULL;
+    if (zwp->dict) {
+        dict = zseek_alloc(&writer->allocator, zwp->dict_size);
+        if (!dict) {
+            set_error_with_errno(errbuf, "allocate dictionary", errno);
+            goto fail_w_writer;
+        }
+        memcpy(dict, zwp->dict, zwp->dict_size);
+    }
+    zseek_buffer_t *train = NULL;
+    if (zwp->dict_train_size > 0) {
+        train = zseek_buffer_new(0, &writer->allocator);
+        if (!train) {
+            set_error(errbuf, "training buffer creation failed");
+            goto fail_w_dict;
+        }
+    }
+
+    if (zwp->output_buffer_size > 0) {
+        writer->stage = zseek_stage_new(zwp->output_buffer_size,
+            output_alignment, pad_output, &writer->allocator);
+        if (!writer->stage) {
+            set_error(errbuf, "output buffer creation failed");
+            goto fail_w_train;
+        }
+    }
+
+    if (type == ZSEEK_LZ4 && zsp->params.lz4_params.block_index) {
+        writer->blog = zseek_blog_new(BLOCK_SIZE_LZ4, &writer->allocator);
+        if (!writer->blog) {
+            set_error(errbuf, "block log creation failed");
+            goto fail_w_stage;
+        }
+    }
+
+    if (!open_writer(writer, user_file, zsp, zwp, call_data, errbuf))
+        goto fail_w_blog;
+    if (zwp->content_defined) {
+        writer->content_defined = true;
+        writer->cdc = cdc;
+    }
+    if (zwp->adaptive) {
+        writer->adaptive = true;
+        writer->fsctl = fsctl;
+    }
+    init_level(writer, zsp, zwp);
+
+    writer->dict = dict;
+    writer->dict_size = zwp->dict_size;
+    writer->train = train;
+    writer->train_size = zwp->dict_train_size;
+    writer->dict_max_size = zwp->dict_max_size;
+    if (writer->dict_max_size == 0) {
+        writer->dict_max_size = type == ZSEEK_LZ4 ? DICT_MAX_SIZE_LZ4 :
+            DICT_MAX_SIZE_ZSTD;
+    }
+    writer->dict_pending = dict || train;
+
+    return writer;
+
+fail_w_blog:
+    zseek_blog_free(writer->blog);
+fail_w_stage:
+    zseek_stage_free(writer->stage);
+fail_w_train:
+    zseek_buffer_free(train);
+fail_w_dict:
+    zseek_free(&writer->allocator, dict);
+fail_w_writer:
+    free_writer(writer);
+fail:
+    return NULL;
+}
+
+zseek_writer_t *zseek_writer_open_ext(zseek_write_file_t user_file,
+    zseek_compression_param_t *zsp, zseek_writer_param_t *zwp,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    return new_writer(user_file, zsp, zwp, false, call_data, errbuf);
+}
+
+zseek_writer_t *zseek_writer_open_full(zseek_write_file_t user_file,
+	zseek_compression_param_t* zsp, size_t min_frame_size, void *call_data,
+	char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    zseek_writer_param_t zwp = { .min_frame_size = min_frame_size };
+    return zseek_writer_open_ext(user_file, zsp, &zwp, call_data, errbuf);
+}
+
+zseek_writer_t *zseek_writer_open(FILE *cfile, zseek_compression_param_t *zsp,
+    size_t min_frame_size, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    zseek_write_file_t user_file = {cfile, default_write, default_flush};
+    return zseek_writer_open_full(user_file, zsp, min_frame_size, call_data,
+        errbuf);
+}
+
+zseek_writer_t *zseek_writer_open_fd(int fd, zseek_compression_param_t *zsp,
+    zseek_writer_param_t *zwp, const zseek_fd_param_t *zfp, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!zwp) {
+        set_error(errbuf, "invalid writer parameters");
+        return NULL;
+    }
+
+    zseek_fd_file_t fd_file;
+    if (!zseek_fd_file_init(&fd_file, fd, zfp, zwp->allocator, errbuf))
+        return NULL;
+
+    // Direct I/O needs the output staged in aligned chunks
+    zseek_writer_param_t zwp_fd = *zwp;
+    if (fd_file.direct) {
+        if (zwp_fd.output_buffer_size == 0)
+            zwp_fd.output_buffer_size = DIRECT_OUTPUT_BUFFER_SIZE;
+        zwp_fd.output_alignment = MAX(zwp_fd.output_alignment ?
+            zwp_fd.output_alignment : OUTPUT_ALIGNMENT, fd_file.alignment);
+    }
+
+    zseek_write_file_t user_file = {&fd_file, zseek_fd_write, zseek_fd_flush};
+    zseek_writer_t *writer = new_writer(user_file, zsp, &zwp_fd,
+        fd_file.direct, call_data, errbuf);
+    if (!writer)
+        return NULL;
+
+    // NOTE: The file lives on the stack only for opening, nothing is written
+    // out before the first write
+    writer->fd_file = fd_file;
+    writer->user_file.user_data = &writer->fd_file;
+
+    return writer;
+}
+
+/**
+ * Free the dictionary and any data buffered for training
+ */
+static void free_dict(zseek_writer_t *writer)
+{
+#ifdef HAVE_LZ4F_DICT
+    LZ4F_freeCDict(writer->cdict_lz4);
+#endif
+    zseek_buffer_free(writer->train);
+    zseek_free(&writer->allocator, writer->train_lens);
+    zseek_free(&writer->allocator, writer->dict);
+}
+
+/**
+ * Write out the block index, between the last frame and the seek table
+ */
+static bool write_block_index(zseek_writer_t *writer, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    size_t nb_blocks = zseek_blog_entries(writer->blog);
+    size_t index_size = ZSEEK_BINDEX_HEADER_SIZE +
+        nb_blocks * ZSEEK_BINDEX_ENTRY_SIZE;
+    size_t cbuf_len = zseek_buffer_capacity(writer->cbuf);
+    cbuf_len = MAX(cbuf_len, MIN(index_size, (size_t)SEEK_TABLE_CHUNK_MAX));
+    if (cbuf_len < 4096)
+        cbuf_len = 4096;
+    if (!zseek_buffer_resize(writer->cbuf, cbuf_len)) {
+        set_error(errbuf, "resize output buffer failed");
+        return false;
+    }
+    uint8_t *cbuf_data = zseek_buffer_data(writer->cbuf);
+    assert(cbuf_data);
+
+    zseek_blog_header(writer->blog, cbuf_data);
+    size_t len = ZSEEK_BINDEX_HEADER_SIZE;
+    size_t first = 0;
+    do {
+        size_t n = zseek_blog_encode(writer->blog, first, cbuf_data + len,
+            cbuf_len - len);
+        first += n;
+        len += n * ZSEEK_BINDEX_ENTRY_SIZE;
+
+        if (!output(writer, cbuf_data, len, call_data)) {
+            // TODO OPT: Use errno if user_file.write sets it
+            set_error(errbuf, "write to file failed");
+            return false;
+        }
+        len = 0;
+    } while (first < nb_blocks);
+
+    return true;
+}
+
+/**
+ * Write out the seek table, after the last frame
+ */
+static bool write_seek_table(zseek_writer_t *writer, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    // NOTE: Frames not made of the expected blocks (never with LZ4F) leave
+    // the file without a block index, read as usual.
+    if (writer->blog && zseek_blog_valid(writer->blog) &&
+        !write_block_index(writer, call_data, errbuf))
+        return false;
+
+    // Write out the whole seek table at once, unless it is too large
+    size_t cbuf_len = zseek_buffer_capacity(writer->cbuf);
+    cbuf_len = MAX(cbuf_len, MIN(framelog_size(writer->fl),
+        (size_t)SEEK_TABLE_CHUNK_MAX));
+    if (cbuf_len < 4096)
+        cbuf_len = 4096;
+    if (!zseek_buffer_resize(writer->cbuf, cbuf_len)) {
+        set_error(errbuf, "resize output buffer failed");
+        return false;
+    }
+    void *cbuf_data = zseek_buffer_data(writer->cbuf);
+    assert(cbuf_data);
+
+    size_t rem = 0;
+    do {
+        ZSTD_outBuffer buffout = {cbuf_data, cbuf_len, 0};
+        rem = ZSTD_seekable_writeSeekTable(writer->fl, &buffout);
+        if (ZSTD_isError(rem)) {
+            set_error(errbuf, "%s: %s", "write seek table",
+                ZSTD_getErrorName(rem));
+            return false;
+        }
+
+        if (!output(writer, buffout.dst, buffout.pos, call_data)) {
+            // TODO OPT: Use errno if user_file.write sets it
+            set_error(errbuf, "write to file failed");
+            return false;
+        }
+    } while (rem > 0);
+
+    if (!flush_output(writer, call_data)) {
+        // TODO OPT: Use errno if user_file.write sets it
+        set_error(errbuf, "write to file failed");
+        return false;
+    }
+
+    // The last write was padded for direct I/O
+    if (writer->fd_file.direct && !zseek_fd_trim(&writer->fd_file)) {
+        set_error_with_errno(errbuf, "truncate file", errno);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Flush, close and write current frame. This will block.
+ */
+static bool end_frame_zstd(zseek_writer_t *writer, void *call_data)
+{
+    // TODO: Communicate error info?
+
+    uint64_t start = writer->adaptive ? monotonic_ns() : 0;
+
+    // Resize output buffer
+    size_t cbuf_len = ZSTD_CStreamOutSize();
+    if (!zseek_buffer_resize(writer->cbuf, cbuf_len)) {
+        // fprintf(stderr, "resize output buffer failed");
+        return false;
+    }
+    void *cbuf_data = zseek_buffer_data(writer->cbuf);
+    assert(cbuf_data);
+
+    ZSTD_inBuffer buffin = {NULL, 0, 0};
+    size_t rem = 0;
+    do {
+        // Flush and end frame
+        ZSTD_outBuffer buffout = {cbuf_data, cbuf_len, 0};
+        rem = ZSTD_compressStream2(writer->cctx_zstd, &buffout, &buffin,
+            ZSTD_e_end);
+        if (ZSTD_isError(rem)) {
+            // fprintf(stderr, "compress: %s\n", ZSTD_getErrorName(rem));
+            return false;
+        }
+
+        // Update current frame compressed bytes
+        writer->frame_cm += buffout.pos;
+
+        // Write output
+        if (!output(writer, buffout.dst, buffout.pos, call_data)) {
+
+            // TODO OPT: Use errno if user_file.write sets it
+            // fprintf(stderr, "write to file failed");
+            return false;
+        }
+    } while (rem > 0);
+
+    if (writer->adaptive)
+        writer->frame_ns += monotonic_ns() - start;
+
+    // Log frame
+    size_t r = ZSTD_seekable_logFrame(writer->fl, writer->frame_cm,
+        writer->frame_uc, 0);
+    if (ZSTD_isError(r)) {
+        // fprintf(stderr, "log frame: %s\n", ZSTD_getErrorName(r));
+        return false;
+    }
+
+    if (!log_level(writer, writer->level)) {
+        // fprintf(stderr, "log level failed");
+        return false;
+    }
+
+    adapt_frame_size(writer);
+    adapt_level(writer);
+
+    // Reset current frame bytes
+    writer->total_cm += writer->frame_cm;
+    writer->frame_uc = 0;
+    writer->frame_cm = 0;
+
+    return true;
+}
+
+static bool zseek_writer_close_zstd(zseek_writer_t *writer,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    bool is_error = false;
+
+    if (writer->frame_uc > 0) {
+        // End final frame
+        if (!end_frame_zstd(writer, call_data)) {
+            set_error(errbuf, "end_frame_zstd failed");
+            is_error = true;
+        }
+    }
+
+    // Write seek table
+    if (!write_seek_table(writer, call_data, is_error ? NULL : errbuf))
+        is_error = true;
+
+    zseek_buffer_free(writer->cbuf);
+    zseek_stage_free(writer->stage);
+    zseek_blog_free(writer->blog);
+
+    size_t r = ZSTD_seekable_freeFrameLog(writer->fl);
+    if (ZSTD_isError(r) && !is_error) {
+        set_error(errbuf, "%s: %s", "free frame log", ZSTD_getErrorName(r));
+        is_error = true;
+    }
+
+    r = ZSTD_freeCCtx(writer->cctx_zstd);
+    if (ZSTD_isError(r) && !is_error) {
+        set_error(errbuf, "%s: %s", "free context", ZSTD_getErrorName(r));
+        is_error = true;
+    }
+
+    free_dict(writer);
+    zseek_free(&writer->allocator, writer->levels);
+    free_writer(writer);
+
+    return !is_error;
+}
+
+/**
+ * Write out @p len bytes of compressed data from the output buffer
+ */
+static bool output_lz4(zseek_writer_t *writer, size_t len, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    writer->frame_cm += len;
+
+    if (!output(writer, zseek_buffer_data(writer->cbuf), len, call_data)) {
+        // TODO OPT: Use errno if user_file.write sets it
+        set_error(errbuf, "write to file failed");
+        return false;
+    }
+
+    if (writer->blog &&
+        !zseek_blog_feed(writer->blog, zseek_buffer_data(writer->cbuf), len)) {
+        set_error(errbuf, "log blocks failed");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Compress @p len bytes into the current frame, starting one if needed.
+ * Compressed data is written out as soon as LZ4F produces it.
+ */
+static bool stream_lz4(zseek_writer_t *writer, const void *buf, size_t len,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    uint64_t start = writer->adaptive ? monotonic_ns() : 0;
+
+    if (writer->frame_cm == 0) {
+        // Start frame
+        if (!zseek_buffer_resize(writer->cbuf, LZ4F_HEADER_SIZE_MAX)) {
+            set_error(errbuf, "resize output buffer failed");
+            return false;
+        }
+        size_t r = begin_frame_lz4(writer, writer->cctx_lz4,
+            zseek_buffer_data(writer->cbuf), LZ4F_HEADER_SIZE_MAX,
+            &writer->preferences);
+        if (LZ4F_isError(r)) {
+            set_error(errbuf, "%s: %s", "begin frame", LZ4F_getErrorName(r));
+            return false;
+        }
+        if (!output_lz4(writer, r, call_data, errbuf))
+            return false;
+    }
+
+    // Resize output buffer
+    size_t cbuf_len = LZ4F_compressBound(len, &writer->preferences);
+    if (!zseek_buffer_resize(writer->cbuf, cbuf_len)) {
+        set_error(errbuf, "resize output buffer failed");
+        return false;
+    }
+
+    // NOTE: LZ4F compresses whole blocks straight from buf and only copies
+    // the remainder internally, up to a block.
+    size_t r = LZ4F_compressUpdate(writer->cctx_lz4,
+        zseek_buffer_data(writer->cbuf), cbuf_len, buf, len, NULL);
+    if (LZ4F_isError(r)) {
+        set_error(errbuf, "%s: %s", "compress", LZ4F_getErrorName(r));
+        return false;
+    }
+    writer->frame_uc += len;
+
+    if (r > 0 && !output_lz4(writer, r, call_data, errbuf))
+        return false;
+
+    if (writer->adaptive)
+        writer->frame_ns += monotonic_ns() - start;
+
+    return true;
+}
+
+/**
+ * Flush, close and write current frame. This will block.
+ */
+static bool end_frame_lz4(zseek_writer_t *writer, void *call_data)
+{
+    // TODO: Communicate error info?
+
+    uint64_t start = writer->adaptive ? monotonic_ns() : 0;
+
+    // Resize output buffer
+    size_t cbuf_len = LZ4F_compressBound(0, &writer->preferences);
+    if (!zseek_buffer_resize(writer->cbuf, cbuf_len)) {
+        // fprintf(stderr, "resize output buffer failed");
+        return false;
+    }
+
+    // Flush and end frame
+    size_t r = LZ4F_compressEnd(writer->cctx_lz4,
+        zseek_buffer_data(writer->cbuf), cbuf_len, NULL);
+    if (LZ4F_isError(r)) {
+        // fprintf(stderr, "%s: %s", "compress", LZ4F_getErrorName(r));
+        return false;
+    }
+
+    // Write output
+    if (!output_lz4(writer, r, call_data, NULL))
+        return false;
+
+    if (writer->adaptive)
+        writer->frame_ns += monotonic_ns() - start;
+
+    // Log frame
+    r = ZSTD_seekable_logFrame(writer->fl, writer->frame_cm, writer->frame_uc,
+        0);
+    if (ZSTD_isError(r)) {
+        // fprintf(stderr, "log frame: %s\n", ZSTD_getErrorName(r));
+        return false;
+    }
+
+    if (!log_level(writer, writer->level)) {
+        // fprintf(stderr, "log level failed");
+        return false;
+    }
+
+    if (writer->blog)
+        zseek_blog_end_frame(writer->blog, writer->frame_uc);
+
+    adapt_frame_size(writer);
+    adapt_level(writer);
+
+    // Reset counters
+    writer->total_cm += writer->frame_cm;
+    writer->frame_uc = 0;
+    writer->frame_cm = 0;
+
+    return true;
+}
+
+static bool zseek_writer_close_lz4(zseek_writer_t *writer,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    bool is_error = false;
+
+    if (writer->frame_uc > 0) {
+        // End final frame
+        if (!end_frame_lz4(writer, call_data)) {
+            set_error(errbuf, "end_frame_lz4 failed");
+            is_error = true;
+        }
+    }
+
+    // Write seek table
+    if (!write_seek_table(writer, call_data, is_error ? NULL : errbuf))
+        is_error = true;
+
+    zseek_buffer_free(writer->cbuf);
+    zseek_stage_free(writer->stage);
+    zseek_blog_free(writer->blog);
+
+    size_t r = ZSTD_seekable_freeFrameLog(writer->fl);
+    if (ZSTD_isError(r) && !is_error) {
+        set_error(errbuf, "%s: %s", "free frame log", ZSTD_getErrorName(r));
+        is_error = true;
+    }
+
+    LZ4F_errorCode_t lr = LZ4F_freeCompressionContext(writer->cctx_lz4);
+    if (LZ4F_isError(lr) && !is_error) {
+        set_error(errbuf, "%s: %s", "free context", LZ4F_getErrorName(lr));
+        is_error = true;
+    }
+
+    free_dict(writer);
+    zseek_free(&writer->allocator, writer->levels);
+    free_writer(writer);
+
+    return !is_error;
+}
+
+/**
+ * Write out and log the compressed frames at the head of the pool, in order.
+ * If @p wait is true, block until all submitted frames are written out.
+ */
+static bool retire_frames_pool(zseek_writer_t *writer, bool wait,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (writer->async) {
+        // The output thread does this in the background
+        if (wait)
+            zseek_cpool_wait(writer->pool, 0);
+        return !zseek_cpool_failed(writer->pool, errbuf);
+    }
+
+    zseek_cjob_t *job;
+    while ((job = zseek_cpool_head(writer->pool, wait))) {
+        if (!output_frame_pool(writer, job, call_data, errbuf))
+            return false;
+        zseek_cpool_pop(writer->pool);
+    }
+
+    return true;
+}
+
+/**
+ * Queue the current frame for compression
+ */
+static void end_frame_pool(zseek_writer_t *writer)
+{
+    writer->job->level = writer->level;
+    adapt_level(writer);
+    zseek_cpool_submit(writer->pool, writer->job);
+    writer->job = NULL;
+    writer->frame_uc = 0;
+}
+
+static bool zseek_writer_close_pool(zseek_writer_t *writer,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
     bool is_error = false;
 
-    if (writer->frame_uc > 0) {
+    if (writer->job && writer->frame_uc > 0) {
         // End final frame
+        end_frame_pool(writer);
+    }
+
+    // Write out all frames in flight
+    if (!retire_frames_pool(writer, true, call_data, errbuf))
+        is_error = true;
+
+    // Write seek table
+    if (!is_error && !write_seek_table(writer, call_data, errbuf))
+        is_error = true;
+
+    zseek_cpool_free(writer->pool);
+
+    if (!free_wctxs(writer, writer->wctxs, writer->nb_wctxs,
+        is_error ? NULL : errbuf))
+        is_error = true;
+
+    pthread_mutex_destroy(&writer->lock);
+
+    zseek_buffer_free(writer->cbuf);
+    zseek_stage_free(writer->stage);
+    zseek_blog_free(writer->blog);
+
+    size_t r = ZSTD_seekable_freeFrameLog(writer->fl);
+    if (ZSTD_isError(r) && !is_error) {
+        set_error(errbuf, "%s: %s", "free frame log", ZSTD_getErrorName(r));
+        is_error = true;
+    }
+
+    free_dict(writer);
+    zseek_free(&writer->allocator, writer->levels);
+    free_writer(writer);
+
+    return !is_error;
+}
+
+static bool start_dict(zseek_writer_t *writer, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE]);
+
+bool zseek_writer_close(zseek_writer_t *writer,  void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!writer)
+        return true;
+
+    // Train on what is buffered, if need be, but close anyway
+    bool is_error = writer->dict_pending && !start_dict(writer, call_data,
+        errbuf);
+    if (is_error)
+        errbuf = NULL;
+
+    bool closed;
+    if (writer->pool) {
+        closed = zseek_writer_close_pool(writer, call_data, errbuf);
+    } else {
+        switch (writer->type) {
+        case ZSEEK_ZSTD:
+            closed = zseek_writer_close_zstd(writer, call_data, errbuf);
+            break;
+        case ZSEEK_LZ4:
+            closed = zseek_writer_close_lz4(writer, call_data, errbuf);
+            break;
+        default:
+            // BUG
+            assert(false);
+            closed = false;
+            break;
+        }
+    }
+
+    return closed && !is_error;
+}
+
+/**
+ * End the current frame, if it is due, before more data is written
+ */
+static bool start_write_zstd(zseek_writer_t *writer, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (writer->frame_uc >= writer->min_frame_size) {
+        // End current frame
+        // NOTE: This blocks, flushing data dispatched for compression in
+        // previous calls.
+        if (!end_frame_zstd(writer, call_data)) {
+            set_error(errbuf, "end_frame_zstd failed");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Dispatch @p len bytes for compression into the current frame
+ */
+static bool stream_zstd(zseek_writer_t *writer, const void *buf, size_t len,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    uint64_t start = writer->adaptive ? monotonic_ns() : 0;
+
+    // Resize output buffer
+    size_t cbuf_len = ZSTD_CStreamOutSize();    // TODO OPT: Tune this according to input len? (see ZSTD_compressBound)
+    if (!zseek_buffer_resize(writer->cbuf, cbuf_len)) {
+        set_error(errbuf, "resize output buffer failed");
+        return false;
+    }
+    void *cbuf_data = zseek_buffer_data(writer->cbuf);
+    assert(cbuf_data);
+
+    ZSTD_inBuffer buffin = {buf, len, 0};
+    do {
+        // Dispatch for compression
+        ZSTD_outBuffer buffout = {cbuf_data, cbuf_len, 0};
+        size_t rem = ZSTD_compressStream2(writer->cctx_zstd, &buffout, &buffin,
+            ZSTD_e_continue);
+        if (ZSTD_isError(rem)) {
+            set_error(errbuf, "%s: %s", "compress", ZSTD_getErrorName(rem));
+            return false;
+        }
+
+        // Update current frame compressed bytes
+        writer->frame_cm += buffout.pos;
+
+        // Write output
+        if (!output(writer, buffout.dst, buffout.pos, call_data)) {
+            // TODO OPT: Use errno if user_file.write sets it
+            set_error(errbuf, "write to file failed");
+            return false;
+        }
+    } while (buffin.pos < buffin.size);
+
+    // Update current frame uncompresed bytes
+    writer->frame_uc += len;
+
+    if (writer->adaptive)
+        writer->frame_ns += monotonic_ns() - start;
+
+    return true;
+}
+
+static bool zseek_write_zstd(zseek_writer_t *writer, const void *buf,
+    size_t len, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!start_write_zstd(writer, call_data, errbuf))
+        return false;
+
+    return stream_zstd(writer, buf, len, call_data, errbuf);
+}
+
+static bool zseek_writev_zstd(zseek_writer_t *writer, const struct iovec *iov,
+    int iovcnt, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!start_write_zstd(writer, call_data, errbuf))
+        return false;
+
+    // Feed each segment to the same frame, so that a record is never split
+    for (int i = 0; i < iovcnt; i++) {
+        if (!stream_zstd(writer, iov[i].iov_base, iov[i].iov_len, call_data,
+            errbuf))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * End the current frame, if it is due, after data has been written
+ */
+static bool finish_write_lz4(zseek_writer_t *writer, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (writer->frame_uc >= writer->min_frame_size) {
+        // End current frame
+        if (!end_frame_lz4(writer, call_data)) {
+            set_error(errbuf, "end_frame_lz4 failed");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool zseek_write_lz4(zseek_writer_t *writer, const void *buf, size_t len,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (len > 0 && !stream_lz4(writer, buf, len, call_data, errbuf))
+        return false;
+
+    return finish_write_lz4(writer, call_data, errbuf);
+}
+
+static bool zseek_writev_lz4(zseek_writer_t *writer, const struct iovec *iov,
+    int iovcnt, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    // Feed each segment to the same frame, so that a record is never split
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > 0 && !stream_lz4(writer, iov[i].iov_base,
+            iov[i].iov_len, call_data, errbuf))
+            return false;
+    }
+
+    return finish_write_lz4(writer, call_data, errbuf);
+}
+
+/**
+ * Acquire a new frame to fill, making room for it if all frames are in flight
+ */
+static bool start_frame_pool(zseek_writer_t *writer, bool may_fail,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (writer->adaptive) {
+        pthread_mutex_lock(&writer->lock);
+        writer->min_frame_size = zseek_fsctl_size(&writer->fsctl);
+        pthread_mutex_unlock(&writer->lock);
+    }
+
+    if (!writer->async) {
+        while (!(writer->job = zseek_cpool_acquire(writer->pool, false))) {
+            // NOTE: This blocks until the oldest frame is compressed, while
+            // the rest are still being compressed by the other workers.
+            zseek_cpool_head(writer->pool, true);
+            if (!retire_frames_pool(writer, false, call_data, errbuf))
+                return false;
+        }
+        return true;
+    }
+
+    switch (writer->backpressure) {
+    case ZSEEK_BACKPRESSURE_BLOCK:
+        writer->job = zseek_cpool_acquire(writer->pool, true);
+        break;
+    case ZSEEK_BACKPRESSURE_FAIL:
+        // Wait instead, if part of the write has been consumed already
+        writer->job = zseek_cpool_acquire(writer->pool, !may_fail);
+        break;
+    case ZSEEK_BACKPRESSURE_GROW:
+        writer->job = zseek_cpool_acquire(writer->pool, false);
+        if (!writer->job && !zseek_cpool_grow(writer->pool)) {
+            set_error(errbuf, "grow write queue failed");
+            return false;
+        }
+        if (!writer->job)
+            writer->job = zseek_cpool_acquire(writer->pool, false);
+        break;
+    default:
+        // BUG
+        assert(false);
+        break;
+    }
+    if (!writer->job) {
+        set_error(errbuf, "write queue full");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Make room in the queue for @p len more bytes, as per the backpressure policy
+ */
+static bool reserve_queue(zseek_writer_t *writer, size_t len,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    size_t pending = zseek_cpool_pending_size(writer->pool);
+    // Always accept data if nothing is in flight, as nothing could drain
+    if (pending == 0 || pending + writer->frame_uc + len <=
+        writer->max_queued_size)
+        return true;
+
+    switch (writer->backpressure) {
+    case ZSEEK_BACKPRESSURE_BLOCK: {
+        // NOTE: Only frames in flight can drain, not the one being filled
+        size_t reserved = writer->frame_uc + len;
+        size_t target = writer->max_queued_size > reserved ?
+            writer->max_queued_size - reserved : 0;
+        zseek_cpool_wait(writer->pool, target);
+        return true;
+    }
+    case ZSEEK_BACKPRESSURE_FAIL:
+        set_error(errbuf, "write queue full");
+        return false;
+    case ZSEEK_BACKPRESSURE_GROW:
+        return true;
+    default:
+        // BUG
+        assert(false);
+        return false;
+    }
+}
+
+/**
+ * Make room for a write of @p len bytes to the frame being filled
+ */
+static bool start_write_pool(zseek_writer_t *writer, size_t len,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    // Report background errors as early as possible
+    if (writer->async && zseek_cpool_failed(writer->pool, errbuf))
+        return false;
+
+    if (!writer->job && !start_frame_pool(writer, true, call_data, errbuf))
+        return false;
+
+    if (writer->async && !reserve_queue(writer, len, errbuf))
+        return false;
+
+    // Reserve the whole write up front, so that it is buffered in full or not
+    // at all
+    if (!zseek_buffer_reserve(writer->job->ubuf, writer->frame_uc + len)) {
+        set_error(errbuf, "failed to buffer uncompressed data");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Queue the frame being filled if it is due, and write out compressed frames
+ */
+static bool finish_write_pool(zseek_writer_t *writer, size_t len,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    writer->frame_uc += len;
+
+    if (writer->frame_uc >= writer->min_frame_size)
+        end_frame_pool(writer);
+
+    // Write out any frames already compressed, without waiting
+    return retire_frames_pool(writer, false, call_data, errbuf);
+}
+
+static bool zseek_write_pool(zseek_writer_t *writer, const void *buf,
+    size_t len, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!start_write_pool(writer, len, call_data, errbuf))
+        return false;
+
+    // Buffer uncompressed data (does not fail, having reserved it)
+    zseek_buffer_push(writer->job->ubuf, buf, len);
+
+    return finish_write_pool(writer, len, call_data, errbuf);
+}
+
+static bool zseek_writev_pool(zseek_writer_t *writer, const struct iovec *iov,
+    int iovcnt, size_t len, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!start_write_pool(writer, len, call_data, errbuf))
+        return false;
+
+    // NOTE: A whole frame is compressed at once by a worker, after this call
+    // has returned, so each segment is gathered straight into the frame.
+    for (int i = 0; i < iovcnt; i++)
+        zseek_buffer_push(writer->job->ubuf, iov[i].iov_base, iov[i].iov_len);
+
+    return finish_write_pool(writer, len, call_data, errbuf);
+}
+
+/**
+ * Append @p len bytes to the current frame, which must not end
+ */
+static bool feed_frame(zseek_writer_t *writer, const void *buf, size_t len,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (writer->pool) {
+        if (!writer->job && !start_frame_pool(writer, false, call_data,
+            errbuf))
+            return false;
+        if (!zseek_buffer_push(writer->job->ubuf, buf, len)) {
+            set_error(errbuf, "failed to buffer uncompressed data");
+            return false;
+        }
+        writer->frame_uc += len;
+        return true;
+    }
+
+    switch (writer->type) {
+    case ZSEEK_ZSTD:
+        return stream_zstd(writer, buf, len, call_data, errbuf);
+    case ZSEEK_LZ4:
+        return stream_lz4(writer, buf, len, call_data, errbuf);
+    default:
+        // BUG
+        assert(false);
+        return false;
+    }
+}
+
+/**
+ * End the current frame, whatever the writer mode
+ */
+static bool end_frame(zseek_writer_t *writer, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (writer->pool) {
+        end_frame_pool(writer);
+        // Write out any frames already compressed, without waiting
+        return retire_frames_pool(writer, false, call_data, errbuf);
+    }
+
+    switch (writer->type) {
+    case ZSEEK_ZSTD:
+        if (!end_frame_zstd(writer, call_data)) {
+            set_error(errbuf, "end_frame_zstd failed");
+            return false;
+        }
+        return true;
+    case ZSEEK_LZ4:
         if (!end_frame_lz4(writer, call_data)) {
             set_error(errbuf, "end_frame_lz4 failed");
-            is_error = true;
+            return false;
         }
+        return true;
+    default:
+        // BUG
+        assert(false);
+        return false;
     }
+}
 
-    size_t cbuf_len = zseek_buffer_capacity(writer->cbuf);
-    if (cbuf_len < 4096)
-        cbuf_len = 4096;
-    if (!zseek_buffer_resize(writer->cbuf, cbuf_len) && !is_error) {
-        set_error(errbuf, "resize output buffer failed");
-        is_error = true;
-    }
-    void *cbuf_data = zseek_buffer_data(writer->cbuf);
-    assert(cbuf_data);
+/**
+ * Make room for a write of @p len bytes, with content-defined frames
+ */
+static bool start_write_cdc(zseek_writer_t *writer, size_t len,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!writer->pool)
+        return true;
 
-    // Write seek table
-    size_t rem = 0;
-    do {
-        ZSTD_outBuffer buffout = {cbuf_data, cbuf_len, 0};
-        rem = ZSTD_seekable_writeSeekTable(writer->fl, &buffout);
-        if (ZSTD_isError(rem) && !is_error) {
-            set_error(errbuf, "%s: %s", "write seek table",
-                ZSTD_getErrorName(rem));
-            is_error = true;
-        }
+    // Report background errors as early as possible
+    if (writer->async && zseek_cpool_failed(writer->pool, errbuf))
+        return false;
 
-        bool written = writer->user_file.write(buffout.dst, buffout.pos,
-            writer->user_file.user_data, call_data);
-        if (!written && !is_error) {
-            // TODO OPT: Use errno if user_file.write sets it
-            set_error(errbuf, "write to file failed");
-            is_error = true;
-        }
-    } while (rem > 0);
+    // Fail, if at all, before consuming any data
+    if (!writer->job && !start_frame_pool(writer, true, call_data, errbuf))
+        return false;
 
-    zseek_buffer_free(writer->cbuf);
+    return !writer->async || reserve_queue(writer, len, errbuf);
+}
 
-    size_t r = ZSTD_seekable_freeFrameLog(writer->fl);
-    if (ZSTD_isError(r) && !is_error) {
-        set_error(errbuf, "%s: %s", "free frame log", ZSTD_getErrorName(r));
-        is_error = true;
+/**
+ * Append @p len bytes, ending frames at the cut points found in them
+ */
+static bool write_cdc(zseek_writer_t *writer, const void *buf, size_t len,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    const uint8_t *data = buf;
+    while (len > 0) {
+        bool cut;
+        size_t n = zseek_cdc_next(&writer->cdc, data, len, &cut);
+        if (!feed_frame(writer, data, n, call_data, errbuf))
+            return false;
+        if (cut && !end_frame(writer, call_data, errbuf))
+            return false;
+        data += n;
+        len -= n;
     }
 
-    zseek_buffer_free(writer->ubuf);
+    return true;
+}
+
+static bool write_buf(zseek_writer_t *writer, const void *buf, size_t len,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (writer->content_defined) {
+        return start_write_cdc(writer, len, call_data, errbuf) &&
+            write_cdc(writer, buf, len, call_data, errbuf);
+    }
 
-    free(writer);
+    if (writer->pool)
+        return zseek_write_pool(writer, buf, len, call_data, errbuf);
 
-    return !is_error;
+    switch (writer->type) {
+    case ZSEEK_ZSTD:
+        return zseek_write_zstd(writer, buf, len, call_data, errbuf);
+    case ZSEEK_LZ4:
+        return zseek_write_lz4(writer, buf, len, call_data, errbuf);
+    default:
+        // BUG
+        assert(false);
+        return false;
+    }
 }
 
-bool zseek_writer_close(zseek_writer_t *writer,  void *call_data,
-    char errbuf[ZSEEK_ERRBUF_SIZE])
+static bool write_iov(zseek_writer_t *writer, const struct iovec *iov,
+    int iovcnt, size_t len, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
 {
-    if (!writer)
+    if (writer->content_defined) {
+        if (!start_write_cdc(writer, len, call_data, errbuf))
+            return false;
+        for (int i = 0; i < iovcnt; i++) {
+            if (!write_cdc(writer, iov[i].iov_base, iov[i].iov_len, call_data,
+                errbuf))
+                return false;
+        }
         return true;
+    }
+
+    if (writer->pool)
+        return zseek_writev_pool(writer, iov, iovcnt, len, call_data, errbuf);
 
     switch (writer->type) {
     case ZSEEK_ZSTD:
-        return zseek_writer_close_zstd(writer, call_data, errbuf);
+        return zseek_writev_zstd(writer, iov, iovcnt, call_data, errbuf);
     case ZSEEK_LZ4:
-        return zseek_writer_close_lz4(writer, call_data, errbuf);
+        return zseek_writev_lz4(writer, iov, iovcnt, call_data, errbuf);
     default:
         // BUG
         assert(false);
@@ -516,156 +2059,330 @@ bool zseek_writer_close(zseek_writer_t *writer,  void *call_data,
     }
 }
 
-static bool zseek_write_zstd(zseek_writer_t *writer, const void *buf,
-    size_t len, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+/**
+ * Load the dictionary into the compression contexts
+ */
+static bool load_dict(zseek_writer_t *writer, char errbuf[ZSEEK_ERRBUF_SIZE])
 {
-    if (writer->frame_uc >= writer->min_frame_size) {
-        // End current frame
-        // NOTE: This blocks, flushing data dispatched for compression in
-        // previous calls.
-        if (!end_frame_zstd(writer, call_data)) {
-            set_error(errbuf, "end_frame_zstd failed");
+    if (writer->type == ZSEEK_LZ4) {
+#ifdef HAVE_LZ4F_DICT
+#ifdef HAVE_LZ4F_CUSTOMMEM
+        LZ4F_CustomMem cmem = {zseek_mem_alloc, NULL, zseek_mem_free,
+            &writer->allocator};
+        writer->cdict_lz4 = LZ4F_createCDict_advanced(cmem, writer->dict,
+            writer->dict_size);
+#else
+        writer->cdict_lz4 = LZ4F_createCDict(writer->dict, writer->dict_size);
+#endif
+        if (!writer->cdict_lz4) {
+            set_error(errbuf, "dictionary creation failed");
             return false;
         }
+        return true;
+#else
+        // BUG: Rejected at open
+        assert(false);
+        return false;
+#endif
     }
 
-    // Resize output buffer
-    size_t cbuf_len = ZSTD_CStreamOutSize();    // TODO OPT: Tune this according to input len? (see ZSTD_compressBound)
-    if (!zseek_buffer_resize(writer->cbuf, cbuf_len)) {
-        set_error(errbuf, "resize output buffer failed");
+    // NOTE: Loaded into each context, rather than shared as a CDict, since a
+    // CDict would impose its compression level on every frame.
+    int nb_cctxs = writer->pool ? writer->nb_wctxs : 1;
+    for (int i = 0; i < nb_cctxs; i++) {
+        ZSTD_CCtx *cctx = writer->pool ? writer->wctxs[i] : writer->cctx_zstd;
+        size_t r = ZSTD_CCtx_loadDictionary(cctx, writer->dict,
+            writer->dict_size);
+        if (ZSTD_isError(r)) {
+            set_error(errbuf, "%s: %s", "load dictionary",
+                ZSTD_getErrorName(r));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Write out the dictionary in a skippable frame, logged as an empty one, so
+ * that readers find it at the start of the file
+ */
+static bool write_dict(zseek_writer_t *writer, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    uint8_t header[ZSEEK_DICT_HEADER_SIZE];
+    zseek_dict_header(header, writer->type, writer->dict_size);
+    if (!output(writer, header, sizeof(header), call_data) ||
+        !output(writer, writer->dict, writer->dict_size, call_data)) {
+        // TODO OPT: Use errno if user_file.write sets it
+        set_error(errbuf, "write to file failed");
         return false;
     }
-    void *cbuf_data = zseek_buffer_data(writer->cbuf);
-    assert(cbuf_data);
 
-    ZSTD_inBuffer buffin = {buf, len, 0};
-    do {
-        // Dispatch for compression
-        ZSTD_outBuffer buffout = {cbuf_data, cbuf_len, 0};
-        size_t rem = ZSTD_compressStream2(writer->cctx_zstd, &buffout, &buffin,
-            ZSTD_e_continue);
-        if (ZSTD_isError(rem)) {
-            set_error(errbuf, "%s: %s", "compress", ZSTD_getErrorName(rem));
+    // Log frame
+    size_t csize = sizeof(header) + writer->dict_size;
+    if (writer->pool)
+        pthread_mutex_lock(&writer->lock);
+    size_t r = ZSTD_seekable_logFrame(writer->fl, csize, 0, 0);
+    if (!ZSTD_isError(r))
+        writer->total_cm += csize;
+    bool level_logged = !ZSTD_isError(r) && log_level(writer, writer->level);
+    bool blocks_logged = log_blocks(writer, NULL, 0, 0);
+    if (writer->pool)
+        pthread_mutex_unlock(&writer->lock);
+    if (ZSTD_isError(r)) {
+        set_error(errbuf, "%s: %s", "log frame", ZSTD_getErrorName(r));
+        return false;
+    }
+    if (!level_logged) {
+        set_error(errbuf, "log level failed");
+        return false;
+    }
+    if (!blocks_logged) {
+        set_error(errbuf, "log blocks failed");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Set up and write out the dictionary, given or trained on the data buffered
+ * so far, then write out that data
+ */
+static bool start_dict(zseek_writer_t *writer, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    writer->dict_pending = false;
+
+    if (writer->train) {
+        writer->dict = zseek_alloc(&writer->allocator, writer->dict_max_size);
+        if (!writer->dict) {
+            set_error_with_errno(errbuf, "allocate dictionary", errno);
             return false;
         }
+        writer->dict_size = zseek_dict_train(writer->dict,
+            writer->dict_max_size, zseek_buffer_data(writer->train),
+            writer->train_lens, writer->nb_train_lens, writer->min_frame_size,
+            &writer->allocator);
+        if (writer->dict_size == 0) {
+            // Compress without a dictionary
+            zseek_free(&writer->allocator, writer->dict);
+            writer->dict = NULL;
+        }
+    }
 
-        // Update current frame compressed bytes
-        writer->frame_cm += buffout.pos;
+    if (writer->dict && (!load_dict(writer, errbuf) ||
+        !write_dict(writer, call_data, errbuf)))
+        return false;
 
-        // Write output
-        if (!writer->user_file.write(buffout.dst, buffout.pos,
-                writer->user_file.user_data, call_data)) {
-            // TODO OPT: Use errno if user_file.write sets it
-            set_error(errbuf, "write to file failed");
+    if (!writer->train)
+        return true;
+
+    // Write out the buffered data, keeping write boundaries
+    // NOTE: Block if need be, as this data has been accepted already.
+    zseek_backpressure_t backpressure = writer->backpressure;
+    writer->backpressure = ZSEEK_BACKPRESSURE_BLOCK;
+    const uint8_t *data = zseek_buffer_data(writer->train);
+    bool ok = true;
+    for (size_t i = 0; ok && i < writer->nb_train_lens; i++) {
+        ok = write_buf(writer, data, writer->train_lens[i], call_data, errbuf);
+        data += writer->train_lens[i];
+    }
+    writer->backpressure = backpressure;
+
+    zseek_buffer_free(writer->train);
+    writer->train = NULL;
+    zseek_free(&writer->allocator, writer->train_lens);
+    writer->train_lens = NULL;
+    writer->nb_train_lens = 0;
+
+    return ok;
+}
+
+/**
+ * Make room to buffer a write of @p len bytes for training
+ */
+static bool reserve_train(zseek_writer_t *writer, size_t len,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (writer->nb_train_lens == writer->train_lens_capacity) {
+        size_t capacity = MAX(2 * writer->train_lens_capacity, (size_t)64);
+        size_t *lens = zseek_realloc(&writer->allocator, writer->train_lens,
+            writer->train_lens_capacity * sizeof(*lens),
+            capacity * sizeof(*lens));
+        if (!lens) {
+            set_error_with_errno(errbuf, "allocate training write sizes",
+                errno);
             return false;
         }
-    } while (buffin.pos < buffin.size);
+        writer->train_lens = lens;
+        writer->train_lens_capacity = capacity;
+    }
 
-    // Update current frame uncompresed bytes
-    writer->frame_uc += len;
+    if (!zseek_buffer_reserve(writer->train,
+        zseek_buffer_size(writer->train) + len)) {
+        set_error(errbuf, "failed to buffer training data");
+        return false;
+    }
+    writer->train_lens[writer->nb_train_lens++] = len;
 
     return true;
 }
 
 /**
- * Compress and write out a whole frame
+ * Train the dictionary once enough data is buffered
  */
-static bool compress_frame_lz4(zseek_writer_t *writer, const void *buf,
-    size_t len, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+static bool finish_write_train(zseek_writer_t *writer, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
 {
-    // Resize output buffer
-    writer->preferences.frameInfo.contentSize = writer->frame_uc;
-    size_t max_cdata_len = LZ4F_compressFrameBound(len, &writer->preferences);
-    if (!zseek_buffer_resize(writer->cbuf, max_cdata_len)) {
-        set_error(errbuf, "failed to resize output buffer");
+    if (zseek_buffer_size(writer->train) < writer->train_size)
+        return true;
+
+    return start_dict(writer, call_data, errbuf);
+}
+
+bool zseek_write(zseek_writer_t *writer, const void *buf, size_t len,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!writer) {
+        set_error(errbuf, "invalid writer");
         return false;
     }
-    void *cbuf_data = zseek_buffer_data(writer->cbuf);
-    assert(cbuf_data);
-    // Compress frame
-    size_t cdata_len = LZ4F_compressFrame(cbuf_data, max_cdata_len, buf, len,
-        &writer->preferences);
-    if (LZ4F_isError(cdata_len)) {
-        set_error(errbuf, "%s: %s", "compress frame",
-            LZ4F_getErrorName(cdata_len));
-        return false;
+
+    if (writer->train) {
+        if (!reserve_train(writer, len, errbuf))
+            return false;
+        // Buffer data (does not fail, having reserved it)
+        zseek_buffer_push(writer->train, buf, len);
+        return finish_write_train(writer, call_data, errbuf);
     }
-    // Correct buffer size (shrinks it, should not fail)
-    assert(zseek_buffer_resize(writer->cbuf, cdata_len));
-    writer->frame_uc += len;
-    writer->frame_cm += cdata_len;
+    if (writer->dict_pending && !start_dict(writer, call_data, errbuf))
+        return false;
 
-    // Write output
-    if (!writer->user_file.write(cbuf_data, cdata_len,
-        writer->user_file.user_data, call_data)) {
+    if (!writer->adaptive_level)
+        return write_buf(writer, buf, len, call_data, errbuf);
 
-        // TODO OPT: Use errno if user_file.write sets it
-        set_error(errbuf, "write to file failed");
+    uint64_t start = monotonic_ns();
+    bool ok = write_buf(writer, buf, len, call_data, errbuf);
+    writer->frame_write_ns += monotonic_ns() - start;
+    writer->frame_writes++;
+
+    return ok;
+}
+
+bool zseek_writev(zseek_writer_t *writer, const struct iovec *iov, int iovcnt,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!writer) {
+        set_error(errbuf, "invalid writer");
         return false;
     }
 
-    // Log frame
-    size_t r = ZSTD_seekable_logFrame(writer->fl, writer->frame_cm,
-        writer->frame_uc, 0);
-    if (ZSTD_isError(r)) {
-        set_error(errbuf, "log frame: %s\n", ZSTD_getErrorName(r));
+    if (iovcnt < 0 || (iovcnt > 0 && !iov)) {
+        set_error(errbuf, "invalid I/O vector");
         return false;
     }
 
-    // Reset buffers and counters
-    writer->total_cm += writer->frame_cm;
-    writer->frame_uc = 0;
-    writer->frame_cm = 0;
-    zseek_buffer_reset(writer->cbuf);
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > SIZE_MAX - len) {
+            set_error(errbuf, "invalid I/O vector");
+            return false;
+        }
+        len += iov[i].iov_len;
+    }
 
-    return true;
+    if (writer->train) {
+        if (!reserve_train(writer, len, errbuf))
+            return false;
+        for (int i = 0; i < iovcnt; i++)
+            zseek_buffer_push(writer->train, iov[i].iov_base, iov[i].iov_len);
+        return finish_write_train(writer, call_data, errbuf);
+    }
+    if (writer->dict_pending && !start_dict(writer, call_data, errbuf))
+        return false;
+
+    if (!writer->adaptive_level)
+        return write_iov(writer, iov, iovcnt, len, call_data, errbuf);
+
+    uint64_t start = monotonic_ns();
+    bool ok = write_iov(writer, iov, iovcnt, len, call_data, errbuf);
+    writer->frame_write_ns += monotonic_ns() - start;
+    writer->frame_writes++;
+
+    return ok;
 }
 
-static bool zseek_write_lz4(zseek_writer_t *writer, const void *buf, size_t len,
-    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+bool zseek_writer_flush(zseek_writer_t *writer, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
 {
-    if (writer->frame_cm == 0 && len >= writer->min_frame_size) {
-        // Compress frame directly from buf, to avoid copying
-        // TODO OPT: Reuse end_frame_lz4 for this
-        return compress_frame_lz4(writer, buf, len, call_data, errbuf);
+    if (!writer) {
+        set_error(errbuf, "invalid writer");
+        return false;
     }
 
-    // Buffer uncompressed data
-    if (!zseek_buffer_push(writer->ubuf, buf, len)) {
-        set_error(errbuf, "failed to buffer uncompressed data");
+    // Train on what is buffered so far, if need be
+    if (writer->dict_pending && !start_dict(writer, call_data, errbuf))
+        return false;
+
+    // End the current frame early
+    if (writer->frame_uc > 0 && !end_frame(writer, call_data, errbuf))
+        return false;
+    if (writer->content_defined)
+        zseek_cdc_reset(&writer->cdc);
+
+    if (writer->pool && !retire_frames_pool(writer, true, call_data, errbuf))
+        return false;
+
+    if (!flush_output(writer, call_data)) {
+        // TODO OPT: Use errno if user_file.write sets it
+        set_error(errbuf, "write to file failed");
         return false;
     }
-    writer->frame_uc += len;
 
-    if (writer->frame_uc >= writer->min_frame_size) {
-        // End current frame
-        if (!end_frame_lz4(writer, call_data)) {
-            set_error(errbuf, "end_frame_lz4 failed");
-            return false;
-        }
+    if (writer->user_file.flush && !writer->user_file.flush(
+        writer->user_file.user_data, call_data)) {
+        // TODO OPT: Use errno if user_file.flush sets it
+        set_error(errbuf, "flush file failed");
+        return false;
     }
 
     return true;
 }
 
-bool zseek_write(zseek_writer_t *writer, const void *buf, size_t len,
-    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+bool zseek_writer_frame_level(zseek_writer_t *writer, size_t frame_idx,
+    int *level, char errbuf[ZSEEK_ERRBUF_SIZE])
 {
     if (!writer) {
         set_error(errbuf, "invalid writer");
         return false;
     }
 
-    switch (writer->type) {
-    case ZSEEK_ZSTD:
-        return zseek_write_zstd(writer, buf, len, call_data, errbuf);
-    case ZSEEK_LZ4:
-        return zseek_write_lz4(writer, buf, len, call_data, errbuf);
-    default:
-        // BUG
-        assert(false);
+    if (!level) {
+        set_error(errbuf, "invalid level pointer");
+        return false;
+    }
+
+    if (writer->pool)
+        pthread_mutex_lock(&writer->lock);
+
+    bool found = frame_idx < framelog_entries(writer->fl);
+    if (found) {
+        // Without adaptation, all frames use the configured level
+        *level = writer->adaptive_level ? writer->levels[frame_idx] :
+            writer->level;
+    }
+
+    if (writer->pool)
+        pthread_mutex_unlock(&writer->lock);
+
+    if (!found) {
+        set_error(errbuf, "frame %zu not written out yet", frame_idx);
         return false;
     }
+
+    return true;
 }
 
 bool zseek_writer_stats(zseek_writer_t *writer, zseek_writer_stats_t *stats,
@@ -681,28 +2398,49 @@ bool zseek_writer_stats(zseek_writer_t *writer, zseek_writer_stats_t *stats,
         return false;
     }
 
-    size_t frames = framelog_entries(writer->fl);
-    if (writer->frame_uc > 0)
-        frames++;
+    if (writer->pool)
+        pthread_mutex_lock(&writer->lock);
 
-    size_t seek_table_size = framelog_size(writer->fl);
-    if (writer->frame_uc > 0) {
-        const size_t SIZE_PER_FRAME = 8; // assume no checksum
-        seek_table_size += SIZE_PER_FRAME;
+    // Frames not logged yet
+    size_t unlogged = writer->frame_uc > 0 ? 1 : 0;
+    if (writer->pool)
+        unlogged += zseek_cpool_pending(writer->pool);
+
+    size_t frames = framelog_entries(writer->fl) + unlogged;
+
+    const size_t SIZE_PER_FRAME = 8; // assume no checksum
+    size_t seek_table_size = framelog_size(writer->fl) +
+        unlogged * SIZE_PER_FRAME;
+    if (writer->blog) {
+        // Also assume the unlogged frames have no blocks
+        seek_table_size += ZSEEK_BINDEX_HEADER_SIZE +
+            zseek_blog_entries(writer->blog) * ZSEEK_BINDEX_ENTRY_SIZE;
     }
 
     size_t seek_table_memory = framelog_memory_usage(writer->fl);
+    if (writer->blog)
+        seek_table_memory += zseek_blog_memory_usage(writer->blog);
+
+    size_t frame_size = writer->adaptive ?
+        zseek_fsctl_size(&writer->fsctl) : writer->min_frame_size;
 
     // NOTE: This is an _estimate_ because frame_cm is <= final frame size,
     // since there may be still data to flush from the compressor.
     size_t compressed_size = writer->total_cm + writer->frame_cm +
         seek_table_size;
 
+    if (writer->pool)
+        pthread_mutex_unlock(&writer->lock);
+
     // NOTE: This is an _estimate_ because the underlying compression lib may
     // buffer too in its context object.
     size_t buffer_size = zseek_buffer_capacity(writer->cbuf);
-    if (writer->type == ZSEEK_LZ4)
-        buffer_size += zseek_buffer_capacity(writer->ubuf);
+    if (writer->stage)
+        buffer_size += zseek_stage_size(writer->stage);
+    if (writer->pool)
+        buffer_size += zseek_cpool_memory_usage(writer->pool);
+    if (writer->train)
+        buffer_size += zseek_buffer_capacity(writer->train);
 
     *stats = (zseek_writer_stats_t) {
         .seek_table_size = seek_table_size,
@@ -710,6 +2448,8 @@ bool zseek_writer_stats(zseek_writer_t *writer, zseek_writer_stats_t *stats,
         .frames = frames,
         .compressed_size = compressed_size,
         .buffer_size = buffer_size,
+        .frame_size = frame_size,
+        .compression_level = writer->level,
     };
 
     return true;
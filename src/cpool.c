@@ -0,0 +1,464 @@
+#include <string.h>     // memset, memcpy
+#include <pthread.h>    // pthread_*
+#include <assert.h>     // assert
+
+#include "cpool.h"
+#include "common.h"
+#include "alloc.h"
+
+struct zseek_cslot {
+    zseek_cjob_t job;   // must be first, see zseek_cpool_submit
+    bool done;
+    size_t memory;      // heap allocation of job, as of its last use
+};
+typedef struct zseek_cslot zseek_cslot_t;
+
+struct zseek_cworker {
+    zseek_cpool_t *pool;
+    void *data;
+    pthread_t tid;
+};
+typedef struct zseek_cworker zseek_cworker_t;
+
+struct zseek_cpool {
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;   // signaled on submit and stop
+    pthread_cond_t done_cond;   // signaled on job completion and stop
+    pthread_cond_t pop_cond;    // signaled on pop
+
+    zseek_cworker_t *workers;
+    int nb_workers;
+    zseek_cpool_compress_t compress;
+    zseek_cpool_output_t output;
+    pthread_t output_tid;
+    void *user_data;
+    const zseek_allocator_t *allocator;
+    bool stop;
+
+    bool failed;
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+
+    // Ring of jobs, indexed by sequence number modulo capacity:
+    // [head, taken): being compressed or done
+    // [taken, submitted): queued for compression
+    // [submitted, acquired): being filled by the producer
+    zseek_cslot_t **slots;
+    size_t capacity;
+    size_t head;
+    size_t taken;
+    size_t submitted;
+    size_t acquired;
+    size_t pending_size;    // uncompressed bytes in [head, submitted)
+};
+
+static size_t slot_memory(const zseek_cslot_t *slot)
+{
+    return sizeof(*slot) + zseek_buffer_capacity(slot->job.ubuf) +
+        zseek_buffer_capacity(slot->job.cbuf);
+}
+
+static zseek_cslot_t *slot_new(const zseek_allocator_t *allocator)
+{
+    zseek_cslot_t *slot = zseek_alloc(allocator, sizeof(*slot));
+    if (!slot)
+        goto fail;
+    memset(slot, 0, sizeof(*slot));
+
+    slot->job.ubuf = zseek_buffer_new(0, allocator);
+    if (!slot->job.ubuf)
+        goto fail_w_slot;
+    slot->job.cbuf = zseek_buffer_new(0, allocator);
+    if (!slot->job.cbuf)
+        goto fail_w_ubuf;
+    slot->memory = slot_memory(slot);
+
+    return slot;
+
+fail_w_ubuf:
+    zseek_buffer_free(slot->job.ubuf);
+fail_w_slot:
+    zseek_free(allocator, slot);
+fail:
+    return NULL;
+}
+
+static void slot_free(const zseek_allocator_t *allocator, zseek_cslot_t *slot)
+{
+    if (!slot)
+        return;
+
+    zseek_buffer_free(slot->job.ubuf);
+    zseek_buffer_free(slot->job.cbuf);
+    zseek_free(allocator, slot);
+}
+
+/**
+ * Release the head job. Called with the lock held.
+ */
+static void pop_locked(zseek_cpool_t *pool)
+{
+    zseek_cslot_t *slot = pool->slots[pool->head % pool->capacity];
+    assert(slot->done);
+
+    pool->pending_size -= zseek_buffer_size(slot->job.ubuf);
+    slot->done = false;
+    slot->job.failed = false;
+    zseek_buffer_reset(slot->job.ubuf);
+    zseek_buffer_reset(slot->job.cbuf);
+    pool->head++;
+
+    pthread_cond_broadcast(&pool->pop_cond);
+}
+
+static void *worker_main(void *arg)
+{
+    zseek_cworker_t *worker = arg;
+    zseek_cpool_t *pool = worker->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->taken == pool->submitted)
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        if (pool->stop)
+            break;
+
+        zseek_cslot_t *slot = pool->slots[pool->taken % pool->capacity];
+        pool->taken++;
+        pthread_mutex_unlock(&pool->lock);
+
+        uint64_t start = monotonic_ns();
+        slot->job.failed = !pool->compress(&slot->job, worker->data,
+            pool->user_data);
+        slot->job.compress_ns = monotonic_ns() - start;
+
+        pthread_mutex_lock(&pool->lock);
+        slot->done = true;
+        slot->memory = slot_memory(slot);
+        pthread_cond_broadcast(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static void *output_main(void *arg)
+{
+    zseek_cpool_t *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        zseek_cslot_t *slot = NULL;
+        while (!pool->stop) {
+            if (pool->head < pool->submitted) {
+                slot = pool->slots[pool->head % pool->capacity];
+                if (slot->done)
+                    break;
+            }
+            slot = NULL;
+            pthread_cond_wait(&pool->done_cond, &pool->lock);
+        }
+        if (!slot)
+            break;
+
+        bool failed = pool->failed;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (!failed && !slot->job.failed)
+            slot->job.failed = !pool->output(&slot->job, pool->user_data);
+
+        pthread_mutex_lock(&pool->lock);
+        if (slot->job.failed && !pool->failed) {
+            pool->failed = true;
+            memcpy(pool->errbuf, slot->job.errbuf, sizeof(pool->errbuf));
+        }
+        pop_locked(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static void stop_threads(zseek_cpool_t *pool, int nb_started, bool output)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_cond_broadcast(&pool->done_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < nb_started; i++)
+        pthread_join(pool->workers[i].tid, NULL);
+    if (output)
+        pthread_join(pool->output_tid, NULL);
+}
+
+static void free_slots(const zseek_allocator_t *allocator,
+    zseek_cslot_t **slots, size_t capacity)
+{
+    for (size_t i = 0; i < capacity; i++)
+        slot_free(allocator, slots[i]);
+    zseek_free(allocator, slots);
+}
+
+zseek_cpool_t *zseek_cpool_new(int nb_workers, size_t queue_size,
+    zseek_cpool_compress_t compress, zseek_cpool_output_t output,
+    void **worker_data, void *user_data, size_t cpusetsize,
+    const cpu_set_t *cpuset, const zseek_allocator_t *allocator)
+{
+    if (nb_workers < 1 || queue_size < 1 || !compress)
+        return NULL;
+
+    zseek_cpool_t *pool = zseek_alloc(allocator, sizeof(*pool));
+    if (!pool)
+        goto fail;
+    memset(pool, 0, sizeof(*pool));
+    pool->compress = compress;
+    pool->output = output;
+    pool->user_data = user_data;
+    pool->allocator = allocator;
+
+    zseek_cslot_t **slots = zseek_alloc(allocator,
+        queue_size * sizeof(*slots));
+    if (!slots)
+        goto fail_w_pool;
+    memset(slots, 0, queue_size * sizeof(*slots));
+    pool->slots = slots;
+    pool->capacity = queue_size;
+    for (size_t i = 0; i < queue_size; i++) {
+        slots[i] = slot_new(allocator);
+        if (!slots[i])
+            goto fail_w_slots;
+    }
+
+    if (pthread_mutex_init(&pool->lock, NULL))
+        goto fail_w_slots;
+    if (pthread_cond_init(&pool->work_cond, NULL))
+        goto fail_w_lock;
+    if (pthread_cond_init(&pool->done_cond, NULL))
+        goto fail_w_work_cond;
+    if (pthread_cond_init(&pool->pop_cond, NULL))
+        goto fail_w_done_cond;
+
+    zseek_cworker_t *workers = zseek_alloc(allocator,
+        nb_workers * sizeof(*workers));
+    if (!workers)
+        goto fail_w_pop_cond;
+    pool->workers = workers;
+
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr))
+        goto fail_w_workers;
+    if (cpuset && pthread_attr_setaffinity_np(&attr, cpusetsize, cpuset))
+        goto fail_w_attr;
+
+    int nb_started = 0;
+    for (; nb_started < nb_workers; nb_started++) {
+        workers[nb_started].pool = pool;
+        workers[nb_started].data = worker_data ? worker_data[nb_started] : NULL;
+        if (pthread_create(&workers[nb_started].tid, &attr, worker_main,
+            &workers[nb_started]))
+            goto fail_w_threads;
+    }
+    pool->nb_workers = nb_workers;
+
+    if (output && pthread_create(&pool->output_tid, &attr, output_main, pool))
+        goto fail_w_threads;
+
+    pthread_attr_destroy(&attr);
+
+    return pool;
+
+fail_w_threads:
+    stop_threads(pool, nb_started, false);
+fail_w_attr:
+    pthread_attr_destroy(&attr);
+fail_w_workers:
+    zseek_free(allocator, workers);
+fail_w_pop_cond:
+    pthread_cond_destroy(&pool->pop_cond);
+fail_w_done_cond:
+    pthread_cond_destroy(&pool->done_cond);
+fail_w_work_cond:
+    pthread_cond_destroy(&pool->work_cond);
+fail_w_lock:
+    pthread_mutex_destroy(&pool->lock);
+fail_w_slots:
+    free_slots(allocator, slots, queue_size);
+fail_w_pool:
+    zseek_free(allocator, pool);
+fail:
+    return NULL;
+}
+
+void zseek_cpool_free(zseek_cpool_t *pool)
+{
+    if (!pool)
+        return;
+
+    stop_threads(pool, pool->nb_workers, pool->output != NULL);
+
+    zseek_free(pool->allocator, pool->workers);
+    pthread_cond_destroy(&pool->pop_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+    free_slots(pool->allocator, pool->slots, pool->capacity);
+    zseek_free(pool->allocator, pool);
+}
+
+zseek_cjob_t *zseek_cpool_acquire(zseek_cpool_t *pool, bool wait)
+{
+    // Without an output thread, nobody would pop for us
+    assert(!wait || pool->output);
+
+    pthread_mutex_lock(&pool->lock);
+
+    // Only one job may be filled at a time
+    assert(pool->acquired == pool->submitted);
+
+    while (wait && pool->acquired - pool->head == pool->capacity)
+        pthread_cond_wait(&pool->pop_cond, &pool->lock);
+
+    zseek_cslot_t *slot = NULL;
+    if (pool->acquired - pool->head < pool->capacity) {
+        slot = pool->slots[pool->acquired % pool->capacity];
+        pool->acquired++;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return slot ? &slot->job : NULL;
+}
+
+void zseek_cpool_submit(zseek_cpool_t *pool, zseek_cjob_t *job)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    assert((zseek_cslot_t*)job == pool->slots[pool->submitted % pool->capacity]);
+
+    pool->submitted++;
+    pool->pending_size += zseek_buffer_size(job->ubuf);
+    pthread_cond_signal(&pool->work_cond);
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+bool zseek_cpool_grow(zseek_cpool_t *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    size_t capacity = pool->capacity;
+    size_t new_capacity = 2 * capacity;
+    zseek_cslot_t **new_slots = zseek_alloc(pool->allocator,
+        new_capacity * sizeof(*new_slots));
+    if (!new_slots)
+        goto fail_w_lock;
+    memset(new_slots, 0, new_capacity * sizeof(*new_slots));
+
+    // Keep the jobs in flight at the same sequence numbers, then the rest
+    size_t seq = pool->head;
+    for (; seq < pool->head + capacity; seq++)
+        new_slots[seq % new_capacity] = pool->slots[seq % capacity];
+    for (; seq < pool->head + new_capacity; seq++) {
+        new_slots[seq % new_capacity] = slot_new(pool->allocator);
+        if (!new_slots[seq % new_capacity])
+            goto fail_w_new_slots;
+    }
+
+    zseek_free(pool->allocator, pool->slots);
+    pool->slots = new_slots;
+    pool->capacity = new_capacity;
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return true;
+
+fail_w_new_slots:
+    for (seq = pool->head + capacity; seq < pool->head + new_capacity; seq++)
+        slot_free(pool->allocator, new_slots[seq % new_capacity]);
+    zseek_free(pool->allocator, new_slots);
+fail_w_lock:
+    pthread_mutex_unlock(&pool->lock);
+    return false;
+}
+
+zseek_cjob_t *zseek_cpool_head(zseek_cpool_t *pool, bool wait)
+{
+    assert(!pool->output);
+
+    pthread_mutex_lock(&pool->lock);
+
+    zseek_cslot_t *slot = NULL;
+    if (pool->head < pool->submitted) {
+        slot = pool->slots[pool->head % pool->capacity];
+        while (wait && !slot->done)
+            pthread_cond_wait(&pool->done_cond, &pool->lock);
+        if (!slot->done)
+            slot = NULL;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return slot ? &slot->job : NULL;
+}
+
+void zseek_cpool_pop(zseek_cpool_t *pool)
+{
+    assert(!pool->output);
+
+    pthread_mutex_lock(&pool->lock);
+    pop_locked(pool);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void zseek_cpool_wait(zseek_cpool_t *pool, size_t size)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending_size > size && pool->head < pool->submitted)
+        pthread_cond_wait(&pool->pop_cond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+bool zseek_cpool_failed(zseek_cpool_t *pool, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    pthread_mutex_lock(&pool->lock);
+    bool failed = pool->failed;
+    if (failed && errbuf)
+        memcpy(errbuf, pool->errbuf, sizeof(pool->errbuf));
+    pthread_mutex_unlock(&pool->lock);
+
+    return failed;
+}
+
+size_t zseek_cpool_pending(zseek_cpool_t *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    size_t pending = pool->submitted - pool->head;
+    pthread_mutex_unlock(&pool->lock);
+
+    return pending;
+}
+
+size_t zseek_cpool_pending_size(zseek_cpool_t *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    size_t pending_size = pool->pending_size;
+    pthread_mutex_unlock(&pool->lock);
+
+    return pending_size;
+}
+
+size_t zseek_cpool_memory_usage(zseek_cpool_t *pool)
+{
+    if (!pool)
+        return 0;
+
+    pthread_mutex_lock(&pool->lock);
+    size_t memory = sizeof(*pool) + pool->nb_workers * sizeof(*pool->workers) +
+        pool->capacity * sizeof(*pool->slots);
+    for (size_t i = 0; i < pool->capacity; i++)
+        memory += pool->slots[i]->memory;
+    pthread_mutex_unlock(&pool->lock);
+
+    return memory;
+}
@@ -0,0 +1,132 @@
+#ifndef CPOOL_H
+#define CPOOL_H
+
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t
+#include <stdbool.h>    // bool
+#include <sched.h>      // cpu_set_t
+
+#include "zseek.h"      // ZSEEK_ERRBUF_SIZE
+#include "buffer.h"
+
+/**
+ * A whole frame to be compressed by a pool worker.
+ */
+typedef struct {
+    zseek_buffer_t *ubuf;   // uncompressed frame data
+    zseek_buffer_t *cbuf;   // compressed frame data
+    int level;              // compression level
+    uint64_t compress_ns;   // time spent compressing
+    bool failed;
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+} zseek_cjob_t;
+
+typedef struct zseek_cpool zseek_cpool_t;
+
+/**
+ * Compresses @p job->ubuf into @p job->cbuf, using the context
+ * @p worker_data of the calling worker.
+ * Returns @a false on error, having populated @p job->errbuf.
+ */
+typedef bool (*zseek_cpool_compress_t)(zseek_cjob_t *job, void *worker_data,
+    void *user_data);
+
+/**
+ * Consumes the compressed @p job, e.g. writes it out.
+ * Returns @a false on error, having populated @p job->errbuf.
+ */
+typedef bool (*zseek_cpool_output_t)(zseek_cjob_t *job, void *user_data);
+
+/**
+ * Creates a new pool of @p nb_workers threads compressing whole frames in
+ * parallel, with room for @p queue_size frames in flight.
+ *
+ * Worker @a i calls @p compress with @p worker_data[i]. If @p output is not
+ * @a NULL, an extra thread calls it for every compressed job in submission
+ * order and pops it, otherwise the caller does so through zseek_cpool_head()
+ * and zseek_cpool_pop(). If @p cpuset is not @a NULL, all threads are
+ * confined to it. Memory comes from @p allocator (the C library if @a NULL),
+ * which must outlive the pool.
+ */
+zseek_cpool_t *zseek_cpool_new(int nb_workers, size_t queue_size,
+    zseek_cpool_compress_t compress, zseek_cpool_output_t output,
+    void **worker_data, void *user_data, size_t cpusetsize,
+    const cpu_set_t *cpuset, const zseek_allocator_t *allocator);
+
+/**
+ * Stops the threads and frees @p pool, including any jobs still in flight.
+ */
+void zseek_cpool_free(zseek_cpool_t *pool);
+
+/**
+ * Returns the next job to fill with uncompressed data. If all jobs are in
+ * flight, returns @a NULL or, if @p wait is @a true, blocks until one is
+ * popped. Only one job may be acquired at a time.
+ *
+ * @attention Not safe to call concurrently with itself or zseek_cpool_submit().
+ */
+zseek_cjob_t *zseek_cpool_acquire(zseek_cpool_t *pool, bool wait);
+
+/**
+ * Queues @p job, as returned by zseek_cpool_acquire(), for compression.
+ *
+ * @attention Not safe to call concurrently with itself or
+ * zseek_cpool_acquire().
+ */
+void zseek_cpool_submit(zseek_cpool_t *pool, zseek_cjob_t *job);
+
+/**
+ * Doubles the number of jobs that may be in flight.
+ * Returns @a false on error.
+ */
+bool zseek_cpool_grow(zseek_cpool_t *pool);
+
+/**
+ * Returns the oldest submitted job if it has been compressed, or @a NULL if
+ * there is none. If @p wait is @a true, blocks until it has been compressed.
+ *
+ * Jobs are returned in submission order, regardless of the order in which
+ * they finish.
+ *
+ * @attention Not safe to call concurrently with itself or zseek_cpool_pop().
+ * Not to be used if the pool has an output callback.
+ */
+zseek_cjob_t *zseek_cpool_head(zseek_cpool_t *pool, bool wait);
+
+/**
+ * Releases the job returned by zseek_cpool_head(), making room for a new one.
+ *
+ * @attention Not safe to call concurrently with itself or zseek_cpool_head().
+ * Not to be used if the pool has an output callback.
+ */
+void zseek_cpool_pop(zseek_cpool_t *pool);
+
+/**
+ * Blocks until at most @p size uncompressed bytes are in flight.
+ *
+ * @note Only useful if the pool has an output callback.
+ */
+void zseek_cpool_wait(zseek_cpool_t *pool, size_t size);
+
+/**
+ * Returns @a true if compressing or outputting a job has failed, copying the
+ * first error message to @p errbuf. Jobs after a failure are dropped.
+ */
+bool zseek_cpool_failed(zseek_cpool_t *pool, char errbuf[ZSEEK_ERRBUF_SIZE]);
+
+/**
+ * Returns the number of submitted jobs not popped yet.
+ */
+size_t zseek_cpool_pending(zseek_cpool_t *pool);
+
+/**
+ * Returns the uncompressed size of submitted jobs not popped yet.
+ */
+size_t zseek_cpool_pending_size(zseek_cpool_t *pool);
+
+/**
+ * Returns the memory usage (total heap allocation) of @p pool in bytes.
+ */
+size_t zseek_cpool_memory_usage(zseek_cpool_t *pool);
+
+#endif  // CPOOL_H
@@ -2,78 +2,246 @@
 #include <stddef.h>     // size_t
 #include <stdint.h>     // uint*_t
 #include <stdio.h>      // I/O
-#include <stdlib.h>     // malloc, free
+#include <stdlib.h>     // qsort
 #include <errno.h>      // errno
 #include <string.h>     // memset
 #include <pthread.h>    // pthread_mutex*
 #include <assert.h>     // assert
 
+#include <unistd.h>     // pread
 #include <sys/stat.h>   // fstat
 #include <endian.h>     // le32toh
+// For custom memory
+#define ZSTD_STATIC_LINKING_ONLY
 #include <zstd.h>
+#if defined(HAVE_LZ4F_DICT) || defined(HAVE_LZ4F_CUSTOMMEM)
+// Part of the static-only API (dictionaries before lz4 1.10, custom memory)
+#define LZ4F_STATIC_LINKING_ONLY
+#endif
 #include <lz4frame.h>
+#include <lz4.h>
 
 #include "zseek.h"
 #include "seek_table.h"
 #include "common.h"
 #include "cache.h"
 #include "buffer.h"
+#include "dict.h"
+#include "alloc.h"
+#include "fpool.h"
+#include "flight.h"
+#include "fdio.h"
+#include "aio.h"
+#include "bindex.h"
+#include "plan.h"
 
 #define ZSTD_MAGIC 0xFD2FB528
 #define LZ4_MAGIC 0x184D2204
+// High bit of lz4 block sizes, for blocks stored uncompressed
+#define LZ4_BLOCK_UNCOMPRESSED 0x80000000U
+
+#define DEFAULT_MAX_COALESCED_IO (1 << 20)
+
+// Smallest frames a cache budget in bytes gets slots for: each takes about a
+// tenth of that, with its share of the table
+#define MIN_CACHED_FRAME_SIZE (1 << 10)
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/**
+ * Decompression context and its buffers, used by one read at a time
+ */
+typedef struct zseek_dctx {
+    struct zseek_dctx *next;    // idle list
+    union {
+        ZSTD_DCtx *zstd;
+        LZ4F_dctx *lz4;
+    };
+    zseek_buffer_t *cbuf;       // compressed frame, unless mapped
+    zseek_buffer_t *dbuf;       // discard buffer, without a cache
+    zseek_buffer_t *sbuf;       // staging of runs of compressed frames
+} zseek_dctx_t;
 
 struct zseek_reader {
+    zseek_allocator_t allocator;    // see zseek_reader_param_t.allocator
     zseek_read_file_t user_file;
+    zseek_fd_file_t fd_file;        // see zseek_reader_open_fd()
+    zseek_map_t map;                // see zseek_reader_open_mmap()
+    // Of the file, if known, to share its cached frames with other readers
+    struct stat file_stat;
+    bool has_file_stat;
     zseek_compression_type_t type;
     union {
-        // TODO: If there's contention, use one dctx per read()
-        ZSTD_DCtx *dctx_zstd;
+        ZSTD_DDict *ddict_zstd;     // referenced by every context, if any
         struct {
-            LZ4F_dctx *dctx_lz4;
-            zseek_buffer_t *dbuf;   // discard buffer
+            void *dict;             // shared by all frames, if any
+            size_t dict_size;
         };
     };
-    pthread_rwlock_t lock;
+    // NOTE: Protects the idle contexts only. Reads take one each, so that
+    // they read and decompress frames in parallel.
+    pthread_mutex_t lock;
+    zseek_dctx_t *dctxs;
+    // NOTE: Serializes calls to user_file.pread, unless it is thread-safe
+    pthread_mutex_t io_lock;
+    bool serialize_io;
+    zseek_flights_t *flights;   // frames being decompressed for the cache
 
     ZSTD_seekTable *st;
+    zseek_bindex_t *bindex;     // see zseek_lz4_param_t.block_index, if any
     zseek_cache_t *cache;
+    zseek_cache_user_t *cache_user;
+    bool own_cache;
+    zseek_cache_admission_t admission;
+    size_t bypasses;            // atomic
+    size_t max_io;              // see zseek_reader_param_t.max_coalesced_io
+    size_t io_alignment;        // of reads of runs of frames
+    size_t coalesced;           // atomic
+    zseek_frame_pool_t *pool;   // for cached frames
+    bool own_pool;
+    size_t pool_hits;           // atomic
+    size_t pool_misses;         // atomic
+    zseek_aio_t *aio;           // see zseek_pread_async(), if enabled
+    size_t async_workers;
     size_t pos;
-    zseek_buffer_t *cbuf;
 };
 
+/**
+ * Part of a range of a batched read within a single frame
+ */
+typedef struct {
+    size_t frame_idx;
+    uint8_t *buf;
+    size_t count;
+    size_t offset;
+} zseek_piece_t;
+
+/**
+ * Frame of a batched read, decompressed once for all of its pieces
+ */
+typedef struct {
+    const zseek_piece_t *pieces;
+    size_t nb_pieces;
+    const void *cdata;      // read ahead, unless mapped
+} zseek_batch_frame_t;
+
+/**
+ * Frames of a batched read being decompressed, see zseek_preadv_batch(), by
+ * the caller and its helpers on the workers of asynchronous reads. Helpers
+ * may start after the caller is gone, so the last one to leave frees it.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;
+    const zseek_batch_frame_t *frames;
+    size_t nb_frames;
+    size_t next;            // first frame not claimed
+    size_t done;            // claimed frames decompressed
+    size_t queued;          // helpers not started yet
+    size_t refs;            // caller and helpers
+    bool failed;
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+} zseek_batch_t;
+
+/**
+ * Asynchronous read, see zseek_pread_async(), followed by its compressed
+ * frame if read ahead, or helper of a batched read
+ */
+typedef struct {
+    zseek_aio_req_t req;
+    void *buf;
+    size_t count;
+    size_t offset;
+    ssize_t frame_idx;  // -1 past the end
+    zseek_pread_cb_t cb;
+    void *ctx;
+    zseek_batch_t *batch;   // helper only, if not NULL
+} zseek_async_read_t;
+
+/**
+ * Reads from a stream without a file descriptor (e.g. fmemopen()), under its
+ * lock, so that concurrent reads find the position they left
+ */
+static ssize_t stdio_pread(FILE *fin, void *data, size_t size, size_t offset)
+{
+    flockfile(fin);
+
+    off_t prev_pos = ftello(fin);
+    if (prev_pos == -1)
+        goto fail;
+
+    if (fseeko(fin, offset, SEEK_SET) == -1)
+        goto fail;
+    size_t done = fread(data, 1, size, fin);
+    if (done != size && ferror(fin))
+        goto fail;
+
+    if (fseeko(fin, prev_pos, SEEK_SET) == -1)
+        goto fail;
+
+    funlockfile(fin);
+    return done;
+
+fail:
+    funlockfile(fin);
+    return -1;
+}
+
 static ssize_t default_pread(void *data, size_t size, size_t offset,
     void *user_data, void *call_data)
 {
     (void)call_data;
 
     FILE *fin = user_data;
-
-    // Save current file position
-    long prev_pos = ftell(fin);
-    if (prev_pos == -1) {
-        // perror("get file position");
-        return -1;
+    int fd = fileno(fin);
+    if (fd == -1)
+        return stdio_pread(fin, data, size, offset);
+
+    // NOTE: Positional, so that concurrent reads share the file safely
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, (uint8_t*)data + done, size - done,
+            offset + done);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        done += n;
     }
 
-    if (fseek(fin, offset, SEEK_SET) == -1) {
-        // perror("set file position");
-        return -1;
-    }
-    size_t _read = fread(data, 1, size, fin);
-    if (_read != size && ferror(fin)) {
-        // perror("read from file");
-        return -1;
-    }
+    return done;
+}
 
-    // Restore previous file position
-    if (fseek(fin, prev_pos, SEEK_SET) == -1) {
-        // perror("restore file position");
-        return -1;
-    }
+/**
+ * Size of a stream without a file descriptor, see stdio_pread()
+ */
+static ssize_t stdio_fsize(FILE *f)
+{
+    flockfile(f);
 
-    return _read;
+    off_t prev_pos = ftello(f);
+    if (prev_pos == -1)
+        goto fail;
+
+    if (fseeko(f, 0, SEEK_END) == -1)
+        goto fail;
+    off_t size = ftello(f);
+    if (size == -1)
+        goto fail;
+
+    if (fseeko(f, prev_pos, SEEK_SET) == -1)
+        goto fail;
+
+    funlockfile(f);
+    return size;
+
+fail:
+    funlockfile(f);
+    return -1;
 }
 
 static ssize_t default_fsize(void *user_data, void *call_data)
@@ -82,10 +250,8 @@ static ssize_t default_fsize(void *user_data, void *call_data)
 
     FILE *f = user_data;
     int fd = fileno(f);
-    if (fd == -1) {
-        // perror("get file descriptor");
-        return -1;
-    }
+    if (fd == -1)
+        return stdio_fsize(f);
 
     struct stat st;
     if (fstat(fd, &st) == -1) {
@@ -96,602 +262,2202 @@ static ssize_t default_fsize(void *user_data, void *call_data)
     return st.st_size;
 }
 
-static zseek_reader_t *zseek_reader_open_full_zstd(zseek_read_file_t user_file,
-    size_t cache_size, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+static ZSTD_DCtx *new_dctx_zstd(zseek_reader_t *reader,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
 {
-    zseek_reader_t *reader = malloc(sizeof(*reader));
-    if (!reader) {
-        set_error_with_errno(errbuf, "allocate reader", errno);
-        goto fail;
+    ZSTD_customMem cmem = {zseek_mem_alloc, zseek_mem_free,
+        &reader->allocator};
+    ZSTD_DCtx *dctx = ZSTD_createDCtx_advanced(cmem);
+    if (!dctx) {
+        set_error(errbuf, "context creation failed");
+        return NULL;
+    }
+
+    if (reader->ddict_zstd) {
+        size_t r = ZSTD_DCtx_refDDict(dctx, reader->ddict_zstd);
+        if (ZSTD_isError(r)) {
+            set_error(errbuf, "%s: %s", "reference dictionary",
+                ZSTD_getErrorName(r));
+            ZSTD_freeDCtx(dctx);
+            return NULL;
+        }
     }
-    memset(reader, 0, sizeof(*reader));
-    reader->type = ZSEEK_ZSTD;
 
-    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    return dctx;
+}
+
+static LZ4F_dctx *new_dctx_lz4(zseek_reader_t *reader,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+#ifdef HAVE_LZ4F_CUSTOMMEM
+    LZ4F_CustomMem cmem = {zseek_mem_alloc, NULL, zseek_mem_free,
+        &reader->allocator};
+    LZ4F_dctx *dctx = LZ4F_createDecompressionContext_advanced(cmem,
+        LZ4F_VERSION);
     if (!dctx) {
         set_error(errbuf, "context creation failed");
-        goto fail_w_reader;
+        return NULL;
     }
-    reader->dctx_zstd = dctx;
+#else
+    (void)reader;
 
-    int pr = pthread_rwlock_init(&reader->lock, NULL);
-    if (pr) {
-        set_error_with_errno(errbuf, "initialize lock", pr);
-        goto fail_w_dctx;
+    // NOTE: Without custom memory support in lz4, the context comes from the
+    // C library.
+    LZ4F_dctx *dctx;
+    LZ4F_errorCode_t r = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+    if (LZ4F_isError(r)) {
+        set_error(errbuf, "%s: %s", "context creation failed",
+            LZ4F_getErrorName(r));
+        return NULL;
     }
+#endif
 
-    reader->user_file = user_file;
+    return dctx;
+}
 
-    ZSTD_seekTable *st = read_seek_table(user_file, call_data);
-    if (!st) {
-        set_error(errbuf, "read_seek_table failed");
-        goto fail_w_lock;
+/**
+ * Free @p dctx, returning @a false on error
+ */
+static bool free_dctx(zseek_reader_t *reader, zseek_dctx_t *dctx,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    bool is_error = false;
+
+    switch (reader->type) {
+    case ZSEEK_ZSTD: {
+        size_t r = ZSTD_freeDCtx(dctx->zstd);
+        if (ZSTD_isError(r)) {
+            set_error(errbuf, "%s: %s", "free context", ZSTD_getErrorName(r));
+            is_error = true;
+        }
+        break;
+    }
+    case ZSEEK_LZ4: {
+        LZ4F_errorCode_t r = LZ4F_freeDecompressionContext(dctx->lz4);
+        if (LZ4F_isError(r)) {
+            set_error(errbuf, "%s: %s", "free context", LZ4F_getErrorName(r));
+            is_error = true;
+        }
+        break;
+    }
+    default:
+        // BUG
+        assert(false);
+        break;
     }
-    reader->st = st;
 
-    zseek_cache_t *cache = zseek_cache_new(cache_size);
-    if (!cache) {
-        set_error(errbuf, "cache creation failed");
-        goto fail_w_st;
+    zseek_buffer_free(dctx->sbuf);
+    zseek_buffer_free(dctx->dbuf);
+    zseek_buffer_free(dctx->cbuf);
+    zseek_free(&reader->allocator, dctx);
+
+    return !is_error;
+}
+
+static zseek_dctx_t *new_dctx(zseek_reader_t *reader,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    zseek_dctx_t *dctx = zseek_alloc(&reader->allocator, sizeof(*dctx));
+    if (!dctx) {
+        set_error_with_errno(errbuf, "allocate context", errno);
+        goto fail;
+    }
+    memset(dctx, 0, sizeof(*dctx));
+
+    switch (reader->type) {
+    case ZSEEK_ZSTD:
+        dctx->zstd = new_dctx_zstd(reader, errbuf);
+        if (!dctx->zstd)
+            goto fail_w_dctx;
+        break;
+    case ZSEEK_LZ4:
+        dctx->lz4 = new_dctx_lz4(reader, errbuf);
+        if (!dctx->lz4)
+            goto fail_w_dctx;
+        break;
+    default:
+        // BUG
+        assert(false);
+        goto fail_w_dctx;
     }
-    reader->cache = cache;
 
-    zseek_buffer_t *cbuf = zseek_buffer_new(0);
-    if (!cbuf) {
+    dctx->cbuf = zseek_buffer_new(0, &reader->allocator);
+    if (!dctx->cbuf) {
         set_error(errbuf, "buffer creation failed");
-        goto fail_w_cache;
+        goto fail_w_dctx;
     }
-    reader->cbuf = cbuf;
 
-    return reader;
+    dctx->dbuf = zseek_buffer_new(0, &reader->allocator);
+    if (!dctx->dbuf) {
+        set_error(errbuf, "discard buffer creation failed");
+        goto fail_w_dctx;
+    }
+
+    dctx->sbuf = zseek_buffer_new(0, &reader->allocator);
+    if (!dctx->sbuf) {
+        set_error(errbuf, "staging buffer creation failed");
+        goto fail_w_dctx;
+    }
+
+    return dctx;
 
-fail_w_cache:
-    zseek_cache_free(cache);
-fail_w_st:
-    seek_table_free(st);
-fail_w_lock:
-    pthread_rwlock_destroy(&reader->lock);
 fail_w_dctx:
-    ZSTD_freeDCtx(dctx);
-fail_w_reader:
-    free(reader);
+    free_dctx(reader, dctx, NULL);
 fail:
     return NULL;
 }
 
-static zseek_reader_t *zseek_reader_open_full_lz4(zseek_read_file_t user_file,
-    size_t cache_size, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+/**
+ * Take an idle context, or create one if all are in use
+ */
+static zseek_dctx_t *get_dctx(zseek_reader_t *reader,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
 {
-    zseek_reader_t *reader = malloc(sizeof(*reader));
-    if (!reader) {
-        set_error_with_errno(errbuf, "allocate reader", errno);
-        goto fail;
+    pthread_mutex_lock(&reader->lock);
+    zseek_dctx_t *dctx = reader->dctxs;
+    if (dctx)
+        reader->dctxs = dctx->next;
+    pthread_mutex_unlock(&reader->lock);
+
+    // NOTE: There are as many contexts as concurrent reads at most
+    if (!dctx)
+        dctx = new_dctx(reader, errbuf);
+
+    return dctx;
+}
+
+static void put_dctx(zseek_reader_t *reader, zseek_dctx_t *dctx)
+{
+    pthread_mutex_lock(&reader->lock);
+    dctx->next = reader->dctxs;
+    reader->dctxs = dctx;
+    pthread_mutex_unlock(&reader->lock);
+}
+
+/**
+ * Read @p size bytes of the file of @p reader at @p offset, as
+ * user_file.pread, one call at a time unless it is thread-safe
+ */
+static ssize_t read_file(zseek_reader_t *reader, void *data, size_t size,
+    size_t offset, void *call_data)
+{
+    if (reader->serialize_io)
+        pthread_mutex_lock(&reader->io_lock);
+    ssize_t _read = reader->user_file.pread(data, size, offset,
+        reader->user_file.user_data, call_data);
+    if (reader->serialize_io)
+        pthread_mutex_unlock(&reader->io_lock);
+
+    return _read;
+}
+
+/**
+ * Read the block index of lz4 frames, if the file has one, between the last
+ * frame and the seek table
+ */
+static bool read_block_index(zseek_reader_t *reader, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    // NOTE: The seek table follows, so there is always room for a header
+    uint8_t header[ZSEEK_BINDEX_HEADER_SIZE];
+    size_t offset = seek_table_compressed_size(reader->st);
+    ssize_t _read = read_file(reader, header, sizeof(header), offset,
+        call_data);
+    if (_read != (ssize_t)sizeof(header)) {
+        if (_read >= 0)
+            set_error(errbuf, "unexpected EOF");
+        else
+            // TODO OPT: Use errno if user_file.pread sets it
+            set_error(errbuf, "read file failed");
+        return false;
     }
-    memset(reader, 0, sizeof(*reader));
-    reader->type = ZSEEK_LZ4;
 
-    LZ4F_dctx *dctx;
-    LZ4F_errorCode_t r = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
-    if (LZ4F_isError(r)) {
-        set_error(errbuf, "%s: %s", "context creation failed",
-            LZ4F_getErrorName(r));
-        goto fail_w_reader;
+    size_t nb_blocks;
+    size_t block_size;
+    if (!zseek_bindex_parse(header, &nb_blocks, &block_size))
+        return true;
+    // Before allocating anything for it
+    if (nb_blocks != zseek_bindex_entries(reader->st, block_size)) {
+        set_error(errbuf, "invalid block index");
+        return false;
+    }
+
+    size_t entries_size = nb_blocks * ZSEEK_BINDEX_ENTRY_SIZE;
+    void *entries = zseek_alloc(&reader->allocator, MAX(entries_size, 1));
+    if (!entries) {
+        set_error_with_errno(errbuf, "allocate block index", errno);
+        return false;
+    }
+    _read = read_file(reader, entries, entries_size, offset + sizeof(header),
+        call_data);
+    if (_read != (ssize_t)entries_size) {
+        if (_read >= 0)
+            set_error(errbuf, "unexpected EOF");
+        else
+            // TODO OPT: Use errno if user_file.pread sets it
+            set_error(errbuf, "read file failed");
+        zseek_free(&reader->allocator, entries);
+        return false;
+    }
+
+    reader->bindex = zseek_bindex_new(entries, nb_blocks, block_size,
+        reader->st, &reader->allocator, errbuf);
+    zseek_free(&reader->allocator, entries);
+
+    return reader->bindex != NULL;
+}
+
+/**
+ * Set up what readers of all types have, once the type and dictionary are
+ * known
+ */
+static bool init_reader(zseek_reader_t *reader, zseek_read_file_t user_file,
+    const zseek_reader_param_t *zrp, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (zrp->cache_policy != ZSEEK_CACHE_CLOCK &&
+            zrp->cache_policy != ZSEEK_CACHE_2Q &&
+            zrp->cache_policy != ZSEEK_CACHE_TINYLFU) {
+        set_error(errbuf, "invalid cache policy");
+        goto fail;
     }
-    reader->dctx_lz4 = dctx;
+    if (zrp->cache_admission != ZSEEK_ADMIT_ALL &&
+            zrp->cache_admission != ZSEEK_ADMIT_PARTIAL) {
+        set_error(errbuf, "invalid cache admission");
+        goto fail;
+    }
+    reader->admission = zrp->cache_admission;
+    reader->max_io = zrp->max_coalesced_io ? zrp->max_coalesced_io :
+        DEFAULT_MAX_COALESCED_IO;
+    reader->io_alignment = 1;
 
-    int pr = pthread_rwlock_init(&reader->lock, NULL);
+    int pr = pthread_mutex_init(&reader->lock, NULL);
     if (pr) {
         set_error_with_errno(errbuf, "initialize lock", pr);
-        goto fail_w_dctx;
+        goto fail;
     }
+    pr = pthread_mutex_init(&reader->io_lock, NULL);
+    if (pr) {
+        set_error_with_errno(errbuf, "initialize I/O lock", pr);
+        goto fail_w_lock;
+    }
+    reader->serialize_io = !zrp->concurrent_io;
 
     reader->user_file = user_file;
 
-    ZSTD_seekTable *st = read_seek_table(user_file, call_data);
+    ZSTD_seekTable *st = reader->map.data ? map_seek_table(reader->map.data,
+        reader->map.size, &reader->allocator) : read_seek_table(user_file,
+        call_data, &reader->allocator);
     if (!st) {
         set_error(errbuf, "read_seek_table failed");
-        goto fail_w_lock;
+        goto fail_w_io_lock;
     }
     reader->st = st;
 
-    zseek_cache_t *cache = NULL;
-    if (cache_size > 0) {
-        cache = zseek_cache_new(cache_size);
+    if (reader->type == ZSEEK_LZ4 &&
+        !read_block_index(reader, call_data, errbuf))
+        goto fail_w_st;
+
+    // NOTE: The cache allocates its slots up front, so size them for a
+    // budget in bytes filled with the smallest frames, but the last one,
+    // bounded by the file
+    size_t capacity = zrp->cache_size;
+    if (zrp->cache_max_size > 0) {
+        size_t frames = seek_table_entries(st);
+        size_t smallest = SIZE_MAX;
+        for (size_t i = 0; i + 1 < frames; i++) {
+            size_t size = frame_size_d(st, i);
+            if (size > 0 && size < smallest)
+                smallest = size;
+        }
+        size_t fit = zrp->cache_max_size / MAX(smallest,
+            MIN_CACHED_FRAME_SIZE) + 1;
+        fit = MAX(1, MIN(frames, fit));
+        capacity = capacity ? MIN(capacity, fit) : fit;
+    }
+    zseek_cache_t *cache = zrp->shared_cache;
+    if (!cache && capacity > 0) {
+        cache = zseek_cache_new(capacity, zrp->cache_max_size,
+            zrp->cache_policy, reader->pool, &reader->allocator);
         if (!cache) {
             set_error(errbuf, "cache creation failed");
-            goto fail_w_st;
+            goto fail_w_bindex;
         }
+        reader->own_cache = true;
     }
     reader->cache = cache;
-
-    zseek_buffer_t *cbuf = zseek_buffer_new(0);
-    if (!cbuf) {
-        set_error(errbuf, "buffer creation failed");
-        goto fail_w_cache;
+    if (cache) {
+        reader->cache_user = zseek_cache_attach(cache,
+            reader->has_file_stat ? &reader->file_stat : NULL);
+        if (!reader->cache_user) {
+            set_error(errbuf, "cache attach failed");
+            goto fail_w_cache;
+        }
     }
-    reader->cbuf = cbuf;
 
-    zseek_buffer_t *dbuf = zseek_buffer_new(0);
-    if (!dbuf) {
-        set_error(errbuf, "discard buffer creation failed");
-        goto fail_w_cbuf;
+    zseek_flights_t *flights = zseek_flights_new(&reader->allocator);
+    if (!flights) {
+        set_error(errbuf, "in-flight table creation failed");
+        goto fail_w_user;
     }
-    reader->dbuf = dbuf;
+    reader->flights = flights;
 
-    return reader;
+    // Fail early if contexts cannot be created
+    zseek_dctx_t *dctx = new_dctx(reader, errbuf);
+    if (!dctx)
+        goto fail_w_flights;
+    reader->dctxs = dctx;
 
-fail_w_cbuf:
-    zseek_buffer_free(cbuf);
+    return true;
+
+fail_w_flights:
+    zseek_flights_free(flights);
+fail_w_user:
+    zseek_cache_detach(cache, reader->cache_user);
 fail_w_cache:
-    zseek_cache_free(cache);
+    if (reader->own_cache)
+        zseek_cache_free(cache);
+fail_w_bindex:
+    zseek_bindex_free(reader->bindex);
 fail_w_st:
     seek_table_free(st);
+fail_w_io_lock:
+    pthread_mutex_destroy(&reader->io_lock);
 fail_w_lock:
-    pthread_rwlock_destroy(&reader->lock);
-fail_w_dctx:
-    LZ4F_freeDecompressionContext(dctx);
-fail_w_reader:
-    free(reader);
+    pthread_mutex_destroy(&reader->lock);
 fail:
-    return NULL;
-}
-
-zseek_reader_t *zseek_reader_open_full(zseek_read_file_t user_file,
-    size_t cache_size, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
-{
-    // Look for magic number in the file
-    uint32_t magic_le;
-    ssize_t _read = user_file.pread(&magic_le, sizeof(magic_le), 0,
-        user_file.user_data, call_data);
-    if (_read != (ssize_t)sizeof(magic_le)) {
-        if (_read >= 0)
-            set_error(errbuf, "unexpected EOF");
-        else
-            // TODO OPT: Use errno if user_file.pread sets it
-            set_error(errbuf, "read file failed");
-        return NULL;
-    }
-
-    switch (le32toh(magic_le)) {
-    case ZSTD_MAGIC:
-        return zseek_reader_open_full_zstd(user_file, cache_size, call_data,
-            errbuf);
-    case LZ4_MAGIC:
-        return zseek_reader_open_full_lz4(user_file, cache_size, call_data,
-            errbuf);
-    default:
-        set_error(errbuf, "unrecognized file format");
-        return NULL;
-    }
-}
-
-zseek_reader_t *zseek_reader_open(FILE *cfile, size_t cache_size,
-    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
-{
-    zseek_read_file_t user_file = {cfile, default_pread, default_fsize};
-    return zseek_reader_open_full(user_file, cache_size, call_data, errbuf);
+    return false;
 }
 
-static bool zseek_reader_close_zstd(zseek_reader_t *reader, void *call_data,
-    char errbuf[ZSEEK_ERRBUF_SIZE])
+/**
+ * Undo init_reader(), returning @a false on error
+ */
+static bool fini_reader(zseek_reader_t *reader, char errbuf[ZSEEK_ERRBUF_SIZE])
 {
     bool is_error = false;
 
-    int pr = pthread_rwlock_destroy(&reader->lock);
+    int pr = pthread_mutex_destroy(&reader->lock);
     if (pr && !is_error) {
         set_error_with_errno(errbuf, "destroy lock", pr);
         is_error = true;
     }
-
-    size_t r = ZSTD_freeDCtx(reader->dctx_zstd);
-    if (ZSTD_isError(r) && !is_error) {
-        set_error(errbuf, "%s: %s", "free context", ZSTD_getErrorName(r));
+    pr = pthread_mutex_destroy(&reader->io_lock);
+    if (pr && !is_error) {
+        set_error_with_errno(errbuf, "destroy I/O lock", pr);
         is_error = true;
     }
 
-    zseek_buffer_free(reader->cbuf);
-    zseek_cache_free(reader->cache);
+    while (reader->dctxs) {
+        zseek_dctx_t *dctx = reader->dctxs;
+        reader->dctxs = dctx->next;
+        if (!free_dctx(reader, dctx, is_error ? NULL : errbuf))
+            is_error = true;
+    }
+
+    zseek_flights_free(reader->flights);
+    zseek_cache_detach(reader->cache, reader->cache_user);
+    if (reader->own_cache)
+        zseek_cache_free(reader->cache);
+    zseek_bindex_free(reader->bindex);
     seek_table_free(reader->st);
-    free(reader);
 
     return !is_error;
 }
 
-static bool zseek_reader_close_lz4(zseek_reader_t *reader, void *call_data,
+static zseek_reader_t *zseek_reader_open_full_zstd(zseek_reader_t *reader,
+    zseek_read_file_t user_file, const zseek_reader_param_t *zrp,
+    const void *dict, size_t dict_size, void *call_data,
     char errbuf[ZSEEK_ERRBUF_SIZE])
 {
-    (void)call_data;
-
-    bool is_error = false;
+    reader->type = ZSEEK_ZSTD;
 
-    int pr = pthread_rwlock_destroy(&reader->lock);
-    if (pr && !is_error) {
-        set_error_with_errno(errbuf, "destroy lock", pr);
-        is_error = true;
+    ZSTD_DDict *ddict = NULL;
+    if (dict) {
+        // NOTE: Digested once, then referenced by every frame decompressed
+        ZSTD_customMem cmem = {zseek_mem_alloc, zseek_mem_free,
+            &reader->allocator};
+        ddict = ZSTD_createDDict_advanced(dict, dict_size, ZSTD_dlm_byCopy,
+            ZSTD_dct_auto, cmem);
+        if (!ddict) {
+            set_error(errbuf, "dictionary creation failed");
+            goto fail;
+        }
     }
+    reader->ddict_zstd = ddict;
 
-    LZ4F_errorCode_t r = LZ4F_freeDecompressionContext(reader->dctx_lz4);
-    if (LZ4F_isError(r) && !is_error) {
-        set_error(errbuf, "%s: %s", "free context", LZ4F_getErrorName(r));
-        is_error = true;
-    }
+    if (!init_reader(reader, user_file, zrp, call_data, errbuf))
+        goto fail_w_ddict;
 
-    zseek_buffer_free(reader->dbuf);
-    zseek_buffer_free(reader->cbuf);
-    zseek_cache_free(reader->cache);
-    seek_table_free(reader->st);
-    free(reader);
+    return reader;
 
-    return !is_error;
+fail_w_ddict:
+    ZSTD_freeDDict(ddict);
+fail:
+    return NULL;
+}
+
+static zseek_reader_t *zseek_reader_open_full_lz4(zseek_reader_t *reader,
+    zseek_read_file_t user_file, const zseek_reader_param_t *zrp,
+    const void *dict, size_t dict_size, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+#ifndef HAVE_LZ4F_DICT
+    if (dict) {
+        set_error(errbuf, "lz4 dictionaries are not supported by this lz4");
+        return NULL;
+    }
+#endif
+
+    reader->type = ZSEEK_LZ4;
+
+    // NOTE: LZ4F keeps no digested form of dictionaries for decompression
+    if (dict) {
+        reader->dict = zseek_alloc(&reader->allocator, dict_size);
+        if (!reader->dict) {
+            set_error_with_errno(errbuf, "allocate dictionary", errno);
+            goto fail;
+        }
+        memcpy(reader->dict, dict, dict_size);
+        reader->dict_size = dict_size;
+    }
+
+    if (!init_reader(reader, user_file, zrp, call_data, errbuf))
+        goto fail_w_dict;
+
+    return reader;
+
+fail_w_dict:
+    zseek_free(&reader->allocator, reader->dict);
+fail:
+    return NULL;
+}
+
+/**
+ * Read the dictionary from the frame at the start of the file, along with the
+ * compression type of the file
+ */
+static bool read_dict(zseek_read_file_t user_file,
+    zseek_compression_type_t *type, void **dict, size_t *dict_size,
+    const zseek_allocator_t *allocator, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    uint8_t header[ZSEEK_DICT_HEADER_SIZE];
+    ssize_t _read = user_file.pread(header, sizeof(header), 0,
+        user_file.user_data, call_data);
+    if (_read != (ssize_t)sizeof(header)) {
+        if (_read >= 0)
+            set_error(errbuf, "unexpected EOF");
+        else
+            // TODO OPT: Use errno if user_file.pread sets it
+            set_error(errbuf, "read file failed");
+        return false;
+    }
+    if (!zseek_dict_parse(header, type, dict_size)) {
+        set_error(errbuf, "invalid dictionary frame");
+        return false;
+    }
+    // Before allocating anything for it
+    ssize_t file_size = user_file.fsize(user_file.user_data, call_data);
+    if (file_size < 0) {
+        set_error(errbuf, "get file size failed");
+        return false;
+    }
+    if ((size_t)file_size < sizeof(header) ||
+            *dict_size > (size_t)file_size - sizeof(header)) {
+        set_error(errbuf, "invalid dictionary size (%zu)", *dict_size);
+        return false;
+    }
+
+    *dict = zseek_alloc(allocator, *dict_size);
+    if (!*dict) {
+        set_error_with_errno(errbuf, "allocate dictionary", errno);
+        return false;
+    }
+    _read = user_file.pread(*dict, *dict_size, sizeof(header),
+        user_file.user_data, call_data);
+    if (_read != (ssize_t)*dict_size) {
+        if (_read >= 0)
+            set_error(errbuf, "unexpected EOF");
+        else
+            // TODO OPT: Use errno if user_file.pread sets it
+            set_error(errbuf, "read file failed");
+        zseek_free(allocator, *dict);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Free the reader itself, with its own allocator
+ */
+static void free_reader(zseek_reader_t *reader)
+{
+    if (reader->own_pool)
+        zseek_frame_pool_free(reader->pool);
+
+    zseek_allocator_t allocator = reader->allocator;
+    zseek_free(&allocator, reader);
+}
+
+/**
+ * Open a reader of @p user_file, or of @p map if not @a NULL, which it then
+ * takes over on success. @p fd is that of the file, if not -1, for readers of
+ * it to share their frames in a shared cache.
+ */
+static zseek_reader_t *open_reader(zseek_read_file_t user_file,
+    const zseek_map_t *map, int fd, zseek_reader_param_t *zrp,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!zrp) {
+        set_error(errbuf, "invalid reader parameters");
+        return NULL;
+    }
+
+    // Look for magic number in the file
+    uint32_t magic_le;
+    ssize_t _read = user_file.pread(&magic_le, sizeof(magic_le), 0,
+        user_file.user_data, call_data);
+    if (_read != (ssize_t)sizeof(magic_le)) {
+        if (_read >= 0)
+            set_error(errbuf, "unexpected EOF");
+        else
+            // TODO OPT: Use errno if user_file.pread sets it
+            set_error(errbuf, "read file failed");
+        return NULL;
+    }
+
+    zseek_reader_t *reader = zseek_alloc(zrp->allocator, sizeof(*reader));
+    if (!reader) {
+        set_error_with_errno(errbuf, "allocate reader", errno);
+        return NULL;
+    }
+    memset(reader, 0, sizeof(*reader));
+    zseek_allocator_init(&reader->allocator, zrp->allocator);
+    if (fd != -1 && zrp->shared_cache)
+        reader->has_file_stat = fstat(fd, &reader->file_stat) == 0;
+    if (map) {
+        reader->map = *map;
+        user_file.user_data = &reader->map;
+    }
+
+    // NOTE: Frames go to the pool of the cache when evicted
+    reader->pool = zrp->shared_cache ? zseek_cache_pool(zrp->shared_cache) :
+        zrp->frame_pool;
+    if (!reader->pool) {
+        zseek_frame_pool_param_t zfp = {
+            .max_size = zrp->frame_pool_size,
+            .allocator = &reader->allocator,
+        };
+        reader->pool = zseek_frame_pool_new(&zfp, errbuf);
+        if (!reader->pool)
+            goto fail_w_reader;
+        reader->own_pool = true;
+    }
+
+    zseek_compression_type_t type;
+    void *dict = NULL;
+    size_t dict_size = 0;
+    switch (le32toh(magic_le)) {
+    case ZSTD_MAGIC:
+        type = ZSEEK_ZSTD;
+        break;
+    case LZ4_MAGIC:
+        type = ZSEEK_LZ4;
+        break;
+    case ZSEEK_DICT_MAGIC:
+        // The dictionary frame comes first and records the type
+        if (!read_dict(user_file, &type, &dict, &dict_size,
+            &reader->allocator, call_data, errbuf))
+            goto fail_w_reader;
+        break;
+    default:
+        set_error(errbuf, "unrecognized file format");
+        goto fail_w_reader;
+    }
+
+    zseek_reader_t *opened;
+    switch (type) {
+    case ZSEEK_ZSTD:
+        opened = zseek_reader_open_full_zstd(reader, user_file,
+            zrp, dict, dict_size, call_data, errbuf);
+        break;
+    case ZSEEK_LZ4:
+        opened = zseek_reader_open_full_lz4(reader, user_file,
+            zrp, dict, dict_size, call_data, errbuf);
+        break;
+    default:
+        // BUG
+        assert(false);
+        opened = NULL;
+        break;
+    }
+    zseek_free(&reader->allocator, dict);
+    if (!opened)
+        goto fail_w_reader;
+
+    return reader;
+
+fail_w_reader:
+    free_reader(reader);
+    return NULL;
+}
+
+static void process_async(zseek_aio_req_t *req, void *user_data);
+
+/**
+ * Start the asynchronous reads of @p reader, if enabled, with io_uring reading
+ * from @p fd if not -1. Closes @p reader on error.
+ */
+static zseek_reader_t *start_async(zseek_reader_t *reader,
+    const zseek_reader_param_t *zrp, int fd, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (zrp->async_workers == 0)
+        return reader;
+
+    reader->aio = zseek_aio_new(zrp->async_backend, fd,
+        zrp->async_queue_depth, zrp->async_workers, process_async, reader,
+        &reader->allocator, errbuf);
+    if (!reader->aio) {
+        zseek_reader_close(reader, call_data, NULL);
+        return NULL;
+    }
+    reader->async_workers = zrp->async_workers;
+
+    return reader;
+}
+
+zseek_reader_t *zseek_reader_open_ext(zseek_read_file_t user_file,
+    zseek_reader_param_t *zrp, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    zseek_reader_t *reader = open_reader(user_file, NULL, -1, zrp, call_data,
+        errbuf);
+    if (!reader)
+        return NULL;
+
+    return start_async(reader, zrp, -1, call_data, errbuf);
+}
+
+zseek_reader_t *zseek_reader_open_full(zseek_read_file_t user_file,
+    size_t cache_size, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    zseek_reader_param_t zrp = { .cache_size = cache_size };
+    return zseek_reader_open_ext(user_file, &zrp, call_data, errbuf);
+}
+
+zseek_reader_t *zseek_reader_open(FILE *cfile, size_t cache_size,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    zseek_read_file_t user_file = {cfile, default_pread, default_fsize};
+    // NOTE: Thread-safe, see default_pread()
+    zseek_reader_param_t zrp = {
+        .cache_size = cache_size,
+        .concurrent_io = true,
+    };
+    return zseek_reader_open_ext(user_file, &zrp, call_data, errbuf);
+}
+
+zseek_reader_t *zseek_reader_open_fd(int fd, zseek_reader_param_t *zrp,
+    const zseek_fd_param_t *zfp, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!zrp) {
+        set_error(errbuf, "invalid reader parameters");
+        return NULL;
+    }
+
+    zseek_fd_file_t fd_file;
+    if (!zseek_fd_file_init(&fd_file, fd, zfp, zrp->allocator, errbuf))
+        return NULL;
+    zseek_read_file_t user_file = {&fd_file, zseek_fd_pread, zseek_fd_size};
+    zseek_reader_t *reader = open_reader(user_file, NULL, fd, zrp, call_data,
+        errbuf);
+    if (!reader)
+        return NULL;
+
+    // NOTE: The file lives on the stack only for opening
+    reader->fd_file = fd_file;
+    reader->fd_file.allocator = &reader->allocator;
+    reader->user_file.user_data = &reader->fd_file;
+    // NOTE: Positional reads are thread-safe
+    reader->serialize_io = false;
+    // NOTE: So that runs of frames are read without a bounce buffer
+    if (fd_file.direct)
+        reader->io_alignment = fd_file.alignment;
+
+    // NOTE: io_uring reads frames into unaligned buffers, not fit for O_DIRECT
+    return start_async(reader, zrp, fd_file.direct ? -1 : fd, call_data,
+        errbuf);
+}
+
+zseek_reader_t *zseek_reader_open_mmap(int fd, zseek_reader_param_t *zrp,
+    const zseek_fd_param_t *zfp, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    zseek_map_t map;
+    if (!zseek_map_file(&map, fd, zfp, errbuf))
+        return NULL;
+    zseek_read_file_t user_file = {&map, zseek_map_pread, zseek_map_size};
+    zseek_reader_t *reader = open_reader(user_file, &map, fd, zrp, call_data,
+        errbuf);
+    if (!reader) {
+        zseek_unmap(&map);
+        return NULL;
+    }
+
+    // NOTE: Mapped frames need no reads ahead, and copies are thread-safe
+    reader->serialize_io = false;
+    return start_async(reader, zrp, -1, call_data, errbuf);
+}
+
+static bool zseek_reader_close_zstd(zseek_reader_t *reader, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    (void)call_data;
+
+    bool is_error = !fini_reader(reader, errbuf);
+
+    size_t r = ZSTD_freeDDict(reader->ddict_zstd);
+    if (ZSTD_isError(r) && !is_error) {
+        set_error(errbuf, "%s: %s", "free dictionary", ZSTD_getErrorName(r));
+        is_error = true;
+    }
+
+    free_reader(reader);
+
+    return !is_error;
+}
+
+static bool zseek_reader_close_lz4(zseek_reader_t *reader, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    (void)call_data;
+
+    bool is_error = !fini_reader(reader, errbuf);
+
+    zseek_free(&reader->allocator, reader->dict);
+    free_reader(reader);
+
+    return !is_error;
 }
 
 bool zseek_reader_close(zseek_reader_t *reader, void *call_data,
     char errbuf[ZSEEK_ERRBUF_SIZE])
 {
-    if (!reader)
-        return true;
+    if (!reader)
+        return true;
+
+    // Complete the queued asynchronous reads first
+    zseek_aio_free(reader->aio);
+
+    zseek_map_t map = reader->map;
+    bool ok;
+    switch (reader->type) {
+    case ZSEEK_ZSTD:
+        ok = zseek_reader_close_zstd(reader, call_data, errbuf);
+        break;
+    case ZSEEK_LZ4:
+        ok = zseek_reader_close_lz4(reader, call_data, errbuf);
+        break;
+    default:
+        // BUG
+        assert(false);
+        ok = false;
+        break;
+    }
+    zseek_unmap(&map);
+
+    return ok;
+}
+
+/**
+ * Reads @p size bytes at @p start in the compressed frame at index
+ * @p frame_idx into the buffer of @p dctx, and returns them, or @a NULL on
+ * error. Mapped frames, or @p cdata if the frame was read ahead, are returned
+ * in place instead.
+ */
+static const void *read_frame_range(zseek_reader_t *reader,
+    zseek_dctx_t *dctx, size_t frame_idx, size_t start, size_t size,
+    const void *cdata, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    assert(start + size <= frame_size_c(reader->st, frame_idx));
+
+    if (cdata)
+        return (const uint8_t *)cdata + start;
+
+    size_t offset = frame_offset_c(reader->st, frame_idx) + start;
+    if (reader->map.data) {
+        if (offset + size > reader->map.size) {
+            set_error(errbuf, "unexpected EOF");
+            return NULL;
+        }
+        return reader->map.data + offset;
+    }
+
+    // Resize compressed buffer
+    if (!zseek_buffer_resize(dctx->cbuf, size)) {
+        set_error(errbuf, "resize compressed buffer");
+        return NULL;
+    }
+    void *cbuf_data = zseek_buffer_data(dctx->cbuf);
+    assert(cbuf_data);
+
+    // Read compressed data
+    ssize_t _read = read_file(reader, cbuf_data, size, offset, call_data);
+    if (_read != (ssize_t)size) {
+        if (_read >= 0)
+            set_error(errbuf, "unexpected EOF");
+        else
+            // TODO OPT: Use errno if user_file.pread sets it
+            set_error(errbuf, "read file failed");
+        return NULL;
+    }
+
+    return cbuf_data;
+}
+
+/**
+ * Reads the compressed frame at index @p frame_idx, as read_frame_range()
+ */
+static const void *read_frame(zseek_reader_t *reader, zseek_dctx_t *dctx,
+    size_t frame_idx, const void *cdata, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    return read_frame_range(reader, dctx, frame_idx, 0,
+        frame_size_c(reader->st, frame_idx), cdata, call_data, errbuf);
+}
+
+/**
+ * Returns @p data rounded up to the alignment of reads of runs of frames
+ */
+static uint8_t *align_io(const zseek_reader_t *reader, void *data)
+{
+    uintptr_t mask = reader->io_alignment - 1;
+    return (uint8_t*)(((uintptr_t)data + mask) & ~mask);
+}
+
+/**
+ * Reads the run of compressed frames of @p plan into @p data, aligned,
+ * at the offset of the read in the file
+ */
+static bool read_plan(zseek_reader_t *reader, const zseek_plan_t *plan,
+    void *data, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    // NOTE: Aligned reads may be cut short past the last frame only
+    ssize_t _read = read_file(reader, data, zseek_plan_size(plan),
+        zseek_plan_offset(plan), call_data);
+    if (_read < (ssize_t)zseek_plan_needed(plan)) {
+        if (_read >= 0)
+            set_error(errbuf, "unexpected EOF");
+        else
+            // TODO OPT: Use errno if user_file.pread sets it
+            set_error(errbuf, "read file failed");
+        return false;
+    }
+
+    if (plan->nb_frames > 1)
+        __atomic_add_fetch(&reader->coalesced, 1, __ATOMIC_RELAXED);
+
+    return true;
+}
+
+/**
+ * Returns whether to read the compressed frame at index @p frame_idx, holding
+ * @p offset, along with adjacent ones, for a read of @p count bytes: unless
+ * cached, or only partly read through the block index
+ */
+static bool coalesce_frame(zseek_reader_t *reader, size_t count,
+    size_t offset, size_t frame_idx)
+{
+    zseek_frame_t *frame = zseek_cache_peek(reader->cache, reader->cache_user,
+        frame_idx);
+    if (frame) {
+        zseek_cache_release(reader->cache, frame);
+        return false;
+    }
+
+    // NOTE: Frames only partly read go through the cache if any
+    return !reader->bindex || reader->cache ||
+        (offset == (size_t)frame_offset_d(reader->st, frame_idx) &&
+            count >= frame_size_d(reader->st, frame_idx));
+}
+
+/**
+ * Plans in @p plan the read of the compressed frame at index @p frame_idx,
+ * holding @p offset, and of the adjacent ones after it, for a read of
+ * @p count bytes. Returns the number of frames planned, worth reading as a
+ * run only if more than one.
+ */
+static size_t plan_frames(zseek_reader_t *reader, zseek_plan_t *plan,
+    size_t count, size_t offset, size_t frame_idx)
+{
+    zseek_plan_init(plan, reader->max_io, reader->io_alignment);
+
+    size_t end = offset + count;
+    size_t nb_frames = seek_table_entries(reader->st);
+    for (size_t i = frame_idx; i < nb_frames; i++) {
+        size_t start = MAX(offset, (size_t)frame_offset_d(reader->st, i));
+        if (start >= end ||
+                !coalesce_frame(reader, end - start, start, i) ||
+                !zseek_plan_add(plan, frame_offset_c(reader->st, i),
+                    frame_size_c(reader->st, i)))
+            break;
+    }
+
+    return plan->nb_frames;
+}
+
+/**
+ * Decompress as with LZ4F_decompress, with the dictionary if there is one
+ */
+static size_t decompress_lz4(zseek_reader_t *reader, LZ4F_dctx *dctx,
+    void *dst, size_t *dst_size, const void *src, size_t *src_size,
+    const LZ4F_decompressOptions_t *opts)
+{
+#ifdef HAVE_LZ4F_DICT
+    if (reader->dict) {
+        return LZ4F_decompress_usingDict(dctx, dst, dst_size, src, src_size,
+            reader->dict, reader->dict_size, opts);
+    }
+#else
+    (void)reader;
+#endif
+    return LZ4F_decompress(dctx, dst, dst_size, src, src_size, opts);
+}
+
+/**
+ * Decompress the independent lz4 block @p src, of @p csize bytes, into
+ * @p dst, with the dictionary if there is one. Returns the decompressed size,
+ * or < 0 on error.
+ */
+static int decompress_block_lz4(zseek_reader_t *reader, void *dst,
+    size_t capacity, const void *src, size_t csize)
+{
+    // NOTE: Without a dictionary, the same as LZ4_decompress_safe()
+    return LZ4_decompress_safe_usingDict(src, dst, csize, capacity,
+        reader->dict, reader->dict_size);
+}
+
+/**
+ * Reads from the frame at index @p frame_idx as zseek_pread_lz4_no_cache(),
+ * but reads and decompresses the indexed blocks of the range read only
+ */
+static ssize_t pread_lz4_blocks(zseek_reader_t *reader, zseek_dctx_t *dctx,
+    void *buf, size_t count, size_t offset, size_t frame_idx,
+    const void *cdata, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    size_t offset_in_frame = offset - frame_offset_d(reader->st, frame_idx);
+    size_t frame_dsize = frame_size_d(reader->st, frame_idx);
+    size_t to_decompress = MIN(count, frame_dsize - offset_in_frame);
+    if (to_decompress == 0)
+        return 0;
+
+    size_t nb_blocks;
+    const uint32_t *blocks = zseek_bindex_blocks(reader->bindex, frame_idx,
+        &nb_blocks);
+    size_t block_size = zseek_bindex_block_size(reader->bindex);
+    size_t first = offset_in_frame / block_size;
+    size_t last = (offset_in_frame + to_decompress - 1) / block_size;
+    assert(last < nb_blocks);
+
+    // Read the compressed blocks only, up to the next one or the end mark
+    size_t start = blocks[first];
+    size_t end = last + 1 < nb_blocks ? blocks[last + 1] :
+        frame_size_c(reader->st, frame_idx);
+    const uint8_t *src = read_frame_range(reader, dctx, frame_idx, start,
+        end - start, cdata, call_data, errbuf);
+    if (!src)
+        return -1;
+
+    size_t buf_offset = 0;
+    for (size_t i = first; i <= last; i++) {
+        // NOTE: Checked when loading the index already, but a corrupt one
+        // must not make this underflow.
+        if (blocks[i] < start || end - blocks[i] < 4) {
+            set_error(errbuf, "invalid block index");
+            return -1;
+        }
+        const uint8_t *block = src + (blocks[i] - start);
+        size_t avail = end - blocks[i] - 4;
+        uint32_t header_le;
+        memcpy(&header_le, block, sizeof(header_le));
+        uint32_t header = le32toh(header_le);
+        size_t csize = header & ~LZ4_BLOCK_UNCOMPRESSED;
+        size_t dsize = MIN(block_size, frame_dsize - i * block_size);
+        if (header == 0 || csize > avail) {
+            set_error(errbuf, "invalid block");
+            return -1;
+        }
+
+        // Part of the block to copy out
+        size_t skip = i == first ? offset_in_frame - first * block_size : 0;
+        size_t len = MIN(dsize - skip, to_decompress - buf_offset);
+        uint8_t *dst = (uint8_t *)buf + buf_offset;
+
+        if (header & LZ4_BLOCK_UNCOMPRESSED) {
+            if (csize != dsize) {
+                set_error(errbuf, "invalid block");
+                return -1;
+            }
+            memcpy(dst, block + 4 + skip, len);
+        } else if (len == dsize) {
+            // Whole block, straight to the user
+            if (decompress_block_lz4(reader, dst, dsize, block + 4, csize) !=
+                (int)dsize) {
+                set_error(errbuf, "decompress block failed");
+                return -1;
+            }
+        } else {
+            if (!zseek_buffer_resize(dctx->dbuf, dsize)) {
+                set_error(errbuf, "resize discard buffer");
+                return -1;
+            }
+            void *dbuf_data = zseek_buffer_data(dctx->dbuf);
+            assert(dbuf_data);
+            if (decompress_block_lz4(reader, dbuf_data, dsize, block + 4,
+                csize) != (int)dsize) {
+                set_error(errbuf, "decompress block failed");
+                return -1;
+            }
+            memcpy(dst, (uint8_t *)dbuf_data + skip, len);
+        }
+        buf_offset += len;
+    }
+    assert(buf_offset == to_decompress);
+
+    return to_decompress;
+}
+
+static ssize_t zseek_pread_lz4_no_cache(zseek_reader_t *reader,
+    zseek_dctx_t *dctx, void *buf, size_t count, size_t offset,
+    size_t frame_idx, const void *cdata, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    // TODO OPT: Use the cache, only for reading?
+
+    if (reader->bindex)
+        return pread_lz4_blocks(reader, dctx, buf, count, offset, frame_idx,
+            cdata, call_data, errbuf);
+
+    size_t frame_csize = frame_size_c(reader->st, frame_idx);
+    const void *cbuf_data = read_frame(reader, dctx, frame_idx, cdata,
+        call_data, errbuf);
+    if (!cbuf_data)
+        return -1;
+
+    // Discard any excess leading data
+    size_t cbuf_offset = 0;
+    size_t offset_in_frame = offset - frame_offset_d(reader->st, frame_idx);
+    if (offset_in_frame > 0) {
+        // Resize discard buffer
+        if (!zseek_buffer_resize(dctx->dbuf, offset_in_frame)) {
+            set_error(errbuf, "resize discard buffer");
+            goto fail_w_reset;
+        }
+        void *dbuf_data = zseek_buffer_data(dctx->dbuf);
+        assert(dbuf_data);
+        // Decompress discard data
+        size_t dbuf_offset = 0;
+        size_t to_decompress = offset_in_frame;
+        do {
+            size_t csize = frame_csize - cbuf_offset;
+            size_t dsize = to_decompress - dbuf_offset;
+            LZ4F_decompressOptions_t opts = { .stableDst = 0 };
+            size_t r = decompress_lz4(reader, dctx->lz4,
+                (uint8_t*)dbuf_data + dbuf_offset, &dsize,
+                (const uint8_t*)cbuf_data + cbuf_offset, &csize,
+                &opts); // NOTE: Overwrites dsize, csize.
+            if (LZ4F_isError(r)) {
+                set_error(errbuf, "%s: %s", "decompress discard data",
+                    LZ4F_getErrorName(r));
+                goto fail_w_reset;
+            }
+            cbuf_offset += csize;
+            dbuf_offset += dsize;
+        } while (dbuf_offset < to_decompress);
+    }
+
+    // Decompress user data
+    size_t buf_offset = 0;
+    size_t frame_dsize = frame_size_d(reader->st, frame_idx);
+    size_t to_decompress = MIN(count, frame_dsize - offset_in_frame);
+    do {
+        size_t csize = frame_csize - cbuf_offset;
+        size_t dsize = to_decompress - buf_offset;
+        LZ4F_decompressOptions_t opts = { .stableDst = 0 };
+        size_t r = decompress_lz4(reader, dctx->lz4,
+            (uint8_t*)buf + buf_offset, &dsize,
+            (const uint8_t*)cbuf_data + cbuf_offset, &csize,
+            &opts); // NOTE: Overwrites dsize, csize.
+        if (LZ4F_isError(r)) {
+            set_error(errbuf, "%s: %s", "decompress user data",
+                LZ4F_getErrorName(r));
+            goto fail_w_reset;
+        }
+        cbuf_offset += csize;
+        buf_offset += dsize;
+    } while (buf_offset < to_decompress);
+
+    if (cbuf_offset < frame_csize) {
+        // Did not consume the whole frame, clean up decompression context
+        LZ4F_resetDecompressionContext(dctx->lz4);
+    }
+
+    return to_decompress;
+
+fail_w_reset:
+    LZ4F_resetDecompressionContext(dctx->lz4);
+    return -1;
+}
+
+static ssize_t zseek_pread_zstd_no_cache(zseek_reader_t *reader,
+    zseek_dctx_t *dctx, void *buf, size_t count, size_t offset,
+    size_t frame_idx, const void *cdata, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    size_t frame_csize = frame_size_c(reader->st, frame_idx);
+    const void *cbuf_data = read_frame(reader, dctx, frame_idx, cdata,
+        call_data, errbuf);
+    if (!cbuf_data)
+        return -1;
+    ZSTD_inBuffer in = {cbuf_data, frame_csize, 0};
+
+    // Discard any excess leading data, a chunk at a time
+    size_t offset_in_frame = offset - frame_offset_d(reader->st, frame_idx);
+    if (offset_in_frame > 0) {
+        // NOTE: Bounded, so that reads far into large frames take no more
+        // memory than those near the start
+        size_t chunk = MIN(offset_in_frame, ZSTD_DStreamOutSize());
+        if (!zseek_buffer_resize(dctx->dbuf, chunk)) {
+            set_error(errbuf, "resize discard buffer");
+            goto fail_w_reset;
+        }
+        void *dbuf_data = zseek_buffer_data(dctx->dbuf);
+        assert(dbuf_data);
+        size_t discarded = 0;
+        do {
+            ZSTD_outBuffer out = {dbuf_data,
+                MIN(chunk, offset_in_frame - discarded), 0};
+            size_t r = ZSTD_decompressStream(dctx->zstd, &out, &in);
+            if (ZSTD_isError(r)) {
+                set_error(errbuf, "%s: %s", "decompress discard data",
+                    ZSTD_getErrorName(r));
+                goto fail_w_reset;
+            }
+            if (out.pos == 0 && in.pos == in.size) {
+                set_error(errbuf, "truncated frame");
+                goto fail_w_reset;
+            }
+            discarded += out.pos;
+        } while (discarded < offset_in_frame);
+    }
+
+    // Decompress user data, and stop there
+    size_t frame_dsize = frame_size_d(reader->st, frame_idx);
+    size_t to_decompress = MIN(count, frame_dsize - offset_in_frame);
+    ZSTD_outBuffer out = {buf, to_decompress, 0};
+    while (out.pos < out.size) {
+        size_t prev_pos = out.pos;
+        size_t r = ZSTD_decompressStream(dctx->zstd, &out, &in);
+        if (ZSTD_isError(r)) {
+            set_error(errbuf, "%s: %s", "decompress user data",
+                ZSTD_getErrorName(r));
+            goto fail_w_reset;
+        }
+        if (out.pos == prev_pos && in.pos == in.size) {
+            set_error(errbuf, "truncated frame");
+            goto fail_w_reset;
+        }
+    }
+
+    // Most likely did not consume the whole frame
+    ZSTD_DCtx_reset(dctx->zstd, ZSTD_reset_session_only);
+
+    return to_decompress;
+
+fail_w_reset:
+    ZSTD_DCtx_reset(dctx->zstd, ZSTD_reset_session_only);
+    return -1;
+}
+
+static bool decompress_frame_zstd(ZSTD_DCtx *dctx, void *dst,
+    size_t dst_size, const void *src, size_t src_size,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    size_t r = ZSTD_decompressDCtx(dctx, dst, dst_size, src, src_size);
+    if (ZSTD_isError(r)) {
+        set_error(errbuf, "%s: %s", "decompress frame", ZSTD_getErrorName(r));
+        return false;
+    }
+
+    return true;
+}
+
+static bool decompress_frame_lz4(zseek_reader_t *reader, LZ4F_dctx *dctx,
+    void *dst, size_t dst_size, const void *src, size_t src_size,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    size_t src_offset = 0;
+    size_t dst_offset = 0;
+    size_t r = 0;
+    do {
+        size_t csize = src_size - src_offset;
+        size_t dsize = dst_size - dst_offset;
+        LZ4F_decompressOptions_t opts = { .stableDst = 0 };
+        // NOTE: In theory, LZ4F_decompress may not finish the whole frame in
+        // one call (r > 0). In practice, this does not happen given enough
+        // room in the output buffer (e.g. here).
+        r = decompress_lz4(reader, dctx,
+            (uint8_t*)dst + dst_offset, &dsize,
+            (const uint8_t*)src + src_offset, &csize,
+            &opts); // NOTE: Overwrites dsize, csize.
+        if (LZ4F_isError(r)) {
+            set_error(errbuf, "%s: %s", "decompress frame",
+                LZ4F_getErrorName(r));
+            LZ4F_resetDecompressionContext(dctx);
+            return false;
+        }
+        src_offset += csize;
+        dst_offset += dsize;
+    } while (r > 0);
+
+    return true;
+}
+
+/**
+ * Decompresses the whole frame in @p src into @p dst, with @p dctx.
+ */
+static bool decompress_frame(zseek_reader_t *reader, zseek_dctx_t *dctx,
+    void *dst, size_t dst_size, const void *src, size_t src_size,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    switch (reader->type) {
+    case ZSEEK_ZSTD:
+        return decompress_frame_zstd(dctx->zstd, dst, dst_size, src,
+            src_size, errbuf);
+    case ZSEEK_LZ4:
+        return decompress_frame_lz4(reader, dctx->lz4, dst, dst_size, src,
+            src_size, errbuf);
+    default:
+        // BUG
+        assert(false);
+        return false;
+    }
+}
+
+/**
+ * Reads (unless @p cdata is the compressed frame) and decompresses the frame
+ * at index @p frame_idx, and caches it. Returns it pinned in the cache, or
+ * @p uncached if the cache has no room for it, or @a NULL on error.
+ */
+static zseek_frame_t *load_frame(zseek_reader_t *reader, size_t frame_idx,
+    zseek_frame_t *uncached, const void *cdata, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    zseek_dctx_t *dctx = get_dctx(reader, errbuf);
+    if (!dctx)
+        goto fail;
+
+    size_t frame_csize = frame_size_c(reader->st, frame_idx);
+    const void *cbuf_data = read_frame(reader, dctx, frame_idx, cdata,
+        call_data, errbuf);
+    if (!cbuf_data)
+        goto fail_w_dctx;
+
+    // Decompress frame
+    size_t frame_dsize = frame_size_d(reader->st, frame_idx);
+    bool hit;
+    void *dbuf = zseek_frame_pool_get(reader->pool, frame_dsize, &hit);
+    if (!dbuf) {
+        set_error_with_errno(errbuf, "allocate decompressed buffer", errno);
+        goto fail_w_dctx;
+    }
+    __atomic_add_fetch(hit ? &reader->pool_hits : &reader->pool_misses, 1,
+        __ATOMIC_RELAXED);
+    if (!decompress_frame(reader, dctx, dbuf, frame_dsize, cbuf_data,
+            frame_csize, errbuf))
+        goto fail_w_dbuf;
+    put_dctx(reader, dctx);
+
+    // Cache frame
+    *uncached = (zseek_frame_t){dbuf, frame_idx, frame_dsize};
+    zseek_frame_t *frame = zseek_cache_insert(reader->cache, reader->cache_user,
+        *uncached);
+    // NOTE: Every frame it could evict is in use, so serve this one without
+    // caching it.
+    return frame ? frame : uncached;
+
+fail_w_dbuf:
+    zseek_frame_pool_put(reader->pool, dbuf, frame_dsize);
+fail_w_dctx:
+    put_dctx(reader, dctx);
+fail:
+    return NULL;
+}
+
+/**
+ * Same as get_frame(), after a miss on the frame, already counted
+ */
+static zseek_frame_t *fetch_frame(zseek_reader_t *reader, size_t frame_idx,
+    zseek_frame_t *uncached, const void *cdata, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    zseek_frame_t *frame = NULL;
+    while (!frame) {
+        zseek_flight_t flight;
+        if (!zseek_flights_join(reader->flights, frame_idx, &flight)) {
+            // Landed, unless the leader failed or could not cache it
+            frame = zseek_cache_peek(reader->cache, reader->cache_user,
+                frame_idx);
+            continue;
+        }
+
+        // Might have landed between the lookup and joining
+        frame = zseek_cache_peek(reader->cache, reader->cache_user,
+            frame_idx);
+        if (!frame)
+            frame = load_frame(reader, frame_idx, uncached, cdata,
+                call_data, errbuf);
+        zseek_flights_land(reader->flights, &flight);
+        if (!frame)
+            return NULL;
+    }
+
+    return frame;
+}
+
+/**
+ * Returns the frame at index @p frame_idx, pinned in the cache, or @p uncached
+ * if the cache has no room for it. Returns @a NULL on error. See load_frame()
+ * for @p cdata.
+ */
+static zseek_frame_t *get_frame(zseek_reader_t *reader, size_t frame_idx,
+    zseek_frame_t *uncached, const void *cdata, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    // NOTE: Hits take no lock. Misses on a frame wait for a single read to
+    // decompress it, while misses on different frames proceed in parallel.
+    zseek_frame_t *frame = zseek_cache_find(reader->cache, reader->cache_user,
+        frame_idx);
+    if (frame)
+        return frame;
+
+    return fetch_frame(reader, frame_idx, uncached, cdata, call_data, errbuf);
+}
+
+/**
+ * Undo get_frame()
+ */
+static void put_frame(zseek_reader_t *reader, zseek_frame_t *frame,
+    const zseek_frame_t *uncached)
+{
+    if (frame == uncached)
+        zseek_frame_pool_put(reader->pool, frame->data, frame->len);
+    else
+        zseek_cache_release(reader->cache, frame);
+}
+
+static ssize_t zseek_pread_cached(zseek_reader_t *reader, void *buf,
+    size_t count, size_t offset, size_t frame_idx, const void *cdata,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    zseek_frame_t uncached = {NULL, 0, 0};
+    zseek_frame_t *frame = get_frame(reader, frame_idx, &uncached, cdata,
+        call_data, errbuf);
+    if (!frame)
+        return -1;
+
+    size_t offset_in_frame = offset - frame_offset_d(reader->st, frame_idx);
+    size_t to_copy = MIN(count, frame->len - offset_in_frame);
+    memcpy(buf, (uint8_t*)frame->data + offset_in_frame, to_copy);
+
+    put_frame(reader, frame, &uncached);
+
+    return to_copy;
+}
+
+/**
+ * Reads from the frame at index @p frame_idx, holding @p offset, without a
+ * cache, with @p dctx. Frames read whole are decompressed straight into
+ * @p buf, others only up to the end of the read.
+ */
+static ssize_t pread_no_cache(zseek_reader_t *reader, zseek_dctx_t *dctx,
+    void *buf, size_t count, size_t offset, size_t frame_idx,
+    const void *cdata, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    size_t frame_dsize = frame_size_d(reader->st, frame_idx);
+    if (offset == (size_t)frame_offset_d(reader->st, frame_idx) &&
+            count >= frame_dsize && frame_dsize > 0) {
+        const void *cbuf_data = read_frame(reader, dctx, frame_idx, cdata,
+            call_data, errbuf);
+        if (!cbuf_data)
+            return -1;
+        if (!decompress_frame(reader, dctx, buf, frame_dsize, cbuf_data,
+                frame_size_c(reader->st, frame_idx), errbuf))
+            return -1;
+        return frame_dsize;
+    }
+
+    switch (reader->type) {
+    case ZSEEK_ZSTD:
+        return zseek_pread_zstd_no_cache(reader, dctx, buf, count, offset,
+            frame_idx, cdata, call_data, errbuf);
+    case ZSEEK_LZ4:
+        return zseek_pread_lz4_no_cache(reader, dctx, buf, count, offset,
+            frame_idx, cdata, call_data, errbuf);
+    default:
+        // BUG
+        assert(false);
+        return -1;
+    }
+}
+
+/**
+ * Returns whether to read the frame at index @p frame_idx, holding @p offset,
+ * straight into the read buffer instead of through the cache
+ */
+static bool bypass_cache(const zseek_reader_t *reader, size_t count,
+    size_t offset, size_t frame_idx)
+{
+    if (reader->admission != ZSEEK_ADMIT_PARTIAL)
+        return false;
+
+    // Read whole
+    return offset == (size_t)frame_offset_d(reader->st, frame_idx) &&
+        count >= frame_size_d(reader->st, frame_idx);
+}
+
+/**
+ * Reads from the frame at index @p frame_idx, holding @p offset, as
+ * pread_no_cache(), unless the frame is cached, in which case it is copied
+ * from there. Takes a context from the pool into @p dctx if it has none, to
+ * put back by the caller.
+ */
+static ssize_t pread_direct(zseek_reader_t *reader, zseek_dctx_t **dctx,
+    void *buf, size_t count, size_t offset, size_t frame_idx,
+    const void *cdata, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (reader->cache) {
+        zseek_frame_t *frame = zseek_cache_find(reader->cache,
+            reader->cache_user, frame_idx);
+        if (frame) {
+            size_t offset_in_frame = offset -
+                frame_offset_d(reader->st, frame_idx);
+            size_t to_copy = MIN(count, frame->len - offset_in_frame);
+            memcpy(buf, (uint8_t*)frame->data + offset_in_frame, to_copy);
+            zseek_cache_release(reader->cache, frame);
+            return to_copy;
+        }
+        __atomic_add_fetch(&reader->bypasses, 1, __ATOMIC_RELAXED);
+    }
+
+    if (!*dctx) {
+        *dctx = get_dctx(reader, errbuf);
+        if (!*dctx)
+            return -1;
+    }
+
+    return pread_no_cache(reader, *dctx, buf, count, offset, frame_idx,
+        cdata, call_data, errbuf);
+}
+
+/**
+ * Reads from the frame at index @p frame_idx, holding @p offset, as
+ * zseek_pread() but cut short at the end of the frame, from @p cdata if the
+ * compressed frame was read ahead
+ */
+static ssize_t pread_frame(zseek_reader_t *reader, void *buf, size_t count,
+    size_t offset, size_t frame_idx, const void *cdata, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (reader->cache && !bypass_cache(reader, count, offset, frame_idx))
+        return zseek_pread_cached(reader, buf, count, offset, frame_idx,
+            cdata, call_data, errbuf);
+
+    zseek_dctx_t *dctx = NULL;
+    ssize_t ret = pread_direct(reader, &dctx, buf, count, offset, frame_idx,
+        cdata, call_data, errbuf);
+    if (dctx)
+        put_dctx(reader, dctx);
+
+    return ret;
+}
+
+/**
+ * Reads the run of compressed frames of @p plan into the staging buffer of
+ * @p dctx, taken from the pool if it has none as with pread_direct(), and
+ * returns the start of the read, or @a NULL on error
+ */
+static const uint8_t *stage_plan(zseek_reader_t *reader, zseek_dctx_t **dctx,
+    const zseek_plan_t *plan, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!*dctx) {
+        *dctx = get_dctx(reader, errbuf);
+        if (!*dctx)
+            return NULL;
+    }
 
-    switch (reader->type) {
-    case ZSEEK_ZSTD:
-        return zseek_reader_close_zstd(reader, call_data, errbuf);
-    case ZSEEK_LZ4:
-        return zseek_reader_close_lz4(reader, call_data, errbuf);
-    default:
-        // BUG
-        assert(false);
-        return false;
+    if (!zseek_buffer_resize((*dctx)->sbuf,
+            zseek_plan_size(plan) + reader->io_alignment - 1)) {
+        set_error(errbuf, "resize staging buffer");
+        return NULL;
     }
+    uint8_t *data = align_io(reader, zseek_buffer_data((*dctx)->sbuf));
+    if (!read_plan(reader, plan, data, call_data, errbuf))
+        return NULL;
+
+    return data;
 }
 
-static ssize_t zseek_pread_zstd(zseek_reader_t *reader, void *buf, size_t count,
+ssize_t zseek_pread(zseek_reader_t *reader, void *buf, size_t count,
     size_t offset, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
 {
-    // TODO: Try to return as much as possible (multiple frames).
+    if (!reader) {
+        set_error(errbuf, "invalid reader");
+        return false;
+    }
 
     ssize_t frame_idx = offset_to_frame_idx(reader->st, offset);
     if (frame_idx == -1)
         return 0;
 
-    int pr = pthread_rwlock_rdlock(&reader->lock);
-    if (pr) {
-        set_error_with_errno(errbuf, "lock for reading", pr);
-        goto fail;
+    // NOTE: Frames are looked up once, then read in turn. Those not read
+    // through the cache share a single context. Runs of adjacent compressed
+    // frames missing from the cache are read at once, into its staging
+    // buffer.
+    zseek_dctx_t *dctx = NULL;
+    zseek_plan_t plan;
+    const uint8_t *staged = NULL;
+    size_t staged_end = frame_idx;  // past the last frame staged
+    size_t nb_frames = seek_table_entries(reader->st);
+    size_t done = 0;
+    ssize_t ret = 0;
+    for (size_t i = frame_idx; i < nb_frames && done < count; i++) {
+        uint8_t *dst = (uint8_t*)buf + done;
+        size_t frame_end = frame_offset_d(reader->st, i) +
+            frame_size_d(reader->st, i);
+        if (i >= staged_end && !reader->map.data &&
+                offset + count > frame_end &&
+                plan_frames(reader, &plan, count - done, offset + done,
+                    i) > 1) {
+            staged = stage_plan(reader, &dctx, &plan, call_data, errbuf);
+            if (!staged) {
+                ret = -1;
+                break;
+            }
+            staged_end = i + plan.nb_frames;
+        }
+        const void *cdata = i < staged_end ? staged +
+            (frame_offset_c(reader->st, i) - zseek_plan_offset(&plan)) :
+            NULL;
+
+        if (reader->cache &&
+                !bypass_cache(reader, count - done, offset + done, i))
+            ret = zseek_pread_cached(reader, dst, count - done,
+                offset + done, i, cdata, call_data, errbuf);
+        else
+            ret = pread_direct(reader, &dctx, dst, count - done,
+                offset + done, i, cdata, call_data, errbuf);
+        if (ret == -1)
+            break;
+        done += ret;
     }
 
-    void *dbuf = NULL;
-    zseek_frame_t frame = zseek_cache_find(reader->cache, frame_idx);
-    if (!frame.data) {
-        // Upgrade to write lock
-        pr = pthread_rwlock_unlock(&reader->lock);
-        if (pr) {
-            set_error_with_errno(errbuf, "unlock to upgrade", pr);
-            goto fail;
-        }
-        pr = pthread_rwlock_wrlock(&reader->lock);
-        if (pr) {
-            set_error_with_errno(errbuf, "lock for writing", pr);
-            goto fail;
-        }
+    if (dctx)
+        put_dctx(reader, dctx);
 
-        frame = zseek_cache_find(reader->cache, frame_idx);
-        if (!frame.data) {
-            // Resize compressed buffer
-            size_t frame_csize = frame_size_c(reader->st, frame_idx);
-            if (!zseek_buffer_resize(reader->cbuf, frame_csize)) {
-                set_error(errbuf, "resize compressed buffer");
-                goto fail_w_lock;
-            }
-            void *cbuf_data = zseek_buffer_data(reader->cbuf);
-            assert(cbuf_data);
-
-            // Read compressed frame
-            off_t frame_offset = frame_offset_c(reader->st, frame_idx);
-            ssize_t _read = reader->user_file.pread(cbuf_data, frame_csize,
-                (size_t)frame_offset, reader->user_file.user_data, call_data);
-            if (_read != (ssize_t)frame_csize) {
-                if (_read >= 0)
-                    set_error(errbuf, "unexpected EOF");
-                else
-                    // TODO OPT: Use errno if user_file.pread sets it
-                    set_error(errbuf, "read file failed");
-                goto fail_w_lock;
-            }
+    // NOTE: Cut short by an error past the first frame, which the next read
+    // then reports
+    return ret == -1 && done == 0 ? -1 : (ssize_t)done;
+}
 
-            // Decompress frame
-            size_t frame_dsize = frame_size_d(reader->st, frame_idx);
-            dbuf = malloc(frame_dsize);
-            if (!dbuf) {
-                set_error_with_errno(errbuf, "allocate decompressed buffer",
-                    errno);
-                goto fail_w_lock;
-            }
-            size_t r = ZSTD_decompressDCtx(reader->dctx_zstd, dbuf, frame_dsize,
-                cbuf_data, frame_csize);
-            if (ZSTD_isError(r)) {
-                set_error(errbuf, "%s: %s", "decompress frame",
-                    ZSTD_getErrorName(r));
-                goto fail_w_dbuf;
-            }
+/**
+ * Maximum compressed size of the frames of a batched read decompressed at
+ * once, but for a single larger frame
+ */
+#define BATCH_WINDOW_SIZE (32 << 20)
+
+/**
+ * Splits @p range in pieces within frames, into @p pieces if not @a NULL.
+ * Returns the number of pieces, and the number of bytes they cover in
+ * @p size.
+ */
+static size_t split_range(ZSTD_seekTable *st, const zseek_range_t *range,
+    zseek_piece_t *pieces, size_t *size)
+{
+    *size = 0;
+    ssize_t frame_idx = offset_to_frame_idx(st, range->offset);
+    if (frame_idx == -1)
+        return 0;
 
-            // Cache frame
-            frame.data = dbuf;
-            frame.idx = frame_idx;
-            frame.len = frame_dsize;
-            if (!zseek_cache_insert(reader->cache, frame)) {
-                set_error(errbuf, "frame caching failed");
-                goto fail_w_dbuf;
-            }
+    size_t nb_frames = seek_table_entries(st);
+    size_t nb_pieces = 0;
+    for (size_t i = frame_idx; i < nb_frames && *size < range->count; i++) {
+        size_t offset = range->offset + *size;
+        size_t offset_in_frame = offset - frame_offset_d(st, i);
+        size_t count = MIN(range->count - *size,
+            frame_size_d(st, i) - offset_in_frame);
+        if (count == 0)
+            continue;
+
+        if (pieces)
+            pieces[nb_pieces] = (zseek_piece_t){i,
+                (uint8_t*)range->buf + *size, count, offset};
+        nb_pieces++;
+        *size += count;
+    }
+
+    return nb_pieces;
+}
+
+static int compare_pieces(const void *a, const void *b)
+{
+    const zseek_piece_t *pa = a;
+    const zseek_piece_t *pb = b;
+
+    if (pa->frame_idx != pb->frame_idx)
+        return pa->frame_idx < pb->frame_idx ? -1 : 1;
+    return (pa->offset > pb->offset) - (pa->offset < pb->offset);
+}
+
+/**
+ * Copies @p pieces of a frame from its decompressed @p data
+ */
+static void copy_pieces(zseek_reader_t *reader, const void *data,
+    const zseek_piece_t *pieces, size_t nb_pieces)
+{
+    for (size_t i = 0; i < nb_pieces; i++) {
+        const zseek_piece_t *piece = &pieces[i];
+        size_t offset_in_frame = piece->offset -
+            frame_offset_d(reader->st, piece->frame_idx);
+        memcpy(piece->buf, (const uint8_t*)data + offset_in_frame,
+            piece->count);
+    }
+}
+
+/**
+ * Decompresses frame @p bf of a batched read for its pieces, through the
+ * cache unless bypassed. Takes a context from the pool into @p dctx if it
+ * needs one and has none, to put back by the caller.
+ */
+static bool read_batch_frame(zseek_reader_t *reader, zseek_dctx_t **dctx,
+    const zseek_batch_frame_t *bf, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    const zseek_piece_t *piece = bf->pieces;
+    size_t frame_idx = piece->frame_idx;
+
+    // NOTE: A single piece is streamed only up to its end, or decompressed
+    // straight into its buffer if whole
+    if (bf->nb_pieces == 1 && (!reader->cache ||
+            bypass_cache(reader, piece->count, piece->offset, frame_idx))) {
+        if (reader->cache)
+            __atomic_add_fetch(&reader->bypasses, 1, __ATOMIC_RELAXED);
+        if (!*dctx) {
+            *dctx = get_dctx(reader, errbuf);
+            if (!*dctx)
+                return false;
         }
+        return pread_no_cache(reader, *dctx, piece->buf, piece->count,
+            piece->offset, frame_idx, bf->cdata, call_data, errbuf) != -1;
     }
 
-    size_t offset_in_frame = offset - frame_offset_d(reader->st, frame_idx);
-    size_t to_copy = MIN(count, frame.len - offset_in_frame);
-    memcpy(buf, (uint8_t*)frame.data + offset_in_frame, to_copy);
+    // NOTE: The miss was counted when grouping pieces
+    zseek_frame_t uncached = {NULL, 0, 0};
+    zseek_frame_t *frame = reader->cache ?
+        fetch_frame(reader, frame_idx, &uncached, bf->cdata, call_data,
+            errbuf) :
+        load_frame(reader, frame_idx, &uncached, bf->cdata, call_data,
+            errbuf);
+    if (!frame)
+        return false;
+    copy_pieces(reader, frame->data, bf->pieces, bf->nb_pieces);
+    put_frame(reader, frame, &uncached);
 
-    pr = pthread_rwlock_unlock(&reader->lock);
-    if (pr) {
-        set_error_with_errno(errbuf, "unlock", pr);
+    return true;
+}
+
+/**
+ * Plans in @p plan the read of the compressed frames of a batched read from
+ * @p frames[first], up to @p nb_frames. Returns the index past the last one
+ * planned.
+ */
+static size_t plan_batch_frames(zseek_reader_t *reader, zseek_plan_t *plan,
+    const zseek_batch_frame_t *frames, size_t first, size_t nb_frames)
+{
+    zseek_plan_init(plan, reader->max_io, reader->io_alignment);
+
+    size_t i = first;
+    while (i < nb_frames) {
+        size_t frame_idx = frames[i].pieces->frame_idx;
+        if (!zseek_plan_add(plan, frame_offset_c(reader->st, frame_idx),
+                frame_size_c(reader->st, frame_idx)))
+            break;
+        i++;
+    }
+
+    return i;
+}
+
+/**
+ * Reads the compressed @p frames of a batched read into @p cbuf, with a single
+ * read per run of adjacent frames, as planned by plan_batch_frames(), and
+ * points them at their data
+ */
+static bool read_batch_frames(zseek_reader_t *reader,
+    zseek_batch_frame_t *frames, size_t nb_frames, zseek_buffer_t *cbuf,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    // NOTE: Planned twice, to size the buffer first
+    zseek_plan_t plan;
+    size_t size = 0;
+    for (size_t i = 0; i < nb_frames; ) {
+        i = plan_batch_frames(reader, &plan, frames, i, nb_frames);
+        size += zseek_plan_size(&plan) + reader->io_alignment - 1;
+    }
+    if (!zseek_buffer_resize(cbuf, size)) {
+        set_error(errbuf, "resize compressed buffer");
+        return false;
+    }
+    uint8_t *data = zseek_buffer_data(cbuf);
+
+    for (size_t i = 0, j; i < nb_frames; i = j) {
+        j = plan_batch_frames(reader, &plan, frames, i, nb_frames);
+        data = align_io(reader, data);
+        if (!read_plan(reader, &plan, data, call_data, errbuf))
+            return false;
+
+        for (size_t k = i; k < j; k++)
+            frames[k].cdata = data + (frame_offset_c(reader->st,
+                frames[k].pieces->frame_idx) - zseek_plan_offset(&plan));
+        data += zseek_plan_size(&plan);
+    }
+
+    return true;
+}
+
+static zseek_batch_t *new_batch(zseek_reader_t *reader,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    zseek_batch_t *batch = zseek_alloc(&reader->allocator, sizeof(*batch));
+    if (!batch) {
+        set_error_with_errno(errbuf, "allocate batch", errno);
         goto fail;
     }
+    memset(batch, 0, sizeof(*batch));
+    batch->refs = 1;
 
-    return to_copy;
+    if (pthread_mutex_init(&batch->lock, NULL)) {
+        set_error(errbuf, "batch mutex initialization failed");
+        goto fail_w_batch;
+    }
+    if (pthread_cond_init(&batch->done_cond, NULL)) {
+        set_error(errbuf, "batch condition initialization failed");
+        goto fail_w_lock;
+    }
+
+    return batch;
 
-fail_w_dbuf:
-    free(dbuf);
 fail_w_lock:
-    pthread_rwlock_unlock(&reader->lock);
+    pthread_mutex_destroy(&batch->lock);
+fail_w_batch:
+    zseek_free(&reader->allocator, batch);
 fail:
-    return -1;
+    return NULL;
 }
 
-static ssize_t zseek_pread_lz4_no_cache(zseek_reader_t *reader, void *buf,
-    size_t count, size_t offset, void *call_data,
+/**
+ * Drops a reference to @p batch, with its lock held, and frees it if last
+ */
+static void leave_batch(zseek_reader_t *reader, zseek_batch_t *batch)
+{
+    bool last = --batch->refs == 0;
+    pthread_mutex_unlock(&batch->lock);
+    if (!last)
+        return;
+
+    pthread_cond_destroy(&batch->done_cond);
+    pthread_mutex_destroy(&batch->lock);
+    zseek_free(&reader->allocator, batch);
+}
+
+/**
+ * Claims and decompresses frames of @p batch until none is left, with its
+ * lock held on entry and return
+ */
+static void run_batch(zseek_reader_t *reader, zseek_batch_t *batch,
+    void *call_data)
+{
+    zseek_dctx_t *dctx = NULL;
+    while (!batch->failed && batch->next < batch->nb_frames) {
+        const zseek_batch_frame_t *bf = &batch->frames[batch->next++];
+        pthread_mutex_unlock(&batch->lock);
+
+        char errbuf[ZSEEK_ERRBUF_SIZE] = "";
+        bool ok = read_batch_frame(reader, &dctx, bf, call_data, errbuf);
+
+        pthread_mutex_lock(&batch->lock);
+        if (!ok && !batch->failed) {
+            batch->failed = true;
+            memcpy(batch->errbuf, errbuf, sizeof(errbuf));
+        }
+        if (++batch->done == batch->next)
+            pthread_cond_signal(&batch->done_cond);
+    }
+
+    if (dctx)
+        put_dctx(reader, dctx);
+}
+
+/**
+ * Helps the caller of a batched read, on a worker thread
+ */
+static void help_batch(zseek_reader_t *reader, zseek_batch_t *batch)
+{
+    pthread_mutex_lock(&batch->lock);
+    batch->queued--;
+    // NOTE: No per-call data to pass to I/O callbacks, which frames read
+    // ahead or mapped do not need
+    run_batch(reader, batch, NULL);
+    leave_batch(reader, batch);
+}
+
+/**
+ * Decompresses @p frames of a batched read in parallel, the caller taking
+ * part, with as many helpers as workers of asynchronous reads at most
+ */
+static bool run_batch_window(zseek_reader_t *reader, zseek_batch_t *batch,
+    const zseek_batch_frame_t *frames, size_t nb_frames, void *call_data,
     char errbuf[ZSEEK_ERRBUF_SIZE])
 {
-    // TODO OPT: Use the cache, only for reading?
+    // NOTE: Helpers still queued from the previous window help this one
+    pthread_mutex_lock(&batch->lock);
+    batch->frames = frames;
+    batch->nb_frames = nb_frames;
+    batch->next = 0;
+    batch->done = 0;
+    size_t wanted = MIN(reader->async_workers, nb_frames - 1);
+    size_t nb_helpers = wanted > batch->queued ? wanted - batch->queued : 0;
+    batch->queued += nb_helpers;
+    batch->refs += nb_helpers;
+    pthread_mutex_unlock(&batch->lock);
+
+    for (size_t i = 0; i < nb_helpers; i++) {
+        zseek_async_read_t *read = zseek_alloc(&reader->allocator,
+            sizeof(*read));
+        if (!read) {
+            // NOTE: Fewer helpers only
+            pthread_mutex_lock(&batch->lock);
+            batch->queued -= nb_helpers - i;
+            batch->refs -= nb_helpers - i;
+            pthread_mutex_unlock(&batch->lock);
+            break;
+        }
+        *read = (zseek_async_read_t){.batch = batch};
+        zseek_aio_submit(reader->aio, &read->req);
+    }
 
-    ssize_t frame_idx = offset_to_frame_idx(reader->st, offset);
-    if (frame_idx == -1)
-        return 0;
+    pthread_mutex_lock(&batch->lock);
+    run_batch(reader, batch, call_data);
+    while (batch->done < batch->next)
+        pthread_cond_wait(&batch->done_cond, &batch->lock);
+    batch->frames = NULL;
+    batch->nb_frames = 0;
+    bool ok = !batch->failed;
+    if (!ok)
+        set_error(errbuf, "%s", batch->errbuf);
+    pthread_mutex_unlock(&batch->lock);
+
+    return ok;
+}
 
-    int pr = pthread_rwlock_wrlock(&reader->lock);
-    if (pr) {
-        set_error_with_errno(errbuf, "lock for writing", pr);
-        goto fail;
+bool zseek_preadv_batch(zseek_reader_t *reader, const zseek_range_t *ranges,
+    size_t nb_ranges, size_t *done, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!reader) {
+        set_error(errbuf, "invalid reader");
+        return false;
     }
 
-    // Resize compressed buffer
-    size_t frame_csize = frame_size_c(reader->st, frame_idx);
-    if (!zseek_buffer_resize(reader->cbuf, frame_csize)) {
-        set_error(errbuf, "resize compressed buffer");
-        goto fail_w_lock;
+    if (!ranges && nb_ranges > 0) {
+        set_error(errbuf, "invalid ranges");
+        return false;
     }
-    void *cbuf_data = zseek_buffer_data(reader->cbuf);
-    assert(cbuf_data);
-    // Read compressed frame
-    off_t frame_offset = frame_offset_c(reader->st, frame_idx);
-    ssize_t _read = reader->user_file.pread(cbuf_data, frame_csize,
-        (size_t)frame_offset, reader->user_file.user_data, call_data);
-    if (_read != (ssize_t)frame_csize) {
-        if (_read >= 0)
-            set_error(errbuf, "unexpected EOF");
-        else
-            // TODO OPT: Use errno if user_file.pread sets it
-            set_error(errbuf, "read file failed");
-        goto fail_w_lock;
+
+    // Split ranges in pieces within frames
+    size_t nb_pieces = 0;
+    for (size_t i = 0; i < nb_ranges; i++) {
+        size_t size;
+        nb_pieces += split_range(reader->st, &ranges[i], NULL, &size);
+        if (done)
+            done[i] = size;
     }
+    if (nb_pieces == 0)
+        return true;
 
-    // Discard any excess leading data
-    size_t cbuf_offset = 0;
-    size_t offset_in_frame = offset - frame_offset_d(reader->st, frame_idx);
-    if (offset_in_frame > 0) {
-        // Resize discard buffer
-        if (!zseek_buffer_resize(reader->dbuf, offset_in_frame)) {
-            set_error(errbuf, "resize discard buffer");
-            goto fail_w_lock;
+    zseek_piece_t *pieces = zseek_alloc(&reader->allocator,
+        nb_pieces * (sizeof(*pieces) + sizeof(zseek_batch_frame_t)));
+    if (!pieces) {
+        set_error_with_errno(errbuf, "allocate batch pieces", errno);
+        goto fail;
+    }
+    zseek_batch_frame_t *frames = (zseek_batch_frame_t*)(pieces + nb_pieces);
+    for (size_t i = 0, n = 0; i < nb_ranges; i++) {
+        size_t size;
+        n += split_range(reader->st, &ranges[i], pieces + n, &size);
+    }
+
+    // Group pieces by frame, copying those of cached frames right away
+    qsort(pieces, nb_pieces, sizeof(*pieces), compare_pieces);
+    size_t nb_frames = 0;
+    for (size_t i = 0, j; i < nb_pieces; i = j) {
+        for (j = i + 1; j < nb_pieces &&
+                pieces[j].frame_idx == pieces[i].frame_idx; j++)
+            ;
+        zseek_frame_t *frame = zseek_cache_find(reader->cache,
+            reader->cache_user, pieces[i].frame_idx);
+        if (frame) {
+            copy_pieces(reader, frame->data, &pieces[i], j - i);
+            zseek_cache_release(reader->cache, frame);
+        } else
+            frames[nb_frames++] = (zseek_batch_frame_t){&pieces[i], j - i,
+                NULL};
+    }
+    if (nb_frames == 0)
+        goto out;
+
+    zseek_batch_t *batch = new_batch(reader, errbuf);
+    if (!batch)
+        goto fail_w_pieces;
+
+    // NOTE: Mapped frames are decompressed in place
+    zseek_buffer_t *cbuf = NULL;
+    if (!reader->map.data) {
+        cbuf = zseek_buffer_new(0, &reader->allocator);
+        if (!cbuf) {
+            set_error(errbuf, "buffer creation failed");
+            goto fail_w_batch;
         }
-        void *dbuf_data = zseek_buffer_data(reader->dbuf);
-        assert(dbuf_data);
-        // Decompress discard data
-        size_t dbuf_offset = 0;
-        size_t to_decompress = offset_in_frame;
-        do {
-            size_t csize = frame_csize - cbuf_offset;
-            size_t dsize = to_decompress - dbuf_offset;
-            LZ4F_decompressOptions_t opts = { .stableDst = 0 };
-            size_t r = LZ4F_decompress(reader->dctx_lz4,
-                (uint8_t*)dbuf_data + dbuf_offset, &dsize,
-                (uint8_t*)cbuf_data + cbuf_offset, &csize,
-                &opts); // NOTE: Overwrites dsize, csize.
-            if (LZ4F_isError(r)) {
-                set_error(errbuf, "%s: %s", "decompress discard data",
-                    LZ4F_getErrorName(r));
-                goto fail_w_lock;
-            }
-            cbuf_offset += csize;
-            dbuf_offset += dsize;
-        } while (dbuf_offset < to_decompress);
     }
 
-    // Decompress user data
-    size_t buf_offset = 0;
-    size_t frame_dsize = frame_size_d(reader->st, frame_idx);
-    size_t to_decompress = MIN(count, frame_dsize - offset_in_frame);
-    do {
-        size_t csize = frame_csize - cbuf_offset;
-        size_t dsize = to_decompress - buf_offset;
-        LZ4F_decompressOptions_t opts = { .stableDst = 0 };
-        size_t r = LZ4F_decompress(reader->dctx_lz4,
-            (uint8_t*)buf + buf_offset, &dsize,
-            (uint8_t*)cbuf_data + cbuf_offset, &csize,
-            &opts); // NOTE: Overwrites dsize, csize.
-        if (LZ4F_isError(r)) {
-            set_error(errbuf, "%s: %s", "decompress user data",
-                LZ4F_getErrorName(r));
-            goto fail_w_lock;
+    // NOTE: Frames are read, then decompressed, by windows, bounding the
+    // memory of compressed frames
+    // TODO OPT: Read the next window while decompressing this one
+    for (size_t first = 0, last; first < nb_frames; first = last) {
+        size_t window_size = frame_size_c(reader->st,
+            frames[first].pieces->frame_idx);
+        for (last = first + 1; last < nb_frames; last++) {
+            size_t frame_csize = frame_size_c(reader->st,
+                frames[last].pieces->frame_idx);
+            if (window_size + frame_csize > BATCH_WINDOW_SIZE)
+                break;
+            window_size += frame_csize;
         }
-        cbuf_offset += csize;
-        buf_offset += dsize;
-    } while (buf_offset < to_decompress);
 
-    if (cbuf_offset < frame_csize) {
-        // Did not consume the whole frame, clean up decompression context
-        LZ4F_resetDecompressionContext(reader->dctx_lz4);
+        if (cbuf && !read_batch_frames(reader, frames + first, last - first,
+                cbuf, call_data, errbuf))
+            goto fail_w_cbuf;
+        if (!run_batch_window(reader, batch, frames + first, last - first,
+                call_data, errbuf))
+            goto fail_w_cbuf;
     }
 
-    pr = pthread_rwlock_unlock(&reader->lock);
-    if (pr) {
-        set_error_with_errno(errbuf, "unlock", pr);
-        goto fail;
-    }
+    zseek_buffer_free(cbuf);
+    pthread_mutex_lock(&batch->lock);
+    leave_batch(reader, batch);
+out:
+    zseek_free(&reader->allocator, pieces);
 
-    return to_decompress;
+    return true;
 
-fail_w_lock:
-    pthread_rwlock_unlock(&reader->lock);
+fail_w_cbuf:
+    zseek_buffer_free(cbuf);
+fail_w_batch:
+    pthread_mutex_lock(&batch->lock);
+    leave_batch(reader, batch);
+fail_w_pieces:
+    zseek_free(&reader->allocator, pieces);
 fail:
-    return -1;
+    return false;
 }
 
-static ssize_t zseek_pread_lz4(zseek_reader_t *reader, void *buf, size_t count,
-    size_t offset, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+ssize_t zseek_pread_ref(zseek_reader_t *reader, zseek_ref_t *ref,
+    size_t count, size_t offset, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
 {
-    // TODO OPT: Try to return as much as possible (multiple frames), to avoid
-    // the repeated fs read and zseek_read overhead?
+    if (!reader) {
+        set_error(errbuf, "invalid reader");
+        return -1;
+    }
 
-    if (!reader->cache)
-        return zseek_pread_lz4_no_cache(reader, buf, count, offset, call_data,
-            errbuf);
+    if (!ref) {
+        set_error(errbuf, "invalid reference pointer");
+        return -1;
+    }
+
+    memset(ref, 0, sizeof(*ref));
 
     ssize_t frame_idx = offset_to_frame_idx(reader->st, offset);
-    if (frame_idx == -1)
+    if (frame_idx == -1 || count == 0)
         return 0;
+    size_t offset_in_frame = offset - frame_offset_d(reader->st, frame_idx);
 
-    int pr = pthread_rwlock_rdlock(&reader->lock);
-    if (pr) {
-        set_error_with_errno(errbuf, "lock for reading", pr);
-        goto fail;
-    }
-
-    void *dbuf = NULL;
-    zseek_frame_t frame = zseek_cache_find(reader->cache, frame_idx);
-    if (!frame.data) {
-        // Upgrade to write lock
-        pr = pthread_rwlock_unlock(&reader->lock);
-        if (pr) {
-            set_error_with_errno(errbuf, "unlock to upgrade", pr);
-            goto fail;
+    if (!reader->cache) {
+        // NOTE: Frames are then decompressed partially, so the view gets a
+        // buffer of its own
+        size_t size = MIN(count, frame_size_d(reader->st, frame_idx) -
+            offset_in_frame);
+        bool hit;
+        void *buf = zseek_frame_pool_get(reader->pool, size, &hit);
+        if (!buf) {
+            set_error_with_errno(errbuf, "allocate view buffer", errno);
+            return -1;
         }
-        pr = pthread_rwlock_wrlock(&reader->lock);
-        if (pr) {
-            set_error_with_errno(errbuf, "lock for writing", pr);
-            goto fail;
+        __atomic_add_fetch(hit ? &reader->pool_hits : &reader->pool_misses, 1,
+            __ATOMIC_RELAXED);
+        ssize_t ret = pread_frame(reader, buf, size, offset, frame_idx, NULL,
+            call_data, errbuf);
+        if (ret <= 0) {
+            zseek_frame_pool_put(reader->pool, buf, size);
+            return ret;
         }
+        ref->data = buf;
+        ref->size = ret;
+        ref->handle.buf = buf;
+        ref->handle.buf_size = size;
+        return ret;
+    }
 
-        frame = zseek_cache_find(reader->cache, frame_idx);
-        if (!frame.data) {
-            // Resize compressed buffer
-            size_t frame_csize = frame_size_c(reader->st, frame_idx);
-            if (!zseek_buffer_resize(reader->cbuf, frame_csize)) {
-                set_error(errbuf, "resize compressed buffer");
-                goto fail_w_lock;
-            }
-            void *cbuf_data = zseek_buffer_data(reader->cbuf);
-            assert(cbuf_data);
-
-            // Read compressed frame
-            off_t frame_offset = frame_offset_c(reader->st, frame_idx);
-            ssize_t _read = reader->user_file.pread(cbuf_data, frame_csize,
-                (size_t)frame_offset, reader->user_file.user_data, call_data);
-            if (_read != (ssize_t)frame_csize) {
-                if (_read >= 0)
-                    set_error(errbuf, "unexpected EOF");
-                else
-                    // TODO OPT: Use errno if user_file.pread sets it
-                    set_error(errbuf, "read file failed");
-                goto fail_w_lock;
-            }
+    zseek_frame_t uncached = {NULL, 0, 0};
+    zseek_frame_t *frame = get_frame(reader, frame_idx, &uncached, NULL,
+        call_data, errbuf);
+    if (!frame)
+        return -1;
 
-            // Decompress frame
-            size_t frame_dsize = frame_size_d(reader->st, frame_idx);
-            dbuf = malloc(frame_dsize);
-            if (!dbuf) {
-                set_error_with_errno(errbuf, "allocate decompressed buffer",
-                    errno);
-                goto fail_w_lock;
-            }
-            size_t cbuf_offset = 0;
-            size_t dbuf_offset = 0;
-            size_t r = 0;
-            do {
-                size_t csize = frame_csize - cbuf_offset;
-                size_t dsize = frame_dsize - dbuf_offset;
-                LZ4F_decompressOptions_t opts = { .stableDst = 0 };
-                // NOTE: In theory, LZ4F_decompress may not finish the whole
-                // frame in one call (r > 0). In practice, this does not happen
-                // given enough room in the output buffer (e.g. here).
-                r = LZ4F_decompress(reader->dctx_lz4,
-                    (uint8_t*)dbuf + dbuf_offset, &dsize,
-                    (uint8_t*)cbuf_data + cbuf_offset, &csize,
-                    &opts); // NOTE: Overwrites dsize, csize.
-                if (LZ4F_isError(r)) {
-                    set_error(errbuf, "%s: %s", "decompress frame",
-                        LZ4F_getErrorName(r));
-                    goto fail_w_dbuf;
-                }
-                cbuf_offset += csize;
-                dbuf_offset += dsize;
-            } while (r > 0);
-
-            // Cache frame
-            frame.data = dbuf;
-            frame.idx = frame_idx;
-            frame.len = frame_dsize;
-            if (!zseek_cache_insert(reader->cache, frame)) {
-                set_error(errbuf, "frame caching failed");
-                goto fail_w_dbuf;
-            }
-        }
+    ref->data = (uint8_t*)frame->data + offset_in_frame;
+    ref->size = MIN(count, frame->len - offset_in_frame);
+    if (frame == &uncached) {
+        // Owned by the view instead
+        ref->handle.buf = uncached.data;
+        ref->handle.buf_size = uncached.len;
+    } else {
+        ref->handle.frame = frame;
     }
 
-    size_t offset_in_frame = offset - frame_offset_d(reader->st, frame_idx);
-    size_t to_copy = MIN(count, frame.len - offset_in_frame);
-    memcpy(buf, (uint8_t*)frame.data + offset_in_frame, to_copy);
+    return ref->size;
+}
 
-    pr = pthread_rwlock_unlock(&reader->lock);
-    if (pr) {
-        set_error_with_errno(errbuf, "unlock", pr);
-        goto fail;
-    }
+void zseek_ref_release(zseek_reader_t *reader, zseek_ref_t *ref)
+{
+    if (!reader || !ref)
+        return;
 
-    return to_copy;
+    if (ref->handle.frame)
+        zseek_cache_release(reader->cache, ref->handle.frame);
+    else if (ref->handle.buf)
+        zseek_frame_pool_put(reader->pool, ref->handle.buf,
+            ref->handle.buf_size);
 
-fail_w_dbuf:
-    free(dbuf);
-fail_w_lock:
-    pthread_rwlock_unlock(&reader->lock);
-fail:
-    return -1;
+    memset(ref, 0, sizeof(*ref));
 }
 
-ssize_t zseek_pread(zseek_reader_t *reader, void *buf, size_t count,
-    size_t offset, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE])
+/**
+ * Completes an asynchronous read, on a worker thread
+ */
+static void process_async(zseek_aio_req_t *req, void *user_data)
+{
+    zseek_reader_t *reader = user_data;
+    zseek_async_read_t *read = (zseek_async_read_t*)req;
+
+    if (read->batch) {
+        zseek_batch_t *batch = read->batch;
+        zseek_free(&reader->allocator, read);
+        help_batch(reader, batch);
+        return;
+    }
+
+    char errbuf[ZSEEK_ERRBUF_SIZE] = "";
+    ssize_t ret = -1;
+    if (req->error)
+        set_error_with_errno(errbuf, "read file", req->error);
+    else if (req->done < req->size)
+        set_error(errbuf, "unexpected EOF");
+    else
+        // NOTE: No per-call data to pass to I/O callbacks
+        ret = read->frame_idx == -1 ? 0 : pread_frame(reader, read->buf,
+            read->count, read->offset, read->frame_idx,
+            req->size ? req->data : NULL, NULL, errbuf);
+
+    // NOTE: Free first, so that the callback may well reuse the memory
+    zseek_pread_cb_t cb = read->cb;
+    void *ctx = read->ctx;
+    zseek_free(&reader->allocator, read);
+
+    cb(ret, ctx, ret == -1 ? errbuf : NULL);
+}
+
+bool zseek_pread_async(zseek_reader_t *reader, void *buf, size_t count,
+    size_t offset, zseek_pread_cb_t cb, void *ctx,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
 {
     if (!reader) {
         set_error(errbuf, "invalid reader");
         return false;
     }
 
-    switch (reader->type) {
-    case ZSEEK_ZSTD:
-        return zseek_pread_zstd(reader, buf, count, offset, call_data, errbuf);
-    case ZSEEK_LZ4:
-        return zseek_pread_lz4(reader, buf, count, offset, call_data, errbuf);
-    default:
-        // BUG
-        assert(false);
-        return -1;
+    if (!reader->aio) {
+        set_error(errbuf, "asynchronous reads are disabled");
+        return false;
+    }
+
+    if (!cb) {
+        set_error(errbuf, "invalid callback");
+        return false;
+    }
+
+    // NOTE: With io_uring, the compressed frame is read ahead, unless cached,
+    // so that workers only decompress
+    size_t frame_csize = 0;
+    size_t frame_offset = 0;
+    ssize_t frame_idx = offset_to_frame_idx(reader->st, offset);
+    if (frame_idx != -1 && count > 0 &&
+            zseek_aio_backend(reader->aio) == ZSEEK_ASYNC_IO_URING) {
+        zseek_frame_t *frame = zseek_cache_peek(reader->cache,
+            reader->cache_user, frame_idx);
+        if (frame)
+            zseek_cache_release(reader->cache, frame);
+        else {
+            frame_csize = frame_size_c(reader->st, frame_idx);
+            frame_offset = frame_offset_c(reader->st, frame_idx);
+        }
+    }
+
+    zseek_async_read_t *read = zseek_alloc(&reader->allocator,
+        sizeof(*read) + frame_csize);
+    if (!read) {
+        set_error_with_errno(errbuf, "allocate asynchronous read", errno);
+        return false;
     }
+    *read = (zseek_async_read_t) {
+        .req = {
+            .data = read + 1,
+            .size = frame_csize,
+            .offset = frame_offset,
+        },
+        .buf = buf,
+        .count = count,
+        .offset = offset,
+        .frame_idx = frame_idx,
+        .cb = cb,
+        .ctx = ctx,
+    };
+    zseek_aio_submit(reader->aio, &read->req);
+
+    return true;
 }
 
 ssize_t zseek_read(zseek_reader_t *reader, void *buf, size_t count,
@@ -718,41 +2484,57 @@ bool zseek_reader_stats(zseek_reader_t *reader, zseek_reader_stats_t *stats,
         return false;
     }
 
-    int pr = pthread_rwlock_rdlock(&reader->lock);
-    if (pr) {
-        set_error_with_errno(errbuf, "lock for reading", pr);
-        return false;
-    }
-
     size_t seek_table_memory = seek_table_memory_usage(reader->st);
+    if (reader->bindex)
+        seek_table_memory += zseek_bindex_memory_usage(reader->bindex);
 
     size_t frames = seek_table_entries(reader->st);
 
     size_t decompressed_size = seek_table_decompressed_size(reader->st);
 
-    size_t cache_memory = zseek_cache_memory_usage(reader->cache);
+    zseek_cache_usage_t usage;
+    zseek_cache_usage(reader->cache, reader->cache_user, &usage);
+    size_t cache_memory = usage.memory;
+    size_t cache_memory_peak = usage.peak_memory;
+    if (reader->own_cache) {
+        cache_memory = zseek_cache_memory_usage(reader->cache);
+        cache_memory_peak = zseek_cache_peak_memory_usage(reader->cache);
+    }
 
-    size_t cached_frames = zseek_cache_entries(reader->cache);
+    size_t frame_pool_hits = __atomic_load_n(&reader->pool_hits,
+        __ATOMIC_RELAXED);
+    size_t frame_pool_misses = __atomic_load_n(&reader->pool_misses,
+        __ATOMIC_RELAXED);
 
     // NOTE: This is an _estimate_ because the underlying compression lib may
-    // buffer too in its context object.
-    size_t buffer_size = zseek_buffer_capacity(reader->cbuf);
-    if (reader->type == ZSEEK_LZ4)
-        buffer_size += zseek_buffer_capacity(reader->dbuf);
-
-    pr = pthread_rwlock_unlock(&reader->lock);
-    if (pr) {
-        set_error_with_errno(errbuf, "unlock", pr);
-        return false;
+    // buffer too in its context object, and the contexts in use by reads are
+    // left out.
+    size_t buffer_size = 0;
+    pthread_mutex_lock(&reader->lock);
+    for (zseek_dctx_t *dctx = reader->dctxs; dctx; dctx = dctx->next) {
+        buffer_size += zseek_buffer_capacity(dctx->cbuf) +
+            zseek_buffer_capacity(dctx->dbuf);
     }
+    pthread_mutex_unlock(&reader->lock);
 
     *stats = (zseek_reader_stats_t) {
         .seek_table_memory = seek_table_memory,
         .frames = frames,
         .decompressed_size = decompressed_size,
         .cache_memory = cache_memory,
-        .cached_frames = cached_frames,
+        .cache_memory_peak = cache_memory_peak,
+        .cached_frames = usage.entries,
+        .cache_hits = usage.hits,
+        .cache_misses = usage.misses,
+        .cache_bypasses = __atomic_load_n(&reader->bypasses,
+            __ATOMIC_RELAXED),
+        .coalesced_reads = __atomic_load_n(&reader->coalesced,
+            __ATOMIC_RELAXED),
         .buffer_size = buffer_size,
+        .frame_pool_hits = frame_pool_hits,
+        .frame_pool_misses = frame_pool_misses,
+        .async_backend = reader->aio ? zseek_aio_backend(reader->aio) :
+            ZSEEK_ASYNC_AUTO,
     };
 
     return true;
@@ -0,0 +1,84 @@
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t, UINT32_MAX
+#include <stdbool.h>    // bool
+#include <string.h>     // memcpy
+
+#include <endian.h>     // htole32, le32toh
+#include <zdict.h>
+
+#include "dict.h"
+#include "alloc.h"
+
+static void write_le32(uint8_t *dst, uint32_t value)
+{
+    uint32_t value_le = htole32(value);
+    memcpy(dst, &value_le, sizeof(value_le));
+}
+
+static uint32_t read_le32(const uint8_t *src)
+{
+    uint32_t value_le;
+    memcpy(&value_le, src, sizeof(value_le));
+    return le32toh(value_le);
+}
+
+void zseek_dict_header(uint8_t header[ZSEEK_DICT_HEADER_SIZE],
+    zseek_compression_type_t type, size_t dict_size)
+{
+    // NOTE: The frame size of skippable frames excludes the magic number and
+    // the frame size itself.
+    write_le32(header, ZSEEK_DICT_MAGIC);
+    write_le32(header + 4, dict_size + 4);
+    write_le32(header + 8, type);
+}
+
+bool zseek_dict_parse(const uint8_t header[ZSEEK_DICT_HEADER_SIZE],
+    zseek_compression_type_t *type, size_t *dict_size)
+{
+    if (read_le32(header) != ZSEEK_DICT_MAGIC)
+        return false;
+
+    uint32_t frame_size = read_le32(header + 4);
+    if (frame_size <= 4 || frame_size - 4 > ZSEEK_DICT_MAX_SIZE)
+        return false;
+
+    uint32_t _type = read_le32(header + 8);
+    if (_type != ZSEEK_ZSTD && _type != ZSEEK_LZ4)
+        return false;
+
+    *type = _type;
+    *dict_size = frame_size - 4;
+
+    return true;
+}
+
+size_t zseek_dict_train(void *dict, size_t capacity, const void *data,
+    const size_t *lens, size_t nb_lens, size_t frame_size,
+    const zseek_allocator_t *allocator)
+{
+    if (nb_lens == 0 || nb_lens > UINT32_MAX)
+        return 0;
+
+    // At most one sample per write
+    size_t *sample_sizes = zseek_alloc(allocator,
+        nb_lens * sizeof(*sample_sizes));
+    if (!sample_sizes)
+        return 0;
+
+    size_t nb_samples = 0;
+    size_t sample_size = 0;
+    for (size_t i = 0; i < nb_lens; i++) {
+        sample_size += lens[i];
+        if (sample_size >= frame_size || i == nb_lens - 1) {
+            sample_sizes[nb_samples++] = sample_size;
+            sample_size = 0;
+        }
+    }
+
+    // NOTE: ZDICT allocates its working memory from the C library.
+    size_t r = ZDICT_trainFromBuffer(dict, capacity, data, sample_sizes,
+        (unsigned)nb_samples);
+    zseek_free(allocator, sample_sizes);
+
+    return ZDICT_isError(r) ? 0 : r;
+}
@@ -0,0 +1,54 @@
+#ifndef DICT_H
+#define DICT_H
+
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t
+#include <stdbool.h>    // bool
+
+#include "zseek.h"
+
+/**
+ * Magic number of the skippable frame holding the dictionary, at the start of
+ * the file. It differs from the seek table's one.
+ */
+#define ZSEEK_DICT_MAGIC 0x184D2A5B
+/**
+ * Size of the dictionary frame header: the magic number, the frame size and
+ * the compression type of the file
+ */
+#define ZSEEK_DICT_HEADER_SIZE 12
+/**
+ * Largest dictionary stored, well past what zstd trains or lz4 uses, so that
+ * a corrupt header does not make readers allocate any size
+ */
+#define ZSEEK_DICT_MAX_SIZE (16 << 20)
+
+/**
+ * Encode in @p header the header of the frame holding a dictionary of
+ * @p dict_size bytes, for a file compressed with @p type.
+ */
+void zseek_dict_header(uint8_t header[ZSEEK_DICT_HEADER_SIZE],
+    zseek_compression_type_t type, size_t dict_size);
+
+/**
+ * Decode the dictionary frame @p header into @p type and @p dict_size.
+ * Returns @a false if @p header is not that of a dictionary frame, or of one
+ * larger than ZSEEK_DICT_MAX_SIZE.
+ */
+bool zseek_dict_parse(const uint8_t header[ZSEEK_DICT_HEADER_SIZE],
+    zseek_compression_type_t *type, size_t *dict_size);
+
+/**
+ * Train a dictionary of up to @p capacity bytes into @p dict, from the
+ * @p nb_lens consecutive writes of @p lens bytes each found in @p data.
+ * Writes are grouped into samples of at least @p frame_size bytes, as they
+ * would be into frames.
+ * Scratch memory comes from @p allocator (the C library if @a NULL).
+ * Returns the size of the dictionary or 0 if training failed (e.g. too few
+ * samples).
+ */
+size_t zseek_dict_train(void *dict, size_t capacity, const void *data,
+    const size_t *lens, size_t nb_lens, size_t frame_size,
+    const zseek_allocator_t *allocator);
+
+#endif  // DICT_H
@@ -0,0 +1,292 @@
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t, uintptr_t
+#include <stdbool.h>    // bool
+#include <string.h>     // memcpy
+#include <errno.h>      // errno
+#include <fcntl.h>      // fcntl, posix_fadvise, O_DIRECT
+#include <unistd.h>     // pread, pwrite, lseek, fsync, ftruncate
+#include <sys/stat.h>   // fstat
+#include <sys/mman.h>   // mmap, munmap, posix_madvise
+
+#include "fdio.h"
+#include "common.h"
+#include "alloc.h"
+
+// Default alignment of direct I/O
+#define DIRECT_ALIGNMENT 4096
+
+#ifndef O_DIRECT
+// No direct I/O, every file is buffered
+#define O_DIRECT 0
+#endif
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+bool zseek_fd_file_init(zseek_fd_file_t *file, int fd,
+    const zseek_fd_param_t *zfp, const zseek_allocator_t *allocator,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    int advice = zfp ? zfp->advice : POSIX_FADV_NORMAL;
+    size_t alignment = zfp && zfp->direct_alignment ? zfp->direct_alignment :
+        DIRECT_ALIGNMENT;
+    if (alignment & (alignment - 1)) {
+        set_error(errbuf, "invalid direct I/O alignment (%zu)", alignment);
+        return false;
+    }
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1) {
+        set_error_with_errno(errbuf, "get file status flags", errno);
+        return false;
+    }
+
+    bool seekable = true;
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos == -1) {
+        if (errno != ESPIPE) {
+            set_error_with_errno(errbuf, "get file position", errno);
+            return false;
+        }
+        seekable = false;
+        pos = 0;
+    }
+
+    // NOTE: O_DIRECT means packet mode for pipes
+    bool direct = (flags & O_DIRECT) && seekable;
+    if (direct && (pos & (alignment - 1))) {
+        set_error(errbuf, "unaligned file position for direct I/O (%jd)",
+            (intmax_t)pos);
+        return false;
+    }
+
+    if (advice != POSIX_FADV_NORMAL && seekable) {
+        int r = posix_fadvise(fd, 0, 0, advice);
+        if (r != 0) {
+            set_error_with_errno(errbuf, "advise file access", r);
+            return false;
+        }
+    }
+
+    *file = (zseek_fd_file_t) {
+        .fd = fd,
+        .direct = direct,
+        .seekable = seekable,
+        .alignment = alignment,
+        .pos = pos,
+        .allocator = allocator,
+    };
+
+    return true;
+}
+
+/**
+ * Reads up to @p size bytes at @p offset, short only at the end of the file
+ */
+static ssize_t pread_full(const zseek_fd_file_t *file, void *data,
+    size_t size, size_t offset)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(file->fd, (uint8_t*)data + done, size - done,
+            offset + done);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        done += n;
+        // Direct reads cannot resume unaligned, short ones end at the end
+        if (file->direct && (done & (file->alignment - 1)))
+            break;
+    }
+
+    return done;
+}
+
+ssize_t zseek_fd_pread(void *data, size_t size, size_t offset,
+    void *user_data, void *call_data)
+{
+    (void)call_data;
+
+    const zseek_fd_file_t *file = user_data;
+    size_t mask = file->alignment - 1;
+    if (!file->direct || (((uintptr_t)data | size | offset) & mask) == 0)
+        return pread_full(file, data, size, offset);
+
+    // NOTE: Direct I/O needs aligned buffers, offsets and sizes, so unaligned
+    // reads (e.g. of the seek table) go through a bounce buffer
+    size_t start = offset & ~mask;
+    size_t len = (offset + size - start + mask) & ~mask;
+    void *mem = zseek_alloc(file->allocator, len + mask);
+    if (!mem)
+        return -1;
+    uint8_t *buf = (uint8_t*)(((uintptr_t)mem + mask) & ~(uintptr_t)mask);
+
+    ssize_t n = pread_full(file, buf, len, start);
+    if (n != -1) {
+        size_t skip = offset - start;
+        n = (size_t)n > skip ? (ssize_t)MIN(size, n - skip) : 0;
+        memcpy(data, buf + skip, n);
+    }
+    zseek_free(file->allocator, mem);
+
+    return n;
+}
+
+ssize_t zseek_fd_size(void *user_data, void *call_data)
+{
+    (void)call_data;
+
+    const zseek_fd_file_t *file = user_data;
+    struct stat st;
+    if (fstat(file->fd, &st) == -1)
+        return -1;
+
+    return st.st_size;
+}
+
+bool zseek_fd_write(const void *data, size_t size, void *user_data,
+    void *call_data)
+{
+    (void)call_data;
+
+    zseek_fd_file_t *file = user_data;
+    // NOTE: Direct writes stay aligned, padding the last, partial block,
+    // which the next write starts over
+    size_t tail = file->direct ? size & (file->alignment - 1) : 0;
+    size_t len = tail ? size - tail + file->alignment : size;
+
+    const uint8_t *src = data;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = file->seekable ? pwrite(file->fd, src + done, len - done,
+            file->pos + done) : write(file->fd, src + done, len - done);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        done += n;
+    }
+    file->pos += size - tail;
+    file->tail = tail;
+
+    return true;
+}
+
+bool zseek_fd_trim(zseek_fd_file_t *file)
+{
+    if (!file->tail)
+        return true;
+
+    // Unless the file went on past the padding
+    struct stat st;
+    if (fstat(file->fd, &st) == -1)
+        return false;
+    if ((size_t)st.st_size == file->pos + file->alignment &&
+            ftruncate(file->fd, file->pos + file->tail) == -1)
+        return false;
+
+    return true;
+}
+
+bool zseek_fd_flush(void *user_data, void *call_data)
+{
+    (void)call_data;
+
+    const zseek_fd_file_t *file = user_data;
+    // Not all files can be synced (e.g. pipes), they are as durable as it gets
+    if (fsync(file->fd) == -1 && errno != EINVAL && errno != EROFS)
+        return false;
+
+    return true;
+}
+
+bool zseek_map_file(zseek_map_t *map, int fd, const zseek_fd_param_t *zfp,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    int advice;
+    switch (zfp ? zfp->advice : POSIX_FADV_NORMAL) {
+    case POSIX_FADV_RANDOM:
+        advice = POSIX_MADV_RANDOM;
+        break;
+    case POSIX_FADV_SEQUENTIAL:
+        advice = POSIX_MADV_SEQUENTIAL;
+        break;
+    case POSIX_FADV_WILLNEED:
+        advice = POSIX_MADV_WILLNEED;
+        break;
+    case POSIX_FADV_DONTNEED:
+        advice = POSIX_MADV_DONTNEED;
+        break;
+    default:
+        // No equivalent for POSIX_FADV_NOREUSE
+        advice = POSIX_MADV_NORMAL;
+        break;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        set_error_with_errno(errbuf, "get file size", errno);
+        return false;
+    }
+    if (st.st_size == 0) {
+        // Cannot be mapped
+        set_error(errbuf, "unexpected EOF");
+        return false;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        set_error_with_errno(errbuf, "map file", errno);
+        return false;
+    }
+    if (advice != POSIX_MADV_NORMAL) {
+        int r = posix_madvise(data, st.st_size, advice);
+        if (r != 0) {
+            set_error_with_errno(errbuf, "advise memory access", r);
+            munmap(data, st.st_size);
+            return false;
+        }
+    }
+
+    map->data = data;
+    map->size = st.st_size;
+
+    return true;
+}
+
+void zseek_unmap(zseek_map_t *map)
+{
+    if (!map->data)
+        return;
+
+    munmap(map->data, map->size);
+    map->data = NULL;
+    map->size = 0;
+}
+
+ssize_t zseek_map_pread(void *data, size_t size, size_t offset,
+    void *user_data, void *call_data)
+{
+    (void)call_data;
+
+    const zseek_map_t *map = user_data;
+    if (offset >= map->size)
+        return 0;
+    size = MIN(size, map->size - offset);
+    memcpy(data, map->data + offset, size);
+
+    return size;
+}
+
+ssize_t zseek_map_size(void *user_data, void *call_data)
+{
+    (void)call_data;
+
+    const zseek_map_t *map = user_data;
+
+    return map->size;
+}
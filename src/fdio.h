@@ -0,0 +1,104 @@
+#ifndef FDIO_H
+#define FDIO_H
+
+#include <stddef.h>     // size_t
+#include <stdbool.h>    // bool
+#include <stdint.h>     // uint8_t
+#include <sys/types.h>  // ssize_t
+
+#include "zseek.h"
+
+/**
+ * File descriptor backing a reader or writer, through positional I/O only,
+ * so that the file position of the descriptor is neither used nor changed.
+ */
+typedef struct {
+    int fd;
+    bool direct;        // opened with O_DIRECT
+    bool seekable;      // false for pipes and the like, written sequentially
+    size_t alignment;   // of direct I/O
+    size_t pos;         // of the next write, aligned if direct
+    size_t tail;        // bytes written past pos, padded, if direct
+    const zseek_allocator_t *allocator;     // for bounce buffers
+} zseek_fd_file_t;
+
+/**
+ * Sets up @p file for @p fd, as per @p zfp (defaults if @a NULL), with
+ * bounce buffers of direct I/O coming from @p allocator, or the C library if
+ * @a NULL. Writes start from the current file position of @p fd.
+ * Returns @a false on error.
+ */
+bool zseek_fd_file_init(zseek_fd_file_t *file, int fd,
+    const zseek_fd_param_t *zfp, const zseek_allocator_t *allocator,
+    char errbuf[ZSEEK_ERRBUF_SIZE]);
+
+/**
+ * Read callback of a zseek_read_file_t, where @p user_data is the file.
+ * Unaligned reads of a direct file go through an aligned bounce buffer.
+ */
+ssize_t zseek_fd_pread(void *data, size_t size, size_t offset,
+    void *user_data, void *call_data);
+
+/**
+ * File size callback of a zseek_read_file_t, where @p user_data is the file.
+ */
+ssize_t zseek_fd_size(void *user_data, void *call_data);
+
+/**
+ * Write callback of a zseek_write_file_t, where @p user_data is the file.
+ *
+ * Writes to a direct file must be aligned in memory. Those of an unaligned
+ * size are padded up to the alignment with the bytes following @p data,
+ * which must be readable. The file position then stays at the start of the
+ * last, partial block, and the next write must start with its bytes again,
+ * as a padding zseek_stage_t does.
+ *
+ * @attention Not safe to call concurrently (unlocked).
+ */
+bool zseek_fd_write(const void *data, size_t size, void *user_data,
+    void *call_data);
+
+/**
+ * Cuts off the padding of the last write to a direct file, if it extended
+ * the file. Returns @a false on error.
+ */
+bool zseek_fd_trim(zseek_fd_file_t *file);
+
+/**
+ * Flush callback of a zseek_write_file_t, where @p user_data is the file.
+ */
+bool zseek_fd_flush(void *user_data, void *call_data);
+
+/**
+ * File mapped in memory
+ */
+typedef struct {
+    uint8_t *data;      // read-only
+    size_t size;
+} zseek_map_t;
+
+/**
+ * Maps the whole file of @p fd in @p map, with the advice of @p zfp (see
+ * zseek_fd_param_t.advice) given for the mapping, if not @a NULL.
+ * Returns @a false on error.
+ */
+bool zseek_map_file(zseek_map_t *map, int fd, const zseek_fd_param_t *zfp,
+    char errbuf[ZSEEK_ERRBUF_SIZE]);
+
+/**
+ * Unmaps @p map, if mapped, and zeroes it.
+ */
+void zseek_unmap(zseek_map_t *map);
+
+/**
+ * Read callback of a zseek_read_file_t, where @p user_data is the map.
+ */
+ssize_t zseek_map_pread(void *data, size_t size, size_t offset,
+    void *user_data, void *call_data);
+
+/**
+ * File size callback of a zseek_read_file_t, where @p user_data is the map.
+ */
+ssize_t zseek_map_size(void *user_data, void *call_data);
+
+#endif  // FDIO_H
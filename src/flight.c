@@ -0,0 +1,104 @@
+#include <stddef.h>     // size_t
+#include <stdbool.h>    // bool
+#include <string.h>     // memset
+#include <pthread.h>    // pthread_*
+
+#include "flight.h"
+#include "alloc.h"
+
+struct zseek_flights {
+    pthread_mutex_t lock;
+    // NOTE: Shared by all flights, which are few (at most one per thread)
+    // and short-lived.
+    pthread_cond_t landed;
+    zseek_flight_t *head;
+    uint64_t next_seq;
+    const zseek_allocator_t *allocator;
+};
+
+zseek_flights_t *zseek_flights_new(const zseek_allocator_t *allocator)
+{
+    zseek_flights_t *flights = zseek_alloc(allocator, sizeof(*flights));
+    if (!flights)
+        goto fail;
+    memset(flights, 0, sizeof(*flights));
+    flights->allocator = allocator;
+
+    if (pthread_mutex_init(&flights->lock, NULL))
+        goto fail_w_flights;
+    if (pthread_cond_init(&flights->landed, NULL))
+        goto fail_w_lock;
+
+    return flights;
+
+fail_w_lock:
+    pthread_mutex_destroy(&flights->lock);
+fail_w_flights:
+    zseek_free(allocator, flights);
+fail:
+    return NULL;
+}
+
+void zseek_flights_free(zseek_flights_t *flights)
+{
+    if (!flights)
+        return;
+
+    pthread_cond_destroy(&flights->landed);
+    pthread_mutex_destroy(&flights->lock);
+    zseek_free(flights->allocator, flights);
+}
+
+static zseek_flight_t *find(const zseek_flights_t *flights, size_t frame_idx)
+{
+    for (zseek_flight_t *f = flights->head; f; f = f->next) {
+        if (f->idx == frame_idx)
+            return f;
+    }
+
+    return NULL;
+}
+
+bool zseek_flights_join(zseek_flights_t *flights, size_t frame_idx,
+    zseek_flight_t *flight)
+{
+    pthread_mutex_lock(&flights->lock);
+
+    zseek_flight_t *leader = find(flights, frame_idx);
+    if (!leader) {
+        *flight = (zseek_flight_t){flights->head, frame_idx, 0,
+            flights->next_seq++};
+        flights->head = flight;
+        pthread_mutex_unlock(&flights->lock);
+        return true;
+    }
+
+    // NOTE: The leader's flight is gone once landed, so look it up anew. The
+    // leader might be in flight again for the same frame, from the same
+    // address, before this wakes up, so compare sequence numbers too.
+    leader->waiters++;
+    uint64_t seq = leader->seq;
+    do {
+        pthread_cond_wait(&flights->landed, &flights->lock);
+        leader = find(flights, frame_idx);
+    } while (leader && leader->seq == seq);
+    pthread_mutex_unlock(&flights->lock);
+
+    return false;
+}
+
+void zseek_flights_land(zseek_flights_t *flights, zseek_flight_t *flight)
+{
+    pthread_mutex_lock(&flights->lock);
+
+    zseek_flight_t **f = &flights->head;
+    while (*f != flight)
+        f = &(*f)->next;
+    *f = flight->next;
+    bool waited = flight->waiters > 0;
+
+    pthread_mutex_unlock(&flights->lock);
+
+    if (waited)
+        pthread_cond_broadcast(&flights->landed);
+}
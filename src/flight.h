@@ -0,0 +1,53 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stddef.h>     // size_t
+#include <stdbool.h>    // bool
+#include <stdint.h>     // uint64_t
+
+#include "zseek.h"
+
+/**
+ * Table of the frames being decompressed, so that concurrent cache misses on
+ * a frame wait for a single decompression ("singleflight").
+ */
+typedef struct zseek_flights zseek_flights_t;
+
+/**
+ * A frame in flight, stored by its leader, e.g. on its stack
+ */
+typedef struct zseek_flight {
+    struct zseek_flight *next;
+    size_t idx;
+    size_t waiters;
+    uint64_t seq;   // tells apart flights stored at the same address
+} zseek_flight_t;
+
+/**
+ * Creates an empty table.
+ * Memory comes from @p allocator, which must outlive the table, or the C
+ * library if @a NULL.
+ * Returns @a NULL on error.
+ */
+zseek_flights_t *zseek_flights_new(const zseek_allocator_t *allocator);
+
+/**
+ * Frees @p flights, which must be empty.
+ */
+void zseek_flights_free(zseek_flights_t *flights);
+
+/**
+ * Leads the decompression of the frame at index @p frame_idx, recording it
+ * in @p flight, unless already in flight. Then, waits for it to land and
+ * returns @a false, after which the frame may be looked up again.
+ * Returns @a true to the leader, who must call zseek_flights_land().
+ */
+bool zseek_flights_join(zseek_flights_t *flights, size_t frame_idx,
+    zseek_flight_t *flight);
+
+/**
+ * Ends @p flight, led by the caller, waking up its waiters.
+ */
+void zseek_flights_land(zseek_flights_t *flights, zseek_flight_t *flight);
+
+#endif  // FLIGHT_H
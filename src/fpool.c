@@ -0,0 +1,208 @@
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t
+#include <stdbool.h>    // bool
+#include <string.h>     // memset
+#include <errno.h>      // errno
+#include <pthread.h>    // pthread_mutex*
+#include <unistd.h>     // sysconf
+
+#include "fpool.h"
+#include "common.h"
+#include "alloc.h"
+
+// Smallest size class, smaller requests are rounded up to it
+#define MIN_CLASS_SHIFT 12  // 4 KiB
+// Size classes per power of two, bounding the waste to 1/CLASSES_PER_POW2
+#define CLASSES_PER_POW2_SHIFT 2
+#define CLASSES_PER_POW2 (1 << CLASSES_PER_POW2_SHIFT)
+#define NB_CLASSES (1 + (64 - MIN_CLASS_SHIFT) * CLASSES_PER_POW2)
+
+// Default maximum size of idle buffers
+#define DEFAULT_MAX_SIZE (16 << 20)
+
+/**
+ * Idle buffer, linked through its own first bytes
+ */
+typedef struct zseek_idle_buf {
+    struct zseek_idle_buf *next;
+} zseek_idle_buf_t;
+
+struct zseek_frame_pool {
+    pthread_mutex_t lock;
+    zseek_allocator_t allocator;
+    size_t max_size;
+    size_t idle_size;       // total size of the idle buffers
+    bool prefault;
+    size_t page_size;
+    zseek_idle_buf_t *idle[NB_CLASSES];     // per size class
+};
+
+/**
+ * Returns the index of the size class of @p size, and its size in
+ * @p class_size.
+ */
+static size_t size_class(size_t size, size_t *class_size)
+{
+    if (size <= (size_t)1 << MIN_CLASS_SHIFT) {
+        *class_size = (size_t)1 << MIN_CLASS_SHIFT;
+        return 0;
+    }
+
+    // 2^msb <= size - 1 < 2^(msb + 1), split in CLASSES_PER_POW2 steps
+    unsigned msb = 63 - __builtin_clzll((unsigned long long)(size - 1));
+    unsigned shift = msb - CLASSES_PER_POW2_SHIFT;
+    size_t step = (size - 1) >> shift;  // in [CLASSES_PER_POW2, 2 * ...)
+    *class_size = (step + 1) << shift;
+
+    return 1 + (msb - MIN_CLASS_SHIFT) * CLASSES_PER_POW2 +
+        (step - CLASSES_PER_POW2);
+}
+
+size_t zseek_frame_pool_class_size(size_t size)
+{
+    size_t class_size;
+    size_class(size, &class_size);
+    return class_size;
+}
+
+/**
+ * Touches every page of @p buf, so that later accesses do not fault
+ */
+static void prefault(const zseek_frame_pool_t *pool, void *buf, size_t size)
+{
+    for (size_t off = 0; off < size; off += pool->page_size)
+        ((volatile uint8_t*)buf)[off] = 0;
+}
+
+zseek_frame_pool_t *zseek_frame_pool_new(zseek_frame_pool_param_t *zfp,
+    char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    const zseek_allocator_t *allocator = zfp ? zfp->allocator : NULL;
+    zseek_frame_pool_t *pool = zseek_alloc(allocator, sizeof(*pool));
+    if (!pool) {
+        set_error_with_errno(errbuf, "allocate frame pool", errno);
+        goto fail;
+    }
+    memset(pool, 0, sizeof(*pool));
+    zseek_allocator_init(&pool->allocator, allocator);
+    pool->max_size = zfp && zfp->max_size ? zfp->max_size : DEFAULT_MAX_SIZE;
+    pool->prefault = zfp && zfp->prefault;
+    long page_size = sysconf(_SC_PAGESIZE);
+    pool->page_size = page_size > 0 ? (size_t)page_size : 4096;
+
+    int pr = pthread_mutex_init(&pool->lock, NULL);
+    if (pr) {
+        set_error_with_errno(errbuf, "initialize lock", pr);
+        goto fail_w_pool;
+    }
+
+    return pool;
+
+fail_w_pool:
+    zseek_free(allocator, pool);
+fail:
+    return NULL;
+}
+
+void zseek_frame_pool_free(zseek_frame_pool_t *pool)
+{
+    if (!pool)
+        return;
+
+    for (size_t i = 0; i < NB_CLASSES; i++) {
+        while (pool->idle[i]) {
+            zseek_idle_buf_t *buf = pool->idle[i];
+            pool->idle[i] = buf->next;
+            zseek_free(&pool->allocator, buf);
+        }
+    }
+    pthread_mutex_destroy(&pool->lock);
+
+    zseek_allocator_t allocator = pool->allocator;
+    zseek_free(&allocator, pool);
+}
+
+bool zseek_frame_pool_reserve(zseek_frame_pool_t *pool, size_t size,
+    size_t count, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    if (!pool) {
+        set_error(errbuf, "invalid frame pool");
+        return false;
+    }
+
+    size_t class_size;
+    size_t idx = size_class(size, &class_size);
+    for (size_t i = 0; i < count; i++) {
+        zseek_idle_buf_t *buf = zseek_alloc(&pool->allocator, class_size);
+        if (!buf) {
+            set_error_with_errno(errbuf, "allocate frame buffer", errno);
+            return false;
+        }
+        if (pool->prefault)
+            prefault(pool, buf, class_size);
+
+        // NOTE: Not subject to max_size, but counts towards it
+        pthread_mutex_lock(&pool->lock);
+        buf->next = pool->idle[idx];
+        pool->idle[idx] = buf;
+        pool->idle_size += class_size;
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return true;
+}
+
+void *zseek_frame_pool_get(zseek_frame_pool_t *pool, size_t size, bool *hit)
+{
+    size_t class_size;
+    size_t idx = size_class(size, &class_size);
+
+    pthread_mutex_lock(&pool->lock);
+    zseek_idle_buf_t *buf = pool->idle[idx];
+    if (buf) {
+        pool->idle[idx] = buf->next;
+        pool->idle_size -= class_size;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    *hit = buf != NULL;
+    if (buf)
+        return buf;
+
+    buf = zseek_alloc(&pool->allocator, class_size);
+    if (buf && pool->prefault)
+        prefault(pool, buf, class_size);
+
+    return buf;
+}
+
+void zseek_frame_pool_put(zseek_frame_pool_t *pool, void *buf, size_t size)
+{
+    if (!buf)
+        return;
+
+    size_t class_size;
+    size_t idx = size_class(size, &class_size);
+
+    pthread_mutex_lock(&pool->lock);
+    bool keep = pool->idle_size + class_size <= pool->max_size;
+    if (keep) {
+        zseek_idle_buf_t *idle = buf;
+        idle->next = pool->idle[idx];
+        pool->idle[idx] = idle;
+        pool->idle_size += class_size;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!keep)
+        zseek_free(&pool->allocator, buf);
+}
+
+size_t zseek_frame_pool_idle_size(zseek_frame_pool_t *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    size_t idle_size = pool->idle_size;
+    pthread_mutex_unlock(&pool->lock);
+
+    return idle_size;
+}
@@ -0,0 +1,33 @@
+#ifndef FPOOL_H
+#define FPOOL_H
+
+#include <stddef.h>     // size_t
+#include <stdbool.h>    // bool
+
+#include "zseek.h"
+
+/**
+ * Returns the size of the buffers handed out for requests of @p size bytes,
+ * i.e. that of their size class.
+ */
+size_t zseek_frame_pool_class_size(size_t size);
+
+/**
+ * Returns a buffer of at least @p size bytes, recycled if one of its size
+ * class is idle, in which case @p hit is set.
+ * Returns @a NULL on error.
+ */
+void *zseek_frame_pool_get(zseek_frame_pool_t *pool, size_t size, bool *hit);
+
+/**
+ * Returns @p buf, obtained for @p size bytes, to @p pool, which frees it if it
+ * keeps too much memory idle already.
+ */
+void zseek_frame_pool_put(zseek_frame_pool_t *pool, void *buf, size_t size);
+
+/**
+ * Returns the size of the idle buffers in @p pool, in bytes.
+ */
+size_t zseek_frame_pool_idle_size(zseek_frame_pool_t *pool);
+
+#endif  // FPOOL_H
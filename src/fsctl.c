@@ -0,0 +1,112 @@
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t
+#include <stdbool.h>    // bool
+
+#include "fsctl.h"
+
+// Frames observed at a size before acting on it
+#define SAMPLES 4
+// Weight of the latest frame in moving averages
+#define ALPHA 0.25
+// Shrink only once throughput exceeds the target by this factor, to damp
+// oscillation around it
+#define HYSTERESIS 1.5
+// Least relative gain, in throughput or ratio, for a growth to pay off
+#define MIN_GAIN 0.05
+// Frames after which growing is tried again, once it did not pay off, in case
+// per-frame costs changed without the target being met
+#define SATURATION_FRAMES 64
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+bool zseek_fsctl_init(zseek_fsctl_t *ctl, size_t min_size, size_t max_size,
+    double target)
+{
+    if (!ctl || min_size == 0 || min_size > max_size || !(target > 0))
+        return false;
+
+    *ctl = (zseek_fsctl_t) {
+        .min_size = min_size,
+        .max_size = max_size,
+        .target = target,
+        .size = min_size,
+    };
+
+    return true;
+}
+
+size_t zseek_fsctl_size(const zseek_fsctl_t *ctl)
+{
+    return ctl->size;
+}
+
+static void resize(zseek_fsctl_t *ctl, size_t size)
+{
+    ctl->size = size;
+    ctl->samples = 0;
+    ctl->tput = 0;
+    ctl->ratio = 0;
+}
+
+void zseek_fsctl_update(zseek_fsctl_t *ctl, size_t usize, size_t csize,
+    uint64_t compress_ns, uint64_t write_ns, int parallelism)
+{
+    if (usize == 0 || csize == 0)
+        return;
+
+    // Throughput is bound by both compression, spread across workers, and
+    // writing, one frame at a time
+    double compress_sec = compress_ns / (1000.0 * 1000 * 1000);
+    double write_sec = write_ns / (1000.0 * 1000 * 1000);
+    double sec = MAX(compress_sec / MAX(parallelism, 1), write_sec);
+    // NOTE: Clamp, so that a frame too quick to measure does not dominate
+    double tput = usize / MAX(sec, 1e-9);
+    double ratio = (double)usize / csize;
+
+    if (ctl->samples == 0) {
+        ctl->tput = tput;
+        ctl->ratio = ratio;
+    } else {
+        ctl->tput += ALPHA * (tput - ctl->tput);
+        ctl->ratio += ALPHA * (ratio - ctl->ratio);
+    }
+    if (ctl->saturated)
+        ctl->saturated_frames++;
+    if (++ctl->samples < SAMPLES)
+        return;
+
+    if (ctl->prev_size) {
+        // Judge the last growth, once
+        bool paid_off = ctl->tput >= ctl->prev_tput * (1 + MIN_GAIN) ||
+            ctl->ratio >= ctl->prev_ratio * (1 + MIN_GAIN);
+        size_t prev_size = ctl->prev_size;
+        ctl->prev_size = 0;
+        if (!paid_off) {
+            // Larger frames do not help, so keep reads cheap
+            ctl->saturated = true;
+            ctl->saturated_frames = 0;
+            resize(ctl, prev_size);
+            return;
+        }
+    }
+
+    // Meeting the target again means costs changed, so growing may pay off
+    // next time it falls short
+    if (ctl->saturated && (ctl->tput >= ctl->target ||
+        ctl->saturated_frames >= SATURATION_FRAMES))
+        ctl->saturated = false;
+
+    if (ctl->tput < ctl->target && !ctl->saturated &&
+        ctl->size < ctl->max_size) {
+        // Too slow, amortize per-frame costs over more data
+        ctl->prev_size = ctl->size;
+        ctl->prev_tput = ctl->tput;
+        ctl->prev_ratio = ctl->ratio;
+        resize(ctl, ctl->size > ctl->max_size / 2 ? ctl->max_size :
+            ctl->size * 2);
+    } else if (ctl->tput > ctl->target * HYSTERESIS &&
+        ctl->size > ctl->min_size) {
+        // Fast enough, reduce read amplification
+        resize(ctl, MAX(ctl->size / 4 * 3, ctl->min_size));
+    }
+}
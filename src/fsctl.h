@@ -0,0 +1,52 @@
+#ifndef FSCTL_H
+#define FSCTL_H
+
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t
+#include <stdbool.h>    // bool
+
+/**
+ * Frame size controller, picking the smallest frame size that sustains a
+ * target throughput. Smaller frames mean less read amplification, larger ones
+ * amortize per-frame costs better and compress better.
+ */
+typedef struct {
+    size_t min_size;
+    size_t max_size;
+    double target;      // target throughput (bytes/sec)
+    size_t size;        // current frame size
+    // Observations at the current size
+    unsigned samples;
+    double tput;        // throughput (bytes/sec), moving average
+    double ratio;       // compression ratio, moving average
+    // Observations at the size before the last growth, if any
+    size_t prev_size;
+    double prev_tput;
+    double prev_ratio;
+    bool saturated;     // growing does not pay off any more
+    unsigned saturated_frames;  // frames observed since
+} zseek_fsctl_t;
+
+/**
+ * Initializes @p ctl to pick frame sizes in [@p min_size, @p max_size],
+ * aiming for @p target uncompressed bytes per second.
+ * Returns @a false if the parameters are invalid.
+ */
+bool zseek_fsctl_init(zseek_fsctl_t *ctl, size_t min_size, size_t max_size,
+    double target);
+
+/**
+ * Returns the frame size to use next.
+ */
+size_t zseek_fsctl_size(const zseek_fsctl_t *ctl);
+
+/**
+ * Accounts for a frame of @p usize uncompressed and @p csize compressed bytes,
+ * which took @p compress_ns to compress and @p write_ns to write out.
+ * Frames are compressed by @p parallelism workers at a time, while others are
+ * written out one at a time.
+ */
+void zseek_fsctl_update(zseek_fsctl_t *ctl, size_t usize, size_t csize,
+    uint64_t compress_ns, uint64_t write_ns, int parallelism);
+
+#endif  // FSCTL_H
@@ -0,0 +1,62 @@
+#include <stddef.h>     // size_t
+#include <stdbool.h>    // bool
+#include <assert.h>     // assert
+
+#include "plan.h"
+
+static size_t align_down(const zseek_plan_t *plan, size_t offset)
+{
+    return offset & ~(plan->alignment - 1);
+}
+
+static size_t align_up(const zseek_plan_t *plan, size_t offset)
+{
+    return (offset + plan->alignment - 1) & ~(plan->alignment - 1);
+}
+
+void zseek_plan_init(zseek_plan_t *plan, size_t max_size, size_t alignment)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    *plan = (zseek_plan_t){
+        .max_size = max_size,
+        .alignment = alignment,
+    };
+}
+
+bool zseek_plan_add(zseek_plan_t *plan, size_t offset, size_t size)
+{
+    if (plan->nb_frames == 0) {
+        plan->start = offset;
+        plan->end = offset + size;
+        plan->nb_frames = 1;
+        return true;
+    }
+
+    // NOTE: Gaps within the aligned block ending the read cost nothing more
+    if (offset < plan->end ||
+            align_down(plan, offset) > align_up(plan, plan->end))
+        return false;
+    if (align_up(plan, offset + size) - align_down(plan, plan->start) >
+            plan->max_size)
+        return false;
+
+    plan->end = offset + size;
+    plan->nb_frames++;
+    return true;
+}
+
+size_t zseek_plan_offset(const zseek_plan_t *plan)
+{
+    return align_down(plan, plan->start);
+}
+
+size_t zseek_plan_size(const zseek_plan_t *plan)
+{
+    return align_up(plan, plan->end) - zseek_plan_offset(plan);
+}
+
+size_t zseek_plan_needed(const zseek_plan_t *plan)
+{
+    return plan->end - zseek_plan_offset(plan);
+}
@@ -0,0 +1,52 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <stddef.h>     // size_t
+#include <stdbool.h>    // bool
+
+/**
+ * Plan of a single read of a run of adjacent compressed frames, rounded to
+ * an alignment at both ends (e.g. that of direct I/O), of bounded size.
+ * Lives on the stack of the reader.
+ */
+typedef struct {
+    size_t max_size;
+    size_t alignment;
+    size_t start;       // of the first frame
+    size_t end;         // of the last frame
+    size_t nb_frames;
+} zseek_plan_t;
+
+/**
+ * Starts an empty plan of a read of up to @p max_size bytes, but for a single
+ * larger frame, aligned to @p alignment, a power of two.
+ */
+void zseek_plan_init(zseek_plan_t *plan, size_t max_size, size_t alignment);
+
+/**
+ * Adds the frame of @p size bytes at @p offset to the read of @p plan, unless
+ * the read would grow larger than its maximum, or the frame is not adjacent
+ * to the last one added, but for a gap within the same aligned block. Frames
+ * must be added in file order. The first frame is always added.
+ * Returns whether added.
+ */
+bool zseek_plan_add(zseek_plan_t *plan, size_t offset, size_t size);
+
+/**
+ * Returns the offset of the read of @p plan in the file, aligned.
+ */
+size_t zseek_plan_offset(const zseek_plan_t *plan);
+
+/**
+ * Returns the size of the read of @p plan in bytes, aligned. The read may be
+ * cut short past the end of the last frame, at the end of the file.
+ */
+size_t zseek_plan_size(const zseek_plan_t *plan);
+
+/**
+ * Returns the number of bytes of the read of @p plan that must be read, up to
+ * the end of the last frame.
+ */
+size_t zseek_plan_needed(const zseek_plan_t *plan);
+
+#endif  // PLAN_H
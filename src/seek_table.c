@@ -2,7 +2,6 @@
 #include <stddef.h>     // size_t
 #include <stdbool.h>    // bool
 #include <limits.h>     // UINT_MAX
-#include <stdlib.h>     // malloc, realloc, free
 #include <assert.h>     // assert
 #include <string.h>     // memcpy
 
@@ -11,6 +10,7 @@
 #include <zstd_errors.h>
 
 #include "seek_table.h"
+#include "alloc.h"
 
 #define ZSTD_seekTableFooterSize 9
 #define ZSTD_SEEKABLE_MAGICNUMBER 0x8F92EAB1
@@ -44,6 +44,8 @@ struct ZSTD_seekTable_s {
     size_t tableLen;
 
     int checksumFlag;
+
+    const zseek_allocator_t *allocator; // NOTE: Not part of the original
 };
 
 static inline void MEM_writeLE32(void *memPtr, U32 val32)
@@ -59,14 +61,34 @@ static inline U32 MEM_readLE32(void const *memPtr)
     return le32toh(val32le);
 }
 
+/**
+ * Parse the seek table entry at @p buf into @p entry, starting at the offsets
+ * @p c_offset and @p d_offset, which it advances. Return its size.
+ */
+static size_t parse_st_entry(const uint8_t *buf, seekEntry_t *entry,
+    bool checksum, size_t *c_offset, size_t *d_offset)
+{
+    entry->cOffset = *c_offset;
+    entry->dOffset = *d_offset;
+    *c_offset += MEM_readLE32(buf);
+    *d_offset += MEM_readLE32(buf + 4);
+    if (checksum) {
+        entry->checksum = MEM_readLE32(buf + 8);
+        return SEEK_ENTRY_SIZE_NO_CHECKSUM + SEEK_ENTRY_CHECKSUM_SIZE;
+    }
+
+    return SEEK_ENTRY_SIZE_NO_CHECKSUM;
+}
+
 static bool read_st_entries(zseek_read_file_t user_file, size_t entries_off,
-    seekEntry_t *entries, size_t num_entries, bool checksum, void *call_data)
+    seekEntry_t *entries, size_t num_entries, bool checksum, void *call_data,
+    const zseek_allocator_t *allocator)
 {
     size_t entry_size = SEEK_ENTRY_SIZE_NO_CHECKSUM +
         (checksum ? SEEK_ENTRY_CHECKSUM_SIZE : 0);
     size_t buf_len = SEEKKTABLE_BUF_SIZE -
         (SEEKKTABLE_BUF_SIZE % entry_size);    // fit whole # of entries
-    void *buf = malloc(buf_len);
+    void *buf = zseek_alloc(allocator, buf_len);
     if (!buf)
         goto fail;
 
@@ -85,37 +107,85 @@ static bool read_st_entries(zseek_read_file_t user_file, size_t entries_off,
             buf_idx = 0;
         }
 
-        // Parse entry
-        entries[e].cOffset = c_offset;
-        entries[e].dOffset = d_offset;
-        c_offset += MEM_readLE32((uint8_t*)buf + buf_idx);
-        buf_idx += 4;
-        d_offset += MEM_readLE32((uint8_t*)buf + buf_idx);
-        buf_idx += 4;
-        if (checksum) {
-            entries[e].checksum = MEM_readLE32((uint8_t*)buf + buf_idx);
-            buf_idx += 4;
-        }
+        buf_idx += parse_st_entry((uint8_t*)buf + buf_idx, &entries[e],
+            checksum, &c_offset, &d_offset);
     }
     entries[num_entries].cOffset = c_offset;
     entries[num_entries].dOffset = d_offset;
 
-    free(buf);
+    zseek_free(allocator, buf);
     return true;
 
 fail_w_buf:
-    free(buf);
+    zseek_free(allocator, buf);
 fail:
     return false;
 }
 
-ZSTD_seekTable *read_seek_table(zseek_read_file_t user_file, void *call_data)
+/**
+ * Parse the seek table footer, at the end of a file of @p fsize bytes, into
+ * the number of frames and checksum flag, and return the size of the seek
+ * table frame, or 0 if invalid.
+ */
+static size_t parse_footer(const uint8_t *footer, size_t fsize,
+    uint32_t *num_frames, bool *checksum)
+{
+    // Check Seekable_Magic_Number
+    if (MEM_readLE32(footer + 5) != ZSTD_SEEKABLE_MAGICNUMBER)
+        return 0;
+    // Check Seek_Table_Descriptor
+    uint8_t std = footer[4];
+    if (std & 0x7c)
+        // Some of the reserved bits are set
+        return 0;
+    *checksum = std & 0x80;
+    *num_frames = MEM_readLE32(footer);
+
+    size_t seek_entry_size = SEEK_ENTRY_SIZE_NO_CHECKSUM +
+        (*checksum ? SEEK_ENTRY_CHECKSUM_SIZE : 0);
+    size_t seek_frame_size = ZSTD_SKIPPABLEHEADERSIZE +
+        (size_t)*num_frames * seek_entry_size + ZSTD_seekTableFooterSize;
+    if (seek_frame_size > fsize)
+        return 0;
+
+    return seek_frame_size;
+}
+
+/**
+ * Check the header of a seek table frame of @p seek_frame_size bytes
+ */
+static bool check_header(const uint8_t *header, size_t seek_frame_size)
+{
+    // Check Skippable_Magic_Number
+    if (MEM_readLE32(header) != SEEKTABLE_SKIPPABLE_MAGICNUMBER)
+        return false;
+    // Check Frame_Size
+    return MEM_readLE32(header + 4) ==
+        seek_frame_size - ZSTD_SKIPPABLEHEADERSIZE;
+}
+
+static ZSTD_seekTable *new_seek_table(seekEntry_t *entries,
+    uint32_t num_frames, bool checksum, const zseek_allocator_t *allocator)
+{
+    ZSTD_seekTable *st = zseek_alloc(allocator, sizeof(*st));
+    if (!st)
+        return NULL;
+    st->entries = entries;
+    st->tableLen = num_frames;
+    st->checksumFlag = (int)checksum;
+    st->allocator = allocator;
+
+    return st;
+}
+
+ZSTD_seekTable *read_seek_table(zseek_read_file_t user_file, void *call_data,
+    const zseek_allocator_t *allocator)
 {
     // TODO: Communicate error info?
 
     // Get file size
     ssize_t fsize = user_file.fsize(user_file.user_data, call_data);
-    if (fsize < 0)
+    if (fsize < ZSTD_seekTableFooterSize)
         goto fail;
 
     // Read seek table footer
@@ -124,53 +194,82 @@ ZSTD_seekTable *read_seek_table(zseek_read_file_t user_file, void *call_data)
         fsize - ZSTD_seekTableFooterSize, user_file.user_data, call_data);
     if (_read != ZSTD_seekTableFooterSize)
         goto fail;
-    // Check Seekable_Magic_Number
-    if (MEM_readLE32(footer + 5) != ZSTD_SEEKABLE_MAGICNUMBER)
+    uint32_t num_frames;
+    bool checksum;
+    size_t seek_frame_size = parse_footer(footer, fsize, &num_frames,
+        &checksum);
+    if (!seek_frame_size)
         goto fail;
-    // Check Seek_Table_Descriptor
-    uint8_t std = footer[4];
-    if (std & 0x7c)
-        // Some of the reserved bits are set
-        goto fail;
-    bool checksum = std & 0x80;
-    uint32_t num_frames = MEM_readLE32(footer);
 
     // Read seek table header
-    long seek_entry_size = SEEK_ENTRY_SIZE_NO_CHECKSUM +
-        (checksum ? SEEK_ENTRY_CHECKSUM_SIZE : 0);
-    long seek_frame_size = ZSTD_SKIPPABLEHEADERSIZE +
-        num_frames * seek_entry_size + ZSTD_seekTableFooterSize;
     uint8_t header[ZSTD_SKIPPABLEHEADERSIZE];
     _read = user_file.pread(header, ZSTD_SKIPPABLEHEADERSIZE,
         fsize - seek_frame_size, user_file.user_data, call_data);
     if (_read != ZSTD_SKIPPABLEHEADERSIZE)
         goto fail;
-    // Check Skippable_Magic_Number
-    if (MEM_readLE32(header) != SEEKTABLE_SKIPPABLE_MAGICNUMBER)
-        goto fail;
-    // Check Frame_Size
-    if (MEM_readLE32(header + 4) != seek_frame_size - ZSTD_SKIPPABLEHEADERSIZE)
+    if (!check_header(header, seek_frame_size))
         goto fail;
 
     // Read seek table
-    seekEntry_t *entries = malloc((num_frames + 1) * sizeof(entries[0]));
+    seekEntry_t *entries = zseek_alloc(allocator,
+        (num_frames + 1) * sizeof(entries[0]));
     if (!entries)
         goto fail;
     size_t entries_off = fsize - seek_frame_size + ZSTD_SKIPPABLEHEADERSIZE;
     if (!read_st_entries(user_file, entries_off, entries, num_frames, checksum,
-        call_data))
+        call_data, allocator))
         goto fail_w_entries;
-    ZSTD_seekTable *st = malloc(sizeof(*st));
+    ZSTD_seekTable *st = new_seek_table(entries, num_frames, checksum,
+        allocator);
     if (!st)
         goto fail_w_entries;
-    st->entries = entries;
-    st->tableLen = num_frames;
-    st->checksumFlag = (int)checksum;
 
     return st;
 
 fail_w_entries:
-    free(entries);
+    zseek_free(allocator, entries);
+fail:
+    return NULL;
+}
+
+ZSTD_seekTable *map_seek_table(const void *data, size_t size,
+    const zseek_allocator_t *allocator)
+{
+    if (size < ZSTD_seekTableFooterSize)
+        goto fail;
+
+    const uint8_t *end = (const uint8_t*)data + size;
+    uint32_t num_frames;
+    bool checksum;
+    size_t seek_frame_size = parse_footer(end - ZSTD_seekTableFooterSize,
+        size, &num_frames, &checksum);
+    if (!seek_frame_size)
+        goto fail;
+    const uint8_t *header = end - seek_frame_size;
+    if (!check_header(header, seek_frame_size))
+        goto fail;
+
+    seekEntry_t *entries = zseek_alloc(allocator,
+        (num_frames + 1) * sizeof(entries[0]));
+    if (!entries)
+        goto fail;
+    const uint8_t *buf = header + ZSTD_SKIPPABLEHEADERSIZE;
+    size_t c_offset = 0;
+    size_t d_offset = 0;
+    for (size_t e = 0; e < num_frames; e++)
+        buf += parse_st_entry(buf, &entries[e], checksum, &c_offset,
+            &d_offset);
+    entries[num_frames].cOffset = c_offset;
+    entries[num_frames].dOffset = d_offset;
+    ZSTD_seekTable *st = new_seek_table(entries, num_frames, checksum,
+        allocator);
+    if (!st)
+        goto fail_w_entries;
+
+    return st;
+
+fail_w_entries:
+    zseek_free(allocator, entries);
 fail:
     return NULL;
 }
@@ -180,8 +279,8 @@ void seek_table_free(ZSTD_seekTable *st)
     if (!st)
         return;
 
-    free(st->entries);
-    free(st);
+    zseek_free(st->allocator, st->entries);
+    zseek_free(st->allocator, st);
 }
 
 ssize_t offset_to_frame_idx(ZSTD_seekTable *st, size_t offset)
@@ -240,6 +339,11 @@ size_t seek_table_decompressed_size(const ZSTD_seekTable *st)
     return st->entries[st->tableLen].dOffset;
 }
 
+size_t seek_table_compressed_size(const ZSTD_seekTable *st)
+{
+    return st->entries[st->tableLen].cOffset;
+}
+
 /* NOTE: The below are copied verbatim from
 zstd/contrib/seekable_format/zstdseek_compress.c @ v1.5.0 */
 
@@ -259,13 +363,15 @@ struct ZSTD_frameLog_s {
     /* for use when streaming out the seek table */
     U32 seekTablePos;
     U32 seekTableIndex;
+
+    const zseek_allocator_t *allocator; // NOTE: Not part of the original
 } framelog_t;
 
 static size_t ZSTD_seekable_frameLog_allocVec(ZSTD_frameLog* fl)
 {
     /* allocate some initial space */
     size_t const FRAMELOG_STARTING_CAPACITY = 16;
-    fl->entries = (framelogEntry_t*)malloc(
+    fl->entries = (framelogEntry_t*)zseek_alloc(fl->allocator,
             sizeof(framelogEntry_t) * FRAMELOG_STARTING_CAPACITY);
     if (fl->entries == NULL) return ERROR(memory_allocation);
     fl->capacity = (U32)FRAMELOG_STARTING_CAPACITY;
@@ -274,17 +380,20 @@ static size_t ZSTD_seekable_frameLog_allocVec(ZSTD_frameLog* fl)
 
 static size_t ZSTD_seekable_frameLog_freeVec(ZSTD_frameLog* fl)
 {
-    if (fl != NULL) free(fl->entries);
+    if (fl != NULL) zseek_free(fl->allocator, fl->entries);
     return 0;
 }
 
-ZSTD_frameLog* ZSTD_seekable_createFrameLog(int checksumFlag)
+ZSTD_frameLog* ZSTD_seekable_createFrameLog(int checksumFlag,
+                                            const zseek_allocator_t* allocator)
 {
-    ZSTD_frameLog* const fl = (ZSTD_frameLog*)malloc(sizeof(ZSTD_frameLog));
+    ZSTD_frameLog* const fl = (ZSTD_frameLog*)zseek_alloc(allocator,
+            sizeof(ZSTD_frameLog));
     if (fl == NULL) return NULL;
 
+    fl->allocator = allocator;
     if (ZSTD_isError(ZSTD_seekable_frameLog_allocVec(fl))) {
-        free(fl);
+        zseek_free(allocator, fl);
         return NULL;
     }
 
@@ -299,7 +408,7 @@ ZSTD_frameLog* ZSTD_seekable_createFrameLog(int checksumFlag)
 size_t ZSTD_seekable_freeFrameLog(ZSTD_frameLog* fl)
 {
     ZSTD_seekable_frameLog_freeVec(fl);
-    free(fl);
+    if (fl != NULL) zseek_free(fl->allocator, fl);
     return 0;
 }
 
@@ -315,7 +424,9 @@ size_t ZSTD_seekable_logFrame(ZSTD_frameLog* fl,
     if (fl->size == fl->capacity) {
         /* exponential size increase for constant amortized runtime */
         size_t const newCapacity = fl->capacity * 2;
-        framelogEntry_t* const newEntries = (framelogEntry_t*)realloc(fl->entries,
+        framelogEntry_t* const newEntries = (framelogEntry_t*)zseek_realloc(
+                fl->allocator, fl->entries,
+                sizeof(framelogEntry_t) * fl->capacity,
                 sizeof(framelogEntry_t) * newCapacity);
 
         if (newEntries == NULL) return ERROR(memory_allocation);
@@ -8,7 +8,8 @@
 
 typedef struct ZSTD_frameLog_s ZSTD_frameLog;
 typedef struct ZSTD_seekTable_s ZSTD_seekTable;
-ZSTD_frameLog* ZSTD_seekable_createFrameLog(int checksumFlag);
+ZSTD_frameLog* ZSTD_seekable_createFrameLog(int checksumFlag,
+    const zseek_allocator_t *allocator);
 size_t ZSTD_seekable_freeFrameLog(ZSTD_frameLog* fl);
 size_t ZSTD_seekable_logFrame(ZSTD_frameLog* fl, unsigned compressedSize,
     unsigned decompressedSize, unsigned checksum);
@@ -16,9 +17,17 @@ size_t ZSTD_seekable_writeSeekTable(ZSTD_frameLog* fl, ZSTD_outBuffer* output);
 
 /**
  * Parse and return the seek table found in the last frame contained in @p fin,
- * or NULL on error.
+ * or NULL on error. Memory comes from @p allocator (the C library if
+ * @a NULL), which must outlive the seek table.
  */
-ZSTD_seekTable *read_seek_table(zseek_read_file_t user_file, void *call_data);
+ZSTD_seekTable *read_seek_table(zseek_read_file_t user_file, void *call_data,
+    const zseek_allocator_t *allocator);
+/**
+ * Same as read_seek_table(), for a file of @p size bytes mapped in memory at
+ * @p data, parsed in place.
+ */
+ZSTD_seekTable *map_seek_table(const void *data, size_t size,
+    const zseek_allocator_t *allocator);
 /**
  * Free the seek table pointed to by @p st.
  */
@@ -71,5 +80,10 @@ size_t seek_table_entries(const ZSTD_seekTable *st);
  * Return the total decompressed size of the frames in @p st.
  */
 size_t seek_table_decompressed_size(const ZSTD_seekTable *st);
+/**
+ * Return the total compressed size of the frames in @p st, i.e. the offset of
+ * the end of the last one.
+ */
+size_t seek_table_compressed_size(const ZSTD_seekTable *st);
 
 #endif /* SEEK_TABLE_H */
@@ -0,0 +1,119 @@
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uintptr_t
+#include <stdbool.h>    // bool
+#include <string.h>     // memcpy, memmove, memset
+
+#include "stage.h"
+#include "alloc.h"
+
+struct zseek_stage {
+    void *mem;          // as allocated
+    uint8_t *data;      // mem, aligned
+    size_t size;        // chunk size
+    size_t alignment;
+    bool pad;
+    size_t pos;         // bytes staged
+    size_t written;     // of them, written out already, if padding
+    const zseek_allocator_t *allocator;
+};
+
+zseek_stage_t *zseek_stage_new(size_t size, size_t alignment, bool pad,
+    const zseek_allocator_t *allocator)
+{
+    if (size == 0 || alignment == 0 || (alignment & (alignment - 1)))
+        return NULL;
+    size = (size + alignment - 1) & ~(alignment - 1);
+
+    zseek_stage_t *stage = zseek_alloc(allocator, sizeof(*stage));
+    if (!stage)
+        goto fail;
+
+    // NOTE: Allocators only guarantee malloc()'s alignment
+    stage->mem = zseek_alloc(allocator, size + alignment - 1);
+    if (!stage->mem)
+        goto fail_w_stage;
+    uintptr_t addr = (uintptr_t)stage->mem;
+    stage->data = (uint8_t*)stage->mem +
+        (((addr + alignment - 1) & ~(uintptr_t)(alignment - 1)) - addr);
+    stage->size = size;
+    stage->alignment = alignment;
+    stage->pad = pad;
+    stage->pos = 0;
+    stage->written = 0;
+    stage->allocator = allocator;
+
+    return stage;
+
+fail_w_stage:
+    zseek_free(allocator, stage);
+fail:
+    return NULL;
+}
+
+void zseek_stage_free(zseek_stage_t *stage)
+{
+    if (!stage)
+        return;
+
+    zseek_free(stage->allocator, stage->mem);
+    zseek_free(stage->allocator, stage);
+}
+
+bool zseek_stage_write(zseek_stage_t *stage, const void *data, size_t len,
+    const zseek_write_file_t *file, void *call_data)
+{
+    const uint8_t *src = data;
+    while (len > 0) {
+        if (stage->pos == stage->size && !zseek_stage_flush(stage, file,
+            call_data))
+            return false;
+
+        size_t n = stage->size - stage->pos;
+        if (n > len)
+            n = len;
+        memcpy(stage->data + stage->pos, src, n);
+        stage->pos += n;
+        src += n;
+        len -= n;
+    }
+
+    // Write out a full chunk right away, rather than on the next write
+    if (stage->pos == stage->size)
+        return zseek_stage_flush(stage, file, call_data);
+
+    return true;
+}
+
+bool zseek_stage_flush(zseek_stage_t *stage, const zseek_write_file_t *file,
+    void *call_data)
+{
+    if (stage->pos == stage->written)
+        return true;
+
+    size_t mask = stage->alignment - 1;
+    if (stage->pad) {
+        // NOTE: Within the chunk, a multiple of the alignment
+        memset(stage->data + stage->pos, 0,
+            ((stage->pos + mask) & ~mask) - stage->pos);
+    }
+    if (!file->write(stage->data, stage->pos, file->user_data, call_data))
+        return false;
+
+    // Keep the partial block, written out again with what follows
+    size_t tail = stage->pad ? stage->pos & mask : 0;
+    memmove(stage->data, stage->data + stage->pos - tail, tail);
+    stage->pos = tail;
+    stage->written = tail;
+
+    return true;
+}
+
+size_t zseek_stage_size(const zseek_stage_t *stage)
+{
+    return stage->size;
+}
+
+size_t zseek_stage_pending(const zseek_stage_t *stage)
+{
+    return stage->pos - stage->written;
+}
@@ -0,0 +1,62 @@
+#ifndef STAGE_H
+#define STAGE_H
+
+#include <stddef.h>     // size_t
+#include <stdbool.h>    // bool
+
+#include "zseek.h"
+
+/**
+ * Output staging buffer, coalescing small writes into whole, aligned chunks
+ * for the write callback.
+ */
+typedef struct zseek_stage zseek_stage_t;
+
+/**
+ * Creates a staging buffer of @p size bytes, rounded up to a multiple of
+ * @p alignment, a power of two, and aligned to it in memory.
+ * If @p pad, data written out is zero-padded up to the alignment, and its
+ * last, partial block stays staged, to be written out again at the start of
+ * the next chunk, as zseek_fd_write() expects of direct files.
+ * Memory comes from @p allocator, which must outlive the buffer, or the C
+ * library if @a NULL.
+ * Returns @a NULL on error.
+ */
+zseek_stage_t *zseek_stage_new(size_t size, size_t alignment, bool pad,
+    const zseek_allocator_t *allocator);
+
+/**
+ * Frees @p stage, dropping any data not written out.
+ */
+void zseek_stage_free(zseek_stage_t *stage);
+
+/**
+ * Stages @p len bytes of @p data, writing out to @p file every chunk that
+ * fills up. Whole chunks are written out as is.
+ * Returns @a false if writing out failed, the failed chunk is kept staged.
+ *
+ * @attention Not safe to call concurrently (unlocked).
+ */
+bool zseek_stage_write(zseek_stage_t *stage, const void *data, size_t len,
+    const zseek_write_file_t *file, void *call_data);
+
+/**
+ * Writes out the data staged so far, if any, to @p file.
+ * Returns @a false on error, the data is kept staged.
+ *
+ * @attention Not safe to call concurrently (unlocked).
+ */
+bool zseek_stage_flush(zseek_stage_t *stage, const zseek_write_file_t *file,
+    void *call_data);
+
+/**
+ * Returns the chunk size of @p stage in bytes.
+ */
+size_t zseek_stage_size(const zseek_stage_t *stage);
+
+/**
+ * Returns the number of bytes staged in @p stage, not written out yet.
+ */
+size_t zseek_stage_pending(const zseek_stage_t *stage);
+
+#endif  // STAGE_H
@@ -26,6 +26,7 @@
 #include <stdio.h>
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sched.h>
 
 /**
@@ -53,6 +54,21 @@
 typedef bool (*zseek_write_t)(const void *data, size_t size, void *user_data,
     void *call_data);
 
+/**
+ * Pluggable flush handler
+ *
+ * @param user_data
+ *  The user-specified file handle
+ * @param call_data
+ *  The user-specified per-call data
+ *
+ * @retval true
+ *  On success. All data written so far is durable.
+ * @retval false
+ *  On error
+ */
+typedef bool (*zseek_flush_t)(void *user_data, void *call_data);
+
 /**
  * User-defined file supporting writes
  */
@@ -61,11 +77,17 @@ typedef struct {
     void *user_data;
     /** Write function */
     zseek_write_t write;
+    /** Flush function, or @a NULL if written data is durable on return */
+    zseek_flush_t flush;
 } zseek_write_file_t;
 
 /**
  * Pluggable read handler
  *
+ * Called by one read at a time, unless zseek_reader_param_t.concurrent_io is
+ * set: concurrent reads then call it concurrently, so it must be thread-safe,
+ * e.g. by reading at @p offset without a shared file position.
+ *
  * @param[out] data
  *  The destination for the data read
  * @param size
@@ -113,6 +135,83 @@ typedef struct {
     zseek_fsize_t fsize;
 } zseek_read_file_t;
 
+/**
+ * File descriptor controls, see zseek_writer_open_fd(),
+ * zseek_reader_open_fd() and zseek_reader_open_mmap()
+ */
+typedef struct {
+    /**
+     * Access pattern advice for the whole file, passed to posix_fadvise(),
+     * e.g. POSIX_FADV_RANDOM for readers (default = 0, POSIX_FADV_NORMAL)
+     */
+    int advice;
+    /**
+     * Alignment of I/O, in memory, offset and size, if the file descriptor
+     * was opened with O_DIRECT, e.g. the logical block size of the storage.
+     * Must be a power of two (default = 4 KiB).
+     */
+    size_t direct_alignment;
+} zseek_fd_param_t;
+
+/**
+ * Pluggable allocation handler
+ *
+ * @param size
+ *  The number of bytes to allocate
+ * @param user_data
+ *  The user-specified allocator state
+ *
+ * @retval ptr
+ *  On success, suitably aligned for any type, as with malloc()
+ * @retval NULL
+ *  On error
+ */
+typedef void *(*zseek_alloc_t)(size_t size, void *user_data);
+
+/**
+ * Pluggable reallocation handler, with the semantics of realloc()
+ *
+ * @param ptr
+ *  The memory to resize, or @a NULL
+ * @param size
+ *  The new size in bytes
+ * @param user_data
+ *  The user-specified allocator state
+ *
+ * @retval ptr
+ *  On success
+ * @retval NULL
+ *  On error, @p ptr is left untouched
+ */
+typedef void *(*zseek_realloc_t)(void *ptr, size_t size, void *user_data);
+
+/**
+ * Pluggable free handler
+ *
+ * @param ptr
+ *  The memory to free, never @a NULL
+ * @param user_data
+ *  The user-specified allocator state
+ */
+typedef void (*zseek_free_t)(void *ptr, void *user_data);
+
+/**
+ * User-defined allocator, e.g. an arena or a hugepage-backed pool.
+ * All memory of a reader or writer (handles, buffers, cached frames, the seek
+ * table, the compression contexts) is allocated through it. It may be called
+ * from library-owned threads too.
+ */
+typedef struct {
+    /** Allocator state to use when calling below functions */
+    void *user_data;
+    /** Allocation function */
+    zseek_alloc_t alloc;
+    /** Reallocation function, or @a NULL to allocate, copy and free */
+    zseek_realloc_t realloc;
+    /** Free function */
+    zseek_free_t free;
+} zseek_allocator_t;
+
 /**
  * Supported compression algorithms
  */
@@ -135,6 +234,13 @@ typedef struct {
     int compression_level;
     /** Compression strategy (default = fast)  */
     int strategy;
+    /**
+     * Compress whole frames in parallel on a pool of @ref nb_workers library
+     * threads, each with a single-threaded context, instead of relying on
+     * zstd's multi-threading. Frame boundaries then do not stall compression
+     * and a libzstd built without multi-threading support suffices.
+     */
+    bool frame_parallel;
 } zseek_zstd_param_t;
 
 /**
@@ -143,6 +249,14 @@ typedef struct {
 typedef struct {
     /** Compression level (default = 0). Values < 0 trigger "acceleration" */
     int compression_level;
+    /** Number of worker threads, in asynchronous mode (default = 1) */
+    int nb_workers;
+    /**
+     * Compress the blocks of each frame independently of each other and
+     * write an index of them before the seek table, so that readers without
+     * a cache decompress only the blocks of the range read. Costs some ratio.
+     */
+    bool block_index;
 } zseek_lz4_param_t;
 
 /**
@@ -156,6 +270,299 @@ typedef struct {
     } params;
 } zseek_compression_param_t;
 
+/**
+ * What zseek_write() does when the asynchronous write queue is full
+ */
+typedef enum {
+    /** Block until enough queued data has been written out */
+    ZSEEK_BACKPRESSURE_BLOCK = 0,
+    /** Fail, without consuming any of the data */
+    ZSEEK_BACKPRESSURE_FAIL,
+    /** Queue the data anyway, exceeding the budget */
+    ZSEEK_BACKPRESSURE_GROW,
+} zseek_backpressure_t;
+
+/**
+ * Writer controls, beyond compression
+ */
+typedef struct {
+    /** Minimum (uncompressed) frame size */
+    size_t min_frame_size;
+    /**
+     * Compress and write out frames on background threads, so that
+     * zseek_write() only queues data. Implies frame-parallel compression and
+     * passes the @a call_data given at open to I/O callbacks.
+     * See zseek_writer_flush().
+     */
+    bool async;
+    /**
+     * Budget of queued (uncompressed) bytes in asynchronous mode
+     * (default = 4 frames per worker)
+     */
+    size_t max_queued_size;
+    /** What to do once @ref max_queued_size is reached */
+    zseek_backpressure_t backpressure;
+    /**
+     * End frames at content-defined points, found by a rolling hash over the
+     * data, instead of at the first write reaching @ref min_frame_size.
+     * Frame boundaries then do not depend on how data is split across writes,
+     * and survive insertions and deletions, so that similar files share most
+     * frames. Writes may be split across frames.
+     */
+    bool content_defined;
+    /**
+     * Target average frame size, for content-defined frames
+     * (default = 2 * @ref min_frame_size)
+     */
+    size_t avg_frame_size;
+    /**
+     * Maximum frame size, for content-defined frames
+     * (default = 4 * @ref avg_frame_size) or adaptive frame sizes
+     * (default = 16 * @ref min_frame_size)
+     */
+    size_t max_frame_size;
+    /**
+     * Adapt the frame size between @ref min_frame_size and
+     * @ref max_frame_size, as observed compression and write times change.
+     * The writer settles on the smallest frame size that sustains
+     * @ref target_throughput, trading throughput for cheaper random reads.
+     */
+    bool adaptive;
+    /**
+     * Target throughput in (uncompressed) bytes per second, for adaptive
+     * frame sizes
+     */
+    size_t target_throughput;
+    /**
+     * Adapt the compression level (or lz4 acceleration) frame by frame, to
+     * keep the mean zseek_write() latency within @ref target_latency_us.
+     * The configured compression level is the highest one used.
+     * See zseek_writer_frame_level().
+     */
+    bool adaptive_level;
+    /** Target mean zseek_write() latency (usec), for adaptive levels */
+    size_t target_latency_us;
+    /**
+     * How many levels below the configured one to go down to, for adaptive
+     * levels (default = 8)
+     */
+    unsigned level_range;
+    /**
+     * Dictionary to compress all frames with, or @a NULL. It is stored once
+     * at the start of the file, where readers load it from, as a frame of
+     * its own holding no data: frame indexes and counts (e.g.
+     * zseek_writer_stats_t.frames) include it, as frame 0.
+     * Frames no longer start with an empty history, so that small frames
+     * (e.g. 4-16 KiB) still compress well, for cheaper random reads.
+     */
+    const void *dict;
+    /** Size of @ref dict in bytes, up to 16 MiB */
+    size_t dict_size;
+    /**
+     * Train a dictionary on the first @ref dict_train_size bytes written,
+     * instead of passing @ref dict. These are buffered until then, or until
+     * the writer is flushed or closed. If training fails (e.g. on too little
+     * data), frames are compressed without a dictionary.
+     */
+    size_t dict_train_size;
+    /**
+     * Maximum size of a trained dictionary, up to 16 MiB
+     * (default = 110 KiB for zstd, 64 KiB for lz4)
+     */
+    size_t dict_max_size;
+    /** Allocator to use, copied at open, or @a NULL for the C library's */
+    const zseek_allocator_t *allocator;
+    /**
+     * Stage compressed output, so that the write callback gets chunks of
+     * @ref output_buffer_size bytes (rounded up to @ref output_alignment),
+     * but for the last one before each flush and at close
+     * (default = 0, every piece of output is written as produced)
+     */
+    size_t output_buffer_size;
+    /**
+     * Alignment of staged chunks, in memory and size, e.g. the block size
+     * of the storage. Must be a power of two (default = 4 KiB).
+     */
+    size_t output_alignment;
+} zseek_writer_param_t;
+
+/**
+ * Pool of decompressed frame buffers, recycled from evicted frames to newly
+ * cached ones. It may be shared between readers.
+ */
+typedef struct zseek_frame_pool zseek_frame_pool_t;
+
+/**
+ * Frame buffer pool controls
+ */
+typedef struct {
+    /** Maximum size of idle buffers to keep, in bytes (default = 16 MiB) */
+    size_t max_size;
+    /** Write to every page of new buffers, so that reads do not fault */
+    bool prefault;
+    /** Allocator to use, copied at creation, or @a NULL for the C library's */
+    const zseek_allocator_t *allocator;
+} zseek_frame_pool_param_t;
+
+/**
+ * Replacement policies of the reader cache
+ */
+typedef enum {
+    /** CLOCK (second chance), approximating LRU */
+    ZSEEK_CACHE_CLOCK = 0,
+    /**
+     * 2Q: frames used once go through a FIFO, holding a quarter of the
+     * cache, so that scans do not flush the frames used again
+     */
+    ZSEEK_CACHE_2Q,
+    /**
+     * W-TinyLFU: frames leaving a small FIFO window only replace others if
+     * used more often lately, which suits skewed access patterns
+     */
+    ZSEEK_CACHE_TINYLFU,
+} zseek_cache_policy_t;
+
+/**
+ * Admission policies of the reader cache, for frames not cached yet
+ */
+typedef enum {
+    /** Cache every frame read */
+    ZSEEK_ADMIT_ALL = 0,
+    /**
+     * Do not cache frames read whole by a single zseek_pread(), but
+     * decompress them straight into the read buffer, e.g. for bulk readers,
+     * so that they take a single pass over memory and do not flush the cache
+     */
+    ZSEEK_ADMIT_PARTIAL,
+} zseek_cache_admission_t;
+
+/**
+ * Backends of asynchronous reads, see zseek_pread_async()
+ */
+typedef enum {
+    /**
+     * io_uring if the kernel supports it and the reader has a file
+     * descriptor (without O_DIRECT), threads otherwise
+     */
+    ZSEEK_ASYNC_AUTO = 0,
+    /**
+     * io_uring: reads of compressed frames are submitted in batches, then
+     * decompressed by worker threads
+     */
+    ZSEEK_ASYNC_IO_URING,
+    /** Worker threads reading and decompressing synchronously */
+    ZSEEK_ASYNC_THREADS,
+} zseek_async_backend_t;
+
+/**
+ * Completion callback of an asynchronous read, called once on a worker thread
+ *
+ * @param result
+ *  Number of bytes read, or -1 on error
+ * @param ctx
+ *  The user-specified context of the read
+ * @param errmsg
+ *  The error message if @p result is -1, @a NULL otherwise. Only valid for the
+ *  duration of the call.
+ */
+typedef void (*zseek_pread_cb_t)(ssize_t result, void *ctx,
+    const char *errmsg);
+
+/**
+ * Cache of decompressed frames, shared between readers under one budget
+ */
+typedef struct zseek_cache zseek_cache_t;
+
+/**
+ * Shared cache controls
+ */
+typedef struct {
+    /** Maximum size of decompressed frames to cache, in bytes */
+    size_t max_size;
+    /**
+     * Maximum number of frames to cache, each taking some memory up front
+     * (default = one per 16 KiB of @ref max_size)
+     */
+    size_t max_frames;
+    /** Replacement policy (default = CLOCK) */
+    zseek_cache_policy_t policy;
+    /**
+     * Pool to take frame buffers from, which must outlive the cache, or
+     * @a NULL for a pool of the cache's own
+     */
+    zseek_frame_pool_t *frame_pool;
+    /**
+     * Maximum size of idle buffers in the cache's own pool, in bytes
+     * (default = 16 MiB)
+     */
+    size_t frame_pool_size;
+    /** Allocator to use, copied at creation, or @a NULL for the C library's */
+    const zseek_allocator_t *allocator;
+} zseek_shared_cache_param_t;
+
+/**
+ * Reader controls
+ */
+typedef struct {
+    /**
+     * Maximum number of decompressed frames to cache. Without a cache, reads
+     * decompress frames up to their end only, with bounded memory.
+     */
+    size_t cache_size;
+    /**
+     * Maximum size of decompressed frames to cache, in bytes, along with or
+     * instead of @ref cache_size (default = 0, unbounded)
+     */
+    size_t cache_max_size;
+    /** Replacement policy of the cache (default = CLOCK) */
+    zseek_cache_policy_t cache_policy;
+    /** Admission policy of the cache (default = ALL) */
+    zseek_cache_admission_t cache_admission;
+    /**
+     * Cache to share with other readers, which must outlive the reader,
+     * instead of one of its own. @ref cache_size, @ref cache_max_size,
+     * @ref cache_policy and @ref frame_pool are then ignored.
+     */
+    zseek_cache_t *shared_cache;
+    /** Allocator to use, copied at open, or @a NULL for the C library's */
+    const zseek_allocator_t *allocator;
+    /**
+     * Pool to take frame buffers from, which must outlive the reader, or
+     * @a NULL for a pool of the reader's own
+     */
+    zseek_frame_pool_t *frame_pool;
+    /**
+     * Maximum size of idle buffers in the reader's own pool, in bytes
+     * (default = 16 MiB)
+     */
+    size_t frame_pool_size;
+    /**
+     * Number of worker threads of asynchronous reads, see
+     * zseek_pread_async() (default = 0, none)
+     */
+    size_t async_workers;
+    /** Backend of asynchronous reads (default = AUTO) */
+    zseek_async_backend_t async_backend;
+    /**
+     * Maximum number of compressed frame reads in flight with io_uring
+     * (default = 128)
+     */
+    size_t async_queue_depth;
+    /**
+     * Maximum size of a single read of a run of adjacent compressed frames,
+     * for reads spanning several frames, in bytes (default = 1 MiB). Frames
+     * larger than it are read alone, so 1 disables coalescing.
+     */
+    size_t max_coalesced_io;
+    /**
+     * Whether the read callback given to zseek_reader_open_ext() is
+     * thread-safe, so that concurrent reads call it concurrently instead of
+     * one at a time, see zseek_pread_t (default = false). Readers of a
+     * @c FILE, a descriptor or a mapping read concurrently regardless.
+     */
+    bool concurrent_io;
+} zseek_reader_param_t;
+
 /**
  * Handle to a compressed file for sequential writes
  */
@@ -170,36 +577,104 @@ typedef struct zseek_reader zseek_reader_t;
  * Collection of writer statistics
  */
 typedef struct {
-    /** Size of seek table in bytes (on disk) */
+    /** Size of seek table in bytes (on disk), with the block index if any */
     size_t seek_table_size;
-    /** Memory usage of seek table in bytes */
+    /** Memory usage of seek table in bytes, with the block index if any */
     size_t seek_table_memory;
-    /** Number of frames */
+    /** Number of frames, with that of the dictionary if any */
     size_t frames;
     /** Estimate for compressed data size in bytes. Always <= actual size. */
     size_t compressed_size;
     /** Estimate for buffered data size in bytes. Always <= actual size. */
     size_t buffer_size;
+    /** Current minimum frame size in bytes, see zseek_writer_param_t */
+    size_t frame_size;
+    /** Compression level of the next frame, see zseek_writer_param_t */
+    int compression_level;
 } zseek_writer_stats_t;
 
 /**
  * Collection of reader statistics
  */
 typedef struct {
-    /** Memory usage of seek table in bytes */
+    /** Memory usage of seek table in bytes, with the block index if any */
     size_t seek_table_memory;
-    /** Number of frames */
+    /** Number of frames, with that of the dictionary if any */
     size_t frames;
     /** Decompressed file size in bytes */
     size_t decompressed_size;
-    /** Memory usage of reader cache in bytes */
+    /**
+     * Memory usage of reader cache in bytes, or of the frames of the reader
+     * in a shared cache, along with the other readers of its file
+     */
     size_t cache_memory;
-    /** Number of frames currently cached */
+    /** Highest memory usage of reader cache in bytes, see @ref cache_memory */
+    size_t cache_memory_peak;
+    /** Number of frames of the reader currently cached */
     size_t cached_frames;
+    /** Number of reads that found their frame cached */
+    size_t cache_hits;
+    /** Number of reads that did not find their frame cached */
+    size_t cache_misses;
+    /** Number of frames read without caching them, see cache_admission */
+    size_t cache_bypasses;
+    /**
+     * Number of reads of runs of several adjacent compressed frames, see
+     * max_coalesced_io
+     */
+    size_t coalesced_reads;
     /** Estimate for buffered data size in bytes. Always <= actual size. */
     size_t buffer_size;
+    /** Number of frame buffers recycled from the frame pool */
+    size_t frame_pool_hits;
+    /** Number of frame buffers newly allocated by the frame pool */
+    size_t frame_pool_misses;
+    /** Backend of asynchronous reads, if any (AUTO if none) */
+    zseek_async_backend_t async_backend;
 } zseek_reader_stats_t;
 
+/**
+ * Read-only view of decompressed data, see zseek_pread_ref()
+ */
+typedef struct {
+    /** Start of the data */
+    const void *data;
+    /** Size of the data in bytes */
+    size_t size;
+    /** Private to the library */
+    struct {
+        void *frame;
+        void *buf;
+        size_t buf_size;
+    } handle;
+} zseek_ref_t;
+
+/**
+ * Range of a batched read, see zseek_preadv_batch()
+ */
+typedef struct {
+    /** Buffer to store decompressed data */
+    void *buf;
+    /** Size of decompressed data to read */
+    size_t count;
+    /** Offset in the decompressed data to read data from */
+    size_t offset;
+} zseek_range_t;
+
+/**
+ * Collection of shared cache statistics
+ */
+typedef struct {
+    /** Memory usage of the cache in bytes */
+    size_t memory;
+    /** Highest memory usage of the cache in bytes */
+    size_t memory_peak;
+    /** Number of frames currently cached, of all readers */
+    size_t cached_frames;
+    /** Number of readers using the cache */
+    size_t readers;
+} zseek_shared_cache_stats_t;
+
 /**
  * Creates a compressed file for sequential writes
  *
@@ -224,6 +699,30 @@ zseek_writer_t *zseek_writer_open_full(zseek_write_file_t user_file,
     zseek_compression_param_t *zsp, size_t min_frame_size, void *call_data,
     char errbuf[ZSEEK_ERRBUF_SIZE]);
 
+/**
+ * Creates a compressed file for sequential writes, with extended controls
+ *
+ * @param user_file
+ *	File to write compressed data to
+ * @param zsp
+ *	Compression tunables and multi-threading controls.
+ *	If @a NULL defaults are applied
+ * @param zwp
+ *	Writer controls
+ * @param call_data
+ *  The user-specified per-call data to pass to I/O callbacks
+ * @param[out] errbuf
+ *	Pointer to error message buffer or @a NULL
+ *
+ * @retval writer
+ *  Handle to perform writes
+ * @retval NULL
+ *  On error. If not @a NULL, @p errbuf is populated with an error message.
+ */
+zseek_writer_t *zseek_writer_open_ext(zseek_write_file_t user_file,
+    zseek_compression_param_t *zsp, zseek_writer_param_t *zwp,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE]);
+
 /**
  * Creates a compressed file for sequential writes, with default file I/O
  *
@@ -247,6 +746,40 @@ zseek_writer_t *zseek_writer_open_full(zseek_write_file_t user_file,
 zseek_writer_t *zseek_writer_open(FILE *cfile, zseek_compression_param_t *zsp,
     size_t min_frame_size, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE]);
 
+/**
+ * Creates a compressed file for sequential writes to a file descriptor
+ *
+ * Writes are positional, starting from the current file position of @p fd,
+ * which is left unchanged, but for pipes and the like. If @p fd was opened
+ * with O_DIRECT, output is staged in aligned chunks (see
+ * zseek_writer_param_t.output_buffer_size, 1 MiB by default). The last chunk
+ * before each flush is zero-padded to the alignment, its last block written
+ * again along with the next chunk, and the padding is cut off on close.
+ *
+ * @param fd
+ *	File descriptor to write compressed data to, which must stay open until
+ *	the writer is closed
+ * @param zsp
+ *	Compression tunables and multi-threading controls.
+ *	If @a NULL defaults are applied
+ * @param zwp
+ *  Writer controls
+ * @param zfp
+ *  File descriptor controls. If @a NULL defaults are applied
+ * @param call_data
+ *  The user-specified per-call data to pass to I/O callbacks
+ * @param[out] errbuf
+ *	Pointer to error message buffer or @a NULL
+ *
+ * @retval writer
+ *  Handle to perform writes
+ * @retval NULL
+ *  On error. If not @a NULL, @p errbuf is populated with an error message.
+ */
+zseek_writer_t *zseek_writer_open_fd(int fd, zseek_compression_param_t *zsp,
+    zseek_writer_param_t *zwp, const zseek_fd_param_t *zfp, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE]);
+
 /**
  * Closes a compressed file handle for writes
  *
@@ -274,7 +807,7 @@ bool zseek_writer_close(zseek_writer_t *writer, void *call_data,
  * internally for efficient compression and IO.
  *
  * This is \e not safe to call concurrently. It will not, in general, return
- * immediately.
+ * immediately, unless the writer is asynchronous.
  *
  * @param writer
  *	Compressed file write handle
@@ -295,6 +828,75 @@ bool zseek_writer_close(zseek_writer_t *writer, void *call_data,
 bool zseek_write(zseek_writer_t *writer, const void *buf, size_t len,
     void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE]);
 
+/**
+ * Appends the data of @p iovcnt segments to a compressed file, as a single
+ * write
+ *
+ * Segments are fed to the compressor in order, without first being
+ * concatenated, and all of them end up in the same frame.
+ * Otherwise the same as zseek_write().
+ *
+ * @param writer
+ *	Compressed file write handle
+ * @param iov
+ *	Array of segments to write
+ * @param iovcnt
+ *	Number of segments in @p iov
+ * @param call_data
+ *  The user-specified per-call data to pass to I/O callbacks
+ * @param[out] errbuf
+ *	Pointer to error message buffer or @a NULL
+ *
+ * @retval true
+ *  On success
+ * @retval false
+ *  On error. If not @a NULL, @p errbuf is populated with an error message.
+ */
+bool zseek_writev(zseek_writer_t *writer, const struct iovec *iov, int iovcnt,
+    void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE]);
+
+/**
+ * Ends the current frame and waits until all data written so far has been
+ * passed to the write callback, then flushes the file
+ *
+ * This is \e not safe to call concurrently with other writer functions.
+ *
+ * @param writer
+ *	Compressed file write handle
+ * @param call_data
+ *  The user-specified per-call data to pass to I/O callbacks
+ * @param[out] errbuf
+ *	Pointer to error message buffer or @a NULL
+ *
+ * @retval true
+ *  On success
+ * @retval false
+ *  On error. If not @a NULL, @p errbuf is populated with an error message.
+ */
+bool zseek_writer_flush(zseek_writer_t *writer, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE]);
+
+/**
+ * Returns the compression level a frame was compressed with
+ *
+ * @param writer
+ *	Compressed file write handle
+ * @param frame_idx
+ *	Index of the frame, which must have been written out. With a dictionary,
+ *	frame 0 is that of the dictionary.
+ * @param[out] level
+ *	Compression level of the frame
+ * @param[out] errbuf
+ *	Pointer to error message buffer or @a NULL
+ *
+ * @retval true
+ *  On success
+ * @retval false
+ *  On error. If not @a NULL, @p errbuf is populated with an error message.
+ */
+bool zseek_writer_frame_level(zseek_writer_t *writer, size_t frame_idx,
+    int *level, char errbuf[ZSEEK_ERRBUF_SIZE]);
+
 /**
  * Returns currently available writer statistics
  *
@@ -316,6 +918,9 @@ bool zseek_writer_stats(zseek_writer_t *writer, zseek_writer_stats_t *stats,
 /**
  * Creates a reader for random access reads
  *
+ * If the file was written with a dictionary, it is loaded once here and shared
+ * by all reads.
+ *
  * @param user_file
  *  File to read compressed data from
  * @param cache_size
@@ -333,9 +938,35 @@ bool zseek_writer_stats(zseek_writer_t *writer, zseek_writer_stats_t *stats,
 zseek_reader_t *zseek_reader_open_full(zseek_read_file_t user_file,
     size_t cache_size, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE]);
 
+/**
+ * Creates a reader for random access reads, with extended controls
+ *
+ * @param user_file
+ *  File to read compressed data from
+ * @param zrp
+ *  Reader controls
+ * @param call_data
+ *  The user-specified per-call data to pass to I/O callbacks
+ * @param[out] errbuf
+ *	Pointer to error message buffer or @a NULL
+ *
+ * @retval reader
+ *  Handle to perform reads
+ * @retval NULL
+ *  On error. If not @a NULL, @p errbuf is populated with an error message.
+ */
+zseek_reader_t *zseek_reader_open_ext(zseek_read_file_t user_file,
+    zseek_reader_param_t *zrp, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE]);
+
 /**
  * Creates a reader for random access reads, with default file I/O
  *
+ * Reads go to the file descriptor of @p cfile, at explicit offsets: they
+ * neither use nor move the position of the stream. Streams without a
+ * descriptor (e.g. fmemopen()) are sought and read under their lock, and
+ * left at their position.
+ *
  * @param cfile
  *  File to read compressed data from
  * @param cache_size
@@ -353,6 +984,67 @@ zseek_reader_t *zseek_reader_open_full(zseek_read_file_t user_file,
 zseek_reader_t *zseek_reader_open(FILE *cfile, size_t cache_size,
     void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE]);
 
+/**
+ * Creates a reader for random access reads from a file descriptor
+ *
+ * Reads are positional, so that the file position of @p fd is not used, and
+ * concurrent reads do not serialize on it. If @p fd was opened with O_DIRECT,
+ * unaligned reads go through an aligned bounce buffer.
+ *
+ * @param fd
+ *  File descriptor to read compressed data from, which must stay open until
+ *  the reader is closed
+ * @param zrp
+ *  Reader controls
+ * @param zfp
+ *  File descriptor controls. If @a NULL defaults are applied
+ * @param call_data
+ *  The user-specified per-call data to pass to I/O callbacks
+ * @param[out] errbuf
+ *	Pointer to error message buffer or @a NULL
+ *
+ * @retval reader
+ *  Handle to perform reads
+ * @retval NULL
+ *  On error. If not @a NULL, @p errbuf is populated with an error message.
+ */
+zseek_reader_t *zseek_reader_open_fd(int fd, zseek_reader_param_t *zrp,
+    const zseek_fd_param_t *zfp, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE]);
+
+/**
+ * Creates a reader for random access reads from a file mapped in memory
+ *
+ * The whole file is mapped read-only, and compressed frames are decompressed
+ * straight from the mapping, without reads nor a copy. The seek table is
+ * parsed in place as well. The advice of @p zfp applies to the mapping, with
+ * posix_madvise(), e.g. POSIX_FADV_RANDOM for point reads, or
+ * POSIX_FADV_WILLNEED to read the file ahead.
+ *
+ * @attention The file must not shrink while mapped, reads of the missing
+ * pages would raise SIGBUS.
+ *
+ * @param fd
+ *  File descriptor to read compressed data from, which may be closed once
+ *  the reader is open
+ * @param zrp
+ *  Reader controls
+ * @param zfp
+ *  File descriptor controls. If @a NULL defaults are applied
+ * @param call_data
+ *  The user-specified per-call data to pass to I/O callbacks
+ * @param[out] errbuf
+ *	Pointer to error message buffer or @a NULL
+ *
+ * @retval reader
+ *  Handle to perform reads
+ * @retval NULL
+ *  On error. If not @a NULL, @p errbuf is populated with an error message.
+ */
+zseek_reader_t *zseek_reader_open_mmap(int fd, zseek_reader_param_t *zrp,
+    const zseek_fd_param_t *zfp, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE]);
+
 /**
  * Closes a compressed file handle for reads
  *
@@ -375,6 +1067,17 @@ bool zseek_reader_close(zseek_reader_t *reader, void *call_data,
 /**
  * Reads data from an arbitrary offset of a compressed file
  *
+ * Reads span as many frames as needed to fill @p count bytes. Frames read
+ * whole are decompressed straight into @p buf if there is no cache. Runs of
+ * adjacent compressed frames missing from the cache are read at once, see
+ * zseek_reader_param_t.max_coalesced_io.
+ *
+ * This is safe to call concurrently. Reads of cached frames take no lock, so
+ * they scale with the number of threads. Cache misses read and decompress
+ * in parallel, each with a context of its own, but concurrent misses on the
+ * same frame wait for a single decompression. The read callback of the file
+ * is called concurrently too if thread-safe, see zseek_pread_t.
+ *
  * @param reader
  *	Compressed file reader
  * @param[out] buf
@@ -389,13 +1092,137 @@ bool zseek_reader_close(zseek_reader_t *reader, void *call_data,
  *	Pointer to error message buffer or @a NULL
  *
  * @retval N>=0
- *	Number of bytes read
+ *	Number of bytes read, less than @p count only at the end of the file, or
+ *	on an error past the first frame read
  * @retval -1
  *  On error. If not @a NULL, @p errbuf is populated with an error message.
  */
 ssize_t zseek_pread(zseek_reader_t *reader, void *buf, size_t count,
     size_t offset, void *call_data, char errbuf[ZSEEK_ERRBUF_SIZE]);
 
+/**
+ * Reads data from many arbitrary offsets of a compressed file at once
+ *
+ * Like zseek_pread() for each of @p ranges, in any order, but every frame
+ * involved is decompressed only once, however many ranges it holds. The
+ * compressed frames missing from the cache are read first, runs of adjacent
+ * ones with a single read each (see zseek_reader_param_t.max_coalesced_io),
+ * then decompressed in parallel by the caller and the idle workers of
+ * asynchronous reads, if any (see zseek_reader_param_t.async_workers). I/O
+ * callbacks are only called by the caller.
+ *
+ * This is safe to call concurrently. Ranges may overlap, but not their
+ * buffers.
+ *
+ * @param reader
+ *	Compressed file reader
+ * @param ranges
+ *	Ranges to read
+ * @param nb_ranges
+ *	Number of ranges
+ * @param[out] done
+ *	Number of bytes read for each range, less than its count only at the end
+ *	of the file, or @a NULL
+ * @param call_data
+ *  The user-specified per-call data to pass to I/O callbacks
+ * @param[out] errbuf
+ *	Pointer to error message buffer or @a NULL
+ *
+ * @retval true
+ *  On success
+ * @retval false
+ *  On error, after which the buffers hold partial data. If not @a NULL,
+ *  @p errbuf is populated with an error message.
+ */
+bool zseek_preadv_batch(zseek_reader_t *reader, const zseek_range_t *ranges,
+    size_t nb_ranges, size_t *done, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE]);
+
+/**
+ * Reads data from an arbitrary offset of a compressed file without copying it
+ *
+ * Like zseek_pread(), but points @p ref at the data in the cache instead. The
+ * frame holding it stays cached until zseek_ref_release(). Reads larger than
+ * the rest of the frame are cut short. If the frame is not cached, or the
+ * reader has no cache, @p ref owns a buffer of its own instead.
+ *
+ * This is safe to call concurrently
+ *
+ * @attention Pinned frames cannot be evicted, so views should be short-lived,
+ * and must all be released before closing @p reader.
+ *
+ * @param reader
+ *	Compressed file reader
+ * @param[out] ref
+ *	View of the decompressed data, zeroed if none
+ * @param count
+ *	Size of decompressed data to read
+ * @param offset
+ *	Offset in the decompressed data to read data from
+ * @param call_data
+ *  The user-specified per-call data to pass to I/O callbacks
+ * @param[out] errbuf
+ *	Pointer to error message buffer or @a NULL
+ *
+ * @retval N>=0
+ *	Number of bytes in the view, to release with zseek_ref_release() if > 0
+ * @retval -1
+ *  On error. If not @a NULL, @p errbuf is populated with an error message.
+ */
+ssize_t zseek_pread_ref(zseek_reader_t *reader, zseek_ref_t *ref,
+    size_t count, size_t offset, void *call_data,
+    char errbuf[ZSEEK_ERRBUF_SIZE]);
+
+/**
+ * Releases a view returned by zseek_pread_ref(), and zeroes it
+ *
+ * This is safe to call concurrently, and does nothing on a zeroed view
+ *
+ * @param reader
+ *	Compressed file reader the view was read from
+ * @param ref
+ *	View to release
+ */
+void zseek_ref_release(zseek_reader_t *reader, zseek_ref_t *ref);
+
+/**
+ * Reads data from an arbitrary offset of a compressed file, asynchronously
+ *
+ * Like zseek_pread(), but returns once the read is queued, and calls @p cb on
+ * a worker thread when done. Reads larger than the rest of the frame are cut
+ * short. With io_uring, reads of compressed frames not cached are submitted
+ * in batches, so that no thread blocks per read, then decompressed by the
+ * workers. I/O callbacks get @a NULL per-call data.
+ *
+ * This is safe to call concurrently. The reader must be opened with
+ * zseek_reader_param_t.async_workers > 0, and waits for queued reads to
+ * complete on close.
+ *
+ * @param reader
+ *	Compressed file reader
+ * @param[out] buf
+ *	Buffer to store decompressed data, until @p cb is called
+ * @param count
+ *	Size of decompressed data to read
+ * @param offset
+ *	Offset in the decompressed data to read data from
+ * @param cb
+ *	Completion callback
+ * @param ctx
+ *	The user-specified context to pass to @p cb
+ * @param[out] errbuf
+ *	Pointer to error message buffer or @a NULL
+ *
+ * @retval true
+ *  On success. @p cb is called exactly once.
+ * @retval false
+ *  On error. If not @a NULL, @p errbuf is populated with an error message.
+ *  @p cb is not called.
+ */
+bool zseek_pread_async(zseek_reader_t *reader, void *buf, size_t count,
+    size_t offset, zseek_pread_cb_t cb, void *ctx,
+    char errbuf[ZSEEK_ERRBUF_SIZE]);
+
 /**
  * Reads data from the current offset of a compressed file
  *
@@ -440,6 +1267,105 @@ ssize_t zseek_read(zseek_reader_t *reader, void *buf, size_t count,
 bool zseek_reader_stats(zseek_reader_t *reader, zseek_reader_stats_t *stats,
     char errbuf[ZSEEK_ERRBUF_SIZE]);
 
+/**
+ * Creates a pool of decompressed frame buffers, to share between readers
+ *
+ * This is safe to use from concurrent readers
+ *
+ * @param zfp
+ *  Pool controls or @a NULL for the defaults
+ * @param[out] errbuf
+ *	Pointer to error message buffer or @a NULL
+ *
+ * @retval pool
+ *  Handle to pass to readers, see zseek_reader_param_t.frame_pool
+ * @retval NULL
+ *  On error. If not @a NULL, @p errbuf is populated with an error message.
+ */
+zseek_frame_pool_t *zseek_frame_pool_new(zseek_frame_pool_param_t *zfp,
+    char errbuf[ZSEEK_ERRBUF_SIZE]);
+
+/**
+ * Allocates idle buffers ahead of reads, prefaulted if the pool is set to
+ *
+ * This is safe to call concurrently
+ *
+ * @param pool
+ *  Frame buffer pool
+ * @param size
+ *  Decompressed size of the frames to allocate buffers for
+ * @param count
+ *  Number of buffers to allocate
+ * @param[out] errbuf
+ *	Pointer to error message buffer or @a NULL
+ *
+ * @retval true
+ *  On success
+ * @retval false
+ *  On error. If not @a NULL, @p errbuf is populated with an error message.
+ */
+bool zseek_frame_pool_reserve(zseek_frame_pool_t *pool, size_t size,
+    size_t count, char errbuf[ZSEEK_ERRBUF_SIZE]);
+
+/**
+ * Frees a frame buffer pool, after all readers using it have been closed
+ *
+ * @param pool
+ *  Frame buffer pool
+ */
+void zseek_frame_pool_free(zseek_frame_pool_t *pool);
+
+/**
+ * Creates a cache of decompressed frames, to share between readers
+ *
+ * Frames are cached per file, as if in caches of their own, but under a
+ * single budget: inserting a frame may evict those of any reader. Readers
+ * opened with zseek_reader_open_fd() or zseek_reader_open_mmap() share the
+ * frames of the same file, as told by its device, inode, size and
+ * modification time, and so their cache statistics. Other readers have frames
+ * of their own.
+ *
+ * @param zscp
+ *  Cache controls, with @ref zseek_shared_cache_param_t.max_size set
+ * @param[out] errbuf
+ *	Pointer to error message buffer or @a NULL
+ *
+ * @retval cache
+ *  Handle to pass to readers, see zseek_reader_param_t.shared_cache
+ * @retval NULL
+ *  On error. If not @a NULL, @p errbuf is populated with an error message.
+ */
+zseek_cache_t *zseek_shared_cache_new(zseek_shared_cache_param_t *zscp,
+    char errbuf[ZSEEK_ERRBUF_SIZE]);
+
+/**
+ * Gets shared cache statistics
+ *
+ * This is safe to call concurrently with the readers of the cache
+ *
+ * @param cache
+ *  Shared cache
+ * @param[out] stats
+ *  Pointer to stats struct to populate
+ * @param[out] errbuf
+ *	Pointer to error message buffer or @a NULL
+ *
+ * @retval true
+ *  On success
+ * @retval false
+ *  On error. If not @a NULL, @p errbuf is populated with an error message.
+ */
+bool zseek_shared_cache_stats(zseek_cache_t *cache,
+    zseek_shared_cache_stats_t *stats, char errbuf[ZSEEK_ERRBUF_SIZE]);
+
+/**
+ * Frees a shared cache, after all readers using it have been closed
+ *
+ * @param cache
+ *  Shared cache
+ */
+void zseek_shared_cache_free(zseek_cache_t *cache);
+
 #endif
 
 /**
@@ -154,7 +154,8 @@ static bool counting_write(const void *data, size_t size, void *user_data,
  * Compress the contents of @p ufilename to @p cfilename.
  */
 static results_t *compress(const char *ufilename, const char *cfilename,
-    int nb_workers, size_t min_frame_size, zseek_compression_type_t ctype)
+    int nb_workers, size_t min_frame_size, zseek_compression_type_t ctype,
+    bool frame_parallel, bool async)
 {
     // TODO OPT: mmap?
 
@@ -215,6 +216,7 @@ static results_t *compress(const char *ufilename, const char *cfilename,
         param.params.zstd_params.nb_workers = nb_workers;
         param.params.zstd_params.compression_level = 3;
         param.params.zstd_params.strategy = 1;
+        param.params.zstd_params.frame_parallel = frame_parallel;
         break;
     case ZSEEK_LZ4:
         param.type = ZSEEK_LZ4;
@@ -227,8 +229,12 @@ static results_t *compress(const char *ufilename, const char *cfilename,
     }
     counting_file_data_t cfd = { .file = cfile };
     zseek_write_file_t zwf = { .user_data = &cfd, .write = counting_write };
-    zseek_writer_t *writer = zseek_writer_open_full(zwf, &param, min_frame_size,
-        NULL, errbuf);
+    zseek_writer_param_t wparam = {
+        .min_frame_size = min_frame_size,
+        .async = async,
+    };
+    zseek_writer_t *writer = zseek_writer_open_ext(zwf, &param, &wparam, NULL,
+        errbuf);
     if (!writer) {
         fprintf(stderr, "compress: zseek_writer_open: %s\n", errbuf);
         goto fail_w_cfile;
@@ -256,12 +262,12 @@ static results_t *compress(const char *ufilename, const char *cfilename,
         lat += (t2.tv_nsec - t1.tv_nsec) / (1000.0 * 1000);
         res->latencies[res->num_latencies++] = lat;
     }
-    res->csize = cfd.written;
 
     if (!zseek_writer_close(writer, NULL, errbuf)) {
         fprintf(stderr, "compress: zseek_writer_close: %s\n", errbuf);
         goto fail_w_buf;
     }
+    res->csize = cfd.written;
 
     if (clock_gettime(CLOCK_MONOTONIC, &res->wt2) == -1) {
         perror("compress: get wall time");
@@ -301,11 +307,16 @@ fail:
     return NULL;
 }
 
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s --zstd|--lz4 INFILE nb_workers frame_size "
+        "(MiB) [-t] [-p] [-a]\n", argv0);
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc < 5 || argc > 6) {
-        fprintf(stderr, "Usage: %s --zstd|--lz4 INFILE nb_workers frame_size "
-            "(MiB) [-t]\n", argv[0]);
+    if (argc < 5 || argc > 8) {
+        usage(argv[0]);
         return 1;
     }
 
@@ -315,8 +326,7 @@ int main(int argc, char *argv[])
     else if (strcmp(argv[1], "--lz4") == 0)
         ctype = ZSEEK_LZ4;
     else {
-        fprintf(stderr, "Usage: %s --zstd|--lz4 INFILE nb_workers frame_size "
-            "(MiB) [-t]\n", argv[0]);
+        usage(argv[0]);
         return 1;
     }
 
@@ -327,18 +337,23 @@ int main(int argc, char *argv[])
     size_t frame_size = atoi(argv[4]) * (1 << 20);
 
     bool terse = false;
-    if (argc > 5) {
-        if (strcmp(argv[5], "-t") == 0)
+    bool frame_parallel = false;
+    bool async = false;
+    for (int i = 5; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0)
             terse = true;
+        else if (strcmp(argv[i], "-p") == 0)
+            frame_parallel = true;
+        else if (strcmp(argv[i], "-a") == 0)
+            async = true;
         else {
-            fprintf(stderr, "Usage: %s --zstd|--lz4 INFILE nb_workers frame_size "
-                "(MiB) [-t]\n", argv[0]);
+            usage(argv[0]);
             return 1;
         }
     }
 
     results_t *res = compress(ufilename, cfilename, nb_workers, frame_size,
-        ctype);
+        ctype, frame_parallel, async);
     if (!res)
         return 1;
 
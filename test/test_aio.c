@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <check.h>
+
+#include "../src/aio.h"
+
+#define NB_REQS 1000
+#define REQ_SIZE 100
+
+static uint8_t pattern[NB_REQS * REQ_SIZE];
+
+static void init_pattern(void)
+{
+    for (size_t i = 0; i < sizeof(pattern); i++)
+        pattern[i] = (uint8_t)(i * 7 + i / 251);
+}
+
+/**
+ * Opens a new, unlinked temporary file in the current directory holding the
+ * pattern, or returns -1
+ */
+static int pattern_file(void)
+{
+    char path[] = "test_aio.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+        return -1;
+    unlink(path);
+    if (write(fd, pattern, sizeof(pattern)) != sizeof(pattern)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+typedef struct {
+    zseek_aio_req_t req;
+    uint8_t data[REQ_SIZE];
+} test_req_t;
+
+static test_req_t reqs[NB_REQS];
+
+// Updated by the workers, checked once they are stopped
+static size_t processed;
+static size_t mismatches;
+static size_t short_reads;
+static size_t fallbacks;
+
+static void process(zseek_aio_req_t *req, void *user_data)
+{
+    (void)user_data;
+
+    __atomic_add_fetch(&processed, 1, __ATOMIC_RELAXED);
+    if (req->fallback)
+        __atomic_add_fetch(&fallbacks, 1, __ATOMIC_RELAXED);
+    if (req->error || req->done > req->size)
+        __atomic_add_fetch(&mismatches, 1, __ATOMIC_RELAXED);
+    else if (req->done < req->size)
+        __atomic_add_fetch(&short_reads, 1, __ATOMIC_RELAXED);
+    else if (memcmp(req->data, pattern + req->offset, req->size) != 0)
+        __atomic_add_fetch(&mismatches, 1, __ATOMIC_RELAXED);
+}
+
+static void reset(void)
+{
+    processed = 0;
+    mismatches = 0;
+    short_reads = 0;
+    fallbacks = 0;
+    memset(reqs, 0, sizeof(reqs));
+}
+
+START_TEST(test_aio_invalid)
+{
+    ck_assert(!zseek_aio_new(ZSEEK_ASYNC_THREADS, -1, 0, 0, process, NULL,
+        NULL, NULL));
+    ck_assert(!zseek_aio_new((zseek_async_backend_t)42, -1, 0, 1, process,
+        NULL, NULL, NULL));
+    // io_uring needs a file
+    ck_assert(!zseek_aio_new(ZSEEK_ASYNC_IO_URING, -1, 0, 1, process, NULL,
+        NULL, NULL));
+}
+END_TEST
+
+START_TEST(test_aio_threads)
+{
+    reset();
+    zseek_aio_t *aio = zseek_aio_new(ZSEEK_ASYNC_AUTO, -1, 0, 4, process,
+        NULL, NULL, NULL);
+    ck_assert(aio);
+    ck_assert(zseek_aio_backend(aio) == ZSEEK_ASYNC_THREADS);
+
+    for (size_t i = 0; i < NB_REQS; i++)
+        zseek_aio_submit(aio, &reqs[i].req);
+
+    // Drains the queue
+    zseek_aio_free(aio);
+    ck_assert(processed == NB_REQS);
+    ck_assert(mismatches == 0 && short_reads == 0);
+}
+END_TEST
+
+START_TEST(test_aio_uring)
+{
+    init_pattern();
+    int fd = pattern_file();
+    ck_assert_msg(fd != -1, "failed to create file");
+
+    reset();
+    // A small queue, so that reads wait for room
+    zseek_aio_t *aio = zseek_aio_new(ZSEEK_ASYNC_AUTO, fd, 16, 3, process,
+        NULL, NULL, NULL);
+    ck_assert(aio);
+    if (zseek_aio_backend(aio) != ZSEEK_ASYNC_IO_URING) {
+        // Not supported by the kernel, or not allowed
+        zseek_aio_free(aio);
+        close(fd);
+        return;
+    }
+
+    for (size_t i = 0; i < NB_REQS; i++) {
+        zseek_aio_req_t *req = &reqs[i].req;
+        req->data = reqs[i].data;
+        req->size = REQ_SIZE;
+        req->offset = (i * 7919) % NB_REQS * REQ_SIZE;
+        // Short at the end of the file
+        if (i % 100 == 0)
+            req->offset = sizeof(pattern) - REQ_SIZE / 2;
+        zseek_aio_submit(aio, req);
+    }
+
+    zseek_aio_free(aio);
+    ck_assert(processed == NB_REQS);
+    ck_assert(mismatches == 0);
+    ck_assert(short_reads == NB_REQS / 100);
+
+    close(fd);
+}
+END_TEST
+
+/**
+ * Returns the descriptor of an io_uring instance of the process, or -1
+ */
+static int find_ring(void)
+{
+    DIR *dir = opendir("/proc/self/fd");
+    if (!dir)
+        return -1;
+
+    int ring_fd = -1;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        char path[300], target[64];
+        snprintf(path, sizeof(path), "/proc/self/fd/%s", entry->d_name);
+        ssize_t n = readlink(path, target, sizeof(target) - 1);
+        if (n == -1)
+            continue;
+        target[n] = 0;
+        if (!strcmp(target, "anon_inode:[io_uring]"))
+            ring_fd = atoi(entry->d_name);
+    }
+    closedir(dir);
+
+    return ring_fd;
+}
+
+START_TEST(test_aio_uring_failed)
+{
+    init_pattern();
+    int fd = pattern_file();
+    ck_assert_msg(fd != -1, "failed to create file");
+
+    reset();
+    zseek_aio_t *aio = zseek_aio_new(ZSEEK_ASYNC_IO_URING, fd, 16, 3,
+        process, NULL, NULL, NULL);
+    if (!aio) {
+        close(fd);
+        return;
+    }
+
+    for (size_t i = 0; i < NB_REQS; i++) {
+        zseek_aio_req_t *req = &reqs[i].req;
+        req->data = reqs[i].data;
+        req->size = REQ_SIZE;
+        req->offset = (i * 7919) % NB_REQS * REQ_SIZE;
+        if (i % 100 == 0)
+            req->offset = sizeof(pattern) - REQ_SIZE / 2;
+        // Submitting fails from then on, with reads of the ring in flight
+        if (i == NB_REQS / 2) {
+            int ring_fd = find_ring();
+            ck_assert(ring_fd != -1);
+            int null_fd = open("/dev/null", O_RDONLY);
+            ck_assert(dup2(null_fd, ring_fd) == ring_fd);
+            close(null_fd);
+        }
+        zseek_aio_submit(aio, req);
+    }
+
+    zseek_aio_free(aio);
+    ck_assert(processed == NB_REQS);
+    ck_assert(mismatches == 0);
+    ck_assert(short_reads == NB_REQS / 100);
+    ck_assert(fallbacks > 0);
+
+    close(fd);
+}
+END_TEST
+
+Suite *aio_suite(void)
+{
+    Suite *s = suite_create("aio");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_aio_invalid);
+    tcase_add_test(tc_core, test_aio_threads);
+    tcase_add_test(tc_core, test_aio_uring);
+    tcase_add_test(tc_core, test_aio_uring_failed);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = aio_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "../src/alloc.h"
+#include "../src/buffer.h"
+
+/**
+ * Allocator state counting calls into the C library
+ */
+typedef struct {
+    size_t allocs;
+    size_t reallocs;
+    size_t frees;
+} counts_t;
+
+static void *count_alloc(size_t size, void *user_data)
+{
+    counts_t *counts = user_data;
+    counts->allocs++;
+    return malloc(size);
+}
+
+static void *count_realloc(void *ptr, size_t size, void *user_data)
+{
+    counts_t *counts = user_data;
+    counts->reallocs++;
+    return realloc(ptr, size);
+}
+
+static void count_free(void *ptr, void *user_data)
+{
+    counts_t *counts = user_data;
+    counts->frees++;
+    free(ptr);
+}
+
+START_TEST(test_alloc_default)
+{
+    zseek_allocator_t allocator;
+    zseek_allocator_init(&allocator, NULL);
+    ck_assert(allocator.alloc && allocator.realloc && allocator.free);
+
+    char *ptr = zseek_alloc(&allocator, 4);
+    ck_assert(ptr != NULL);
+    memcpy(ptr, "abc", 4);
+    ptr = zseek_realloc(&allocator, ptr, 4, 1 << 20);
+    ck_assert(ptr != NULL);
+    ck_assert(strcmp(ptr, "abc") == 0);
+    zseek_free(&allocator, ptr);
+
+    // No allocator at all
+    ptr = zseek_alloc(NULL, 4);
+    ck_assert(ptr != NULL);
+    zseek_free(NULL, ptr);
+}
+END_TEST
+
+START_TEST(test_alloc_custom)
+{
+    counts_t counts = {0};
+    zseek_allocator_t user = {&counts, count_alloc, count_realloc, count_free};
+    zseek_allocator_t allocator;
+    zseek_allocator_init(&allocator, &user);
+
+    void *ptr = zseek_alloc(&allocator, 16);
+    ck_assert(ptr != NULL);
+    ptr = zseek_realloc(&allocator, ptr, 16, 32);
+    ck_assert(ptr != NULL);
+    zseek_free(&allocator, ptr);
+    // NULL is not passed on
+    zseek_free(&allocator, NULL);
+
+    ck_assert(counts.allocs == 1);
+    ck_assert(counts.reallocs == 1);
+    ck_assert(counts.frees == 1);
+}
+END_TEST
+
+START_TEST(test_alloc_no_realloc)
+{
+    counts_t counts = {0};
+    zseek_allocator_t allocator = {&counts, count_alloc, NULL, count_free};
+
+    char *ptr = zseek_realloc(&allocator, NULL, 0, 4);
+    ck_assert(ptr != NULL);
+    memcpy(ptr, "abc", 4);
+    // Grow, then shrink
+    ptr = zseek_realloc(&allocator, ptr, 4, 1 << 20);
+    ck_assert(ptr != NULL);
+    ck_assert(strcmp(ptr, "abc") == 0);
+    ptr = zseek_realloc(&allocator, ptr, 1 << 20, 2);
+    ck_assert(ptr != NULL);
+    ck_assert(memcmp(ptr, "ab", 2) == 0);
+    zseek_free(&allocator, ptr);
+
+    ck_assert(counts.allocs == 3);
+    ck_assert(counts.reallocs == 0);
+    ck_assert(counts.frees == 3);
+}
+END_TEST
+
+START_TEST(test_alloc_mem)
+{
+    counts_t counts = {0};
+    zseek_allocator_t allocator = {&counts, count_alloc, count_realloc,
+        count_free};
+
+    // As called back by zstd and lz4
+    void *ptr = zseek_mem_alloc(&allocator, 16);
+    ck_assert(ptr != NULL);
+    zseek_mem_free(&allocator, ptr);
+
+    ck_assert(counts.allocs == 1);
+    ck_assert(counts.frees == 1);
+}
+END_TEST
+
+START_TEST(test_alloc_buffer)
+{
+    counts_t counts = {0};
+    zseek_allocator_t allocator = {&counts, count_alloc, count_realloc,
+        count_free};
+
+    zseek_buffer_t *buffer = zseek_buffer_new(0, &allocator);
+    ck_assert_msg(buffer != NULL, "failed to create buffer");
+    char data[1024] = {0};
+    for (int i = 0; i < 64; i++)
+        ck_assert(zseek_buffer_push(buffer, data, sizeof(data)));
+    zseek_buffer_free(buffer);
+
+    // The handle and its data
+    ck_assert(counts.allocs > 0);
+    ck_assert(counts.reallocs > 0);
+    ck_assert(counts.frees == 2);
+}
+END_TEST
+
+Suite *alloc_suite(void)
+{
+    Suite *s = suite_create("alloc");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_alloc_default);
+    tcase_add_test(tc_core, test_alloc_custom);
+    tcase_add_test(tc_core, test_alloc_no_realloc);
+    tcase_add_test(tc_core, test_alloc_mem);
+    tcase_add_test(tc_core, test_alloc_buffer);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = alloc_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
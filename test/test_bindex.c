@@ -0,0 +1,325 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+
+#include <check.h>
+#include <zstd.h>
+#include <lz4.h>
+#include <lz4frame.h>
+
+#include "../src/bindex.h"
+
+#define BLOCK_SIZE (64 << 10)
+#define DATA_SIZE (BLOCK_SIZE * 5 + 1000)
+
+static uint8_t data[DATA_SIZE];
+
+static void init_data(void)
+{
+    uint32_t x = 1;
+    for (size_t i = 0; i < sizeof(data); i++) {
+        x = x * 1103515245 + 12345;
+        data[i] = (x >> 16) % 5 == 0 ? (uint8_t)(x >> 8) : "abcdef"[i / 7 % 6];
+    }
+}
+
+static uint32_t read_le32(const uint8_t *src)
+{
+    uint32_t value_le;
+    memcpy(&value_le, src, sizeof(value_le));
+    return le32toh(value_le);
+}
+
+/**
+ * Compresses @p size bytes of the data into a new lz4 frame of 64 KiB blocks,
+ * returning its size in @p csize
+ */
+static uint8_t *compress_frame(size_t size, bool independent,
+    bool checksums, size_t *csize)
+{
+    LZ4F_preferences_t preferences;
+    memset(&preferences, 0, sizeof(preferences));
+    preferences.frameInfo.blockSizeID = LZ4F_max64KB;
+    preferences.frameInfo.blockMode = independent ? LZ4F_blockIndependent :
+        LZ4F_blockLinked;
+    if (checksums) {
+        preferences.frameInfo.contentSize = size;
+        preferences.frameInfo.blockChecksumFlag = LZ4F_blockChecksumEnabled;
+        preferences.frameInfo.contentChecksumFlag =
+            LZ4F_contentChecksumEnabled;
+    }
+
+    size_t capacity = LZ4F_compressFrameBound(size, &preferences);
+    uint8_t *frame = malloc(capacity);
+    ck_assert(frame);
+    *csize = LZ4F_compressFrame(frame, capacity, data, size, &preferences);
+    ck_assert(!LZ4F_isError(*csize));
+    return frame;
+}
+
+/**
+ * Feeds @p size bytes at @p frame to @p blog in pieces of varying sizes
+ */
+static void feed(zseek_blog_t *blog, const uint8_t *frame, size_t size)
+{
+    size_t piece = 1;
+    for (size_t pos = 0; pos < size; ) {
+        size_t n = size - pos < piece ? size - pos : piece;
+        ck_assert(zseek_blog_feed(blog, frame + pos, n));
+        pos += n;
+        piece = piece * 3 % 1001 + 1;
+    }
+}
+
+/**
+ * Checks that the last @p nb_blocks entries of @p blog point at the blocks of
+ * @p frame, of @p size decompressed bytes
+ */
+static void check_blocks(const zseek_blog_t *blog, const uint8_t *frame,
+    size_t csize, size_t size, size_t nb_blocks)
+{
+    size_t first = zseek_blog_entries(blog) - nb_blocks;
+    uint8_t *entries = malloc(nb_blocks * ZSEEK_BINDEX_ENTRY_SIZE);
+    ck_assert(entries);
+    ck_assert(zseek_blog_encode(blog, first, entries,
+        nb_blocks * ZSEEK_BINDEX_ENTRY_SIZE) == nb_blocks);
+
+    uint8_t *out = malloc(BLOCK_SIZE);
+    ck_assert(out);
+    for (size_t i = 0; i < nb_blocks; i++) {
+        uint32_t offset = read_le32(entries + i * ZSEEK_BINDEX_ENTRY_SIZE);
+        ck_assert(offset + 4 <= csize);
+        uint32_t header = read_le32(frame + offset);
+        size_t block_csize = header & 0x7FFFFFFF;
+        size_t dsize = size - i * BLOCK_SIZE < BLOCK_SIZE ?
+            size - i * BLOCK_SIZE : BLOCK_SIZE;
+        if (header & 0x80000000) {
+            ck_assert(block_csize == dsize);
+            ck_assert(!memcmp(frame + offset + 4, data + i * BLOCK_SIZE,
+                dsize));
+            continue;
+        }
+        // Each block decompresses on its own
+        int r = LZ4_decompress_safe((const char *)frame + offset + 4,
+            (char *)out, block_csize, BLOCK_SIZE);
+        ck_assert_msg(r == (int)dsize, "block %zu: %d", i, r);
+        ck_assert(!memcmp(out, data + i * BLOCK_SIZE, dsize));
+    }
+
+    free(out);
+    free(entries);
+}
+
+START_TEST(test_bindex_scan)
+{
+    init_data();
+    zseek_blog_t *blog = zseek_blog_new(BLOCK_SIZE, NULL);
+    ck_assert(blog);
+
+    // A frame not scanned, as the dictionary
+    zseek_blog_end_frame(blog, 0);
+    ck_assert(zseek_blog_entries(blog) == 0);
+
+    size_t sizes[] = {DATA_SIZE, BLOCK_SIZE, 1, BLOCK_SIZE * 2 + 1};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t csize;
+        uint8_t *frame = compress_frame(sizes[i], true, i % 2, &csize);
+        feed(blog, frame, csize);
+        zseek_blog_end_frame(blog, sizes[i]);
+        ck_assert(zseek_blog_valid(blog));
+
+        size_t nb_blocks = (sizes[i] + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        check_blocks(blog, frame, csize, sizes[i], nb_blocks);
+        free(frame);
+    }
+    ck_assert(zseek_blog_entries(blog) == 6 + 1 + 1 + 3);
+
+    zseek_blog_free(blog);
+}
+END_TEST
+
+START_TEST(test_bindex_scan_invalid)
+{
+    init_data();
+    size_t csize;
+
+    // Linked blocks
+    zseek_blog_t *blog = zseek_blog_new(BLOCK_SIZE, NULL);
+    ck_assert(blog);
+    uint8_t *frame = compress_frame(DATA_SIZE, false, false, &csize);
+    feed(blog, frame, csize);
+    zseek_blog_end_frame(blog, DATA_SIZE);
+    ck_assert(!zseek_blog_valid(blog));
+    zseek_blog_free(blog);
+    free(frame);
+
+    // Blocks not matching the decompressed size
+    blog = zseek_blog_new(BLOCK_SIZE, NULL);
+    ck_assert(blog);
+    frame = compress_frame(DATA_SIZE, true, false, &csize);
+    feed(blog, frame, csize);
+    zseek_blog_end_frame(blog, BLOCK_SIZE);
+    ck_assert(!zseek_blog_valid(blog));
+    zseek_blog_free(blog);
+
+    // Frame cut short
+    blog = zseek_blog_new(BLOCK_SIZE, NULL);
+    ck_assert(blog);
+    feed(blog, frame, csize - 4);
+    zseek_blog_end_frame(blog, DATA_SIZE);
+    ck_assert(!zseek_blog_valid(blog));
+    zseek_blog_free(blog);
+    free(frame);
+
+    ck_assert(!zseek_blog_new(0, NULL));
+}
+END_TEST
+
+START_TEST(test_bindex_header)
+{
+    uint8_t header[ZSEEK_BINDEX_HEADER_SIZE];
+    size_t nb_blocks;
+    size_t block_size;
+
+    zseek_blog_t *blog = zseek_blog_new(BLOCK_SIZE, NULL);
+    ck_assert(blog);
+    zseek_blog_header(blog, header);
+    ck_assert(zseek_bindex_parse(header, &nb_blocks, &block_size));
+    ck_assert(nb_blocks == 0);
+    ck_assert(block_size == BLOCK_SIZE);
+    zseek_blog_free(blog);
+
+    // A skippable frame, as per the zstd and lz4 frame formats
+    ck_assert((read_le32(header) & 0xFFFFFFF0) == 0x184D2A50);
+
+    uint8_t bad[ZSEEK_BINDEX_HEADER_SIZE];
+    memcpy(bad, header, sizeof(bad));
+    bad[0] ^= 1;
+    ck_assert(!zseek_bindex_parse(bad, &nb_blocks, &block_size));
+    memcpy(bad, header, sizeof(bad));
+    bad[4] += 1;
+    ck_assert(!zseek_bindex_parse(bad, &nb_blocks, &block_size));
+    memcpy(bad, header, sizeof(bad));
+    memset(bad + 8, 0, 4);
+    ck_assert(!zseek_bindex_parse(bad, &nb_blocks, &block_size));
+}
+END_TEST
+
+START_TEST(test_bindex_index)
+{
+    init_data();
+
+    // A dictionary frame, then frames of 3, 1 and 2 blocks
+    size_t sizes[] = {0, BLOCK_SIZE * 2 + 10, 100, BLOCK_SIZE * 2};
+    size_t nb_frames = sizeof(sizes) / sizeof(sizes[0]);
+    zseek_blog_t *blog = zseek_blog_new(BLOCK_SIZE, NULL);
+    ck_assert(blog);
+    ZSTD_frameLog *fl = ZSTD_seekable_createFrameLog(0, NULL);
+    ck_assert(fl);
+    uint8_t *frames[4];
+    size_t csizes[4];
+    for (size_t i = 0; i < nb_frames; i++) {
+        frames[i] = NULL;
+        csizes[i] = 100;
+        if (sizes[i] > 0) {
+            frames[i] = compress_frame(sizes[i], true, false, &csizes[i]);
+            feed(blog, frames[i], csizes[i]);
+        }
+        zseek_blog_end_frame(blog, sizes[i]);
+        ck_assert(!ZSTD_isError(ZSTD_seekable_logFrame(fl, csizes[i],
+            sizes[i], 0)));
+    }
+    ck_assert(zseek_blog_valid(blog));
+
+    uint8_t st_data[1024];
+    ZSTD_outBuffer out = {st_data, sizeof(st_data), 0};
+    ck_assert(ZSTD_seekable_writeSeekTable(fl, &out) == 0);
+    ZSTD_seekTable *st = map_seek_table(st_data, out.pos, NULL);
+    ck_assert(st);
+    ck_assert(zseek_bindex_entries(st, BLOCK_SIZE) == 6);
+
+    // Encoded in pieces
+    uint8_t entries[6 * ZSEEK_BINDEX_ENTRY_SIZE];
+    size_t n = zseek_blog_encode(blog, 0, entries, 9);
+    ck_assert(n == 2);
+    ck_assert(zseek_blog_encode(blog, n, entries + n * 4, 100) == 4);
+
+    zseek_bindex_t *bindex = zseek_bindex_new(entries, 6, BLOCK_SIZE, st,
+        NULL, NULL);
+    ck_assert(bindex);
+    ck_assert(zseek_bindex_block_size(bindex) == BLOCK_SIZE);
+    size_t expected[] = {0, 3, 1, 2};
+    for (size_t i = 0; i < nb_frames; i++) {
+        size_t nb_blocks;
+        const uint32_t *blocks = zseek_bindex_blocks(bindex, i, &nb_blocks);
+        ck_assert(nb_blocks == expected[i]);
+        for (size_t j = 0; j < nb_blocks; j++)
+            ck_assert(blocks[j] + 4 <= csizes[i]);
+    }
+    zseek_bindex_free(bindex);
+
+    // Too few blocks
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    ck_assert(!zseek_bindex_new(entries, 5, BLOCK_SIZE, st, NULL, errbuf));
+    // Blocks out of order
+    uint8_t swapped[sizeof(entries)];
+    memcpy(swapped, entries, sizeof(entries));
+    memcpy(swapped, entries + 4, 4);
+    memcpy(swapped + 4, entries, 4);
+    ck_assert(!zseek_bindex_new(swapped, 6, BLOCK_SIZE, st, NULL, errbuf));
+    // Blocks past the end of their frame
+    memcpy(swapped, entries, sizeof(entries));
+    memset(swapped + 5 * 4, 0xFF, 4);
+    ck_assert(!zseek_bindex_new(swapped, 6, BLOCK_SIZE, st, NULL, errbuf));
+    // Blocks without room for their header at the end of their frame
+    for (uint32_t k = 1; k < 4; k++) {
+        memcpy(swapped, entries, sizeof(entries));
+        uint32_t offset_le = htole32(csizes[3] - k);
+        memcpy(swapped + 5 * 4, &offset_le, 4);
+        ck_assert(!zseek_bindex_new(swapped, 6, BLOCK_SIZE, st, NULL,
+            errbuf));
+    }
+    // Blocks overlapping the header of the previous one
+    memcpy(swapped, entries, sizeof(entries));
+    uint32_t offset_le = htole32(read_le32(entries + 4 * 4) + 3);
+    memcpy(swapped + 5 * 4, &offset_le, 4);
+    ck_assert(!zseek_bindex_new(swapped, 6, BLOCK_SIZE, st, NULL, errbuf));
+    memcpy(swapped, entries, sizeof(entries));
+    memcpy(swapped + 2 * 4, entries + 1 * 4, 4);
+    ck_assert(!zseek_bindex_new(swapped, 6, BLOCK_SIZE, st, NULL, errbuf));
+
+    seek_table_free(st);
+    ZSTD_seekable_freeFrameLog(fl);
+    zseek_blog_free(blog);
+    for (size_t i = 0; i < nb_frames; i++)
+        free(frames[i]);
+}
+END_TEST
+
+Suite *bindex_suite(void)
+{
+    Suite *s = suite_create("bindex");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_bindex_scan);
+    tcase_add_test(tc_core, test_bindex_scan_invalid);
+    tcase_add_test(tc_core, test_bindex_header);
+    tcase_add_test(tc_core, test_bindex_index);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = bindex_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -9,7 +9,7 @@
 START_TEST(test_buffer_new)
 {
     size_t capacity = 5;
-    zseek_buffer_t *buffer = zseek_buffer_new(capacity);
+    zseek_buffer_t *buffer = zseek_buffer_new(capacity, NULL);
     ck_assert(buffer != NULL);
     ck_assert(zseek_buffer_capacity(buffer) >= capacity);
     ck_assert(zseek_buffer_size(buffer) == 0);
@@ -26,7 +26,7 @@ END_TEST
 
 START_TEST(test_buffer_push)
 {
-    zseek_buffer_t *buffer = zseek_buffer_new(0);
+    zseek_buffer_t *buffer = zseek_buffer_new(0, NULL);
     ck_assert_msg(buffer != NULL, "failed to create buffer");
 
     uint8_t data[] = {0, 1, 2, 3, 4};
@@ -45,7 +45,7 @@ END_TEST
 
 START_TEST(test_buffer_free)
 {
-    zseek_buffer_t *buffer = zseek_buffer_new(0);
+    zseek_buffer_t *buffer = zseek_buffer_new(0, NULL);
     ck_assert_msg(buffer != NULL, "failed to create buffer");
     uint8_t data[] = {0, 1, 2, 3, 4};
     ck_assert_msg(zseek_buffer_push(buffer, data, sizeof(data)),
@@ -63,7 +63,7 @@ END_TEST
 
 START_TEST(test_buffer_size)
 {
-    zseek_buffer_t *buffer = zseek_buffer_new(0);
+    zseek_buffer_t *buffer = zseek_buffer_new(0, NULL);
     ck_assert_msg(buffer != NULL, "failed to create buffer");
     uint8_t data[] = {0, 1, 2, 3, 4};
     ck_assert_msg(zseek_buffer_push(buffer, data, sizeof(data)),
@@ -84,7 +84,7 @@ END_TEST
 START_TEST(test_buffer_capacity)
 {
     size_t capacity = 4;
-    zseek_buffer_t *buffer = zseek_buffer_new(capacity);
+    zseek_buffer_t *buffer = zseek_buffer_new(capacity, NULL);
     ck_assert_msg(buffer != NULL, "failed to create buffer");
 
     ck_assert(zseek_buffer_capacity(buffer) >= capacity);
@@ -101,7 +101,7 @@ END_TEST
 
 START_TEST(test_buffer_data)
 {
-    zseek_buffer_t *buffer = zseek_buffer_new(0);
+    zseek_buffer_t *buffer = zseek_buffer_new(0, NULL);
     ck_assert_msg(buffer != NULL, "failed to create buffer");
     uint8_t data[] = {0, 1, 2, 3, 4};
     ck_assert_msg(zseek_buffer_push(buffer, data, sizeof(data)),
@@ -121,7 +121,7 @@ END_TEST
 
 START_TEST(test_buffer_reserve)
 {
-    zseek_buffer_t *buffer = zseek_buffer_new(0);
+    zseek_buffer_t *buffer = zseek_buffer_new(0, NULL);
     ck_assert_msg(buffer != NULL, "failed to create buffer");
 
     size_t capacity = 6;
@@ -140,7 +140,7 @@ END_TEST
 
 START_TEST(test_buffer_resize)
 {
-    zseek_buffer_t *buffer = zseek_buffer_new(0);
+    zseek_buffer_t *buffer = zseek_buffer_new(0, NULL);
     ck_assert_msg(buffer != NULL, "failed to create buffer");
     uint8_t data[] = {0, 1, 2, 3, 4};
     ck_assert_msg(zseek_buffer_push(buffer, data, sizeof(data)),
@@ -162,7 +162,7 @@ END_TEST
 
 START_TEST(test_buffer_reset)
 {
-    zseek_buffer_t *buffer = zseek_buffer_new(0);
+    zseek_buffer_t *buffer = zseek_buffer_new(0, NULL);
     ck_assert_msg(buffer != NULL, "failed to create buffer");
     uint8_t data[] = {0, 1, 2, 3, 4};
     ck_assert_msg(zseek_buffer_push(buffer, data, sizeof(data)),
@@ -1,4 +1,9 @@
 #include <stdlib.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#include <sys/stat.h>
 
 #include <check.h>
 
@@ -8,14 +13,22 @@
 
 START_TEST(test_cache_new_null)
 {
-    zseek_cache_t *cache = zseek_cache_new(0);
+    zseek_cache_t *cache = zseek_cache_new(0, 0, ZSEEK_CACHE_CLOCK, NULL, NULL);
+    ck_assert(cache == NULL);
+}
+END_TEST
+
+START_TEST(test_cache_new_invalid_policy)
+{
+    zseek_cache_t *cache = zseek_cache_new(3, 0, (zseek_cache_policy_t)-1,
+        NULL, NULL);
     ck_assert(cache == NULL);
 }
 END_TEST
 
 START_TEST(test_cache_new)
 {
-    zseek_cache_t *cache = zseek_cache_new(3);
+    zseek_cache_t *cache = zseek_cache_new(3, 0, ZSEEK_CACHE_CLOCK, NULL, NULL);
     ck_assert(cache != NULL);
 
     zseek_cache_free(cache);
@@ -25,20 +38,54 @@ END_TEST
 START_TEST(test_cache_insert_null)
 {
     zseek_frame_t frame = {NULL, 0, 0};
-    ck_assert(!zseek_cache_insert(NULL, frame));
+    ck_assert(zseek_cache_insert(NULL, NULL, frame) == NULL);
 }
 END_TEST
 
 START_TEST(test_cache_insert)
 {
-    zseek_cache_t *cache = zseek_cache_new(2);
+    zseek_cache_t *cache = zseek_cache_new(2, 0, ZSEEK_CACHE_CLOCK, NULL, NULL);
     ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
     zseek_frame_t frame = {.idx = 1, .len = 512};
     frame.data = malloc(frame.len);
     ck_assert_msg(frame.data != NULL, "failed to create frame %zu", frame.idx);
 
-    ck_assert(zseek_cache_insert(cache, frame));
+    zseek_frame_t *cached = zseek_cache_insert(cache, user, frame);
+    ck_assert(cached != NULL);
+    ck_assert(cached->data == frame.data);
+    zseek_cache_release(cache, cached);
 
+    zseek_cache_detach(cache, user);
+    zseek_cache_free(cache);
+}
+END_TEST
+
+START_TEST(test_cache_insert_present)
+{
+    zseek_cache_t *cache = zseek_cache_new(2, 0, ZSEEK_CACHE_CLOCK, NULL, NULL);
+    ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
+    zseek_frame_t frame = {.idx = 1, .len = 512};
+    frame.data = malloc(frame.len);
+    ck_assert_msg(frame.data != NULL, "failed to create frame %zu", frame.idx);
+    zseek_frame_t *cached = zseek_cache_insert(cache, user, frame);
+    ck_assert_msg(cached != NULL, "failed to insert frame %zu", frame.idx);
+    zseek_cache_release(cache, cached);
+
+    // As if decompressed concurrently: the first copy stays
+    zseek_frame_t again = {.idx = 1, .len = 512};
+    again.data = malloc(again.len);
+    ck_assert_msg(again.data != NULL, "failed to create frame %zu", again.idx);
+    cached = zseek_cache_insert(cache, user, again);
+    ck_assert(cached != NULL);
+    ck_assert(cached->data == frame.data);
+    zseek_cache_release(cache, cached);
+    ck_assert(zseek_cache_entries(cache) == 1);
+
+    zseek_cache_detach(cache, user);
     zseek_cache_free(cache);
 }
 END_TEST
@@ -51,113 +98,522 @@ END_TEST
 
 START_TEST(test_cache_free)
 {
-    zseek_cache_t *cache = zseek_cache_new(4);
+    zseek_cache_t *cache = zseek_cache_new(4, 0, ZSEEK_CACHE_CLOCK, NULL, NULL);
     ck_assert_msg(cache != NULL, "failed to create cache");
-    zseek_frame_t frame = {.idx = 1, .len = 512};
-    frame.data = malloc(frame.len);
-    ck_assert_msg(frame.data != NULL, "failed to create frame %zu", frame.idx);
-    ck_assert_msg(zseek_cache_insert(cache, frame),
-        "failed to insert frame %zu", frame.idx);
-    frame = (zseek_frame_t){.idx = 2, .len = 1024};
-    frame.data = malloc(frame.len);
-    ck_assert_msg(frame.data != NULL, "failed to create frame %zu", frame.idx);
-    ck_assert_msg(zseek_cache_insert(cache, frame),
-        "failed to insert frame %zu", frame.idx);
-    frame = (zseek_frame_t){.idx = 3, .len = 2048};
-    frame.data = malloc(frame.len);
-    ck_assert_msg(frame.data != NULL, "failed to create frame %zu", frame.idx);
-    ck_assert_msg(zseek_cache_insert(cache, frame),
-        "failed to insert frame %zu", frame.idx);
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
+    for (size_t i = 1; i <= 3; i++) {
+        zseek_frame_t frame = {.idx = i, .len = 512 * i};
+        frame.data = malloc(frame.len);
+        ck_assert_msg(frame.data != NULL, "failed to create frame %zu", i);
+        zseek_frame_t *cached = zseek_cache_insert(cache, user, frame);
+        ck_assert_msg(cached != NULL, "failed to insert frame %zu", i);
+        zseek_cache_release(cache, cached);
+    }
 
+    zseek_cache_detach(cache, user);
     zseek_cache_free(cache);
 }
 END_TEST
 
 START_TEST(test_cache_find_null)
 {
-    zseek_frame_t frame = zseek_cache_find(NULL, 0);
-    ck_assert(frame.data == NULL);
+    ck_assert(zseek_cache_find(NULL, NULL, 0) == NULL);
 }
 END_TEST
 
 START_TEST(test_cache_find_empty)
 {
-    zseek_cache_t *cache = zseek_cache_new(1);
+    zseek_cache_t *cache = zseek_cache_new(1, 0, ZSEEK_CACHE_CLOCK, NULL, NULL);
     ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
 
-    zseek_frame_t found = zseek_cache_find(cache, 1);
-    ck_assert(found.data == NULL);
+    ck_assert(zseek_cache_find(cache, user, 1) == NULL);
 
+    zseek_cache_detach(cache, user);
     zseek_cache_free(cache);
 }
 END_TEST
 
 START_TEST(test_cache_find_present)
 {
-    zseek_cache_t *cache = zseek_cache_new(2);
+    zseek_cache_t *cache = zseek_cache_new(2, 0, ZSEEK_CACHE_CLOCK, NULL, NULL);
     ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
     zseek_frame_t frame = {.idx = 1, .len = 512};
     frame.data = malloc(frame.len);
     ck_assert_msg(frame.data != NULL, "failed to create frame");
-    ck_assert_msg(zseek_cache_insert(cache, frame), "failed to insert frame");
-
-    zseek_frame_t found = zseek_cache_find(cache, 1);
-    ck_assert(found.data == frame.data);
-    ck_assert(found.idx == frame.idx);
-    ck_assert(found.len == frame.len);
-
+    zseek_frame_t *cached = zseek_cache_insert(cache, user, frame);
+    ck_assert_msg(cached != NULL, "failed to insert frame");
+    zseek_cache_release(cache, cached);
+
+    zseek_frame_t *found = zseek_cache_find(cache, user, 1);
+    ck_assert(found != NULL);
+    ck_assert(found->data == frame.data);
+    ck_assert(found->idx == frame.idx);
+    ck_assert(found->len == frame.len);
+    zseek_cache_release(cache, found);
+
+    zseek_cache_detach(cache, user);
     zseek_cache_free(cache);
 }
 END_TEST
 
 START_TEST(test_cache_find_absent)
 {
-    zseek_cache_t *cache = zseek_cache_new(2);
+    zseek_cache_t *cache = zseek_cache_new(2, 0, ZSEEK_CACHE_CLOCK, NULL, NULL);
     ck_assert_msg(cache != NULL, "failed to create cache");
-    zseek_frame_t frame = {.idx = 1, .len = 512};
-    frame.data = malloc(frame.len);
-    ck_assert_msg(frame.data != NULL, "failed to create frame %zu", frame.idx);
-    ck_assert_msg(zseek_cache_insert(cache, frame),
-        "failed to insert frame %zu", frame.idx);
-    frame = (zseek_frame_t){.idx = 2, .len = 1024};
-    frame.data = malloc(frame.len);
-    ck_assert_msg(frame.data != NULL, "failed to create frame %zu", frame.idx);
-    ck_assert_msg(zseek_cache_insert(cache, frame),
-        "failed to insert frame %zu", frame.idx);
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
+    for (size_t i = 1; i <= 2; i++) {
+        zseek_frame_t frame = {.idx = i, .len = 512 * i};
+        frame.data = malloc(frame.len);
+        ck_assert_msg(frame.data != NULL, "failed to create frame %zu", i);
+        zseek_frame_t *cached = zseek_cache_insert(cache, user, frame);
+        ck_assert_msg(cached != NULL, "failed to insert frame %zu", i);
+        zseek_cache_release(cache, cached);
+    }
 
-    zseek_frame_t found = zseek_cache_find(cache, 3);
-    ck_assert(found.data == NULL);
+    ck_assert(zseek_cache_find(cache, user, 3) == NULL);
 
+    zseek_cache_detach(cache, user);
     zseek_cache_free(cache);
 }
 END_TEST
 
 START_TEST(test_cache_replace)
 {
-    zseek_cache_t *cache = zseek_cache_new(3);
+    zseek_cache_t *cache = zseek_cache_new(3, 0, ZSEEK_CACHE_CLOCK, NULL, NULL);
     ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
     zseek_frame_t frames[4];
     for (int i = 0; i < 4; i++) {
         frames[i] = (zseek_frame_t){.idx = i, .len = 1024};
         frames[i].data = malloc(frames[i].len);
-        ck_assert_msg(frames[i].data != NULL, "failed to create frame %zu", i);
-        ck_assert_msg(zseek_cache_insert(cache, frames[i]),
-            "failed to insert frame %zu", i);
+        ck_assert_msg(frames[i].data != NULL, "failed to create frame %d", i);
+        zseek_frame_t *cached = zseek_cache_insert(cache, user, frames[i]);
+        ck_assert_msg(cached != NULL, "failed to insert frame %d", i);
+        zseek_cache_release(cache, cached);
     }
 
-    zseek_frame_t found = zseek_cache_find(cache, 0);
-    ck_assert(found.data == NULL);
+    ck_assert(zseek_cache_find(cache, user, 0) == NULL);
     for (int i = 1; i < 4; i++) {
-        found = zseek_cache_find(cache, i);
-        ck_assert(found.data == frames[i].data);
-        ck_assert(found.idx == frames[i].idx);
-        ck_assert(found.len == frames[i].len);
+        zseek_frame_t *found = zseek_cache_find(cache, user, i);
+        ck_assert(found != NULL);
+        ck_assert(found->data == frames[i].data);
+        ck_assert(found->idx == frames[i].idx);
+        ck_assert(found->len == frames[i].len);
+        zseek_cache_release(cache, found);
     }
+    ck_assert(zseek_cache_entries(cache) == 3);
 
+    zseek_cache_detach(cache, user);
     zseek_cache_free(cache);
 }
 END_TEST
 
+START_TEST(test_cache_second_chance)
+{
+    zseek_cache_t *cache = zseek_cache_new(2, 0, ZSEEK_CACHE_CLOCK, NULL, NULL);
+    ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
+    for (size_t i = 0; i < 2; i++) {
+        zseek_frame_t frame = {.idx = i, .len = 1024};
+        frame.data = malloc(frame.len);
+        ck_assert_msg(frame.data != NULL, "failed to create frame %zu", i);
+        zseek_frame_t *cached = zseek_cache_insert(cache, user, frame);
+        ck_assert_msg(cached != NULL, "failed to insert frame %zu", i);
+        zseek_cache_release(cache, cached);
+    }
+    // Hit the oldest frame, so that the other one goes first
+    zseek_frame_t *found = zseek_cache_find(cache, user, 0);
+    ck_assert(found != NULL);
+    zseek_cache_release(cache, found);
+
+    zseek_frame_t frame = {.idx = 2, .len = 1024};
+    frame.data = malloc(frame.len);
+    ck_assert_msg(frame.data != NULL, "failed to create frame %zu", frame.idx);
+    zseek_frame_t *cached = zseek_cache_insert(cache, user, frame);
+    ck_assert_msg(cached != NULL, "failed to insert frame %zu", frame.idx);
+    zseek_cache_release(cache, cached);
+
+    found = zseek_cache_find(cache, user, 0);
+    ck_assert(found != NULL);
+    zseek_cache_release(cache, found);
+    ck_assert(zseek_cache_find(cache, user, 1) == NULL);
+
+    zseek_cache_detach(cache, user);
+    zseek_cache_free(cache);
+}
+END_TEST
+
+START_TEST(test_cache_pinned)
+{
+    zseek_cache_t *cache = zseek_cache_new(1, 0, ZSEEK_CACHE_CLOCK, NULL, NULL);
+    ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
+    zseek_frame_t frame = {.idx = 0, .len = 512};
+    frame.data = malloc(frame.len);
+    ck_assert_msg(frame.data != NULL, "failed to create frame %zu", frame.idx);
+    zseek_frame_t *pinned = zseek_cache_insert(cache, user, frame);
+    ck_assert_msg(pinned != NULL, "failed to insert frame %zu", frame.idx);
+
+    // Nothing to evict, the frame stays with the caller
+    zseek_frame_t other = {.idx = 1, .len = 512};
+    other.data = malloc(other.len);
+    ck_assert_msg(other.data != NULL, "failed to create frame %zu", other.idx);
+    ck_assert(zseek_cache_insert(cache, user, other) == NULL);
+    free(other.data);
+
+    zseek_cache_release(cache, pinned);
+    other.data = malloc(other.len);
+    ck_assert_msg(other.data != NULL, "failed to create frame %zu", other.idx);
+    zseek_frame_t *cached = zseek_cache_insert(cache, user, other);
+    ck_assert(cached != NULL);
+    zseek_cache_release(cache, cached);
+    ck_assert(zseek_cache_find(cache, user, 0) == NULL);
+
+    zseek_cache_detach(cache, user);
+    zseek_cache_free(cache);
+}
+END_TEST
+
+/**
+ * Reads the frame at index @p idx through @p cache, as a reader would
+ */
+static bool access_frame(zseek_cache_t *cache, zseek_cache_user_t *user,
+    size_t idx)
+{
+    zseek_frame_t *frame = zseek_cache_find(cache, user, idx);
+    if (!frame) {
+        zseek_frame_t miss = {.idx = idx, .len = 1024};
+        miss.data = malloc(miss.len);
+        if (!miss.data)
+            return false;
+        frame = zseek_cache_insert(cache, user, miss);
+        if (!frame) {
+            free(miss.data);
+            return false;
+        }
+    }
+    zseek_cache_release(cache, frame);
+
+    return true;
+}
+
+static bool cached(zseek_cache_t *cache, const zseek_cache_user_t *user,
+    size_t idx)
+{
+    zseek_frame_t *frame = zseek_cache_peek(cache, user, idx);
+    zseek_cache_release(cache, frame);
+
+    return frame != NULL;
+}
+
+/**
+ * Inserts a frame of @p len bytes at index @p idx of @p user in @p cache,
+ * returning whether it was cached
+ */
+static bool insert_frame(zseek_cache_t *cache, zseek_cache_user_t *user,
+    size_t idx, size_t len)
+{
+    zseek_frame_t frame = {.idx = idx, .len = len};
+    frame.data = malloc(frame.len);
+    if (!frame.data)
+        return false;
+    zseek_frame_t *cached = zseek_cache_insert(cache, user, frame);
+    if (!cached) {
+        free(frame.data);
+        return false;
+    }
+    zseek_cache_release(cache, cached);
+
+    return true;
+}
+
+START_TEST(test_cache_clock_scan)
+{
+    zseek_cache_t *cache = zseek_cache_new(8, 0, ZSEEK_CACHE_CLOCK, NULL,
+        NULL);
+    ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
+    for (int round = 0; round < 3; round++) {
+        ck_assert(access_frame(cache, user, 0));
+        ck_assert(access_frame(cache, user, 1));
+    }
+
+    // A long enough scan flushes everything
+    for (size_t i = 100; i < 200; i++)
+        ck_assert_msg(access_frame(cache, user, i),
+            "failed to access frame %zu", i);
+    ck_assert(!cached(cache, user, 0));
+    ck_assert(!cached(cache, user, 1));
+
+    zseek_cache_detach(cache, user);
+    zseek_cache_free(cache);
+}
+END_TEST
+
+START_TEST(test_cache_2q_scan)
+{
+    zseek_cache_t *cache = zseek_cache_new(8, 0, ZSEEK_CACHE_2Q, NULL, NULL);
+    ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
+    ck_assert(access_frame(cache, user, 0));
+    ck_assert(access_frame(cache, user, 1));
+    for (size_t i = 100; i < 110; i++)
+        ck_assert_msg(access_frame(cache, user, i),
+            "failed to access frame %zu", i);
+    // Used again after leaving probation, so promoted
+    ck_assert(!cached(cache, user, 0));
+    ck_assert(!cached(cache, user, 1));
+    ck_assert(access_frame(cache, user, 0));
+    ck_assert(access_frame(cache, user, 1));
+
+    for (size_t i = 200; i < 300; i++)
+        ck_assert_msg(access_frame(cache, user, i),
+            "failed to access frame %zu", i);
+    ck_assert(cached(cache, user, 0));
+    ck_assert(cached(cache, user, 1));
+    ck_assert(cached(cache, user, 299));
+    ck_assert(zseek_cache_entries(cache) == 8);
+
+    zseek_cache_detach(cache, user);
+    zseek_cache_free(cache);
+}
+END_TEST
+
+START_TEST(test_cache_tinylfu_scan)
+{
+    zseek_cache_t *cache = zseek_cache_new(8, 0, ZSEEK_CACHE_TINYLFU, NULL,
+        NULL);
+    ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
+    for (int round = 0; round < 10; round++) {
+        for (size_t i = 0; i < 4; i++)
+            ck_assert(access_frame(cache, user, i));
+    }
+
+    // Frames used once do not replace frequently used ones
+    for (size_t i = 100; i < 130; i++)
+        ck_assert_msg(access_frame(cache, user, i),
+            "failed to access frame %zu", i);
+    for (size_t i = 0; i < 4; i++)
+        ck_assert_msg(cached(cache, user, i), "frame %zu was evicted", i);
+    ck_assert(cached(cache, user, 129));
+
+    zseek_cache_detach(cache, user);
+    zseek_cache_free(cache);
+}
+END_TEST
+
+START_TEST(test_cache_usage_null)
+{
+    zseek_cache_usage_t usage = {.entries = 1};
+    zseek_cache_usage(NULL, NULL, &usage);
+    ck_assert(usage.entries == 0);
+}
+END_TEST
+
+START_TEST(test_cache_usage)
+{
+    zseek_cache_t *cache = zseek_cache_new(2, 0, ZSEEK_CACHE_CLOCK, NULL,
+        NULL);
+    ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
+    ck_assert(access_frame(cache, user, 0));
+    ck_assert(access_frame(cache, user, 0));
+    ck_assert(access_frame(cache, user, 0));
+    ck_assert(access_frame(cache, user, 1));
+    // Not counted
+    ck_assert(cached(cache, user, 1));
+    ck_assert(!cached(cache, user, 2));
+
+    zseek_cache_usage_t usage;
+    zseek_cache_usage(cache, user, &usage);
+    ck_assert(usage.hits == 2);
+    ck_assert(usage.misses == 2);
+    ck_assert(usage.entries == 2);
+    ck_assert(usage.memory == 2048);
+    ck_assert(usage.peak_memory == 2048);
+
+    zseek_cache_detach(cache, user);
+    zseek_cache_free(cache);
+}
+END_TEST
+
+START_TEST(test_cache_shared)
+{
+    zseek_cache_t *cache = zseek_cache_new(8, 4096, ZSEEK_CACHE_CLOCK, NULL,
+        NULL);
+    ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *users[2];
+    for (int i = 0; i < 2; i++) {
+        users[i] = zseek_cache_attach(cache, NULL);
+        ck_assert_msg(users[i] != NULL, "failed to attach to cache");
+    }
+
+    // Same indexes, different frames
+    for (size_t i = 0; i < 2; i++) {
+        ck_assert(access_frame(cache, users[0], i));
+        ck_assert(!cached(cache, users[1], i));
+    }
+    ck_assert(access_frame(cache, users[1], 0));
+    ck_assert(zseek_cache_entries(cache) == 3);
+
+    // One budget for both
+    for (size_t i = 2; i < 8; i++)
+        ck_assert(access_frame(cache, users[1], i));
+    zseek_cache_usage_t usage[2];
+    for (int i = 0; i < 2; i++)
+        zseek_cache_usage(cache, users[i], &usage[i]);
+    ck_assert(usage[0].memory + usage[1].memory <= 4096);
+    ck_assert(usage[0].entries + usage[1].entries ==
+        zseek_cache_entries(cache));
+    ck_assert(usage[0].entries < 2);
+
+    // Frames of a user go with it
+    zseek_cache_detach(cache, users[1]);
+    ck_assert(zseek_cache_entries(cache) == usage[0].entries);
+
+    zseek_cache_detach(cache, users[0]);
+    ck_assert(zseek_cache_entries(cache) == 0);
+    zseek_cache_free(cache);
+}
+END_TEST
+
+START_TEST(test_cache_shared_file)
+{
+    // Many shards, of less than a frame each
+    zseek_cache_t *cache = zseek_cache_new(256, 64 << 10, ZSEEK_CACHE_CLOCK,
+        NULL, NULL);
+    ck_assert_msg(cache != NULL, "failed to create cache");
+    struct stat st = {.st_dev = 1, .st_ino = 2, .st_size = 3};
+    zseek_cache_user_t *users[3];
+    for (int i = 0; i < 2; i++) {
+        users[i] = zseek_cache_attach(cache, &st);
+        ck_assert_msg(users[i] != NULL, "failed to attach to cache");
+    }
+    ck_assert(users[0] == users[1]);
+    st.st_mtim.tv_nsec = 1;
+    users[2] = zseek_cache_attach(cache, &st);
+    ck_assert_msg(users[2] != NULL, "failed to attach to cache");
+    ck_assert(users[2] != users[0]);
+
+    // Readers of the same file share its frames, not those of a new version
+    for (size_t i = 0; i < 4; i++)
+        ck_assert(insert_frame(cache, users[0], i, 16 << 10));
+    for (size_t i = 0; i < 4; i++) {
+        ck_assert(cached(cache, users[1], i));
+        ck_assert(!cached(cache, users[2], i));
+    }
+    ck_assert(insert_frame(cache, users[2], 0, 32 << 10));
+    ck_assert(zseek_cache_entries(cache) == 3);
+
+    // Until the last of them goes
+    zseek_cache_detach(cache, users[0]);
+    ck_assert(cached(cache, users[1], 3));
+    zseek_cache_detach(cache, users[1]);
+    ck_assert(zseek_cache_entries(cache) == 1);
+    zseek_cache_detach(cache, users[2]);
+    ck_assert(zseek_cache_entries(cache) == 0);
+    zseek_cache_free(cache);
+}
+END_TEST
+
+#define NB_THREADS 4
+#define NB_USERS 2
+#define NB_FRAMES 64
+#define NB_LOOKUPS 100000
+
+typedef struct {
+    zseek_cache_t *cache;
+    zseek_cache_user_t *user;
+} lookup_arg_t;
+
+static void *lookup_thread(void *arg)
+{
+    zseek_cache_t *cache = ((lookup_arg_t*)arg)->cache;
+    zseek_cache_user_t *user = ((lookup_arg_t*)arg)->user;
+    unsigned seed = (unsigned)(size_t)pthread_self();
+
+    for (int i = 0; i < NB_LOOKUPS; i++) {
+        size_t idx = rand_r(&seed) % NB_FRAMES;
+        zseek_frame_t *frame = zseek_cache_find(cache, user, idx);
+        if (!frame) {
+            zseek_frame_t miss = {.idx = idx, .len = 2 * sizeof(void*)};
+            miss.data = malloc(miss.len);
+            if (!miss.data)
+                return (void*)1;
+            ((size_t*)miss.data)[0] = idx;
+            ((void**)miss.data)[1] = user;
+            frame = zseek_cache_insert(cache, user, miss);
+            if (!frame) {
+                free(miss.data);
+                continue;
+            }
+        }
+        // Whatever the evictions, a pinned frame is the one asked for
+        bool ok = frame->idx == idx && ((size_t*)frame->data)[0] == idx &&
+            ((void**)frame->data)[1] == user;
+        zseek_cache_release(cache, frame);
+        if (!ok)
+            return (void*)1;
+    }
+
+    return NULL;
+}
+
+START_TEST(test_cache_concurrent)
+{
+    zseek_cache_policy_t policies[] = {
+        ZSEEK_CACHE_CLOCK, ZSEEK_CACHE_2Q, ZSEEK_CACHE_TINYLFU,
+    };
+    for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+        zseek_cache_t *cache = zseek_cache_new(NB_FRAMES / 2, 0, policies[p],
+            NULL, NULL);
+        ck_assert_msg(cache != NULL, "failed to create cache");
+        lookup_arg_t args[NB_USERS];
+        for (int i = 0; i < NB_USERS; i++) {
+            args[i].cache = cache;
+            args[i].user = zseek_cache_attach(cache, NULL);
+            ck_assert_msg(args[i].user != NULL, "failed to attach to cache");
+        }
+
+        pthread_t threads[NB_THREADS];
+        for (int i = 0; i < NB_THREADS; i++) {
+            ck_assert_msg(!pthread_create(&threads[i], NULL, lookup_thread,
+                &args[i % NB_USERS]), "failed to create thread %d", i);
+        }
+        for (int i = 0; i < NB_THREADS; i++) {
+            void *ret;
+            ck_assert(!pthread_join(threads[i], &ret));
+            ck_assert_msg(ret == NULL, "thread %d found a wrong frame", i);
+        }
+        ck_assert(zseek_cache_entries(cache) <= NB_FRAMES / 2);
+        size_t lookups = 0;
+        for (int i = 0; i < NB_USERS; i++) {
+            zseek_cache_usage_t usage;
+            zseek_cache_usage(cache, args[i].user, &usage);
+            lookups += usage.hits + usage.misses;
+            zseek_cache_detach(cache, args[i].user);
+        }
+        ck_assert(lookups == NB_THREADS * NB_LOOKUPS);
+
+        zseek_cache_free(cache);
+    }
+}
+END_TEST
+
 START_TEST(test_cache_memory_usage_null)
 {
     ck_assert(zseek_cache_memory_usage(NULL) == 0);
@@ -166,15 +622,148 @@ END_TEST
 
 START_TEST(test_cache_memory_usage)
 {
-    zseek_cache_t *cache = zseek_cache_new(1);
+    zseek_cache_t *cache = zseek_cache_new(1, 0, ZSEEK_CACHE_CLOCK, NULL, NULL);
     ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
     zseek_frame_t frame = {.idx = 1, .len = 512};
     frame.data = malloc(frame.len);
     ck_assert_msg(frame.data != NULL, "failed to create frame %zu", frame.idx);
-    ck_assert_msg(zseek_cache_insert(cache, frame), "failed to insert frame");
+    zseek_frame_t *cached = zseek_cache_insert(cache, user, frame);
+    ck_assert_msg(cached != NULL, "failed to insert frame");
+    zseek_cache_release(cache, cached);
 
     ck_assert(zseek_cache_memory_usage(cache) >= frame.len);
 
+    zseek_cache_detach(cache, user);
+    zseek_cache_free(cache);
+}
+END_TEST
+
+START_TEST(test_cache_max_size)
+{
+    zseek_cache_t *cache = zseek_cache_new(8, 3000, ZSEEK_CACHE_CLOCK, NULL,
+        NULL);
+    ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
+    for (size_t i = 0; i < 4; i++) {
+        zseek_frame_t frame = {.idx = i, .len = 1024};
+        frame.data = malloc(frame.len);
+        ck_assert_msg(frame.data != NULL, "failed to create frame %zu", i);
+        zseek_frame_t *cached = zseek_cache_insert(cache, user, frame);
+        ck_assert_msg(cached != NULL, "failed to insert frame %zu", i);
+        zseek_cache_release(cache, cached);
+    }
+
+    // Room for 2 frames of 1 KiB only, below the capacity in frames
+    ck_assert(zseek_cache_entries(cache) == 2);
+    ck_assert(zseek_cache_find(cache, user, 0) == NULL);
+    ck_assert(zseek_cache_find(cache, user, 1) == NULL);
+
+    // Larger than the whole cache
+    zseek_frame_t large = {.idx = 4, .len = 4096};
+    large.data = malloc(large.len);
+    ck_assert_msg(large.data != NULL, "failed to create frame %zu", large.idx);
+    ck_assert(zseek_cache_insert(cache, user, large) == NULL);
+    free(large.data);
+    ck_assert(zseek_cache_entries(cache) == 2);
+
+    // Evicts both to fit
+    large.len = 2900;
+    large.data = malloc(large.len);
+    ck_assert_msg(large.data != NULL, "failed to create frame %zu", large.idx);
+    zseek_frame_t *cached = zseek_cache_insert(cache, user, large);
+    ck_assert(cached != NULL);
+    zseek_cache_release(cache, cached);
+    ck_assert(zseek_cache_entries(cache) == 1);
+
+    zseek_cache_detach(cache, user);
+    zseek_cache_free(cache);
+}
+END_TEST
+
+START_TEST(test_cache_max_size_shards)
+{
+    static const zseek_cache_policy_t policies[] = {
+        ZSEEK_CACHE_CLOCK, ZSEEK_CACHE_2Q, ZSEEK_CACHE_TINYLFU,
+    };
+    for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+        // 16 shards, of 64 KiB each were the budget split among them
+        size_t max_size = 1 << 20;
+        zseek_cache_t *cache = zseek_cache_new(256, max_size, policies[p],
+            NULL, NULL);
+        ck_assert_msg(cache != NULL, "failed to create cache");
+        zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+        ck_assert_msg(user != NULL, "failed to attach to cache");
+        zseek_cache_usage_t usage;
+
+        for (size_t i = 0; i < 64; i++)
+            ck_assert(insert_frame(cache, user, i, 4 << 10));
+
+        // Frames larger than the share of a shard, evicting from others
+        ck_assert(insert_frame(cache, user, 64, 512 << 10));
+        ck_assert(cached(cache, user, 64));
+        ck_assert(insert_frame(cache, user, 65, 900 << 10));
+        ck_assert(cached(cache, user, 65));
+        zseek_cache_usage(cache, user, &usage);
+        ck_assert(usage.memory <= max_size);
+        ck_assert(insert_frame(cache, user, 66, max_size));
+        ck_assert(zseek_cache_entries(cache) == 1);
+
+        // Mixed sizes fill the whole budget, never more
+        unsigned seed = 1;
+        for (size_t i = 67; i < 2000; i++) {
+            size_t len = 1024 + rand_r(&seed) % (63 << 10);
+            if (i % 100 == 0)
+                len = 300 << 10;
+            ck_assert_msg(insert_frame(cache, user, i, len),
+                "failed to insert frame %zu", i);
+            zseek_cache_usage(cache, user, &usage);
+            ck_assert_msg(usage.memory <= max_size, "%zu bytes cached",
+                usage.memory);
+        }
+        ck_assert_msg(usage.memory > max_size / 2, "%zu bytes cached",
+            usage.memory);
+        ck_assert(usage.peak_memory <= max_size);
+
+        zseek_cache_detach(cache, user);
+        zseek_cache_free(cache);
+    }
+}
+END_TEST
+
+START_TEST(test_cache_peak_memory_usage)
+{
+    zseek_cache_t *cache = zseek_cache_new(2, 0, ZSEEK_CACHE_CLOCK, NULL, NULL);
+    ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
+    size_t empty = zseek_cache_memory_usage(cache);
+    ck_assert(zseek_cache_peak_memory_usage(cache) == empty);
+
+    for (size_t i = 0; i < 3; i++) {
+        zseek_frame_t frame = {.idx = i, .len = i == 1 ? 4096 : 512};
+        frame.data = malloc(frame.len);
+        ck_assert_msg(frame.data != NULL, "failed to create frame %zu", i);
+        zseek_frame_t *cached = zseek_cache_insert(cache, user, frame);
+        ck_assert_msg(cached != NULL, "failed to insert frame %zu", i);
+        zseek_cache_release(cache, cached);
+    }
+
+    // Frame 0 went, leaving frames 1 and 2, as at the peak
+    ck_assert(zseek_cache_memory_usage(cache) == empty + 4096 + 512);
+    ck_assert(zseek_cache_peak_memory_usage(cache) == empty + 4096 + 512);
+    zseek_frame_t frame = {.idx = 3, .len = 512};
+    frame.data = malloc(frame.len);
+    ck_assert_msg(frame.data != NULL, "failed to create frame %zu", frame.idx);
+    zseek_frame_t *cached = zseek_cache_insert(cache, user, frame);
+    ck_assert_msg(cached != NULL, "failed to insert frame %zu", frame.idx);
+    zseek_cache_release(cache, cached);
+    ck_assert(zseek_cache_memory_usage(cache) == empty + 512 + 512);
+    ck_assert(zseek_cache_peak_memory_usage(cache) == empty + 4096 + 512);
+
+    zseek_cache_detach(cache, user);
     zseek_cache_free(cache);
 }
 END_TEST
@@ -187,15 +776,20 @@ END_TEST
 
 START_TEST(test_cache_entries)
 {
-    zseek_cache_t *cache = zseek_cache_new(2);
+    zseek_cache_t *cache = zseek_cache_new(2, 0, ZSEEK_CACHE_CLOCK, NULL, NULL);
     ck_assert_msg(cache != NULL, "failed to create cache");
+    zseek_cache_user_t *user = zseek_cache_attach(cache, NULL);
+    ck_assert_msg(user != NULL, "failed to attach to cache");
     zseek_frame_t frame = {.idx = 1, .len = 512};
     frame.data = malloc(frame.len);
     ck_assert_msg(frame.data != NULL, "failed to create frame %zu", frame.idx);
-    ck_assert_msg(zseek_cache_insert(cache, frame), "failed to insert frame");
+    zseek_frame_t *cached = zseek_cache_insert(cache, user, frame);
+    ck_assert_msg(cached != NULL, "failed to insert frame");
+    zseek_cache_release(cache, cached);
 
     ck_assert(zseek_cache_entries(cache) == 1);
 
+    zseek_cache_detach(cache, user);
     zseek_cache_free(cache);
 }
 END_TEST
@@ -206,9 +800,11 @@ Suite *cache_suite(void)
     TCase *tc_core = tcase_create("Core");
 
     tcase_add_test(tc_core, test_cache_new_null);
+    tcase_add_test(tc_core, test_cache_new_invalid_policy);
     tcase_add_test(tc_core, test_cache_new);
     tcase_add_test(tc_core, test_cache_insert_null);
     tcase_add_test(tc_core, test_cache_insert);
+    tcase_add_test(tc_core, test_cache_insert_present);
     tcase_add_test(tc_core, test_cache_free_null);
     tcase_add_test(tc_core, test_cache_free);
     tcase_add_test(tc_core, test_cache_find_null);
@@ -216,8 +812,21 @@ Suite *cache_suite(void)
     tcase_add_test(tc_core, test_cache_find_present);
     tcase_add_test(tc_core, test_cache_find_absent);
     tcase_add_test(tc_core, test_cache_replace);
+    tcase_add_test(tc_core, test_cache_second_chance);
+    tcase_add_test(tc_core, test_cache_pinned);
+    tcase_add_test(tc_core, test_cache_clock_scan);
+    tcase_add_test(tc_core, test_cache_2q_scan);
+    tcase_add_test(tc_core, test_cache_tinylfu_scan);
+    tcase_add_test(tc_core, test_cache_usage_null);
+    tcase_add_test(tc_core, test_cache_usage);
+    tcase_add_test(tc_core, test_cache_shared);
+    tcase_add_test(tc_core, test_cache_shared_file);
+    tcase_add_test(tc_core, test_cache_concurrent);
     tcase_add_test(tc_core, test_cache_memory_usage_null);
     tcase_add_test(tc_core, test_cache_memory_usage);
+    tcase_add_test(tc_core, test_cache_max_size);
+    tcase_add_test(tc_core, test_cache_max_size_shards);
+    tcase_add_test(tc_core, test_cache_peak_memory_usage);
     tcase_add_test(tc_core, test_cache_entries_null);
     tcase_add_test(tc_core, test_cache_entries);
 
@@ -237,4 +846,3 @@ int main(void)
 
     return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
-
@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <check.h>
+
+#include "../src/cdc.h"
+
+#define MIN_SIZE 2048
+#define AVG_SIZE 8192
+#define MAX_SIZE 32768
+#define DATA_SIZE (1 << 20)
+#define MAX_CUTS (DATA_SIZE / MIN_SIZE + 1)
+
+static uint8_t *random_data(size_t len, uint32_t seed)
+{
+    uint8_t *data = malloc(len);
+    if (!data)
+        return NULL;
+
+    uint32_t x = seed;
+    for (size_t i = 0; i < len; i++) {
+        x = x * 1103515245 + 12345;
+        data[i] = x >> 16;
+    }
+
+    return data;
+}
+
+/**
+ * Returns the number of cut points in @p data, fed @p step bytes at a time,
+ * storing their offsets in @p cuts.
+ */
+static size_t find_cuts(const uint8_t *data, size_t len, size_t step,
+    size_t *cuts)
+{
+    zseek_cdc_t cdc;
+    ck_assert(zseek_cdc_init(&cdc, MIN_SIZE, AVG_SIZE, MAX_SIZE));
+
+    size_t nb_cuts = 0;
+    size_t pos = 0;
+    while (pos < len) {
+        size_t n = len - pos < step ? len - pos : step;
+        while (n > 0) {
+            bool cut;
+            size_t r = zseek_cdc_next(&cdc, data + pos, n, &cut);
+            ck_assert(r > 0 && r <= n);
+            pos += r;
+            n -= r;
+            if (cut)
+                cuts[nb_cuts++] = pos;
+        }
+    }
+
+    return nb_cuts;
+}
+
+START_TEST(test_cdc_init)
+{
+    zseek_cdc_t cdc;
+    ck_assert(!zseek_cdc_init(NULL, MIN_SIZE, AVG_SIZE, MAX_SIZE));
+    ck_assert(!zseek_cdc_init(&cdc, AVG_SIZE, AVG_SIZE, MAX_SIZE));
+    ck_assert(!zseek_cdc_init(&cdc, MIN_SIZE, MAX_SIZE, AVG_SIZE));
+    ck_assert(zseek_cdc_init(&cdc, MIN_SIZE, AVG_SIZE, AVG_SIZE));
+    ck_assert(zseek_cdc_init(&cdc, 0, AVG_SIZE, MAX_SIZE));
+}
+END_TEST
+
+START_TEST(test_cdc_sizes)
+{
+    uint8_t *data = random_data(DATA_SIZE, 1);
+    ck_assert_msg(data != NULL, "failed to allocate data");
+    size_t cuts[MAX_CUTS];
+
+    size_t nb_cuts = find_cuts(data, DATA_SIZE, DATA_SIZE, cuts);
+    ck_assert(nb_cuts > 0);
+
+    size_t prev = 0;
+    for (size_t i = 0; i < nb_cuts; i++) {
+        size_t size = cuts[i] - prev;
+        ck_assert(size >= MIN_SIZE);
+        ck_assert(size <= MAX_SIZE);
+        prev = cuts[i];
+    }
+
+    // Roughly the requested average
+    size_t avg = prev / nb_cuts;
+    ck_assert(avg >= AVG_SIZE / 2);
+    ck_assert(avg <= AVG_SIZE * 2);
+
+    free(data);
+}
+END_TEST
+
+START_TEST(test_cdc_max)
+{
+    // Constant data never matches, so chunks are cut at the maximum size
+    uint8_t *data = calloc(DATA_SIZE, 1);
+    ck_assert_msg(data != NULL, "failed to allocate data");
+    size_t cuts[MAX_CUTS];
+
+    size_t nb_cuts = find_cuts(data, DATA_SIZE, DATA_SIZE, cuts);
+    ck_assert(nb_cuts == DATA_SIZE / MAX_SIZE);
+    for (size_t i = 0; i < nb_cuts; i++)
+        ck_assert(cuts[i] == (i + 1) * MAX_SIZE);
+
+    free(data);
+}
+END_TEST
+
+START_TEST(test_cdc_split)
+{
+    uint8_t *data = random_data(DATA_SIZE, 2);
+    ck_assert_msg(data != NULL, "failed to allocate data");
+    size_t cuts[MAX_CUTS];
+    size_t split_cuts[MAX_CUTS];
+
+    // Cut points do not depend on how data is fed
+    size_t nb_cuts = find_cuts(data, DATA_SIZE, DATA_SIZE, cuts);
+    size_t steps[] = {1, 63, 4096, 10007};
+    for (size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); s++) {
+        size_t nb_split_cuts = find_cuts(data, DATA_SIZE, steps[s],
+            split_cuts);
+        ck_assert(nb_split_cuts == nb_cuts);
+        ck_assert(memcmp(split_cuts, cuts, nb_cuts * sizeof(*cuts)) == 0);
+    }
+
+    free(data);
+}
+END_TEST
+
+START_TEST(test_cdc_shift)
+{
+    uint8_t *data = random_data(DATA_SIZE, 3);
+    ck_assert_msg(data != NULL, "failed to allocate data");
+    size_t cuts[MAX_CUTS];
+    size_t shifted_cuts[MAX_CUTS];
+
+    // Insert a byte near the start
+    uint8_t *shifted = malloc(DATA_SIZE + 1);
+    ck_assert_msg(shifted != NULL, "failed to allocate data");
+    memcpy(shifted, data, 100);
+    shifted[100] = 0xff;
+    memcpy(shifted + 101, data + 100, DATA_SIZE - 100);
+
+    size_t nb_cuts = find_cuts(data, DATA_SIZE, DATA_SIZE, cuts);
+    size_t nb_shifted_cuts = find_cuts(shifted, DATA_SIZE + 1, DATA_SIZE,
+        shifted_cuts);
+
+    // Cut points resynchronize, so most of them are the same, shifted by one
+    size_t same = 0;
+    size_t j = 0;
+    for (size_t i = 0; i < nb_cuts; i++) {
+        while (j < nb_shifted_cuts && shifted_cuts[j] < cuts[i] + 1)
+            j++;
+        if (j < nb_shifted_cuts && shifted_cuts[j] == cuts[i] + 1)
+            same++;
+    }
+    ck_assert(same + 2 >= nb_cuts);
+
+    free(shifted);
+    free(data);
+}
+END_TEST
+
+Suite *cdc_suite(void)
+{
+    Suite *s = suite_create("cdc");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_cdc_init);
+    tcase_add_test(tc_core, test_cdc_sizes);
+    tcase_add_test(tc_core, test_cdc_max);
+    tcase_add_test(tc_core, test_cdc_split);
+    tcase_add_test(tc_core, test_cdc_shift);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = cdc_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <endian.h>
+
+#include <check.h>
+
+#include "../src/dict.h"
+
+#define NB_RECORDS 4096
+#define RECORD_SIZE 128
+#define FRAME_SIZE 4096
+#define DICT_CAPACITY (16 << 10)
+
+/**
+ * Fills @p data with @p nb_records similar records of @p RECORD_SIZE bytes
+ */
+static void make_records(char *data, size_t nb_records, size_t *lens)
+{
+    const char *levels[] = {"debug", "info", "warning", "error"};
+    uint32_t x = 1;
+    for (size_t i = 0; i < nb_records; i++) {
+        x = x * 1103515245 + 12345;
+        char record[RECORD_SIZE + 1];
+        snprintf(record, sizeof(record), "{\"id\": %zu, \"level\": \"%s\", "
+            "\"user\": \"user%u\", \"message\": \"request served in %u ms\"}",
+            i, levels[(x >> 16) % 4], (x >> 8) % 1000, (x >> 20) % 500);
+        memset(record + strlen(record), ' ', RECORD_SIZE - strlen(record));
+        memcpy(data + i * RECORD_SIZE, record, RECORD_SIZE);
+        lens[i] = RECORD_SIZE;
+    }
+}
+
+START_TEST(test_dict_header)
+{
+    uint8_t header[ZSEEK_DICT_HEADER_SIZE];
+    zseek_compression_type_t type;
+    size_t dict_size;
+
+    zseek_dict_header(header, ZSEEK_ZSTD, 1000);
+    ck_assert(zseek_dict_parse(header, &type, &dict_size));
+    ck_assert(type == ZSEEK_ZSTD);
+    ck_assert(dict_size == 1000);
+
+    zseek_dict_header(header, ZSEEK_LZ4, 1);
+    ck_assert(zseek_dict_parse(header, &type, &dict_size));
+    ck_assert(type == ZSEEK_LZ4);
+    ck_assert(dict_size == 1);
+
+    // A skippable frame, as per the zstd and lz4 frame formats
+    uint32_t magic;
+    memcpy(&magic, header, sizeof(magic));
+    ck_assert((le32toh(magic) & 0xFFFFFFF0) == 0x184D2A50);
+}
+END_TEST
+
+START_TEST(test_dict_parse_invalid)
+{
+    uint8_t header[ZSEEK_DICT_HEADER_SIZE];
+    zseek_compression_type_t type;
+    size_t dict_size;
+
+    // Wrong magic number
+    zseek_dict_header(header, ZSEEK_ZSTD, 1000);
+    header[0] ^= 1;
+    ck_assert(!zseek_dict_parse(header, &type, &dict_size));
+
+    // Empty dictionary
+    zseek_dict_header(header, ZSEEK_ZSTD, 0);
+    ck_assert(!zseek_dict_parse(header, &type, &dict_size));
+
+    // Unknown compression type
+    zseek_dict_header(header, 42, 1000);
+    ck_assert(!zseek_dict_parse(header, &type, &dict_size));
+
+    // Too large to allocate blindly
+    zseek_dict_header(header, ZSEEK_ZSTD, ZSEEK_DICT_MAX_SIZE + 1);
+    ck_assert(!zseek_dict_parse(header, &type, &dict_size));
+    zseek_dict_header(header, ZSEEK_ZSTD, UINT32_MAX - 4);
+    ck_assert(!zseek_dict_parse(header, &type, &dict_size));
+    zseek_dict_header(header, ZSEEK_ZSTD, ZSEEK_DICT_MAX_SIZE);
+    ck_assert(zseek_dict_parse(header, &type, &dict_size));
+    ck_assert(dict_size == ZSEEK_DICT_MAX_SIZE);
+}
+END_TEST
+
+START_TEST(test_dict_train)
+{
+    char *data = malloc(NB_RECORDS * RECORD_SIZE);
+    size_t *lens = malloc(NB_RECORDS * sizeof(*lens));
+    void *dict = malloc(DICT_CAPACITY);
+    ck_assert_msg(data && lens && dict, "failed to allocate data");
+    make_records(data, NB_RECORDS, lens);
+
+    size_t dict_size = zseek_dict_train(dict, DICT_CAPACITY, data, lens,
+        NB_RECORDS, FRAME_SIZE, NULL);
+    ck_assert(dict_size > 0);
+    ck_assert(dict_size <= DICT_CAPACITY);
+
+    free(dict);
+    free(lens);
+    free(data);
+}
+END_TEST
+
+START_TEST(test_dict_train_too_little)
+{
+    char *data = malloc(NB_RECORDS * RECORD_SIZE);
+    size_t *lens = malloc(NB_RECORDS * sizeof(*lens));
+    void *dict = malloc(DICT_CAPACITY);
+    ck_assert_msg(data && lens && dict, "failed to allocate data");
+    make_records(data, NB_RECORDS, lens);
+
+    // Nothing to train on
+    ck_assert(zseek_dict_train(dict, DICT_CAPACITY, data, lens, 0,
+        FRAME_SIZE, NULL) == 0);
+    // A single sample
+    ck_assert(zseek_dict_train(dict, DICT_CAPACITY, data, lens, 4,
+        FRAME_SIZE, NULL) == 0);
+
+    free(dict);
+    free(lens);
+    free(data);
+}
+END_TEST
+
+Suite *dict_suite(void)
+{
+    Suite *s = suite_create("dict");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_dict_header);
+    tcase_add_test(tc_core, test_dict_parse_invalid);
+    tcase_add_test(tc_core, test_dict_train);
+    tcase_add_test(tc_core, test_dict_train_too_little);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = dict_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include "../src/fdio.h"
+
+static uint8_t pattern[1 << 15];
+
+static void init_pattern(void)
+{
+    for (size_t i = 0; i < sizeof(pattern); i++)
+        pattern[i] = (uint8_t)(i * 7 + i / 251);
+}
+
+/**
+ * Opens a new, unlinked temporary file in the current directory, with
+ * @p flags in addition, or returns -1
+ */
+static int temp_file(int flags)
+{
+    char path[] = "test_fdio.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+        return -1;
+    unlink(path);
+    if (flags && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | flags) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+START_TEST(test_fdio_init_invalid)
+{
+    zseek_fd_file_t file;
+    zseek_fd_param_t zfp = { .direct_alignment = 3000 };
+
+    int fd = temp_file(0);
+    ck_assert_msg(fd != -1, "failed to create file");
+    ck_assert(!zseek_fd_file_init(&file, fd, &zfp, NULL, NULL));
+    close(fd);
+
+    ck_assert(!zseek_fd_file_init(&file, -1, NULL, NULL, NULL));
+}
+END_TEST
+
+START_TEST(test_fdio_write_read)
+{
+    init_pattern();
+    int fd = temp_file(0);
+    ck_assert_msg(fd != -1, "failed to create file");
+
+    zseek_fd_file_t file;
+    zseek_fd_param_t zfp = { .advice = POSIX_FADV_RANDOM };
+    ck_assert(zseek_fd_file_init(&file, fd, &zfp, NULL, NULL));
+    ck_assert(!file.direct);
+    ck_assert(zseek_fd_write(pattern, 1000, &file, NULL));
+    ck_assert(zseek_fd_write(pattern + 1000, sizeof(pattern) - 1000, &file,
+        NULL));
+    ck_assert(zseek_fd_flush(&file, NULL));
+    ck_assert(zseek_fd_size(&file, NULL) == sizeof(pattern));
+
+    // Positional only
+    ck_assert(lseek(fd, 0, SEEK_CUR) == 0);
+
+    static uint8_t buf[sizeof(pattern)];
+    ck_assert(zseek_fd_pread(buf, 5000, 123, &file, NULL) == 5000);
+    ck_assert(memcmp(buf, pattern + 123, 5000) == 0);
+
+    // Short at the end of the file
+    ck_assert(zseek_fd_pread(buf, 5000, sizeof(pattern) - 10, &file, NULL) ==
+        10);
+    ck_assert(memcmp(buf, pattern + sizeof(pattern) - 10, 10) == 0);
+    ck_assert(zseek_fd_pread(buf, 5000, sizeof(pattern), &file, NULL) == 0);
+
+    close(fd);
+}
+END_TEST
+
+START_TEST(test_fdio_write_position)
+{
+    init_pattern();
+    int fd = temp_file(0);
+    ck_assert_msg(fd != -1, "failed to create file");
+    ck_assert(write(fd, pattern, 100) == 100);
+
+    // Writes start from the current position
+    zseek_fd_file_t file;
+    ck_assert(zseek_fd_file_init(&file, fd, NULL, NULL, NULL));
+    ck_assert(file.pos == 100);
+    ck_assert(zseek_fd_write(pattern + 100, 900, &file, NULL));
+    ck_assert(file.pos == 1000);
+    ck_assert(lseek(fd, 0, SEEK_CUR) == 100);
+
+    static uint8_t buf[1000];
+    ck_assert(zseek_fd_pread(buf, sizeof(buf), 0, &file, NULL) == 1000);
+    ck_assert(memcmp(buf, pattern, 1000) == 0);
+
+    close(fd);
+}
+END_TEST
+
+START_TEST(test_fdio_pipe)
+{
+    init_pattern();
+    int fds[2];
+    ck_assert_msg(pipe(fds) == 0, "failed to create pipe");
+
+    zseek_fd_file_t file;
+    ck_assert(zseek_fd_file_init(&file, fds[1], NULL, NULL, NULL));
+    ck_assert(!file.seekable);
+    ck_assert(zseek_fd_write(pattern, 1000, &file, NULL));
+    ck_assert(zseek_fd_flush(&file, NULL));
+
+    static uint8_t buf[1000];
+    ck_assert(read(fds[0], buf, sizeof(buf)) == 1000);
+    ck_assert(memcmp(buf, pattern, 1000) == 0);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+END_TEST
+
+START_TEST(test_fdio_direct)
+{
+    init_pattern();
+    // Not every file system supports direct I/O (e.g. tmpfs)
+    int fd = temp_file(O_DIRECT);
+    if (fd == -1)
+        return;
+
+    zseek_fd_file_t file;
+    ck_assert(zseek_fd_file_init(&file, fd, NULL, NULL, NULL));
+    ck_assert(file.direct);
+
+    // An aligned chunk, then an unaligned tail, padded
+    static uint8_t chunk[8192] __attribute__((aligned(4096)));
+    memcpy(chunk, pattern, sizeof(chunk));
+    ck_assert(zseek_fd_write(chunk, sizeof(chunk), &file, NULL));
+    memcpy(chunk, pattern + 8192, 4096);
+    ck_assert(zseek_fd_write(chunk, 500, &file, NULL));
+    ck_assert(file.pos == 8192 && file.tail == 500);
+    ck_assert(zseek_fd_size(&file, NULL) == 12288);
+
+    // Then written again, along with what follows, and cut off
+    ck_assert(zseek_fd_write(chunk, 1000, &file, NULL));
+    ck_assert(file.pos == 8192 && file.tail == 1000);
+    ck_assert(zseek_fd_trim(&file));
+    ck_assert(fcntl(fd, F_GETFL) & O_DIRECT);
+    ck_assert(zseek_fd_size(&file, NULL) == 9192);
+
+    // Unaligned reads go through a bounce buffer
+    static uint8_t buf[9192];
+    ck_assert(zseek_fd_pread(buf, 5000, 3, &file, NULL) == 5000);
+    ck_assert(memcmp(buf, pattern + 3, 5000) == 0);
+    ck_assert(zseek_fd_pread(buf, 5000, 9000, &file, NULL) == 192);
+    ck_assert(memcmp(buf, pattern + 9000, 192) == 0);
+    ck_assert(zseek_fd_pread(chunk, 8192, 4096, &file, NULL) == 5096);
+    ck_assert(memcmp(chunk, pattern + 4096, 5096) == 0);
+
+    close(fd);
+}
+END_TEST
+
+START_TEST(test_fdio_map)
+{
+    init_pattern();
+    int fd = temp_file(0);
+    ck_assert_msg(fd != -1, "failed to create file");
+
+    // Empty files cannot be mapped
+    zseek_map_t map = {NULL, 0};
+    ck_assert(!zseek_map_file(&map, fd, NULL, NULL));
+
+    ck_assert(write(fd, pattern, sizeof(pattern)) == sizeof(pattern));
+    zseek_fd_param_t zfp = { .advice = POSIX_FADV_RANDOM };
+    ck_assert(zseek_map_file(&map, fd, &zfp, NULL));
+    close(fd);
+    ck_assert(map.size == sizeof(pattern));
+    ck_assert(memcmp(map.data, pattern, sizeof(pattern)) == 0);
+    ck_assert(zseek_map_size(&map, NULL) == sizeof(pattern));
+
+    static uint8_t buf[5000];
+    ck_assert(zseek_map_pread(buf, sizeof(buf), 123, &map, NULL) == 5000);
+    ck_assert(memcmp(buf, pattern + 123, 5000) == 0);
+    ck_assert(zseek_map_pread(buf, sizeof(buf), sizeof(pattern) - 10, &map,
+        NULL) == 10);
+    ck_assert(zseek_map_pread(buf, sizeof(buf), sizeof(pattern), &map,
+        NULL) == 0);
+
+    zseek_unmap(&map);
+    ck_assert(map.data == NULL && map.size == 0);
+    zseek_unmap(&map);
+}
+END_TEST
+
+Suite *fdio_suite(void)
+{
+    Suite *s = suite_create("fdio");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_fdio_init_invalid);
+    tcase_add_test(tc_core, test_fdio_write_read);
+    tcase_add_test(tc_core, test_fdio_write_position);
+    tcase_add_test(tc_core, test_fdio_pipe);
+    tcase_add_test(tc_core, test_fdio_direct);
+    tcase_add_test(tc_core, test_fdio_map);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = fdio_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include "../src/flight.h"
+
+START_TEST(test_flights_new)
+{
+    zseek_flights_t *flights = zseek_flights_new(NULL);
+    ck_assert(flights != NULL);
+
+    zseek_flights_free(flights);
+}
+END_TEST
+
+START_TEST(test_flights_free_null)
+{
+    zseek_flights_free(NULL);
+}
+END_TEST
+
+START_TEST(test_flights_lead)
+{
+    zseek_flights_t *flights = zseek_flights_new(NULL);
+    ck_assert_msg(flights != NULL, "failed to create table");
+
+    // Distinct frames are led independently
+    zseek_flight_t a, b;
+    ck_assert(zseek_flights_join(flights, 1, &a));
+    ck_assert(zseek_flights_join(flights, 2, &b));
+    zseek_flights_land(flights, &a);
+    zseek_flights_land(flights, &b);
+
+    // And anew once landed
+    ck_assert(zseek_flights_join(flights, 1, &a));
+    zseek_flights_land(flights, &a);
+
+    zseek_flights_free(flights);
+}
+END_TEST
+
+#define NB_THREADS 4
+
+typedef struct {
+    zseek_flights_t *flights;
+    int *decoded;       // set by the leader before landing
+    bool led;
+    int seen;
+} waiter_t;
+
+static void *join_thread(void *arg)
+{
+    waiter_t *w = arg;
+
+    zseek_flight_t flight;
+    w->led = zseek_flights_join(w->flights, 7, &flight);
+    if (w->led)
+        zseek_flights_land(w->flights, &flight);
+    else
+        __atomic_store_n(&w->seen, __atomic_load_n(w->decoded,
+            __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+START_TEST(test_flights_wait)
+{
+    zseek_flights_t *flights = zseek_flights_new(NULL);
+    ck_assert_msg(flights != NULL, "failed to create table");
+
+    int decoded = 0;
+    zseek_flight_t flight;
+    ck_assert(zseek_flights_join(flights, 7, &flight));
+
+    waiter_t waiters[NB_THREADS];
+    pthread_t threads[NB_THREADS];
+    for (int i = 0; i < NB_THREADS; i++) {
+        waiters[i] = (waiter_t){flights, &decoded, false, 0};
+        ck_assert_msg(!pthread_create(&threads[i], NULL, join_thread,
+            &waiters[i]), "failed to create thread %d", i);
+    }
+    // Let them queue up behind the flight
+    usleep(100000);
+    __atomic_store_n(&decoded, 1, __ATOMIC_RELEASE);
+    zseek_flights_land(flights, &flight);
+
+    for (int i = 0; i < NB_THREADS; i++) {
+        ck_assert(!pthread_join(threads[i], NULL));
+        // Either waited for the decode, or came too late and led another
+        ck_assert(waiters[i].led || waiters[i].seen == 1);
+    }
+
+    zseek_flights_free(flights);
+}
+END_TEST
+
+START_TEST(test_flights_rejoin)
+{
+    zseek_flights_t *flights = zseek_flights_new(NULL);
+    ck_assert_msg(flights != NULL, "failed to create table");
+
+    int decoded = 0;
+    zseek_flight_t flight;
+    ck_assert(zseek_flights_join(flights, 7, &flight));
+
+    waiter_t waiter = {flights, &decoded, false, 0};
+    pthread_t thread;
+    ck_assert_msg(!pthread_create(&thread, NULL, join_thread, &waiter),
+        "failed to create thread");
+    usleep(100000);
+    __atomic_store_n(&decoded, 1, __ATOMIC_RELEASE);
+
+    // Lead again from the same address, likely before the waiter wakes up,
+    // which must not wait for this flight too
+    zseek_flights_land(flights, &flight);
+    ck_assert(zseek_flights_join(flights, 7, &flight));
+    for (int i = 0; i < 100 && !__atomic_load_n(&waiter.seen,
+        __ATOMIC_ACQUIRE); i++)
+        usleep(10000);
+    ck_assert(waiter.seen == 1);
+    zseek_flights_land(flights, &flight);
+
+    ck_assert(!pthread_join(thread, NULL));
+    ck_assert(!waiter.led);
+
+    zseek_flights_free(flights);
+}
+END_TEST
+
+Suite *flight_suite(void)
+{
+    Suite *s = suite_create("flight");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_flights_new);
+    tcase_add_test(tc_core, test_flights_free_null);
+    tcase_add_test(tc_core, test_flights_lead);
+    tcase_add_test(tc_core, test_flights_wait);
+    tcase_add_test(tc_core, test_flights_rejoin);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = flight_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "../src/fpool.h"
+
+START_TEST(test_fpool_class_size)
+{
+    // Rounded up to the smallest class
+    ck_assert(zseek_frame_pool_class_size(0) == 4096);
+    ck_assert(zseek_frame_pool_class_size(1) == 4096);
+    ck_assert(zseek_frame_pool_class_size(4096) == 4096);
+    // Four classes per power of two
+    ck_assert(zseek_frame_pool_class_size(4097) == 5120);
+    ck_assert(zseek_frame_pool_class_size(8192) == 8192);
+    ck_assert(zseek_frame_pool_class_size(8193) == 10240);
+    ck_assert(zseek_frame_pool_class_size(1 << 20) == 1 << 20);
+    ck_assert(zseek_frame_pool_class_size((1 << 20) + 1) == 5 << 18);
+
+    // Never smaller, and wasting at most a quarter
+    for (size_t size = 1; size < (64 << 20); size = size * 3 + 1) {
+        size_t class_size = zseek_frame_pool_class_size(size);
+        ck_assert(class_size >= size);
+        ck_assert(size <= 4096 || class_size - size < size / 4);
+    }
+}
+END_TEST
+
+START_TEST(test_fpool_recycle)
+{
+    zseek_frame_pool_t *pool = zseek_frame_pool_new(NULL, NULL);
+    ck_assert_msg(pool != NULL, "failed to create pool");
+
+    bool hit;
+    void *buf = zseek_frame_pool_get(pool, 100000, &hit);
+    ck_assert(buf != NULL);
+    ck_assert(!hit);
+    memset(buf, 1, 100000);
+    zseek_frame_pool_put(pool, buf, 100000);
+    ck_assert(zseek_frame_pool_idle_size(pool) ==
+        zseek_frame_pool_class_size(100000));
+
+    // Same class
+    void *buf2 = zseek_frame_pool_get(pool, 99000, &hit);
+    ck_assert(hit);
+    ck_assert(buf2 == buf);
+    ck_assert(zseek_frame_pool_idle_size(pool) == 0);
+
+    // Other class
+    void *buf3 = zseek_frame_pool_get(pool, 200000, &hit);
+    ck_assert(buf3 != NULL);
+    ck_assert(!hit);
+
+    zseek_frame_pool_put(pool, buf2, 99000);
+    zseek_frame_pool_put(pool, buf3, 200000);
+    zseek_frame_pool_free(pool);
+}
+END_TEST
+
+START_TEST(test_fpool_max_size)
+{
+    zseek_frame_pool_param_t zfp = { .max_size = 3 * 4096 };
+    zseek_frame_pool_t *pool = zseek_frame_pool_new(&zfp, NULL);
+    ck_assert_msg(pool != NULL, "failed to create pool");
+
+    bool hit;
+    void *bufs[4];
+    for (int i = 0; i < 4; i++) {
+        bufs[i] = zseek_frame_pool_get(pool, 4096, &hit);
+        ck_assert(bufs[i] != NULL);
+    }
+    for (int i = 0; i < 4; i++)
+        zseek_frame_pool_put(pool, bufs[i], 4096);
+    // The last one was freed
+    ck_assert(zseek_frame_pool_idle_size(pool) == 3 * 4096);
+
+    // Larger than the limit altogether
+    void *buf = zseek_frame_pool_get(pool, 1 << 20, &hit);
+    ck_assert(buf != NULL);
+    zseek_frame_pool_put(pool, buf, 1 << 20);
+    ck_assert(zseek_frame_pool_idle_size(pool) == 3 * 4096);
+
+    zseek_frame_pool_free(pool);
+}
+END_TEST
+
+START_TEST(test_fpool_reserve)
+{
+    zseek_frame_pool_param_t zfp = { .prefault = true };
+    zseek_frame_pool_t *pool = zseek_frame_pool_new(&zfp, NULL);
+    ck_assert_msg(pool != NULL, "failed to create pool");
+
+    ck_assert(!zseek_frame_pool_reserve(NULL, 1 << 20, 2, NULL));
+    ck_assert(zseek_frame_pool_reserve(pool, 1 << 20, 2, NULL));
+    ck_assert(zseek_frame_pool_idle_size(pool) == 2 << 20);
+
+    bool hit;
+    void *bufs[3];
+    for (int i = 0; i < 3; i++) {
+        bufs[i] = zseek_frame_pool_get(pool, 1 << 20, &hit);
+        ck_assert(bufs[i] != NULL);
+        ck_assert(hit == (i < 2));
+    }
+    for (int i = 0; i < 3; i++)
+        zseek_frame_pool_put(pool, bufs[i], 1 << 20);
+
+    zseek_frame_pool_free(pool);
+}
+END_TEST
+
+Suite *fpool_suite(void)
+{
+    Suite *s = suite_create("fpool");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_fpool_class_size);
+    tcase_add_test(tc_core, test_fpool_recycle);
+    tcase_add_test(tc_core, test_fpool_max_size);
+    tcase_add_test(tc_core, test_fpool_reserve);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = fpool_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
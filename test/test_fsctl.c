@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <check.h>
+
+#include "../src/fsctl.h"
+
+#define MIN_SIZE (64 << 10)
+#define MAX_SIZE (16 << 20)
+#define MB (1000.0 * 1000)
+
+/**
+ * Feeds @p ctl with @p nb_frames frames, taking a fixed @p overhead_ns each,
+ * plus the time to process them at @p rate bytes/sec.
+ */
+static void run(zseek_fsctl_t *ctl, int nb_frames, uint64_t overhead_ns,
+    double rate, double ratio)
+{
+    for (int i = 0; i < nb_frames; i++) {
+        size_t size = zseek_fsctl_size(ctl);
+        ck_assert(size >= MIN_SIZE);
+        ck_assert(size <= MAX_SIZE);
+        uint64_t ns = overhead_ns + size / rate * 1000 * 1000 * 1000;
+        zseek_fsctl_update(ctl, size, size / ratio, ns, 0, 1);
+    }
+}
+
+START_TEST(test_fsctl_init)
+{
+    zseek_fsctl_t ctl;
+    ck_assert(!zseek_fsctl_init(NULL, MIN_SIZE, MAX_SIZE, 100 * MB));
+    ck_assert(!zseek_fsctl_init(&ctl, 0, MAX_SIZE, 100 * MB));
+    ck_assert(!zseek_fsctl_init(&ctl, MAX_SIZE, MIN_SIZE, 100 * MB));
+    ck_assert(!zseek_fsctl_init(&ctl, MIN_SIZE, MAX_SIZE, 0));
+    ck_assert(zseek_fsctl_init(&ctl, MIN_SIZE, MAX_SIZE, 100 * MB));
+    ck_assert(zseek_fsctl_size(&ctl) == MIN_SIZE);
+}
+END_TEST
+
+START_TEST(test_fsctl_grow)
+{
+    zseek_fsctl_t ctl;
+    ck_assert(zseek_fsctl_init(&ctl, MIN_SIZE, MAX_SIZE, 200 * MB));
+
+    // 1 msec per frame at 1 GB/s needs frames of at least 250 KB for 200 MB/s
+    run(&ctl, 100, 1000 * 1000, 1000 * MB, 3);
+    ck_assert(zseek_fsctl_size(&ctl) == 4 * MIN_SIZE);
+}
+END_TEST
+
+START_TEST(test_fsctl_max)
+{
+    zseek_fsctl_t ctl;
+    ck_assert(zseek_fsctl_init(&ctl, MIN_SIZE, MAX_SIZE, 900 * MB));
+
+    // Unreachable target, but growing keeps paying off
+    run(&ctl, 200, 100 * 1000 * 1000, 1000 * MB, 3);
+    ck_assert(zseek_fsctl_size(&ctl) == MAX_SIZE);
+}
+END_TEST
+
+START_TEST(test_fsctl_saturated)
+{
+    zseek_fsctl_t ctl;
+    ck_assert(zseek_fsctl_init(&ctl, MIN_SIZE, MAX_SIZE, 200 * MB));
+
+    // Without per-frame costs, larger frames do not help
+    run(&ctl, 100, 0, 100 * MB, 3);
+    ck_assert(zseek_fsctl_size(&ctl) == MIN_SIZE);
+}
+END_TEST
+
+START_TEST(test_fsctl_unsaturate)
+{
+    zseek_fsctl_t ctl;
+    ck_assert(zseek_fsctl_init(&ctl, MIN_SIZE, MAX_SIZE, 200 * MB));
+
+    run(&ctl, 20, 0, 100 * MB, 3);
+    ck_assert(ctl.saturated);
+
+    // Fast enough at the smallest size, then per-frame costs appear
+    run(&ctl, 8, 0, 1000 * MB, 3);
+    ck_assert(!ctl.saturated);
+    run(&ctl, 100, 1000 * 1000, 1000 * MB, 3);
+    ck_assert(zseek_fsctl_size(&ctl) == 4 * MIN_SIZE);
+
+    // Or appear while still short of the target, tried again after a while
+    ck_assert(zseek_fsctl_init(&ctl, MIN_SIZE, MAX_SIZE, 200 * MB));
+    run(&ctl, 20, 0, 100 * MB, 3);
+    ck_assert(ctl.saturated);
+    run(&ctl, 200, 1000 * 1000, 1000 * MB, 3);
+    ck_assert(zseek_fsctl_size(&ctl) == 4 * MIN_SIZE);
+}
+END_TEST
+
+START_TEST(test_fsctl_shrink)
+{
+    zseek_fsctl_t ctl;
+    ck_assert(zseek_fsctl_init(&ctl, MIN_SIZE, MAX_SIZE, 200 * MB));
+
+    run(&ctl, 200, 10 * 1000 * 1000, 1000 * MB, 3);
+    size_t size = zseek_fsctl_size(&ctl);
+    ck_assert(size > MIN_SIZE);
+
+    // Per-frame costs go away, so small frames are fast enough
+    run(&ctl, 200, 0, 1000 * MB, 3);
+    ck_assert(zseek_fsctl_size(&ctl) == MIN_SIZE);
+}
+END_TEST
+
+Suite *fsctl_suite(void)
+{
+    Suite *s = suite_create("fsctl");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_fsctl_init);
+    tcase_add_test(tc_core, test_fsctl_grow);
+    tcase_add_test(tc_core, test_fsctl_max);
+    tcase_add_test(tc_core, test_fsctl_saturated);
+    tcase_add_test(tc_core, test_fsctl_unsaturate);
+    tcase_add_test(tc_core, test_fsctl_shrink);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = fsctl_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <check.h>
+
+#include "../src/plan.h"
+
+START_TEST(test_plan_adjacent)
+{
+    zseek_plan_t plan;
+    zseek_plan_init(&plan, 1000, 1);
+
+    ck_assert(zseek_plan_add(&plan, 100, 300));
+    ck_assert(zseek_plan_add(&plan, 400, 200));
+    ck_assert(zseek_plan_add(&plan, 600, 500));
+    ck_assert(plan.nb_frames == 3);
+    ck_assert(zseek_plan_offset(&plan) == 100);
+    ck_assert(zseek_plan_size(&plan) == 1000);
+    ck_assert(zseek_plan_needed(&plan) == 1000);
+
+    // Too large
+    ck_assert(!zseek_plan_add(&plan, 1100, 1));
+    ck_assert(plan.nb_frames == 3);
+}
+END_TEST
+
+START_TEST(test_plan_gap)
+{
+    zseek_plan_t plan;
+    zseek_plan_init(&plan, 1 << 20, 1);
+
+    ck_assert(zseek_plan_add(&plan, 0, 100));
+    ck_assert(!zseek_plan_add(&plan, 101, 100));
+    // Out of order
+    ck_assert(!zseek_plan_add(&plan, 50, 10));
+    ck_assert(plan.nb_frames == 1);
+    ck_assert(zseek_plan_size(&plan) == 100);
+}
+END_TEST
+
+START_TEST(test_plan_large_frame)
+{
+    zseek_plan_t plan;
+    zseek_plan_init(&plan, 1000, 1);
+
+    // The first frame is read alone, whatever its size
+    ck_assert(zseek_plan_add(&plan, 0, 5000));
+    ck_assert(!zseek_plan_add(&plan, 5000, 1));
+    ck_assert(zseek_plan_size(&plan) == 5000);
+
+    zseek_plan_init(&plan, 1000, 1);
+    ck_assert(zseek_plan_add(&plan, 5000, 10));
+    ck_assert(!zseek_plan_add(&plan, 5010, 5000));
+    ck_assert(plan.nb_frames == 1);
+}
+END_TEST
+
+START_TEST(test_plan_aligned)
+{
+    zseek_plan_t plan;
+    zseek_plan_init(&plan, 16384, 4096);
+
+    ck_assert(zseek_plan_add(&plan, 5000, 3000));
+    ck_assert(zseek_plan_offset(&plan) == 4096);
+    ck_assert(zseek_plan_size(&plan) == 4096);
+    ck_assert(zseek_plan_needed(&plan) == 8000 - 4096);
+
+    // A gap within the last aligned block is read along
+    ck_assert(zseek_plan_add(&plan, 8100, 100));
+    ck_assert(zseek_plan_add(&plan, 9000, 3000));
+    ck_assert(zseek_plan_size(&plan) == 8192);
+    ck_assert(zseek_plan_needed(&plan) == 12000 - 4096);
+
+    // Not past it
+    ck_assert(!zseek_plan_add(&plan, 16384, 100));
+
+    // Aligned size is bounded
+    ck_assert(zseek_plan_add(&plan, 12000, 8000));
+    ck_assert(zseek_plan_size(&plan) == 16384);
+    ck_assert(!zseek_plan_add(&plan, 20000, 1000));
+    ck_assert(plan.nb_frames == 4);
+}
+END_TEST
+
+Suite *plan_suite(void)
+{
+    Suite *s = suite_create("plan");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_plan_adjacent);
+    tcase_add_test(tc_core, test_plan_gap);
+    tcase_add_test(tc_core, test_plan_large_frame);
+    tcase_add_test(tc_core, test_plan_aligned);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = plan_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
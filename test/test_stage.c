@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "../src/stage.h"
+
+#define MAX_WRITES 64
+
+/**
+ * Sink recording the writes it gets
+ */
+typedef struct {
+    uint8_t data[1 << 16];
+    size_t size;
+    size_t lens[MAX_WRITES];
+    const void *ptrs[MAX_WRITES];
+    size_t nb_writes;
+    bool fail;
+} sink_t;
+
+static bool sink_write(const void *data, size_t size, void *user_data,
+    void *call_data)
+{
+    (void)call_data;
+
+    sink_t *sink = user_data;
+    if (sink->fail || sink->nb_writes == MAX_WRITES ||
+        sink->size + size > sizeof(sink->data))
+        return false;
+    memcpy(sink->data + sink->size, data, size);
+    sink->size += size;
+    sink->lens[sink->nb_writes] = size;
+    sink->ptrs[sink->nb_writes] = data;
+    sink->nb_writes++;
+    return true;
+}
+
+static uint8_t pattern[1 << 15];
+
+static void init_pattern(void)
+{
+    for (size_t i = 0; i < sizeof(pattern); i++)
+        pattern[i] = (uint8_t)(i * 7 + i / 251);
+}
+
+START_TEST(test_stage_new_invalid)
+{
+    ck_assert(zseek_stage_new(0, 4096, false, NULL) == NULL);
+    ck_assert(zseek_stage_new(4096, 0, false, NULL) == NULL);
+    ck_assert(zseek_stage_new(4096, 3000, false, NULL) == NULL);
+}
+END_TEST
+
+START_TEST(test_stage_size)
+{
+    zseek_stage_t *stage = zseek_stage_new(5000, 4096, false, NULL);
+    ck_assert_msg(stage != NULL, "failed to create stage");
+    ck_assert(zseek_stage_size(stage) == 8192);
+    ck_assert(zseek_stage_pending(stage) == 0);
+    zseek_stage_free(stage);
+
+    stage = zseek_stage_new(100, 1, false, NULL);
+    ck_assert_msg(stage != NULL, "failed to create stage");
+    ck_assert(zseek_stage_size(stage) == 100);
+    zseek_stage_free(stage);
+}
+END_TEST
+
+START_TEST(test_stage_coalesce)
+{
+    static sink_t sink;
+    memset(&sink, 0, sizeof(sink));
+    zseek_write_file_t file = {&sink, sink_write, NULL};
+    init_pattern();
+
+    zseek_stage_t *stage = zseek_stage_new(4096, 4096, false, NULL);
+    ck_assert_msg(stage != NULL, "failed to create stage");
+
+    // Small writes, then one spanning several chunks
+    size_t off = 0;
+    for (size_t len = 1; len < 200; len += 13) {
+        ck_assert(zseek_stage_write(stage, pattern + off, len, &file, NULL));
+        off += len;
+    }
+    ck_assert(zseek_stage_write(stage, pattern + off, 20000, &file, NULL));
+    off += 20000;
+    ck_assert(zseek_stage_flush(stage, &file, NULL));
+    ck_assert(zseek_stage_pending(stage) == 0);
+    // Nothing left to flush
+    ck_assert(zseek_stage_flush(stage, &file, NULL));
+
+    ck_assert(sink.size == off);
+    ck_assert(memcmp(sink.data, pattern, off) == 0);
+    for (size_t i = 0; i < sink.nb_writes; i++) {
+        ck_assert(((uintptr_t)sink.ptrs[i] & 4095) == 0);
+        // Whole chunks, but for the last one
+        ck_assert(sink.lens[i] == 4096 || i == sink.nb_writes - 1);
+    }
+    ck_assert(sink.nb_writes == (off + 4095) / 4096);
+
+    zseek_stage_free(stage);
+}
+END_TEST
+
+START_TEST(test_stage_write_failed)
+{
+    static sink_t sink;
+    memset(&sink, 0, sizeof(sink));
+    zseek_write_file_t file = {&sink, sink_write, NULL};
+    init_pattern();
+
+    zseek_stage_t *stage = zseek_stage_new(4096, 4096, false, NULL);
+    ck_assert_msg(stage != NULL, "failed to create stage");
+
+    ck_assert(zseek_stage_write(stage, pattern, 100, &file, NULL));
+    sink.fail = true;
+    ck_assert(!zseek_stage_flush(stage, &file, NULL));
+    ck_assert(zseek_stage_pending(stage) == 100);
+    ck_assert(!zseek_stage_write(stage, pattern, 5000, &file, NULL));
+
+    // The failed chunk is kept
+    sink.fail = false;
+    ck_assert(zseek_stage_flush(stage, &file, NULL));
+    ck_assert(sink.size == 4096);
+    ck_assert(memcmp(sink.data, pattern, 100) == 0);
+
+    zseek_stage_free(stage);
+}
+END_TEST
+
+START_TEST(test_stage_pad)
+{
+    static sink_t sink;
+    memset(&sink, 0, sizeof(sink));
+    zseek_write_file_t file = {&sink, sink_write, NULL};
+    init_pattern();
+
+    zseek_stage_t *stage = zseek_stage_new(8192, 4096, true, NULL);
+    ck_assert_msg(stage != NULL, "failed to create stage");
+
+    // Padded with zeros, the partial block kept
+    ck_assert(zseek_stage_write(stage, pattern, 100, &file, NULL));
+    ck_assert(zseek_stage_flush(stage, &file, NULL));
+    ck_assert(sink.nb_writes == 1 && sink.lens[0] == 100);
+    const uint8_t *padded = sink.ptrs[0];
+    for (size_t i = 100; i < 4096; i++)
+        ck_assert(padded[i] == 0);
+    ck_assert(zseek_stage_pending(stage) == 0);
+    // Nothing new to flush
+    ck_assert(zseek_stage_flush(stage, &file, NULL));
+    ck_assert(sink.nb_writes == 1);
+
+    // Written again with what follows, whole blocks dropped once written
+    ck_assert(zseek_stage_write(stage, pattern + 100, 5000, &file, NULL));
+    ck_assert(zseek_stage_pending(stage) == 5000);
+    ck_assert(zseek_stage_flush(stage, &file, NULL));
+    ck_assert(sink.nb_writes == 2 && sink.lens[1] == 5100);
+    ck_assert(memcmp(sink.data + 100, pattern, 5100) == 0);
+    ck_assert(zseek_stage_write(stage, pattern + 5100, 10000, &file, NULL));
+    ck_assert(zseek_stage_flush(stage, &file, NULL));
+    ck_assert(sink.nb_writes == 4);
+    ck_assert(sink.lens[2] == 8192 && sink.lens[3] == 15100 - 4096 - 8192);
+    ck_assert(memcmp(sink.data + 5200, pattern + 4096, 11004) == 0);
+    for (size_t i = 0; i < sink.nb_writes; i++)
+        ck_assert(((uintptr_t)sink.ptrs[i] & 4095) == 0);
+
+    zseek_stage_free(stage);
+}
+END_TEST
+
+Suite *stage_suite(void)
+{
+    Suite *s = suite_create("stage");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_stage_new_invalid);
+    tcase_add_test(tc_core, test_stage_size);
+    tcase_add_test(tc_core, test_stage_coalesce);
+    tcase_add_test(tc_core, test_stage_write_failed);
+    tcase_add_test(tc_core, test_stage_pad);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = stage_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,1418 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <check.h>
+
+#include "../src/zseek.h"
+
+#define DATA_SIZE (4 << 20)
+#define FRAME_SIZE (64 << 10)
+#define NB_THREADS 8
+#define NB_READS 5000
+#define MAX_READ (16 << 10)
+
+static uint8_t *data;
+
+/**
+ * Fills @p data with compressible bytes, words of a small vocabulary in an
+ * order that does not repeat
+ */
+static void init_data(void)
+{
+    if (data)
+        return;
+
+    static const char *const words[] = {
+        "seek ", "frame ", "table ", "zstd ", "lz4 ", "cache ", "read ",
+        "write ", "offset ", "block ", "\n",
+    };
+    data = malloc(DATA_SIZE);
+    ck_assert_msg(data, "failed to allocate data");
+    unsigned seed = 42;
+    for (size_t i = 0; i < DATA_SIZE; ) {
+        const char *w = words[rand_r(&seed) % (sizeof(words) /
+            sizeof(words[0]))];
+        for (; *w && i < DATA_SIZE; w++)
+            data[i++] = (uint8_t)*w;
+    }
+}
+
+/**
+ * Opens a new, unlinked temporary file in the current directory, or returns
+ * -1
+ */
+static int temp_file(void)
+{
+    char path[] = "test_zseek.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+        return -1;
+    unlink(path);
+    return fd;
+}
+
+static bool fd_write(const void *buf, size_t size, void *user_data,
+    void *call_data)
+{
+    (void)call_data;
+
+    int fd = (int)(intptr_t)user_data;
+    for (size_t done = 0; done < size; ) {
+        ssize_t n = write(fd, (const uint8_t*)buf + done, size - done);
+        if (n < 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+static ssize_t fd_pread(void *buf, size_t size, size_t offset,
+    void *user_data, void *call_data)
+{
+    (void)call_data;
+
+    return pread((int)(intptr_t)user_data, buf, size, offset);
+}
+
+static ssize_t fd_fsize(void *user_data, void *call_data)
+{
+    (void)call_data;
+
+    struct stat st;
+    if (fstat((int)(intptr_t)user_data, &st))
+        return -1;
+    return st.st_size;
+}
+
+/**
+ * Returns callbacks writing to @p fd
+ */
+static zseek_write_file_t write_file(int fd)
+{
+    return (zseek_write_file_t){
+        .user_data = (void*)(intptr_t)fd,
+        .write = fd_write,
+    };
+}
+
+/**
+ * Opens a reader of @p fd through callbacks, caching up to @p cache_size
+ * frames
+ */
+static zseek_reader_t *open_reader(int fd, size_t cache_size)
+{
+    zseek_read_file_t file = {
+        .user_data = (void*)(intptr_t)fd,
+        .pread = fd_pread,
+        .fsize = fd_fsize,
+    };
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    zseek_reader_t *reader = zseek_reader_open_full(file, cache_size, NULL,
+        errbuf);
+    ck_assert_msg(reader, "zseek_reader_open_full: %s", errbuf);
+    return reader;
+}
+
+/**
+ * Compresses the first @p size bytes of the data to a new temporary file, in
+ * writes of @p chunk bytes, returning its descriptor, rewound
+ */
+static int compress_data(zseek_compression_param_t *zsp,
+    zseek_writer_param_t *zwp, size_t size, size_t chunk)
+{
+    int fd = temp_file();
+    ck_assert_msg(fd != -1, "failed to create file");
+
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    zseek_writer_t *writer = zseek_writer_open_ext(write_file(fd), zsp, zwp,
+        NULL, errbuf);
+    ck_assert_msg(writer, "zseek_writer_open_ext: %s", errbuf);
+    for (size_t done = 0; done < size; done += chunk) {
+        size_t len = size - done < chunk ? size - done : chunk;
+        ck_assert_msg(zseek_write(writer, data + done, len, NULL, errbuf),
+            "zseek_write: %s", errbuf);
+    }
+    ck_assert_msg(zseek_writer_close(writer, NULL, errbuf),
+        "zseek_writer_close: %s", errbuf);
+    ck_assert(lseek(fd, 0, SEEK_SET) == 0);
+
+    return fd;
+}
+
+/**
+ * Reads up to @p count bytes at @p offset of @p reader, over as many calls as
+ * it takes, returning the number of bytes read or -1 on error
+ */
+static ssize_t read_range(zseek_reader_t *reader, void *buf, size_t count,
+    size_t offset, char errbuf[ZSEEK_ERRBUF_SIZE])
+{
+    size_t done = 0;
+    while (done < count) {
+        ssize_t n = zseek_pread(reader, (uint8_t*)buf + done, count - done,
+            offset + done, NULL, errbuf);
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+/**
+ * Checks that @p reader holds the first @p size bytes of the data, read in
+ * chunks of @p chunk bytes
+ */
+static void check_data(zseek_reader_t *reader, size_t size, size_t chunk)
+{
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    uint8_t *buf = malloc(chunk);
+    ck_assert_msg(buf, "failed to allocate buffer");
+    for (size_t done = 0; done < size; done += chunk) {
+        size_t len = size - done < chunk ? size - done : chunk;
+        ssize_t n = read_range(reader, buf, chunk, done, errbuf);
+        ck_assert_msg(n == (ssize_t)len, "zseek_pread at %zu: %zd, %s", done,
+            n, errbuf);
+        ck_assert_msg(!memcmp(buf, data + done, len), "bad data at %zu",
+            done);
+    }
+    ck_assert(zseek_pread(reader, buf, chunk, size, NULL, errbuf) == 0);
+    free(buf);
+}
+
+START_TEST(test_zseek_frame_parallel)
+{
+    init_data();
+    zseek_compression_param_t zsp = {
+        .type = ZSEEK_ZSTD,
+        .params.zstd_params = { .nb_workers = 4, .frame_parallel = true },
+    };
+    zseek_writer_param_t zwp = { .min_frame_size = FRAME_SIZE };
+    // Writes smaller and larger than frames
+    int fd = compress_data(&zsp, &zwp, DATA_SIZE, 10000);
+    int fd2 = compress_data(&zsp, &zwp, DATA_SIZE, 3 * FRAME_SIZE + 1);
+
+    for (int i = 0; i < 2; i++) {
+        zseek_reader_t *reader = open_reader(i ? fd2 : fd, 4);
+        zseek_reader_stats_t stats;
+        ck_assert(zseek_reader_stats(reader, &stats, NULL));
+        ck_assert(stats.decompressed_size == DATA_SIZE);
+        ck_assert_msg(stats.frames >= DATA_SIZE / (4 * FRAME_SIZE) &&
+            stats.frames <= DATA_SIZE / FRAME_SIZE, "%zu frames",
+            stats.frames);
+        check_data(reader, DATA_SIZE, MAX_READ);
+        ck_assert(zseek_reader_close(reader, NULL, NULL));
+    }
+    close(fd);
+    close(fd2);
+}
+END_TEST
+
+START_TEST(test_zseek_write_async)
+{
+    init_data();
+    static const zseek_backpressure_t policies[] = {
+        ZSEEK_BACKPRESSURE_BLOCK, ZSEEK_BACKPRESSURE_FAIL,
+        ZSEEK_BACKPRESSURE_GROW,
+    };
+    for (size_t p = 0; p < 4; p++) {
+        zseek_compression_param_t zsp = { .type = ZSEEK_ZSTD };
+        zsp.params.zstd_params.nb_workers = 2;
+        if (p == 3) {
+            zsp.type = ZSEEK_LZ4;
+            zsp.params.lz4_params.nb_workers = 2;
+        }
+        zseek_writer_param_t zwp = {
+            .min_frame_size = FRAME_SIZE,
+            .async = true,
+            .max_queued_size = 2 * FRAME_SIZE,
+            .backpressure = policies[p % 3],
+        };
+        int fd = temp_file();
+        ck_assert_msg(fd != -1, "failed to create file");
+        char errbuf[ZSEEK_ERRBUF_SIZE];
+        zseek_writer_t *writer = zseek_writer_open_ext(write_file(fd), &zsp,
+            &zwp, NULL, errbuf);
+        ck_assert_msg(writer, "zseek_writer_open_ext: %s", errbuf);
+
+        off_t flushed = 0;
+        for (size_t done = 0; done < DATA_SIZE; done += 50000) {
+            size_t len = DATA_SIZE - done < 50000 ? DATA_SIZE - done : 50000;
+            if (!zseek_write(writer, data + done, len, NULL, errbuf)) {
+                // None of the data was taken, so it goes again once drained
+                ck_assert_msg(zwp.backpressure == ZSEEK_BACKPRESSURE_FAIL,
+                    "zseek_write: %s", errbuf);
+                ck_assert_msg(zseek_writer_flush(writer, NULL, errbuf),
+                    "zseek_writer_flush: %s", errbuf);
+                ck_assert_msg(zseek_write(writer, data + done, len, NULL,
+                    errbuf), "zseek_write: %s", errbuf);
+            }
+            if ((done / 50000) % 20 != 19)
+                continue;
+
+            // Everything written so far reached the file
+            ck_assert_msg(zseek_writer_flush(writer, NULL, errbuf),
+                "zseek_writer_flush: %s", errbuf);
+            struct stat st;
+            ck_assert(!fstat(fd, &st));
+            ck_assert(st.st_size > flushed);
+            flushed = st.st_size;
+        }
+        ck_assert_msg(zseek_writer_close(writer, NULL, errbuf),
+            "zseek_writer_close: %s", errbuf);
+
+        zseek_reader_t *reader = open_reader(fd, 4);
+        check_data(reader, DATA_SIZE, MAX_READ);
+        ck_assert(zseek_reader_close(reader, NULL, NULL));
+        close(fd);
+    }
+}
+END_TEST
+
+/**
+ * File whose writes wait until it is opened
+ */
+typedef struct {
+    int fd;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool open;
+} gate_t;
+
+static bool gate_write(const void *buf, size_t size, void *user_data,
+    void *call_data)
+{
+    gate_t *gate = user_data;
+    pthread_mutex_lock(&gate->lock);
+    while (!gate->open)
+        pthread_cond_wait(&gate->cond, &gate->lock);
+    pthread_mutex_unlock(&gate->lock);
+
+    return fd_write(buf, size, (void*)(intptr_t)gate->fd, call_data);
+}
+
+START_TEST(test_zseek_write_queue_full)
+{
+    init_data();
+    gate_t gate = {
+        .fd = temp_file(),
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+    };
+    ck_assert_msg(gate.fd != -1, "failed to create file");
+    zseek_write_file_t file = { .user_data = &gate, .write = gate_write };
+    zseek_compression_param_t zsp = { .type = ZSEEK_ZSTD };
+    zsp.params.zstd_params.nb_workers = 2;
+    zseek_writer_param_t zwp = {
+        .min_frame_size = FRAME_SIZE,
+        .async = true,
+        .max_queued_size = 2 * FRAME_SIZE,
+        .backpressure = ZSEEK_BACKPRESSURE_FAIL,
+    };
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    zseek_writer_t *writer = zseek_writer_open_ext(file, &zsp, &zwp, NULL,
+        errbuf);
+    ck_assert_msg(writer, "zseek_writer_open_ext: %s", errbuf);
+
+    // A frame stuck in flight, then more than the rest of the budget
+    ck_assert_msg(zseek_write(writer, data, FRAME_SIZE, NULL, errbuf),
+        "zseek_write: %s", errbuf);
+    ck_assert(!zseek_write(writer, data + FRAME_SIZE, 2 * FRAME_SIZE, NULL,
+        errbuf));
+    ck_assert_msg(!strcmp(errbuf, "write queue full"), "zseek_write: %s",
+        errbuf);
+
+    // Taken whole once drained
+    pthread_mutex_lock(&gate.lock);
+    gate.open = true;
+    pthread_cond_broadcast(&gate.cond);
+    pthread_mutex_unlock(&gate.lock);
+    ck_assert_msg(zseek_writer_flush(writer, NULL, errbuf),
+        "zseek_writer_flush: %s", errbuf);
+    ck_assert_msg(zseek_write(writer, data + FRAME_SIZE, 2 * FRAME_SIZE, NULL,
+        errbuf), "zseek_write: %s", errbuf);
+    ck_assert_msg(zseek_writer_close(writer, NULL, errbuf),
+        "zseek_writer_close: %s", errbuf);
+
+    zseek_reader_t *reader = open_reader(gate.fd, 4);
+    check_data(reader, 3 * FRAME_SIZE, MAX_READ);
+    ck_assert(zseek_reader_close(reader, NULL, NULL));
+    close(gate.fd);
+}
+END_TEST
+
+START_TEST(test_zseek_writev)
+{
+    init_data();
+    for (int t = 0; t < 3; t++) {
+        zseek_compression_param_t zsp = { .type = t == 1 ? ZSEEK_LZ4 :
+            ZSEEK_ZSTD };
+        if (t == 2) {
+            zsp.params.zstd_params.nb_workers = 2;
+            zsp.params.zstd_params.frame_parallel = true;
+        }
+        int fd = temp_file();
+        ck_assert_msg(fd != -1, "failed to create file");
+        char errbuf[ZSEEK_ERRBUF_SIZE];
+        zseek_writer_param_t zwp = { .min_frame_size = FRAME_SIZE };
+        zseek_writer_t *writer = zseek_writer_open_ext(write_file(fd), &zsp,
+            &zwp, NULL, errbuf);
+        ck_assert_msg(writer, "zseek_writer_open_ext: %s", errbuf);
+        ck_assert(zseek_writev(writer, NULL, 0, NULL, errbuf));
+
+        // Writes of a frame each, in segments of all sizes, empty ones too
+        size_t nb_writes = 0;
+        for (size_t done = 0; done < DATA_SIZE; nb_writes++) {
+            size_t lens[] = {1, 0, 1000, 2 * FRAME_SIZE - 1001, 0};
+            struct iovec iov[5];
+            for (int i = 0; i < 5; i++) {
+                size_t len = DATA_SIZE - done < lens[i] ? DATA_SIZE - done :
+                    lens[i];
+                iov[i] = (struct iovec){ data + done, len };
+                done += len;
+            }
+            ck_assert_msg(zseek_writev(writer, iov, 5, NULL, errbuf),
+                "zseek_writev: %s", errbuf);
+        }
+        ck_assert_msg(zseek_writer_close(writer, NULL, errbuf),
+            "zseek_writer_close: %s", errbuf);
+
+        zseek_reader_t *reader = open_reader(fd, 4);
+        zseek_reader_stats_t stats;
+        ck_assert(zseek_reader_stats(reader, &stats, NULL));
+        ck_assert_msg(stats.frames == nb_writes, "%zu frames of %zu writes",
+            stats.frames, nb_writes);
+        check_data(reader, DATA_SIZE, MAX_READ);
+        ck_assert(zseek_reader_close(reader, NULL, NULL));
+        close(fd);
+    }
+}
+END_TEST
+
+/**
+ * Checks that the files of @p fd1 and @p fd2 hold the same bytes
+ */
+static bool same_files(int fd1, int fd2)
+{
+    struct stat st1, st2;
+    ck_assert(!fstat(fd1, &st1) && !fstat(fd2, &st2));
+    if (st1.st_size != st2.st_size)
+        return false;
+
+    uint8_t *buf1 = malloc(st1.st_size), *buf2 = malloc(st2.st_size);
+    ck_assert_msg(buf1 && buf2, "failed to allocate buffers");
+    ck_assert(pread(fd1, buf1, st1.st_size, 0) == st1.st_size);
+    ck_assert(pread(fd2, buf2, st2.st_size, 0) == st2.st_size);
+    bool same = !memcmp(buf1, buf2, st1.st_size);
+    free(buf1);
+    free(buf2);
+
+    return same;
+}
+
+START_TEST(test_zseek_write_cdc)
+{
+    init_data();
+    for (int t = 0; t < 2; t++) {
+        zseek_compression_param_t zsp = { .type = t ? ZSEEK_LZ4 :
+            ZSEEK_ZSTD };
+        zseek_writer_param_t zwp = {
+            .min_frame_size = FRAME_SIZE / 4,
+            .content_defined = true,
+            .avg_frame_size = FRAME_SIZE / 2,
+        };
+        // Frame boundaries do not depend on how data is split across writes
+        int fd = compress_data(&zsp, &zwp, DATA_SIZE, 1000);
+        int fd2 = compress_data(&zsp, &zwp, DATA_SIZE, 3 * FRAME_SIZE + 7);
+        ck_assert(same_files(fd, fd2));
+
+        zseek_reader_t *reader = open_reader(fd, 4);
+        zseek_reader_stats_t stats;
+        ck_assert(zseek_reader_stats(reader, &stats, NULL));
+        // Between the minimum and default maximum sizes, near the average
+        ck_assert_msg(stats.frames > DATA_SIZE / (4 * FRAME_SIZE) &&
+            stats.frames < DATA_SIZE / (FRAME_SIZE / 4), "%zu frames",
+            stats.frames);
+        check_data(reader, DATA_SIZE, MAX_READ);
+        ck_assert(zseek_reader_close(reader, NULL, NULL));
+        close(fd);
+        close(fd2);
+    }
+}
+END_TEST
+
+#define CDC_SIZE (256 << 10)
+#define MAX_CUTS (CDC_SIZE / (FRAME_SIZE / 16))
+
+START_TEST(test_zseek_write_cdc_splits)
+{
+    init_data();
+    zseek_writer_param_t zwp = {
+        .min_frame_size = FRAME_SIZE / 16,
+        .content_defined = true,
+        .avg_frame_size = FRAME_SIZE / 8,
+    };
+
+    // Frame boundaries, as seen a byte at a time
+    int fd = temp_file();
+    ck_assert_msg(fd != -1, "failed to create file");
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    zseek_writer_t *writer = zseek_writer_open_ext(write_file(fd), NULL, &zwp,
+        NULL, errbuf);
+    ck_assert_msg(writer, "zseek_writer_open_ext: %s", errbuf);
+    size_t cuts[MAX_CUTS + 1];
+    size_t nb_cuts = 0;
+    for (size_t i = 0; i < CDC_SIZE; i++) {
+        ck_assert_msg(zseek_write(writer, data + i, 1, NULL, errbuf),
+            "zseek_write: %s", errbuf);
+        zseek_writer_stats_t stats;
+        ck_assert(zseek_writer_stats(writer, &stats, NULL));
+        ck_assert(stats.frames <= MAX_CUTS);
+        if (stats.frames > nb_cuts)
+            cuts[nb_cuts++] = i + 1;
+    }
+    ck_assert_msg(zseek_writer_close(writer, NULL, errbuf),
+        "zseek_writer_close: %s", errbuf);
+    ck_assert_msg(nb_cuts > 4, "%zu frames", nb_cuts);
+    cuts[nb_cuts] = CDC_SIZE;
+
+    // Vectors split just before, at and just after each boundary, with empty
+    // segments in between, in a single call and in a call per boundary
+    for (int t = 0; t < 6; t++) {
+        int shift = t % 3 - 1;
+        int fd2 = temp_file();
+        ck_assert_msg(fd2 != -1, "failed to create file");
+        writer = zseek_writer_open_ext(write_file(fd2), NULL, &zwp, NULL,
+            errbuf);
+        ck_assert_msg(writer, "zseek_writer_open_ext: %s", errbuf);
+        struct iovec iov[2 * (MAX_CUTS + 1)];
+        int iovcnt = 0;
+        for (size_t i = 0, start = 0; i <= nb_cuts; i++) {
+            size_t end = i < nb_cuts ? cuts[i] + shift : CDC_SIZE;
+            iov[iovcnt++] = (struct iovec){ data + start, end - start };
+            iov[iovcnt++] = (struct iovec){ data + end, 0 };
+            start = end;
+            if (t < 3 && i < nb_cuts)
+                continue;
+            ck_assert_msg(zseek_writev(writer, iov, iovcnt, NULL, errbuf),
+                "zseek_writev: %s", errbuf);
+            iovcnt = 0;
+        }
+        ck_assert_msg(zseek_writer_close(writer, NULL, errbuf),
+            "zseek_writer_close: %s", errbuf);
+        ck_assert_msg(same_files(fd, fd2), "different files, split %d",
+            shift);
+        close(fd2);
+    }
+    close(fd);
+}
+END_TEST
+
+START_TEST(test_zseek_write_adaptive)
+{
+    init_data();
+    size_t min_frame_size = FRAME_SIZE / 4;
+    size_t max_frame_size = 4 * FRAME_SIZE;
+    // Met at any size, then out of reach
+    size_t targets[] = {1, SIZE_MAX / 2};
+    for (int t = 0; t < 2; t++) {
+        zseek_writer_param_t zwp = {
+            .min_frame_size = min_frame_size,
+            .max_frame_size = max_frame_size,
+            .adaptive = true,
+            .target_throughput = targets[t],
+        };
+        int fd = temp_file();
+        ck_assert_msg(fd != -1, "failed to create file");
+        char errbuf[ZSEEK_ERRBUF_SIZE];
+        zseek_writer_t *writer = zseek_writer_open_ext(write_file(fd), NULL,
+            &zwp, NULL, errbuf);
+        ck_assert_msg(writer, "zseek_writer_open_ext: %s", errbuf);
+        for (size_t done = 0; done < DATA_SIZE; done += 4096) {
+            ck_assert_msg(zseek_write(writer, data + done, 4096, NULL,
+                errbuf), "zseek_write: %s", errbuf);
+            zseek_writer_stats_t stats;
+            ck_assert(zseek_writer_stats(writer, &stats, NULL));
+            ck_assert_msg(stats.frame_size >= min_frame_size &&
+                stats.frame_size <= max_frame_size, "frame size %zu",
+                stats.frame_size);
+            if (t == 0)
+                ck_assert(stats.frame_size == min_frame_size);
+        }
+        ck_assert_msg(zseek_writer_close(writer, NULL, errbuf),
+            "zseek_writer_close: %s", errbuf);
+
+        zseek_reader_t *reader = open_reader(fd, 4);
+        zseek_reader_stats_t stats;
+        ck_assert(zseek_reader_stats(reader, &stats, NULL));
+        if (t == 0)
+            ck_assert(stats.frames == DATA_SIZE / min_frame_size);
+        else
+            ck_assert_msg(stats.frames < DATA_SIZE / min_frame_size,
+                "%zu frames", stats.frames);
+        check_data(reader, DATA_SIZE, MAX_READ);
+        ck_assert(zseek_reader_close(reader, NULL, NULL));
+        close(fd);
+    }
+}
+END_TEST
+
+START_TEST(test_zseek_write_adaptive_level)
+{
+    init_data();
+    for (int t = 0; t < 4; t++) {
+        zseek_compression_param_t zsp = { .type = t % 2 ? ZSEEK_LZ4 :
+            ZSEEK_ZSTD };
+        if (zsp.type == ZSEEK_ZSTD)
+            zsp.params.zstd_params.compression_level = 9;
+        else
+            zsp.params.lz4_params.compression_level = 9;
+        // Out of reach, then met at any level
+        zseek_writer_param_t zwp = {
+            .min_frame_size = FRAME_SIZE,
+            .adaptive_level = true,
+            .target_latency_us = t < 2 ? 1 : SIZE_MAX / 1000,
+            .level_range = 4,
+        };
+        int fd = temp_file();
+        ck_assert_msg(fd != -1, "failed to create file");
+        char errbuf[ZSEEK_ERRBUF_SIZE];
+        zseek_writer_t *writer = zseek_writer_open_ext(write_file(fd), &zsp,
+            &zwp, NULL, errbuf);
+        ck_assert_msg(writer, "zseek_writer_open_ext: %s", errbuf);
+        for (size_t done = 0; done < DATA_SIZE; done += 4096) {
+            ck_assert_msg(zseek_write(writer, data + done, 4096, NULL,
+                errbuf), "zseek_write: %s", errbuf);
+        }
+        ck_assert_msg(zseek_writer_flush(writer, NULL, errbuf),
+            "zseek_writer_flush: %s", errbuf);
+
+        zseek_writer_stats_t stats;
+        ck_assert(zseek_writer_stats(writer, &stats, NULL));
+        ck_assert(stats.frames == DATA_SIZE / FRAME_SIZE);
+        int lowest = 9;
+        for (size_t i = 0; i < stats.frames; i++) {
+            int level;
+            ck_assert_msg(zseek_writer_frame_level(writer, i, &level,
+                errbuf), "zseek_writer_frame_level: %s", errbuf);
+            ck_assert_msg(level >= 5 && level <= 9, "level %d", level);
+            lowest = level < lowest ? level : lowest;
+        }
+        int level;
+        ck_assert(!zseek_writer_frame_level(writer, stats.frames, &level,
+            NULL));
+        if (t < 2)
+            ck_assert_msg(lowest < 9, "level %d", lowest);
+        else
+            ck_assert_msg(lowest == 9, "level %d", lowest);
+        ck_assert_msg(zseek_writer_close(writer, NULL, errbuf),
+            "zseek_writer_close: %s", errbuf);
+
+        zseek_reader_t *reader = open_reader(fd, 4);
+        check_data(reader, DATA_SIZE, MAX_READ);
+        ck_assert(zseek_reader_close(reader, NULL, NULL));
+        close(fd);
+    }
+}
+END_TEST
+
+START_TEST(test_zseek_dict)
+{
+    init_data();
+    off_t sizes[6] = {0};
+    for (int t = 0; t < 6; t++) {
+        zseek_compression_param_t zsp = { .type = t % 2 ? ZSEEK_LZ4 :
+            ZSEEK_ZSTD };
+        // Small frames, without a dictionary, with one given or trained
+        zseek_writer_param_t zwp = { .min_frame_size = FRAME_SIZE / 16 };
+        if (t / 2 == 1) {
+            zwp.dict = data + DATA_SIZE - FRAME_SIZE;
+            zwp.dict_size = FRAME_SIZE;
+        } else if (t / 2 == 2) {
+            zwp.dict_train_size = DATA_SIZE / 4;
+        }
+        int fd = temp_file();
+        ck_assert_msg(fd != -1, "failed to create file");
+        char errbuf[ZSEEK_ERRBUF_SIZE];
+        zseek_writer_t *writer = zseek_writer_open_ext(write_file(fd), &zsp,
+            &zwp, NULL, errbuf);
+        if (!writer && t % 2 && t / 2) {
+            ck_assert_msg(strstr(errbuf, "not supported"),
+                "zseek_writer_open_ext: %s", errbuf);
+            close(fd);
+            continue;
+        }
+        ck_assert_msg(writer, "zseek_writer_open_ext: %s", errbuf);
+        for (size_t done = 0; done < DATA_SIZE; done += FRAME_SIZE / 16) {
+            ck_assert_msg(zseek_write(writer, data + done, FRAME_SIZE / 16,
+                NULL, errbuf), "zseek_write: %s", errbuf);
+        }
+        ck_assert_msg(zseek_writer_close(writer, NULL, errbuf),
+            "zseek_writer_close: %s", errbuf);
+        struct stat st;
+        ck_assert(!fstat(fd, &st));
+        sizes[t] = st.st_size;
+
+        for (size_t cache_size = 0; cache_size <= 4; cache_size += 4) {
+            zseek_reader_t *reader = open_reader(fd, cache_size);
+            // The dictionary counts as frame 0, holding no data
+            zseek_reader_stats_t stats;
+            ck_assert(zseek_reader_stats(reader, &stats, NULL));
+            ck_assert_msg(stats.frames == DATA_SIZE / (FRAME_SIZE / 16) +
+                (t >= 2), "%zu frames", stats.frames);
+            ck_assert(stats.decompressed_size == DATA_SIZE);
+            check_data(reader, DATA_SIZE, MAX_READ);
+            ck_assert(zseek_reader_close(reader, NULL, NULL));
+        }
+        close(fd);
+    }
+
+    // Small frames compress better with a dictionary, even counting it
+    for (int t = 2; t < 6; t++) {
+        ck_assert_msg(!sizes[t] || sizes[t] < sizes[t % 2], "%jd vs %jd bytes",
+            (intmax_t)sizes[t], (intmax_t)sizes[t % 2]);
+    }
+}
+END_TEST
+
+/**
+ * Opens a new, unlinked temporary file in the current directory for direct
+ * I/O, or returns -1 if the file system does not support it (e.g. tmpfs)
+ */
+static int temp_file_direct(void)
+{
+    int fd = temp_file();
+    if (fd != -1 && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+START_TEST(test_zseek_write_direct)
+{
+    init_data();
+    int fd = temp_file_direct();
+    if (fd == -1)
+        return;
+
+    // Flushes in between leave unaligned tails
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    zseek_writer_param_t zwp = {
+        .min_frame_size = FRAME_SIZE,
+        .output_buffer_size = 64 << 10,
+    };
+    zseek_writer_t *writer = zseek_writer_open_fd(fd, NULL, &zwp, NULL, NULL,
+        errbuf);
+    ck_assert_msg(writer, "zseek_writer_open_fd: %s", errbuf);
+    for (size_t done = 0; done < DATA_SIZE; done += 100000) {
+        size_t len = DATA_SIZE - done < 100000 ? DATA_SIZE - done : 100000;
+        ck_assert_msg(zseek_write(writer, data + done, len, NULL, errbuf),
+            "zseek_write: %s", errbuf);
+        ck_assert_msg(zseek_writer_flush(writer, NULL, errbuf),
+            "zseek_writer_flush: %s", errbuf);
+        ck_assert(fcntl(fd, F_GETFL) & O_DIRECT);
+    }
+    ck_assert_msg(zseek_writer_close(writer, NULL, errbuf),
+        "zseek_writer_close: %s", errbuf);
+    ck_assert(fcntl(fd, F_GETFL) & O_DIRECT);
+
+    zseek_reader_param_t zrp = { .cache_size = 4 };
+    zseek_reader_t *reader = zseek_reader_open_fd(fd, &zrp, NULL, NULL,
+        errbuf);
+    ck_assert_msg(reader, "zseek_reader_open_fd: %s", errbuf);
+    check_data(reader, DATA_SIZE, 100000);
+    ck_assert(zseek_reader_close(reader, NULL, NULL));
+    close(fd);
+}
+END_TEST
+
+START_TEST(test_zseek_pread_ref)
+{
+    init_data();
+    zseek_writer_param_t zwp = { .min_frame_size = FRAME_SIZE };
+    int fd = compress_data(NULL, &zwp, DATA_SIZE, FRAME_SIZE);
+
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    for (size_t cache_size = 0; cache_size <= 1; cache_size++) {
+        zseek_reader_t *reader = open_reader(fd, cache_size);
+
+        // Cut short at the end of the frame
+        zseek_ref_t refs[2];
+        size_t offset = FRAME_SIZE + 100;
+        ssize_t n = zseek_pread_ref(reader, &refs[0], 2 * FRAME_SIZE, offset,
+            NULL, errbuf);
+        ck_assert_msg(n == FRAME_SIZE - 100, "zseek_pread_ref: %zd, %s", n,
+            errbuf);
+        ck_assert(refs[0].size == (size_t)n);
+        n = zseek_pread_ref(reader, &refs[1], 1000, offset + 1000, NULL,
+            errbuf);
+        ck_assert_msg(n == 1000, "zseek_pread_ref: %zd, %s", n, errbuf);
+
+        // Pinned while every other frame goes through the cache
+        check_data(reader, DATA_SIZE, MAX_READ);
+        ck_assert(!memcmp(refs[0].data, data + offset, refs[0].size));
+        ck_assert(!memcmp(refs[1].data, data + offset + 1000, 1000));
+        for (int i = 0; i < 2; i++) {
+            zseek_ref_release(reader, &refs[i]);
+            ck_assert(!refs[i].data && !refs[i].size);
+            zseek_ref_release(reader, &refs[i]);
+        }
+
+        // Then evicted as usual
+        check_data(reader, DATA_SIZE, MAX_READ);
+        ck_assert(zseek_pread_ref(reader, &refs[0], 1, DATA_SIZE, NULL,
+            errbuf) == 0);
+        ck_assert(!refs[0].data);
+        ck_assert(zseek_reader_close(reader, NULL, NULL));
+    }
+    close(fd);
+}
+END_TEST
+
+static void *pread_thread(void *arg)
+{
+    zseek_reader_t *reader = arg;
+    unsigned seed = (unsigned)(size_t)pthread_self();
+    uint8_t *buf = malloc(MAX_READ);
+    if (!buf)
+        return (void*)1;
+
+    void *ret = NULL;
+    for (int i = 0; i < NB_READS && !ret; i++) {
+        size_t offset = rand_r(&seed) % DATA_SIZE;
+        size_t count = 1 + rand_r(&seed) % MAX_READ;
+        size_t len = DATA_SIZE - offset < count ? DATA_SIZE - offset : count;
+        ssize_t n = read_range(reader, buf, count, offset, NULL);
+        if (n != (ssize_t)len || memcmp(buf, data + offset, len))
+            ret = (void*)1;
+    }
+    free(buf);
+
+    return ret;
+}
+
+/**
+ * Reads random ranges of @p reader from @a NB_THREADS threads at once,
+ * checking the data
+ */
+static void check_concurrent(zseek_reader_t *reader)
+{
+    pthread_t threads[NB_THREADS];
+    for (int i = 0; i < NB_THREADS; i++) {
+        ck_assert_msg(!pthread_create(&threads[i], NULL, pread_thread,
+            reader), "failed to create thread");
+    }
+    int failed = 0;
+    for (int i = 0; i < NB_THREADS; i++) {
+        void *ret;
+        ck_assert(!pthread_join(threads[i], &ret));
+        failed += ret != NULL;
+    }
+    ck_assert_msg(!failed, "%d threads read bad data", failed);
+}
+
+START_TEST(test_zseek_pread_concurrent)
+{
+    init_data();
+    // Small frames, so that reads mostly do I/O on the shared stream
+    zseek_writer_param_t zwp = { .min_frame_size = FRAME_SIZE / 16 };
+    int fd = compress_data(NULL, &zwp, DATA_SIZE, FRAME_SIZE / 16);
+
+    FILE *cfile = fdopen(fd, "rb");
+    ck_assert_msg(cfile, "failed to open stream");
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    zseek_reader_t *reader = zseek_reader_open(cfile, 0, NULL, errbuf);
+    ck_assert_msg(reader, "zseek_reader_open: %s", errbuf);
+
+    check_concurrent(reader);
+
+    check_data(reader, DATA_SIZE, MAX_READ);
+    ck_assert(zseek_reader_close(reader, NULL, NULL));
+    fclose(cfile);
+}
+END_TEST
+
+START_TEST(test_zseek_pread_stream)
+{
+    init_data();
+    zseek_writer_param_t zwp = { .min_frame_size = FRAME_SIZE / 16 };
+    int fd = compress_data(NULL, &zwp, DATA_SIZE, FRAME_SIZE / 16);
+    struct stat st;
+    ck_assert(!fstat(fd, &st));
+    uint8_t *cdata = malloc(st.st_size);
+    ck_assert_msg(cdata, "failed to allocate buffer");
+    ck_assert(pread(fd, cdata, st.st_size, 0) == st.st_size);
+    close(fd);
+
+    // A stream without a descriptor, left at its position
+    FILE *cfile = fmemopen(cdata, st.st_size, "rb");
+    ck_assert_msg(cfile, "failed to open stream");
+    ck_assert(fileno(cfile) == -1);
+    ck_assert(!fseek(cfile, 100, SEEK_SET));
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    for (size_t cache_size = 0; cache_size <= 4; cache_size += 4) {
+        zseek_reader_t *reader = zseek_reader_open(cfile, cache_size, NULL,
+            errbuf);
+        ck_assert_msg(reader, "zseek_reader_open: %s", errbuf);
+        check_data(reader, DATA_SIZE, MAX_READ);
+        check_concurrent(reader);
+        ck_assert(zseek_reader_close(reader, NULL, NULL));
+        ck_assert(ftell(cfile) == 100);
+    }
+    fclose(cfile);
+    free(cdata);
+}
+END_TEST
+
+/**
+ * File read through a shared position, so not thread-safe
+ */
+typedef struct {
+    int fd;
+    int active;     // atomic
+    bool overlap;   // atomic
+} seek_file_t;
+
+static ssize_t seek_pread(void *buf, size_t size, size_t offset,
+    void *user_data, void *call_data)
+{
+    (void)call_data;
+
+    seek_file_t *file = user_data;
+    if (__atomic_add_fetch(&file->active, 1, __ATOMIC_SEQ_CST) > 1)
+        __atomic_store_n(&file->overlap, true, __ATOMIC_SEQ_CST);
+    ssize_t n = -1;
+    if (lseek(file->fd, offset, SEEK_SET) == (off_t)offset)
+        n = read(file->fd, buf, size);
+    __atomic_sub_fetch(&file->active, 1, __ATOMIC_SEQ_CST);
+    return n;
+}
+
+static ssize_t seek_fsize(void *user_data, void *call_data)
+{
+    seek_file_t *file = user_data;
+    return fd_fsize((void*)(intptr_t)file->fd, call_data);
+}
+
+START_TEST(test_zseek_pread_serialized)
+{
+    init_data();
+    zseek_writer_param_t zwp = { .min_frame_size = FRAME_SIZE / 16 };
+    int fd = compress_data(NULL, &zwp, DATA_SIZE, FRAME_SIZE / 16);
+
+    // Called one at a time, unless declared thread-safe
+    seek_file_t file = { .fd = fd };
+    zseek_read_file_t user_file = { &file, seek_pread, seek_fsize };
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    for (size_t cache_size = 0; cache_size <= 4; cache_size += 4) {
+        zseek_reader_t *reader = zseek_reader_open_full(user_file, cache_size,
+            NULL, errbuf);
+        ck_assert_msg(reader, "zseek_reader_open_full: %s", errbuf);
+        check_concurrent(reader);
+        check_data(reader, DATA_SIZE, MAX_READ);
+        ck_assert(zseek_reader_close(reader, NULL, NULL));
+    }
+    ck_assert(!file.overlap);
+    close(fd);
+}
+END_TEST
+
+START_TEST(test_zseek_mmap)
+{
+    init_data();
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    int fd = temp_file();
+    ck_assert_msg(fd != -1, "failed to create file");
+    ck_assert(!zseek_reader_open_mmap(fd, &(zseek_reader_param_t){0}, NULL,
+        NULL, errbuf));
+    close(fd);
+
+    for (int t = 0; t < 4; t++) {
+        zseek_compression_param_t zsp = { .type = t % 2 ? ZSEEK_LZ4 :
+            ZSEEK_ZSTD };
+        zseek_writer_param_t zwp = { .min_frame_size = FRAME_SIZE };
+        fd = compress_data(&zsp, &zwp, DATA_SIZE, FRAME_SIZE);
+
+        // The mapping outlives the descriptor
+        zseek_reader_param_t zrp = { .cache_size = t < 2 ? 0 : 4 };
+        zseek_fd_param_t zfp = { .advice = POSIX_FADV_RANDOM };
+        zseek_reader_t *reader = zseek_reader_open_mmap(fd, &zrp, &zfp, NULL,
+            errbuf);
+        ck_assert_msg(reader, "zseek_reader_open_mmap: %s", errbuf);
+        close(fd);
+
+        check_data(reader, DATA_SIZE, MAX_READ - 1);
+        check_concurrent(reader);
+        ck_assert(zseek_reader_close(reader, NULL, NULL));
+    }
+}
+END_TEST
+
+START_TEST(test_zseek_shared_cache)
+{
+    init_data();
+    // Frames larger than the share of each shard of the cache
+    zseek_writer_param_t zwp = { .min_frame_size = 1 << 20 };
+    int fd = compress_data(NULL, &zwp, DATA_SIZE, 1 << 20);
+
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    zseek_shared_cache_param_t zscp = { .max_size = 8 << 20 };
+    zseek_cache_t *cache = zseek_shared_cache_new(&zscp, errbuf);
+    ck_assert_msg(cache, "zseek_shared_cache_new: %s", errbuf);
+    zseek_reader_param_t zrp = { .shared_cache = cache };
+    zseek_reader_t *readers[2];
+    readers[0] = zseek_reader_open_fd(fd, &zrp, NULL, NULL, errbuf);
+    ck_assert_msg(readers[0], "zseek_reader_open_fd: %s", errbuf);
+    readers[1] = zseek_reader_open_mmap(fd, &zrp, NULL, NULL, errbuf);
+    ck_assert_msg(readers[1], "zseek_reader_open_mmap: %s", errbuf);
+
+    // Frames read through one reader are found by the other, of the file
+    for (int i = 0; i < 3; i++)
+        check_data(readers[i % 2], DATA_SIZE, MAX_READ);
+    zseek_reader_stats_t stats;
+    ck_assert_msg(zseek_reader_stats(readers[1], &stats, errbuf),
+        "zseek_reader_stats: %s", errbuf);
+    ck_assert_msg(stats.cache_misses == stats.frames, "%zu misses",
+        stats.cache_misses);
+    ck_assert(stats.cached_frames == stats.frames);
+    zseek_shared_cache_stats_t cache_stats;
+    ck_assert(zseek_shared_cache_stats(cache, &cache_stats, NULL));
+    ck_assert(cache_stats.cached_frames == stats.frames);
+    ck_assert(cache_stats.readers == 2);
+
+    for (int i = 0; i < 2; i++)
+        ck_assert(zseek_reader_close(readers[i], NULL, NULL));
+    ck_assert(zseek_shared_cache_stats(cache, &cache_stats, NULL));
+    ck_assert(cache_stats.cached_frames == 0);
+    zseek_shared_cache_free(cache);
+    close(fd);
+}
+END_TEST
+
+#define NB_ASYNC_READS 256
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t completed;
+    ssize_t results[NB_ASYNC_READS];
+} async_reads_t;
+
+typedef struct {
+    async_reads_t *reads;
+    size_t i;
+} async_read_t;
+
+static void async_read_cb(ssize_t result, void *ctx, const char *errmsg)
+{
+    (void)errmsg;
+
+    async_read_t *read = ctx;
+    async_reads_t *reads = read->reads;
+    pthread_mutex_lock(&reads->lock);
+    reads->results[read->i] = result;
+    reads->completed++;
+    pthread_cond_signal(&reads->cond);
+    pthread_mutex_unlock(&reads->lock);
+}
+
+START_TEST(test_zseek_pread_async)
+{
+    init_data();
+    zseek_writer_param_t zwp = { .min_frame_size = FRAME_SIZE };
+    int fd = compress_data(NULL, &zwp, DATA_SIZE, FRAME_SIZE);
+
+    // Asynchronous reads need workers
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    zseek_reader_t *reader = zseek_reader_open_fd(fd,
+        &(zseek_reader_param_t){0}, NULL, NULL, errbuf);
+    ck_assert_msg(reader, "zseek_reader_open_fd: %s", errbuf);
+    uint8_t byte;
+    ck_assert(!zseek_pread_async(reader, &byte, 1, 0, async_read_cb, NULL,
+        errbuf));
+    ck_assert(zseek_reader_close(reader, NULL, NULL));
+
+    uint8_t *bufs = malloc(NB_ASYNC_READS * MAX_READ);
+    ck_assert_msg(bufs, "failed to allocate buffers");
+    static const zseek_async_backend_t backends[] = {
+        ZSEEK_ASYNC_AUTO, ZSEEK_ASYNC_THREADS,
+    };
+    for (int t = 0; t < 4; t++) {
+        zseek_reader_param_t zrp = {
+            .cache_size = t < 2 ? 0 : 4,
+            .async_workers = 2,
+            .async_backend = backends[t % 2],
+        };
+        reader = zseek_reader_open_fd(fd, &zrp, NULL, NULL, errbuf);
+        ck_assert_msg(reader, "zseek_reader_open_fd: %s", errbuf);
+
+        async_reads_t reads = {
+            .lock = PTHREAD_MUTEX_INITIALIZER,
+            .cond = PTHREAD_COND_INITIALIZER,
+        };
+        async_read_t ctxs[NB_ASYNC_READS];
+        size_t offsets[NB_ASYNC_READS], counts[NB_ASYNC_READS];
+        unsigned seed = t;
+        for (size_t i = 0; i < NB_ASYNC_READS; i++) {
+            // The last one at the end of the file
+            offsets[i] = i + 1 < NB_ASYNC_READS ? rand_r(&seed) % DATA_SIZE :
+                DATA_SIZE;
+            counts[i] = 1 + rand_r(&seed) % MAX_READ;
+            ctxs[i] = (async_read_t){ &reads, i };
+            ck_assert_msg(zseek_pread_async(reader, bufs + i * MAX_READ,
+                counts[i], offsets[i], async_read_cb, &ctxs[i], errbuf),
+                "zseek_pread_async: %s", errbuf);
+        }
+
+        pthread_mutex_lock(&reads.lock);
+        while (reads.completed < NB_ASYNC_READS / 2)
+            pthread_cond_wait(&reads.cond, &reads.lock);
+        pthread_mutex_unlock(&reads.lock);
+        // Waits for the rest
+        ck_assert(zseek_reader_close(reader, NULL, NULL));
+        ck_assert(reads.completed == NB_ASYNC_READS);
+
+        for (size_t i = 0; i < NB_ASYNC_READS; i++) {
+            // Cut short at the end of the frame
+            size_t end = (offsets[i] / FRAME_SIZE + 1) * FRAME_SIZE;
+            if (end > DATA_SIZE)
+                end = DATA_SIZE;
+            size_t len = end - offsets[i] < counts[i] ? end - offsets[i] :
+                counts[i];
+            ck_assert_msg(reads.results[i] == (ssize_t)len,
+                "read %zu: %zd of %zu", i, reads.results[i], len);
+            ck_assert_msg(!memcmp(bufs + i * MAX_READ, data + offsets[i],
+                len), "bad data of read %zu", i);
+        }
+    }
+    free(bufs);
+    close(fd);
+}
+END_TEST
+
+START_TEST(test_zseek_pread_no_cache)
+{
+    init_data();
+    // Large frames, of which reads decompress only the start
+    size_t frame_size = 1 << 20;
+    zseek_writer_param_t zwp = { .min_frame_size = frame_size };
+    int fd = compress_data(NULL, &zwp, DATA_SIZE, frame_size);
+
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    zseek_reader_t *reader = zseek_reader_open_fd(fd,
+        &(zseek_reader_param_t){0}, NULL, NULL, errbuf);
+    ck_assert_msg(reader, "zseek_reader_open_fd: %s", errbuf);
+    uint8_t buf[1000];
+    for (size_t start = 0; start < DATA_SIZE; start += frame_size) {
+        size_t offsets[] = {start, start + 1, start + 200000,
+            start + frame_size - sizeof(buf)};
+        for (int i = 0; i < 4; i++) {
+            ssize_t n = zseek_pread(reader, buf, sizeof(buf), offsets[i],
+                NULL, errbuf);
+            ck_assert_msg(n == (ssize_t)sizeof(buf),
+                "zseek_pread at %zu: %zd, %s", offsets[i], n, errbuf);
+            ck_assert_msg(!memcmp(buf, data + offsets[i], sizeof(buf)),
+                "bad data at %zu", offsets[i]);
+        }
+    }
+
+    // Never a whole decompressed frame in memory
+    zseek_reader_stats_t stats;
+    ck_assert(zseek_reader_stats(reader, &stats, NULL));
+    ck_assert_msg(stats.buffer_size < frame_size, "%zu bytes buffered",
+        stats.buffer_size);
+    ck_assert(stats.cache_hits == 0 && stats.cached_frames == 0);
+
+    check_data(reader, DATA_SIZE, MAX_READ);
+    check_concurrent(reader);
+    ck_assert(zseek_reader_close(reader, NULL, NULL));
+    close(fd);
+}
+END_TEST
+
+START_TEST(test_zseek_pread_frames)
+{
+    init_data();
+    uint8_t *buf = malloc(DATA_SIZE + 1);
+    ck_assert_msg(buf, "failed to allocate buffer");
+    for (int t = 0; t < 4; t++) {
+        zseek_compression_param_t zsp = { .type = t % 2 ? ZSEEK_LZ4 :
+            ZSEEK_ZSTD };
+        zseek_writer_param_t zwp = { .min_frame_size = FRAME_SIZE / 16 };
+        int fd = compress_data(&zsp, &zwp, DATA_SIZE, FRAME_SIZE / 16);
+        char errbuf[ZSEEK_ERRBUF_SIZE];
+        zseek_reader_t *reader = zseek_reader_open_fd(fd,
+            &(zseek_reader_param_t){ .cache_size = t < 2 ? 0 : 16 }, NULL,
+            NULL, errbuf);
+        ck_assert_msg(reader, "zseek_reader_open_fd: %s", errbuf);
+
+        // Reads of many frames, filled in one call
+        check_data(reader, DATA_SIZE, 100000);
+        unsigned seed = t;
+        for (int i = 0; i < 100; i++) {
+            size_t offset = rand_r(&seed) % DATA_SIZE;
+            size_t count = rand_r(&seed) % (8 * FRAME_SIZE);
+            size_t len = DATA_SIZE - offset < count ? DATA_SIZE - offset :
+                count;
+            ssize_t n = zseek_pread(reader, buf, count, offset, NULL, errbuf);
+            ck_assert_msg(n == (ssize_t)len, "zseek_pread at %zu: %zd, %s",
+                offset, n, errbuf);
+            ck_assert_msg(!memcmp(buf, data + offset, len), "bad data at %zu",
+                offset);
+        }
+
+        // The whole file, and past its end
+        ssize_t n = zseek_pread(reader, buf, DATA_SIZE + 1, 0, NULL, errbuf);
+        ck_assert_msg(n == DATA_SIZE, "zseek_pread: %zd, %s", n, errbuf);
+        ck_assert(!memcmp(buf, data, DATA_SIZE));
+
+        // Sequential reads too
+        for (size_t done = 0; done < DATA_SIZE; done += 3 * FRAME_SIZE) {
+            size_t len = DATA_SIZE - done < 3 * FRAME_SIZE ?
+                DATA_SIZE - done : 3 * FRAME_SIZE;
+            n = zseek_read(reader, buf, 3 * FRAME_SIZE, NULL, errbuf);
+            ck_assert_msg(n == (ssize_t)len, "zseek_read at %zu: %zd, %s",
+                done, n, errbuf);
+            ck_assert_msg(!memcmp(buf, data + done, len), "bad data at %zu",
+                done);
+        }
+        ck_assert(zseek_read(reader, buf, 1, NULL, errbuf) == 0);
+        ck_assert(zseek_reader_close(reader, NULL, NULL));
+        close(fd);
+    }
+    free(buf);
+}
+END_TEST
+
+START_TEST(test_zseek_admit_partial)
+{
+    init_data();
+    zseek_writer_param_t zwp = { .min_frame_size = FRAME_SIZE };
+    int fd = compress_data(NULL, &zwp, DATA_SIZE, FRAME_SIZE);
+
+    char errbuf[ZSEEK_ERRBUF_SIZE];
+    zseek_reader_param_t zrp = {
+        .cache_size = 16,
+        .cache_admission = (zseek_cache_admission_t)-1,
+    };
+    ck_assert(!zseek_reader_open_fd(fd, &zrp, NULL, NULL, errbuf));
+
+    for (int t = 0; t < 2; t++) {
+        zrp.cache_admission = t ? ZSEEK_ADMIT_ALL : ZSEEK_ADMIT_PARTIAL;
+        zseek_reader_t *reader = zseek_reader_open_fd(fd, &zrp, NULL, NULL,
+            errbuf);
+        ck_assert_msg(reader, "zseek_reader_open_fd: %s", errbuf);
+
+        // Whole frames bypass the cache, but with ADMIT_ALL
+        check_data(reader, DATA_SIZE, 2 * FRAME_SIZE);
+        zseek_reader_stats_t stats;
+        ck_assert(zseek_reader_stats(reader, &stats, NULL));
+        if (t) {
+            ck_assert(stats.cache_bypasses == 0);
+            ck_assert(stats.cached_frames == 16);
+        } else {
+            ck_assert_msg(stats.cache_bypasses == stats.frames,
+                "%zu bypasses", stats.cache_bypasses);
+            ck_assert(stats.cached_frames == 0);
+        }
+
+        // Parts of frames are cached
+        uint8_t buf[1024];
+        for (size_t offset = 0; offset < 8 * FRAME_SIZE;
+                offset += sizeof(buf)) {
+            ck_assert(zseek_pread(reader, buf, sizeof(buf), offset, NULL,
+                errbuf) == (ssize_t)sizeof(buf));
+            ck_assert(!memcmp(buf, data + offset, sizeof(buf)));
+        }
+        ck_assert(zseek_reader_stats(reader, &stats, NULL));
+        ck_assert(stats.cached_frames == 16 || (!t &&
+            stats.cached_frames == 8));
+        ck_assert(stats.cache_hits > 0);
+        ck_assert(zseek_reader_close(reader, NULL, NULL));
+    }
+    close(fd);
+}
+END_TEST
+
+#define NB_RANGES 200
+
+START_TEST(test_zseek_preadv_batch)
+{
+    init_data();
+    uint8_t *bufs = malloc(NB_RANGES * 4 * FRAME_SIZE);
+    ck_assert_msg(bufs, "failed to allocate buffers");
+    for (int t = 0; t < 6; t++) {
+        zseek_compression_param_t zsp = { .type = t % 2 ? ZSEEK_LZ4 :
+            ZSEEK_ZSTD };
+        zseek_writer_param_t zwp = { .min_frame_size = FRAME_SIZE / 4 };
+        int fd = compress_data(&zsp, &zwp, DATA_SIZE, FRAME_SIZE / 4);
+        // Without a cache, with one, and with helpers
+        zseek_reader_param_t zrp = {
+            .cache_size = t < 2 ? 0 : 16,
+            .async_workers = t < 4 ? 0 : 2,
+        };
+        char errbuf[ZSEEK_ERRBUF_SIZE];
+        zseek_reader_t *reader = zseek_reader_open_fd(fd, &zrp, NULL, NULL,
+            errbuf);
+        ck_assert_msg(reader, "zseek_reader_open_fd: %s", errbuf);
+        ck_assert(zseek_preadv_batch(reader, NULL, 0, NULL, NULL, errbuf));
+
+        zseek_range_t ranges[NB_RANGES];
+        unsigned seed = t;
+        for (size_t i = 0; i < NB_RANGES; i++) {
+            ranges[i] = (zseek_range_t){
+                .buf = bufs + i * 4 * FRAME_SIZE,
+                .count = rand_r(&seed) % (4 * FRAME_SIZE),
+                .offset = rand_r(&seed) % DATA_SIZE,
+            };
+        }
+        // Empty, overlapping, across the end and out of range
+        ranges[0].count = 0;
+        ranges[1].offset = ranges[2].offset + 1;
+        ranges[3].offset = DATA_SIZE - 10;
+        ranges[4].offset = DATA_SIZE;
+        ranges[5].offset = DATA_SIZE + FRAME_SIZE;
+        ranges[6].count = 4 * FRAME_SIZE;
+
+        size_t done[NB_RANGES];
+        ck_assert_msg(zseek_preadv_batch(reader, ranges, NB_RANGES, done,
+            NULL, errbuf), "zseek_preadv_batch: %s", errbuf);
+        for (size_t i = 0; i < NB_RANGES; i++) {
+            size_t offset = ranges[i].offset;
+            size_t len = 0;
+            if (offset < DATA_SIZE) {
+                len = DATA_SIZE - offset < ranges[i].count ?
+                    DATA_SIZE - offset : ranges[i].count;
+            }
+            ck_assert_msg(done[i] == len, "range %zu: %zu of %zu", i,
+                done[i], len);
+            ck_assert_msg(!memcmp(ranges[i].buf, data + offset, len),
+                "bad data of range %zu", i);
+        }
+        ck_assert(zseek_preadv_batch(reader, ranges, NB_RANGES, NULL, NULL,
+            errbuf));
+        ck_assert(zseek_reader_close(reader, NULL, NULL));
+        close(fd);
+    }
+    free(bufs);
+}
+END_TEST
+
+START_TEST(test_zseek_coalesced)
+{
+    init_data();
+    uint8_t *bufs[2];
+    for (int i = 0; i < 2; i++) {
+        bufs[i] = malloc(16 * FRAME_SIZE);
+        ck_assert_msg(bufs[i], "failed to allocate buffer");
+    }
+    for (int t = 0; t < 6; t++) {
+        zseek_compression_param_t zsp = { .type = t % 2 ? ZSEEK_LZ4 :
+            ZSEEK_ZSTD };
+        zseek_writer_param_t zwp = { .min_frame_size = FRAME_SIZE / 16 };
+        int fd = compress_data(&zsp, &zwp, DATA_SIZE, FRAME_SIZE / 16);
+        // Without a cache, with one, and with direct I/O if supported
+        if (t >= 4 && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT)) {
+            close(fd);
+            continue;
+        }
+
+        // Coalesced, then not
+        zseek_reader_t *readers[2];
+        char errbuf[ZSEEK_ERRBUF_SIZE];
+        for (int i = 0; i < 2; i++) {
+            zseek_reader_param_t zrp = {
+                .cache_size = t / 2 == 1 ? 16 : 0,
+                .max_coalesced_io = i ? 1 : 0,
+            };
+            readers[i] = zseek_reader_open_fd(fd, &zrp, NULL, NULL, errbuf);
+            ck_assert_msg(readers[i], "zseek_reader_open_fd: %s", errbuf);
+        }
+
+        unsigned seed = t;
+        for (int j = 0; j < 200; j++) {
+            size_t offset = rand_r(&seed) % DATA_SIZE;
+            size_t count = rand_r(&seed) % (16 * FRAME_SIZE);
+            size_t len = DATA_SIZE - offset < count ? DATA_SIZE - offset :
+                count;
+            for (int i = 0; i < 2; i++) {
+                ssize_t n = zseek_pread(readers[i], bufs[i], count, offset,
+                    NULL, errbuf);
+                ck_assert_msg(n == (ssize_t)len, "zseek_pread at %zu: %zd, %s",
+                    offset, n, errbuf);
+            }
+            ck_assert_msg(!memcmp(bufs[0], bufs[1], len), "mismatch at %zu",
+                offset);
+            ck_assert_msg(!memcmp(bufs[0], data + offset, len),
+                "bad data at %zu", offset);
+        }
+
+        zseek_reader_stats_t stats[2];
+        for (int i = 0; i < 2; i++) {
+            ck_assert(zseek_reader_stats(readers[i], &stats[i], NULL));
+            ck_assert(zseek_reader_close(readers[i], NULL, NULL));
+        }
+        ck_assert(stats[0].coalesced_reads > 0);
+        ck_assert(stats[1].coalesced_reads == 0);
+        close(fd);
+    }
+    for (int i = 0; i < 2; i++)
+        free(bufs[i]);
+}
+END_TEST
+
+Suite *zseek_suite(void)
+{
+    Suite *s = suite_create("zseek");
+    TCase *tc_core = tcase_create("Core");
+
+    tcase_set_timeout(tc_core, 60);
+    tcase_add_test(tc_core, test_zseek_frame_parallel);
+    tcase_add_test(tc_core, test_zseek_write_async);
+    tcase_add_test(tc_core, test_zseek_write_queue_full);
+    tcase_add_test(tc_core, test_zseek_writev);
+    tcase_add_test(tc_core, test_zseek_write_cdc);
+    tcase_add_test(tc_core, test_zseek_write_cdc_splits);
+    tcase_add_test(tc_core, test_zseek_write_adaptive);
+    tcase_add_test(tc_core, test_zseek_write_adaptive_level);
+    tcase_add_test(tc_core, test_zseek_dict);
+    tcase_add_test(tc_core, test_zseek_write_direct);
+    tcase_add_test(tc_core, test_zseek_pread_ref);
+    tcase_add_test(tc_core, test_zseek_pread_concurrent);
+    tcase_add_test(tc_core, test_zseek_pread_stream);
+    tcase_add_test(tc_core, test_zseek_pread_serialized);
+    tcase_add_test(tc_core, test_zseek_mmap);
+    tcase_add_test(tc_core, test_zseek_shared_cache);
+    tcase_add_test(tc_core, test_zseek_pread_async);
+    tcase_add_test(tc_core, test_zseek_pread_no_cache);
+    tcase_add_test(tc_core, test_zseek_pread_frames);
+    tcase_add_test(tc_core, test_zseek_admit_partial);
+    tcase_add_test(tc_core, test_zseek_preadv_batch);
+    tcase_add_test(tc_core, test_zseek_coalesced);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    Suite *s = zseek_suite();
+    SRunner *sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    free(data);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}